@@ -0,0 +1,145 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_DV_DPI_COMMON_SIMCTRL_SIMCTRL_DPI_H_
+#define OPENTITAN_HW_DV_DPI_COMMON_SIMCTRL_SIMCTRL_DPI_H_
+
+/**
+ * Hooks from DPI models into the Verilator simulation controller
+ *
+ * These functions are defined by VerilatorSimCtrl. They are declared weak so
+ * that DPI models which use them can also be linked into simulations that
+ * don't have a simulation controller (such as UVM testbenches), where they
+ * are null. Use the simctrl_* wrappers below, which check for that.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * How a DPI context is carried over in a checkpoint
+ *
+ * A restored simulation runs the initial blocks of the design first, so each
+ * DPI model has already created a new context when the checkpoint is loaded.
+ * These hooks move the state that matters from the saved context to the new
+ * one. A model whose new context can carry on as it is (e.g. because its
+ * state is only a connection to the outside world) sets both to NULL.
+ */
+typedef struct simctrl_dpi_hooks {
+  /**
+   * Save the state of a context
+   *
+   * @param ctx   The context
+   * @param state Set to a buffer from malloc() holding the state, which the
+   *              caller frees, or NULL if there is nothing to save
+   * @param len   Set to the length of the state
+   * @return false (after printing why) if the context can't be saved now
+   */
+  bool (*save)(void *ctx, void **state, size_t *len);
+  /**
+   * Load state from save() into the context of the restored simulation
+   *
+   * @param ctx   The new context
+   * @param state The saved state (NULL if there was none)
+   * @param len   The length of the saved state
+   * @return false (after printing why) if the state doesn't fit the context
+   */
+  bool (*restore)(void *ctx, const void *state, size_t len);
+} simctrl_dpi_hooks_t;
+
+/**
+ * Record that a DPI model has created a context that is only referenced from
+ * the simulated design (typically through a chandle set in an initial block)
+ *
+ * Such contexts live in the address space of the simulation process, outside
+ * the design. Checkpoints carry them over with the given hooks, and are
+ * refused for designs with a context that has none.
+ *
+ * @param name  Name of the DPI model instance, used to match contexts when a
+ *              checkpoint is restored and in diagnostic messages
+ * @param ctx   The context, as passed to the design
+ * @param hooks Checkpoint hooks (which must outlive the context), or NULL if
+ *              the context can't be checkpointed
+ */
+void simctrl_register_dpi_context(const char *name, void *ctx,
+                                  const simctrl_dpi_hooks_t *hooks)
+    __attribute__((weak));
+
+/**
+ * Set once a checkpoint has been restored
+ *
+ * The design may then hold pointers to contexts of the simulation that saved
+ * the checkpoint, which simctrl_restored_dpi_context() maps to the contexts
+ * of this one.
+ */
+extern bool simctrl_dpi_contexts_restored __attribute__((weak));
+
+/**
+ * Map a context pointer from the design of a restored simulation
+ *
+ * @param handle A context pointer held by the design
+ * @return the matching context of this simulation
+ */
+void *simctrl_restored_dpi_context(void *handle) __attribute__((weak));
+
+/**
+ * Start tracing now, e.g. because a DPI model has seen an event of interest
+ *
+ * This is also a DPI function, so it can be imported by the design with
+ *   import "DPI-C" function void simctrl_trigger_trace(input int num_cycles);
+ * It must be called from the simulation thread, and has no effect if tracing
+ * support hasn't been compiled into the simulation.
+ *
+ * @param num_cycles Stop tracing after this many cycles. 0 keeps tracing
+ *                   until the end of the simulation (or --trace-stop).
+ */
+void simctrl_trigger_trace(int num_cycles) __attribute__((weak));
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+/**
+ * Call simctrl_register_dpi_context() if there is a simulation controller
+ */
+static inline void simctrl_dpi_context_created(
+    const char *name, void *ctx, const simctrl_dpi_hooks_t *hooks) {
+  if (simctrl_register_dpi_context) {
+    simctrl_register_dpi_context(name, ctx, hooks);
+  }
+}
+
+/**
+ * Get the context for a chandle passed in by the design
+ *
+ * DPI functions which take a context registered with
+ * simctrl_dpi_context_created() must look it up with this, since a restored
+ * design may hold a pointer from the simulation that saved the checkpoint.
+ * Until then, this is just a test of a flag.
+ */
+static inline void *simctrl_dpi_context(void *handle) {
+  if (&simctrl_dpi_contexts_restored && simctrl_dpi_contexts_restored) {
+    return simctrl_restored_dpi_context(handle);
+  }
+  return handle;
+}
+
+/**
+ * Call simctrl_trigger_trace() if there is a simulation controller
+ *
+ * @return true if there is a simulation controller
+ */
+static inline bool simctrl_dpi_trigger_trace(int num_cycles) {
+  if (!simctrl_trigger_trace) {
+    return false;
+  }
+  simctrl_trigger_trace(num_cycles);
+  return true;
+}
+
+#endif  // OPENTITAN_HW_DV_DPI_COMMON_SIMCTRL_SIMCTRL_DPI_H_
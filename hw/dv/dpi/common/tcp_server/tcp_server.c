@@ -15,71 +15,175 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 /**
- * Simple buffer for passing data between TCP sockets and DPI modules
+ * Lock-free single-producer, single-consumer ring buffer for passing data
+ * between TCP sockets and DPI modules
+ *
+ * The read and write pointers count bytes since the buffer was created (so
+ * they wrap at UINT_MAX, not at the buffer size) and are only written by the
+ * consumer and producer respectively. They are kept on separate cache lines so
+ * that the two threads don't fight over them.
  */
-#define BUFSIZE_BYTE 256
+#define BUFSIZE_BYTE 65536
+#define CACHE_LINE_BYTES 64
 
 struct tcp_buf {
   unsigned int rptr;
+  char pad0[CACHE_LINE_BYTES - sizeof(unsigned int)];
   unsigned int wptr;
+  char pad1[CACHE_LINE_BYTES - sizeof(unsigned int)];
   char buf[BUFSIZE_BYTE];
 };
 
 /**
  * TCP Server thread context structure
+ *
+ * The socket thread sleeps in poll until the listening socket or the client
+ * has something for it, or the host thread wakes it by writing to wake_pipe.
+ * To avoid a system call on every write, the host thread only writes to
+ * wake_pipe if the socket thread has said that it is about to sleep.
  */
 struct tcp_server_ctx {
   // Writeable by the host thread
   char *display_name;
   uint16_t listen_port;
-  volatile bool socket_run;
+  bool socket_run;
+  bool client_close_req;
   // Writeable by the server thread
   struct tcp_buf *buf_in;
   struct tcp_buf *buf_out;
   int sfd;  // socket fd
   int cfd;  // client fd
+  int wake_pipe[2];  // read and write ends of the wakeup pipe
+  // Set while the socket thread is asleep (or about to be)
+  bool sleeping;
+  // Set when the socket thread has stopped reading from the client because
+  // buf_in is full
+  bool rx_stalled;
+  // Set when the client isn't accepting data, so there's no point waking the
+  // socket thread to send more
+  bool tx_stalled;
+  // Set while a client is connected
+  bool connected;
   pthread_t sock_thread;
 };
 
-static bool tcp_buffer_is_full(struct tcp_buf *buf) {
-  if (buf->wptr >= buf->rptr) {
-    return (buf->wptr - buf->rptr) == (BUFSIZE_BYTE - 1);
-  } else {
-    return (buf->rptr - buf->wptr) == 1;
-  }
+static unsigned int load_acquire(const unsigned int *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(unsigned int *ptr, unsigned int value) {
+  __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static bool load_flag(const bool *flag) {
+  return __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+}
+
+static void store_flag(bool *flag, bool value) {
+  __atomic_store_n(flag, value, __ATOMIC_RELEASE);
 }
 
-static bool tcp_buffer_is_empty(struct tcp_buf *buf) {
-  return (buf->wptr == buf->rptr);
+/**
+ * Get the number of bytes in a buffer (as seen by either side)
+ */
+static size_t tcp_buffer_used(const struct tcp_buf *buf) {
+  return load_acquire(&buf->wptr) - load_acquire(&buf->rptr);
+}
+
+/**
+ * Get the contiguous free space at the write pointer (producer only)
+ *
+ * @param buf buffer
+ * @param span set to the start of the free space
+ * @return the number of bytes that can be written to *span
+ */
+static size_t tcp_buffer_write_span(struct tcp_buf *buf, char **span) {
+  unsigned int wptr = buf->wptr;
+  size_t space = BUFSIZE_BYTE - (wptr - load_acquire(&buf->rptr));
+  size_t offset = wptr % BUFSIZE_BYTE;
+  *span = &buf->buf[offset];
+  return space < BUFSIZE_BYTE - offset ? space : BUFSIZE_BYTE - offset;
 }
 
-static void tcp_buffer_put_byte(struct tcp_buf *buf, char dat) {
-  bool done = false;
-  while (!done) {
-    if (!tcp_buffer_is_full(buf)) {
-      buf->buf[buf->wptr++] = dat;
-      buf->wptr %= BUFSIZE_BYTE;
-      done = true;
+/**
+ * Publish len bytes that were written to the span from tcp_buffer_write_span
+ */
+static void tcp_buffer_commit_write(struct tcp_buf *buf, size_t len) {
+  store_release(&buf->wptr, buf->wptr + len);
+}
+
+/**
+ * Get the contiguous data at the read pointer (consumer only)
+ *
+ * @param buf buffer
+ * @param span set to the start of the data
+ * @return the number of bytes that can be read from *span
+ */
+static size_t tcp_buffer_read_span(struct tcp_buf *buf, const char **span) {
+  unsigned int rptr = buf->rptr;
+  size_t used = load_acquire(&buf->wptr) - rptr;
+  size_t offset = rptr % BUFSIZE_BYTE;
+  *span = &buf->buf[offset];
+  return used < BUFSIZE_BYTE - offset ? used : BUFSIZE_BYTE - offset;
+}
+
+/**
+ * Release len bytes that were read from the span from tcp_buffer_read_span
+ */
+static void tcp_buffer_commit_read(struct tcp_buf *buf, size_t len) {
+  store_release(&buf->rptr, buf->rptr + len);
+}
+
+/**
+ * Copy up to len bytes into a buffer (producer only)
+ *
+ * @return the number of bytes copied
+ */
+static size_t tcp_buffer_put(struct tcp_buf *buf, const char *src,
+                             size_t len) {
+  size_t done = 0;
+  // At most two spans, since the free space can wrap round once
+  for (int i = 0; i < 2 && done < len; ++i) {
+    char *span;
+    size_t n = tcp_buffer_write_span(buf, &span);
+    if (n > len - done) {
+      n = len - done;
     }
+    memcpy(span, src + done, n);
+    tcp_buffer_commit_write(buf, n);
+    done += n;
   }
+  return done;
 }
 
-static bool tcp_buffer_get_byte(struct tcp_buf *buf, char *dat) {
-  if (tcp_buffer_is_empty(buf)) {
-    return false;
+/**
+ * Copy up to len bytes out of a buffer (consumer only)
+ *
+ * @return the number of bytes copied
+ */
+static size_t tcp_buffer_get(struct tcp_buf *buf, char *dst, size_t len) {
+  size_t done = 0;
+  for (int i = 0; i < 2 && done < len; ++i) {
+    const char *span;
+    size_t n = tcp_buffer_read_span(buf, &span);
+    if (n > len - done) {
+      n = len - done;
+    }
+    memcpy(dst + done, span, n);
+    tcp_buffer_commit_read(buf, n);
+    done += n;
   }
-  *dat = buf->buf[buf->rptr++];
-  buf->rptr %= BUFSIZE_BYTE;
-  return true;
+  return done;
 }
 
 static struct tcp_buf *tcp_buffer_new(void) {
@@ -95,6 +199,31 @@ static void tcp_buffer_free(struct tcp_buf **buf) {
   *buf = NULL;
 }
 
+/**
+ * Wake the socket thread if it is asleep
+ *
+ * The caller must have published whatever it wants the socket thread to see
+ * before calling this. The fence pairs with the one in server_sleep: either
+ * this thread sees that the socket thread is going to sleep, or the socket
+ * thread sees the new state before it sleeps.
+ *
+ * @param ctx context object
+ * @param force wake the thread even if it doesn't look like it's asleep
+ */
+static void wake(struct tcp_server_ctx *ctx, bool force) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!force && !load_flag(&ctx->sleeping)) {
+    return;
+  }
+  // If the pipe is full, there is already a wakeup waiting
+  char one = 1;
+  if (write(ctx->wake_pipe[1], &one, sizeof(one)) != sizeof(one) &&
+      errno != EAGAIN) {
+    fprintf(stderr, "%s: Unable to wake socket thread: %s (%d)\n",
+            ctx->display_name, strerror(errno), errno);
+  }
+}
+
 /**
  * Start a TCP server
  *
@@ -174,7 +303,8 @@ static int start(struct tcp_server_ctx *ctx) {
 /**
  * Accept an incoming connection from a client (nonblocking)
  *
- * The resulting client fd is made non-blocking.
+ * The resulting client fd is made non-blocking. While there is a client, the
+ * server stops watching for new connections.
  *
  * @param ctx context object
  * @return 0 on success, any other value indicates an error
@@ -201,17 +331,45 @@ static int client_tryaccept(struct tcp_server_ctx *ctx) {
   if (rv != 0) {
     fprintf(stderr, "%s: Unable to make client socket non-blocking: %s (%d)\n",
             ctx->display_name, strerror(errno), errno);
+    close(cfd);
     return -1;
   }
 
   ctx->cfd = cfd;
   assert(ctx->cfd > 0);
+  store_flag(&ctx->rx_stalled, false);
+  store_flag(&ctx->tx_stalled, false);
+  store_flag(&ctx->connected, true);
 
   printf("%s: Accepted client connection\n", ctx->display_name);
 
   return 0;
 }
 
+/**
+ * Disconnect the client (if any) and start watching for new connections
+ *
+ * Only called on the socket thread.
+ *
+ * @param ctx context object
+ */
+static void client_close(struct tcp_server_ctx *ctx) {
+  if (!ctx->cfd) {
+    return;
+  }
+
+  close(ctx->cfd);
+  ctx->cfd = 0;
+  store_flag(&ctx->connected, false);
+
+  // Anything that didn't get sent was meant for this client, not the next one
+  const char *span;
+  size_t len;
+  while ((len = tcp_buffer_read_span(ctx->buf_out, &span)) != 0) {
+    tcp_buffer_commit_read(ctx->buf_out, len);
+  }
+}
+
 /**
  * Stop the TCP server
  *
@@ -227,64 +385,167 @@ static void stop(struct tcp_server_ctx *ctx) {
 }
 
 /**
- * Receive a byte from a connected client
+ * Receive as much as possible from the connected client into buf_in
  *
  * @param ctx context object
- * @param cmd byte received
- * @return true if a byte was read
  */
-static bool get_byte(struct tcp_server_ctx *ctx, char *cmd) {
+static void client_recv(struct tcp_server_ctx *ctx) {
   assert(ctx);
 
-  ssize_t num_read = read(ctx->cfd, cmd, 1);
+  while (ctx->cfd) {
+    char *span;
+    size_t space = tcp_buffer_write_span(ctx->buf_in, &span);
+    if (space == 0) {
+      // The host isn't keeping up. Stop reading (the client will see TCP
+      // flow control) until it has made some space.
+      store_flag(&ctx->rx_stalled, true);
+      return;
+    }
 
-  if (num_read == 0) {
-    return false;
-  }
-  if (num_read == -1) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      return false;
-    } else if (errno == EBADF) {
-      // Possibly client went away? Accept a new connection.
-      fprintf(stderr, "%s: Client disappeared.\n", ctx->display_name);
-      tcp_server_client_close(ctx);
-      return false;
-    } else {
-      fprintf(stderr, "%s: Error while reading from client: %s (%d)\n",
-              ctx->display_name, strerror(errno), errno);
-      assert(0 && "Error reading from client");
+    ssize_t num_read = recv(ctx->cfd, span, space, 0);
+
+    if (num_read == 0) {
+      printf("%s: Remote disconnected.\n", ctx->display_name);
+      client_close(ctx);
+      return;
     }
+    if (num_read == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      } else if (errno == EINTR) {
+        continue;
+      } else if (errno == EBADF || errno == ECONNRESET) {
+        // Possibly client went away? Accept a new connection.
+        fprintf(stderr, "%s: Client disappeared.\n", ctx->display_name);
+        client_close(ctx);
+        return;
+      } else {
+        fprintf(stderr, "%s: Error while reading from client: %s (%d)\n",
+                ctx->display_name, strerror(errno), errno);
+        assert(0 && "Error reading from client");
+      }
+    }
+    tcp_buffer_commit_write(ctx->buf_in, num_read);
   }
-  assert(num_read == 1);
-  return true;
 }
 
 /**
- * Send a byte to a connected client
+ * Send as much of buf_out as possible to the connected client
  *
  * @param ctx context object
- * @param cmd byte to send
  */
-static void put_byte(struct tcp_server_ctx *ctx, char cmd) {
-  while (1) {
-    ssize_t num_written = send(ctx->cfd, &cmd, sizeof(cmd), MSG_NOSIGNAL);
+static void client_send(struct tcp_server_ctx *ctx) {
+  while (ctx->cfd) {
+    const char *span;
+    size_t len = tcp_buffer_read_span(ctx->buf_out, &span);
+    if (len == 0) {
+      return;
+    }
+
+    ssize_t num_written = send(ctx->cfd, span, len, MSG_NOSIGNAL);
     if (num_written == -1) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // Wait for POLLOUT
+        store_flag(&ctx->tx_stalled, true);
+        return;
+      } else if (errno == EINTR) {
         continue;
-      } else if (errno == EPIPE) {
+      } else if (errno == EPIPE || errno == ECONNRESET) {
         printf("%s: Remote disconnected.\n", ctx->display_name);
-        tcp_server_client_close(ctx);
-        break;
+        client_close(ctx);
+        return;
       } else {
         fprintf(stderr, "%s: Error while writing to client: %s (%d)\n",
                 ctx->display_name, strerror(errno), errno);
         assert(0 && "Error writing to client.");
       }
     }
-    if (num_written >= 1) {
-      break;
+    tcp_buffer_commit_read(ctx->buf_out, num_written);
+  }
+}
+
+/**
+ * Check whether the socket thread has work to do without waiting for an event
+ *
+ * @param ctx context object
+ * @return true if the socket thread shouldn't sleep
+ */
+static bool server_has_work(struct tcp_server_ctx *ctx) {
+  if (!load_flag(&ctx->socket_run) || load_flag(&ctx->client_close_req)) {
+    return true;
+  }
+  if (!ctx->cfd) {
+    return false;
+  }
+  if (load_flag(&ctx->rx_stalled) &&
+      tcp_buffer_used(ctx->buf_in) < BUFSIZE_BYTE) {
+    return true;
+  }
+  return !load_flag(&ctx->tx_stalled) && tcp_buffer_used(ctx->buf_out) != 0;
+}
+
+/**
+ * Sleep until there is something for the socket thread to do
+ *
+ * @param ctx context object
+ * @return 0 on success, -1 in case of an error
+ */
+static int server_sleep(struct tcp_server_ctx *ctx) {
+  // Watch the listening socket while there is no client, and the client for
+  // the directions that are waiting for it. If there are none, leave it out,
+  // since poll would otherwise keep reporting a hang up.
+  struct pollfd fds[2];
+  nfds_t num_fds = 0;
+  fds[num_fds].fd = ctx->wake_pipe[0];
+  fds[num_fds++].events = POLLIN;
+  if (!ctx->cfd) {
+    fds[num_fds].fd = ctx->sfd;
+    fds[num_fds++].events = POLLIN;
+  } else {
+    short events = load_flag(&ctx->rx_stalled) ? 0 : POLLIN;
+    if (load_flag(&ctx->tx_stalled)) {
+      events |= POLLOUT;
+    }
+    if (events) {
+      fds[num_fds].fd = ctx->cfd;
+      fds[num_fds++].events = events;
     }
   }
+
+  store_flag(&ctx->sleeping, true);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (server_has_work(ctx)) {
+    store_flag(&ctx->sleeping, false);
+    return 0;
+  }
+
+  int num_events = poll(fds, num_fds, -1);
+  store_flag(&ctx->sleeping, false);
+  if (num_events < 0) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    fprintf(stderr, "%s: Error while waiting for socket activity: %s (%d)\n",
+            ctx->display_name, strerror(errno), errno);
+    return -1;
+  }
+
+  for (nfds_t i = 0; i < num_fds; ++i) {
+    if (!fds[i].revents) {
+      continue;
+    }
+    int fd = fds[i].fd;
+    if (fd == ctx->wake_pipe[0]) {
+      char drain[64];
+      while (read(ctx->wake_pipe[0], drain, sizeof(drain)) > 0) {
+      }
+    } else if (fd == ctx->sfd) {
+      client_tryaccept(ctx);
+    } else if (fd == ctx->cfd && (fds[i].revents & POLLOUT)) {
+      store_flag(&ctx->tx_stalled, false);
+    }
+  }
+  return 0;
 }
 
 /**
@@ -296,11 +557,16 @@ static void ctx_free(struct tcp_server_ctx *ctx) {
   // Free the buffers
   tcp_buffer_free(&ctx->buf_in);
   tcp_buffer_free(&ctx->buf_out);
+  // Close the wakeup pipe
+  for (int i = 0; i < 2; ++i) {
+    if (ctx->wake_pipe[i] >= 0) {
+      close(ctx->wake_pipe[i]);
+    }
+  }
   // Free the display name
   free(ctx->display_name);
   // Free the ctx
   free(ctx);
-  ctx = NULL;
 }
 
 /**
@@ -312,7 +578,6 @@ static void ctx_free(struct tcp_server_ctx *ctx) {
 static void *server_create(void *ctx_void) {
   // Cast to a server struct
   struct tcp_server_ctx *ctx = (struct tcp_server_ctx *)ctx_void;
-  struct timeval timeout;
 
   // Start the server
   int rv = start(ctx);
@@ -322,61 +587,36 @@ static void *server_create(void *ctx_void) {
     goto err_cleanup_return;
   }
 
-  // Initialise timeout
-  timeout.tv_sec = 0;
-
-  // Initialise fd_set
-
-  // Start waiting for connection / data
-  char xfer_data;
-  while (ctx->socket_run) {
-    // Initialise structure of fds
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    if (ctx->sfd) {
-      FD_SET(ctx->sfd, &read_fds);
-    }
+  // Move data until the host shuts us down, sleeping whenever there's
+  // nothing to do
+  while (load_flag(&ctx->socket_run)) {
     if (ctx->cfd) {
-      FD_SET(ctx->cfd, &read_fds);
+      if (load_flag(&ctx->rx_stalled) &&
+          tcp_buffer_used(ctx->buf_in) < BUFSIZE_BYTE) {
+        store_flag(&ctx->rx_stalled, false);
+      }
+      client_recv(ctx);
+      client_send(ctx);
     }
-    // max fd num
-    int mfd = (ctx->cfd > ctx->sfd) ? ctx->cfd : ctx->sfd;
-
-    // Set timeout - 50us gives good performance
-    timeout.tv_usec = 50;
 
-    // Wait for socket activity or timeout
-    rv = select(mfd + 1, &read_fds, NULL, NULL, &timeout);
+    // Close the client if the host asked, after sending anything that it
+    // wrote before asking
+    if (load_flag(&ctx->client_close_req)) {
+      client_close(ctx);
+      store_flag(&ctx->client_close_req, false);
+    }
 
-    if (rv < 0) {
+    if (server_sleep(ctx) != 0) {
       printf("%s: Socket read failed, port: %d\n", ctx->display_name,
              ctx->listen_port);
-      tcp_server_client_close(ctx);
-    }
-
-    // New connection
-    if (FD_ISSET(ctx->sfd, &read_fds)) {
-      client_tryaccept(ctx);
-    }
-
-    // New client data
-    if (FD_ISSET(ctx->cfd, &read_fds)) {
-      while (get_byte(ctx, &xfer_data)) {
-        tcp_buffer_put_byte(ctx->buf_in, xfer_data);
-      }
-    }
-
-    if (ctx->cfd != 0) {
-      while (tcp_buffer_get_byte(ctx->buf_out, &xfer_data)) {
-        put_byte(ctx, xfer_data);
-      }
+      client_close(ctx);
     }
   }
 
 err_cleanup_return:
 
   // Simulation done - clean up
-  tcp_server_client_close(ctx);
+  client_close(ctx);
   stop(ctx);
 
   return NULL;
@@ -405,28 +645,84 @@ struct tcp_server_ctx *tcp_server_create(const char *display_name,
   ctx->display_name = strdup(display_name);
   assert(ctx->display_name);
 
+  // Both ends are non-blocking: the socket thread drains the pipe until it
+  // is empty, and a full pipe already holds a wakeup.
+  if (pipe(ctx->wake_pipe) != 0) {
+    fprintf(stderr, "%s: Unable to create wakeup pipe: %s (%d)\n",
+            ctx->display_name, strerror(errno), errno);
+    ctx->wake_pipe[0] = ctx->wake_pipe[1] = -1;
+    ctx_free(ctx);
+    return NULL;
+  }
+  for (int i = 0; i < 2; ++i) {
+    fcntl(ctx->wake_pipe[i], F_SETFL, O_NONBLOCK);
+    fcntl(ctx->wake_pipe[i], F_SETFD, FD_CLOEXEC);
+  }
+
   if (pthread_create(&ctx->sock_thread, NULL, server_create, (void *)ctx) !=
       0) {
     fprintf(stderr, "%s: Unable to create TCP socket thread\n",
             ctx->display_name);
     ctx_free(ctx);
-    free(ctx);
     return NULL;
   }
   return ctx;
 }
 
+size_t tcp_server_read_buf(struct tcp_server_ctx *ctx, void *buf,
+                           size_t len) {
+  size_t num_read = tcp_buffer_get(ctx->buf_in, (char *)buf, len);
+  // If the socket thread stopped reading because the buffer was full, tell it
+  // that there's space now.
+  if (num_read && load_flag(&ctx->rx_stalled)) {
+    wake(ctx, false);
+  }
+  return num_read;
+}
+
+void tcp_server_write_buf(struct tcp_server_ctx *ctx, const void *buf,
+                          size_t len) {
+  const char *src = (const char *)buf;
+  while (len) {
+    size_t num_written = tcp_buffer_put(ctx->buf_out, src, len);
+    src += num_written;
+    len -= num_written;
+
+    if (!load_flag(&ctx->tx_stalled)) {
+      wake(ctx, false);
+    }
+    if (len) {
+      // The buffer is full, so wait for the socket thread to drain it
+      sched_yield();
+    }
+  }
+}
+
+size_t tcp_server_try_write_buf(struct tcp_server_ctx *ctx, const void *buf,
+                                size_t len) {
+  size_t num_written = tcp_buffer_put(ctx->buf_out, (const char *)buf, len);
+  if (num_written && !load_flag(&ctx->tx_stalled)) {
+    wake(ctx, false);
+  }
+  return num_written;
+}
+
+bool tcp_server_client_connected(struct tcp_server_ctx *ctx) {
+  return load_flag(&ctx->connected);
+}
+
 bool tcp_server_read(struct tcp_server_ctx *ctx, char *dat) {
-  return tcp_buffer_get_byte(ctx->buf_in, dat);
+  return tcp_server_read_buf(ctx, dat, 1) == 1;
 }
 
 void tcp_server_write(struct tcp_server_ctx *ctx, char dat) {
-  tcp_buffer_put_byte(ctx->buf_out, dat);
+  tcp_server_write_buf(ctx, &dat, 1);
 }
 
 void tcp_server_close(struct tcp_server_ctx *ctx) {
   // Shut down the socket thread
-  ctx->socket_run = false;
+  store_flag(&ctx->socket_run, false);
+  wake(ctx, true);
   pthread_join(ctx->sock_thread, NULL);
   ctx_free(ctx);
 }
@@ -434,10 +730,7 @@ void tcp_server_close(struct tcp_server_ctx *ctx) {
 void tcp_server_client_close(struct tcp_server_ctx *ctx) {
   assert(ctx);
 
-  if (!ctx->cfd) {
-    return;
-  }
-
-  close(ctx->cfd);
-  ctx->cfd = 0;
+  // The socket thread owns the client fd, so ask it to do the close
+  store_flag(&ctx->client_close_req, true);
+  wake(ctx, true);
 }
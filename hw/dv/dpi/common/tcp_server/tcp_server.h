@@ -10,6 +10,11 @@
  *
  * This is intended to be used by simulation add-on DPI modules to provide
  * basic TCP socket communication between a host and simulated peripherals.
+ *
+ * Data is passed between the simulation (host) thread and the socket thread
+ * through lock-free ring buffers, so reads and writes from the host thread
+ * don't normally make system calls. The socket thread sleeps until there is
+ * socket activity or the host thread has something for it to do.
  */
 
 #ifdef __cplusplus
@@ -17,6 +22,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 struct tcp_server_ctx;
@@ -30,6 +36,16 @@ struct tcp_server_ctx;
  */
 bool tcp_server_read(struct tcp_server_ctx *ctx, char *dat);
 
+/**
+ * Non-blocking read of up to len bytes from a connected client
+ *
+ * @param ctx tcp server context object
+ * @param buf buffer for the data received
+ * @param len maximum number of bytes to read
+ * @return the number of bytes read (0 if there was no data)
+ */
+size_t tcp_server_read_buf(struct tcp_server_ctx *ctx, void *buf, size_t len);
+
 /**
  * Write a byte to a connected client
  *
@@ -41,6 +57,47 @@ bool tcp_server_read(struct tcp_server_ctx *ctx, char *dat);
  */
 void tcp_server_write(struct tcp_server_ctx *ctx, char dat);
 
+/**
+ * Write len bytes to a connected client
+ *
+ * Like tcp_server_write, this only blocks if the internal buffer fills up.
+ * Writing a block of data at once is much cheaper than writing it a byte at a
+ * time.
+ *
+ * @param ctx tcp server context object
+ * @param buf data to send
+ * @param len number of bytes to send
+ */
+void tcp_server_write_buf(struct tcp_server_ctx *ctx, const void *buf,
+                          size_t len);
+
+/**
+ * Non-blocking write of up to len bytes to a connected client
+ *
+ * This never waits for the internal buffer to drain, so it can be used to
+ * stream data out without stalling the simulation when the client is slow to
+ * read.
+ *
+ * @param ctx tcp server context object
+ * @param buf data to send
+ * @param len maximum number of bytes to send
+ * @return the number of bytes written (0 if the buffer is full)
+ */
+size_t tcp_server_try_write_buf(struct tcp_server_ctx *ctx, const void *buf,
+                                size_t len);
+
+/**
+ * Check whether a client is connected
+ *
+ * Data written while no client is connected stays in the internal buffer
+ * until one connects, and any that a client didn't receive before it
+ * disconnected is thrown away.
+ *
+ * @param ctx tcp server context object
+ * @return true if a client is connected
+ */
+bool tcp_server_client_connected(struct tcp_server_ctx *ctx);
+
 /**
  * Create a new TCP server instance
  *
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "simctrl_dpi.h"
 #include "tcp_server.h"
 
 // IDCODE register
@@ -374,6 +375,39 @@ static void update_dmi_state(struct dmidpi_ctx *ctx) {
   }
 }
 
+/**
+ * State saved in a checkpoint: everything but the client connection
+ */
+struct dmidpi_checkpoint {
+  struct jtag_ctx jtag;
+  struct dmi_sig_values sig;
+};
+
+static bool dmidpi_save(void *ctx_void, void **state, size_t *len) {
+  struct dmidpi_ctx *ctx = (struct dmidpi_ctx *)ctx_void;
+  struct dmidpi_checkpoint *cp =
+      (struct dmidpi_checkpoint *)malloc(sizeof(*cp));
+  assert(cp);
+  cp->jtag = ctx->jtag;
+  cp->sig = ctx->sig;
+  *state = cp;
+  *len = sizeof(*cp);
+  return true;
+}
+
+static bool dmidpi_restore(void *ctx_void, const void *state, size_t len) {
+  struct dmidpi_ctx *ctx = (struct dmidpi_ctx *)ctx_void;
+  const struct dmidpi_checkpoint *cp = (const struct dmidpi_checkpoint *)state;
+  if (!cp || len != sizeof(*cp)) {
+    return false;
+  }
+  ctx->jtag = cp->jtag;
+  ctx->sig = cp->sig;
+  return true;
+}
+
+static const simctrl_dpi_hooks_t dmidpi_hooks = {dmidpi_save, dmidpi_restore};
+
 void *dmidpi_create(const char *display_name, int listen_port) {
   // Create context
   struct dmidpi_ctx *ctx =
@@ -392,11 +426,13 @@ void *dmidpi_create(const char *display_name, int listen_port) {
       "  remote_bitbang_port %d\n",
       display_name, listen_port, listen_port);
 
+  simctrl_dpi_context_created(display_name, ctx, &dmidpi_hooks);
   return (void *)ctx;
 }
 
 void dmidpi_close(void *ctx_void) {
-  struct dmidpi_ctx *ctx = (struct dmidpi_ctx *)ctx_void;
+  struct dmidpi_ctx *ctx =
+      (struct dmidpi_ctx *)simctrl_dpi_context(ctx_void);
   if (!ctx) {
     return;
   }
@@ -413,7 +449,8 @@ void dmidpi_tick(void *ctx_void, svBit *dmi_req_valid,
                  const svBit dmi_rsp_valid, svBit *dmi_rsp_ready,
                  const svBitVecVal *dmi_rsp_data,
                  const svBitVecVal *dmi_rsp_resp, svBit *dmi_rst_n) {
-  struct dmidpi_ctx *ctx = (struct dmidpi_ctx *)ctx_void;
+  struct dmidpi_ctx *ctx =
+      (struct dmidpi_ctx *)simctrl_dpi_context(ctx_void);
 
   if (!ctx) {
     return;
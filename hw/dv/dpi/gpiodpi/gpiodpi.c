@@ -23,6 +23,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "simctrl_dpi.h"
+
 // The number of ticks of host_to_device_tick between making syscalls.
 #define TICKS_PER_SYSCALL 2048
 
@@ -107,6 +109,40 @@ static void print_usage(char *rfifo, char *wfifo, int n_bits) {
          wfifo);
 }
 
+// The pin values driven from the host side survive a checkpoint; the FIFOs are
+// opened afresh by the restored simulation.
+struct gpiodpi_checkpoint {
+  uint32_t driven_pin_values;
+  uint32_t weak_pins;
+};
+
+static bool gpiodpi_save(void *ctx_void, void **state, size_t *len) {
+  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
+  struct gpiodpi_checkpoint *cp =
+      (struct gpiodpi_checkpoint *)malloc(sizeof(*cp));
+  assert(cp);
+  cp->driven_pin_values = ctx->driven_pin_values;
+  cp->weak_pins = ctx->weak_pins;
+  *state = cp;
+  *len = sizeof(*cp);
+  return true;
+}
+
+static bool gpiodpi_restore(void *ctx_void, const void *state, size_t len) {
+  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
+  const struct gpiodpi_checkpoint *cp =
+      (const struct gpiodpi_checkpoint *)state;
+  if (!cp || len != sizeof(*cp)) {
+    return false;
+  }
+  ctx->driven_pin_values = cp->driven_pin_values;
+  ctx->weak_pins = cp->weak_pins;
+  return true;
+}
+
+static const simctrl_dpi_hooks_t gpiodpi_hooks = {gpiodpi_save,
+                                                  gpiodpi_restore};
+
 void *gpiodpi_create(const char *name, int n_bits) {
   struct gpiodpi_ctx *ctx =
       (struct gpiodpi_ctx *)malloc(sizeof(struct gpiodpi_ctx));
@@ -147,12 +183,14 @@ void *gpiodpi_create(const char *name, int n_bits) {
 
   print_usage(ctx->dev_to_host_path, ctx->host_to_dev_path, ctx->n_bits);
 
+  simctrl_dpi_context_created(name, ctx, &gpiodpi_hooks);
   return (void *)ctx;
 }
 
 void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
                             svBitVecVal *gpio_oe) {
-  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
+  struct gpiodpi_ctx *ctx =
+      (struct gpiodpi_ctx *)simctrl_dpi_context(ctx_void);
   assert(ctx);
 
   // Write 0, 1, or X (when oe is not set) for each GPIO pin, in big endian
@@ -214,7 +252,8 @@ static void set_bit_val(uint32_t *word, uint32_t idx, bool val) {
 uint32_t gpiodpi_host_to_device_tick(void *ctx_void, svBitVecVal *gpio_oe,
                                      svBitVecVal *gpio_pull_en,
                                      svBitVecVal *gpio_pull_sel) {
-  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
+  struct gpiodpi_ctx *ctx =
+      (struct gpiodpi_ctx *)simctrl_dpi_context(ctx_void);
   assert(ctx);
 
   if (ctx->counter % TICKS_PER_SYSCALL == 0) {
@@ -300,7 +339,8 @@ parse_loop_end:
 }
 
 void gpiodpi_close(void *ctx_void) {
-  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
+  struct gpiodpi_ctx *ctx =
+      (struct gpiodpi_ctx *)simctrl_dpi_context(ctx_void);
   if (ctx == NULL) {
     return;
   }
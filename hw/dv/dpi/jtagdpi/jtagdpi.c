@@ -10,8 +10,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "simctrl_dpi.h"
 #include "tcp_server.h"
 
+/**
+ * Size of the local command queue and TDO response buffer
+ *
+ * OpenOCD queues up a batch of commands (including reads) and only waits for
+ * the responses when it needs them, so reading and replying a batch at a time
+ * avoids a trip through the TCP server for every JTAG bit.
+ */
+#define JTAGDPI_BUF_SIZE 4096
+
 struct jtagdpi_ctx {
   // Server context
   struct tcp_server_ctx *sock;
@@ -22,6 +32,13 @@ struct jtagdpi_ctx {
   uint8_t tdo;
   uint8_t trst_n;
   uint8_t srst_n;
+  // Commands received from the client but not yet run
+  char cmds[JTAGDPI_BUF_SIZE];
+  size_t cmd_pos;
+  size_t cmd_len;
+  // TDO responses waiting to be sent
+  char resp[JTAGDPI_BUF_SIZE];
+  size_t resp_len;
 };
 
 /**
@@ -41,8 +58,46 @@ static void reset_jtag_signals(struct jtagdpi_ctx *ctx) {
   ctx->srst_n = 1;
 }
 
+/**
+ * Send any TDO responses that have been queued up
+ */
+static void flush_responses(struct jtagdpi_ctx *ctx) {
+  if (ctx->resp_len) {
+    tcp_server_write_buf(ctx->sock, ctx->resp, ctx->resp_len);
+    ctx->resp_len = 0;
+  }
+}
+
+/**
+ * Get the next command byte from the local queue, refilling it from the
+ * client if it is empty
+ *
+ * Before waiting on the client for more commands, any queued responses are
+ * sent, since the client may be waiting for them.
+ *
+ * @return true if a command was available
+ */
+static bool next_cmd(struct jtagdpi_ctx *ctx, char *cmd) {
+  if (ctx->cmd_pos == ctx->cmd_len) {
+    ctx->cmd_pos = 0;
+    ctx->cmd_len = tcp_server_read_buf(ctx->sock, ctx->cmds, sizeof(ctx->cmds));
+    if (!ctx->cmd_len) {
+      flush_responses(ctx);
+      return false;
+    }
+  }
+  *cmd = ctx->cmds[ctx->cmd_pos++];
+  return true;
+}
+
 /**
  * Update the JTAG signals in the context structure
+ *
+ * Each call runs queued commands up to and including the next one that
+ * changes the JTAG signals, so the design sees one change per tick. Reads
+ * and other commands that don't change the signals are run in the same tick.
+ * A read sees TDO as it was after the previous change had been applied for a
+ * tick, just as if it had been given a tick of its own.
  */
 static void update_jtag_signals(struct jtagdpi_ctx *ctx) {
   assert(ctx);
@@ -54,56 +109,103 @@ static void update_jtag_signals(struct jtagdpi_ctx *ctx) {
    * https://repo.or.cz/openocd.git/blob/HEAD:/doc/manual/jtag/drivers/remote_bitbang.txt
    */
 
-  // read a command byte
   char cmd;
-  if (!tcp_server_read(ctx->sock, &cmd)) {
-    return;
+  while (next_cmd(ctx, &cmd)) {
+    // parse received command byte
+    if (cmd >= '0' && cmd <= '7') {
+      // JTAG write
+      char cmd_bit = cmd - '0';
+      ctx->tdi = (cmd_bit >> 0) & 0x1;
+      ctx->tms = (cmd_bit >> 1) & 0x1;
+      ctx->tck = (cmd_bit >> 2) & 0x1;
+      return;
+    } else if (cmd >= 'r' && cmd <= 'u') {
+      // JTAG reset (active high from OpenOCD)
+      char cmd_bit = cmd - 'r';
+      ctx->srst_n = !((cmd_bit >> 0) & 0x1);
+      ctx->trst_n = !((cmd_bit >> 1) & 0x1);
+      return;
+    } else if (cmd == 'R') {
+      // JTAG read: queue tdo as response
+      ctx->resp[ctx->resp_len++] = ctx->tdo + '0';
+      if (ctx->resp_len == sizeof(ctx->resp)) {
+        flush_responses(ctx);
+      }
+    } else if (cmd == 'B') {
+      // printf("%s: BLINK ON!\n", ctx->display_name);
+    } else if (cmd == 'b') {
+      // printf("%s: BLINK OFF!\n", ctx->display_name);
+    } else if (cmd == 'Z' || cmd == 'z') {
+      // Sleep for 1ms or 100us (remote_bitbang_use_remote_sleep). These let
+      // real hardware catch up, but simulated time doesn't pass while we
+      // sleep, so there's nothing to gain from sleeping.
+    } else if (cmd == 'Q') {
+      // quit (client disconnect). Drop anything else the client sent.
+      flush_responses(ctx);
+      ctx->cmd_pos = ctx->cmd_len = 0;
+      printf("JTAG DPI: Remote disconnected.\n");
+      tcp_server_client_close(ctx->sock);
+      return;
+    } else {
+      fprintf(stderr,
+              "JTAG DPI Protocol violation detected: unsupported command %c\n",
+              cmd);
+      exit(1);
+    }
   }
+}
 
-  bool act_send_resp = false;
-  bool act_quit = false;
-
-  // parse received command byte
-  if (cmd >= '0' && cmd <= '7') {
-    // JTAG write
-    char cmd_bit = cmd - '0';
-    ctx->tdi = (cmd_bit >> 0) & 0x1;
-    ctx->tms = (cmd_bit >> 1) & 0x1;
-    ctx->tck = (cmd_bit >> 2) & 0x1;
-  } else if (cmd >= 'r' && cmd <= 'u') {
-    // JTAG reset (active high from OpenOCD)
-    char cmd_bit = cmd - 'r';
-    ctx->srst_n = !((cmd_bit >> 0) & 0x1);
-    ctx->trst_n = !((cmd_bit >> 1) & 0x1);
-  } else if (cmd == 'R') {
-    // JTAG read
-    act_send_resp = true;
-  } else if (cmd == 'B') {
-    // printf("%s: BLINK ON!\n", ctx->display_name);
-  } else if (cmd == 'b') {
-    // printf("%s: BLINK OFF!\n", ctx->display_name);
-  } else if (cmd == 'Q') {
-    // quit (client disconnect)
-    act_quit = true;
-  } else {
-    fprintf(stderr,
-            "JTAG DPI Protocol violation detected: unsupported command %c\n",
-            cmd);
-    exit(1);
-  }
+/**
+ * JTAG signals as saved in a checkpoint
+ *
+ * The client connection isn't carried over, so a restored simulation keeps
+ * driving the signals the client left and waits for a new one.
+ */
+struct jtagdpi_checkpoint {
+  uint8_t tck;
+  uint8_t tms;
+  uint8_t tdi;
+  uint8_t trst_n;
+  uint8_t srst_n;
+};
 
-  // send tdo as response
-  if (act_send_resp) {
-    char tdo_ascii = ctx->tdo + '0';
-    tcp_server_write(ctx->sock, tdo_ascii);
+static bool jtagdpi_save(void *ctx_void, void **state, size_t *len) {
+  struct jtagdpi_ctx *ctx = (struct jtagdpi_ctx *)ctx_void;
+  // A half-run batch of commands would be lost along with the client.
+  if (ctx->cmd_pos < ctx->cmd_len || ctx->resp_len) {
+    return false;
   }
+  struct jtagdpi_checkpoint *cp =
+      (struct jtagdpi_checkpoint *)malloc(sizeof(*cp));
+  assert(cp);
+  cp->tck = ctx->tck;
+  cp->tms = ctx->tms;
+  cp->tdi = ctx->tdi;
+  cp->trst_n = ctx->trst_n;
+  cp->srst_n = ctx->srst_n;
+  *state = cp;
+  *len = sizeof(*cp);
+  return true;
+}
 
-  if (act_quit) {
-    printf("JTAG DPI: Remote disconnected.\n");
-    tcp_server_client_close(ctx->sock);
+static bool jtagdpi_restore(void *ctx_void, const void *state, size_t len) {
+  struct jtagdpi_ctx *ctx = (struct jtagdpi_ctx *)ctx_void;
+  const struct jtagdpi_checkpoint *cp =
+      (const struct jtagdpi_checkpoint *)state;
+  if (!cp || len != sizeof(*cp)) {
+    return false;
   }
+  ctx->tck = cp->tck;
+  ctx->tms = cp->tms;
+  ctx->tdi = cp->tdi;
+  ctx->trst_n = cp->trst_n;
+  ctx->srst_n = cp->srst_n;
+  return true;
 }
 
+static const simctrl_dpi_hooks_t jtagdpi_hooks = {jtagdpi_save,
+                                                  jtagdpi_restore};
+
 void *jtagdpi_create(const char *display_name, int listen_port) {
   struct jtagdpi_ctx *ctx =
       (struct jtagdpi_ctx *)calloc(1, sizeof(struct jtagdpi_ctx));
@@ -123,28 +225,31 @@ void *jtagdpi_create(const char *display_name, int listen_port) {
       "  remote_bitbang_port %d\n",
       display_name, listen_port, listen_port);
 
+  simctrl_dpi_context_created(display_name, ctx, &jtagdpi_hooks);
   return (void *)ctx;
 }
 
 void jtagdpi_close(void *ctx_void) {
-  struct jtagdpi_ctx *ctx = (struct jtagdpi_ctx *)ctx_void;
+  struct jtagdpi_ctx *ctx =
+      (struct jtagdpi_ctx *)simctrl_dpi_context(ctx_void);
   if (!ctx) {
     return;
   }
+  flush_responses(ctx);
   tcp_server_close(ctx->sock);
   free(ctx);
 }
 
 void jtagdpi_tick(void *ctx_void, svBit *tck, svBit *tms, svBit *tdi,
                   svBit *trst_n, svBit *srst_n, const svBit tdo) {
-  struct jtagdpi_ctx *ctx = (struct jtagdpi_ctx *)ctx_void;
+  struct jtagdpi_ctx *ctx =
+      (struct jtagdpi_ctx *)simctrl_dpi_context(ctx_void);
+  if (!ctx) {
+    return;
+  }
 
   ctx->tdo = tdo;
-
-  // TODO: Evaluate moving this functionality into a separate thread
-  if (ctx) {
-    update_jtag_signals(ctx);
-  }
+  update_jtag_signals(ctx);
 
   *tdi = ctx->tdi;
   *tms = ctx->tms;
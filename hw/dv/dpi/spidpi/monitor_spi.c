@@ -168,8 +168,8 @@ void monitor_spi(void *mon_void, FILE *mon_file, int loglevel, int tick,
                  int p2d, int d2p) {
   struct mon_ctx *mon = (struct mon_ctx *)mon_void;
   assert(mon);
-  int logbits = (loglevel & 0x1);
-  int logpkts = (loglevel & 0x8);
+  int logbits = (loglevel & LOG_BITS);
+  int logpkts = (loglevel & LOG_PACKETS);
 
   if ((tick == 1) && logbits) {
     fprintf(mon_file, "              CSB SCK MO  MI\n");
@@ -13,6 +13,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,10 +24,77 @@
 #include <unistd.h>
 
 #include "spidpi.h"
+#include "simctrl_dpi.h"
+#include "tcp_server.h"
 #ifdef VERILATOR
 #include "verilator_sim_ctrl.h"
 #endif
 
+// The number of idle ticks between reads of the pseudo-terminal. Reading it
+// is a system call, which is far too expensive to make on every tick.
+#define IDLE_TICKS_PER_READ 256
+
+// Transaction mode: the largest write or read in one frame
+#define XACT_MAX_DATA (1024 * 1024)
+
+// Transaction mode: the header of a frame from the host (all fields are
+// little-endian), which is followed by write_len bytes of data
+struct spidpi_xact_hdr {
+  uint8_t opcode;
+  // Lanes for each phase, as log2 of the number of lanes (0 for single, 1 for
+  // dual or 2 for quad): command in bits [1:0], address in [3:2], data in
+  // [5:4]
+  uint8_t lanes;
+  // Number of address bytes (0 to 4)
+  uint8_t addr_len;
+  // Number of dummy cycles between the address and the data
+  uint8_t dummy_cycles;
+  uint32_t addr;
+  uint32_t write_len;
+  uint32_t read_len;
+};
+#define XACT_HDR_LEN 16
+
+// Transaction mode: one phase of a frame
+struct spidpi_xact_seg {
+  // Bits moved per SCK cycle (1, 2 or 4)
+  int lanes;
+  // Number of SCK cycles
+  uint32_t cycles;
+  // The data to send (NULL for a dummy or read phase)
+  const uint8_t *out;
+  // True for the read phase
+  bool in;
+};
+#define XACT_MAX_SEGS 5
+
+// Transaction mode state
+struct spidpi_xact {
+  struct tcp_server_ctx *sock;
+  // Ticks per half SCK period
+  int half_period;
+  // Ticks until the next SCK edge (or other event)
+  int countdown;
+  int state;
+  // The frame being received from the host
+  uint8_t *frame;
+  size_t frame_len;
+  size_t frame_cap;
+  // The frame being run, split into phases
+  uint8_t hdr_out[5];
+  struct spidpi_xact_seg segs[XACT_MAX_SEGS];
+  int num_segs;
+  int seg;
+  uint32_t seg_cycle;
+  // The response: the read data after a 4-byte length. It is streamed to the
+  // host as it is read, so resp_ready bytes are complete and resp_sent of
+  // those have been passed to the TCP server.
+  uint8_t *resp;
+  size_t resp_len;
+  size_t resp_ready;
+  size_t resp_sent;
+};
+
 // This holds the necessary SPI state.
 #define MAX_TRANSACTION 4
 struct spidpi_ctx {
@@ -46,9 +115,11 @@ struct spidpi_ctx {
   int bin;
   int din;
   int nmax;
-  char driving;
+  int driving;
   int state;
   char buf[MAX_TRANSACTION];
+  // Transaction mode state (NULL in character mode)
+  struct spidpi_xact *xact;
 };
 
 // SPI Host States
@@ -59,12 +130,399 @@ struct spidpi_ctx {
 #define SP_CSRISE 4
 #define SP_FINISH 99
 
+// Transaction mode states
+// Waiting for a frame from the host
+#define XS_IDLE 0
+// Before a leading SCK edge (CSB is low)
+#define XS_LEADING 1
+// Before a trailing SCK edge
+#define XS_TRAILING 2
+// After the last trailing edge, before CSB goes high
+#define XS_END 3
+// CSB high, until the response has gone and the next frame can start
+#define XS_GAP 4
+
 // Enable this define to stop tracing at cycle 4
 // and resume at the first SPI packet
 // #define CONTROL_TRACE
 
-void *spidpi_create(const char *name, int mode, int loglevel) {
-  int i;
+/**
+ * Set up transaction mode, listening for a host on the given TCP port
+ *
+ * On failure, ctx->xact is left NULL.
+ */
+static void xact_create(struct spidpi_ctx *ctx, const char *name, int port,
+                        int half_period) {
+  struct spidpi_xact *xact =
+      (struct spidpi_xact *)calloc(1, sizeof(struct spidpi_xact));
+  assert(xact);
+
+  xact->sock = tcp_server_create(name, port);
+  if (!xact->sock) {
+    fprintf(stderr, "SPI: Unable to create TCP server for %s\n", name);
+    free(xact);
+    return;
+  }
+  xact->half_period = half_period > 0 ? half_period : 1;
+  xact->state = XS_IDLE;
+  ctx->xact = xact;
+
+  printf(
+      "\n"
+      "SPI: %s is in transaction mode. Send command frames to TCP port %d.\n",
+      name, port);
+}
+
+static void xact_free(struct spidpi_xact *xact) {
+  if (!xact) {
+    return;
+  }
+  tcp_server_close(xact->sock);
+  free(xact->frame);
+  free(xact->resp);
+  free(xact);
+}
+
+static uint32_t get_le32(const uint8_t *buf) {
+  return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+         ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static void put_le32(uint8_t *buf, uint32_t val) {
+  buf[0] = val & 0xff;
+  buf[1] = (val >> 8) & 0xff;
+  buf[2] = (val >> 16) & 0xff;
+  buf[3] = (val >> 24) & 0xff;
+}
+
+static void parse_hdr(const uint8_t *buf, struct spidpi_xact_hdr *hdr) {
+  hdr->opcode = buf[0];
+  hdr->lanes = buf[1];
+  hdr->addr_len = buf[2];
+  hdr->dummy_cycles = buf[3];
+  hdr->addr = get_le32(buf + 4);
+  hdr->write_len = get_le32(buf + 8);
+  hdr->read_len = get_le32(buf + 12);
+}
+
+/**
+ * Check that a frame header describes something we can run
+ *
+ * @return true if the header is valid
+ */
+static bool check_hdr(const struct spidpi_xact_hdr *hdr) {
+  for (int i = 0; i < 3; ++i) {
+    if (((hdr->lanes >> (2 * i)) & 3) == 3) {
+      fprintf(stderr, "SPI: Bad lanes field in frame: 0x%02x\n", hdr->lanes);
+      return false;
+    }
+  }
+  if (hdr->lanes & 0xc0) {
+    fprintf(stderr, "SPI: Bad lanes field in frame: 0x%02x\n", hdr->lanes);
+    return false;
+  }
+  if (hdr->addr_len > 4) {
+    fprintf(stderr, "SPI: Bad address length in frame: %d\n", hdr->addr_len);
+    return false;
+  }
+  if (hdr->write_len > XACT_MAX_DATA || hdr->read_len > XACT_MAX_DATA) {
+    fprintf(stderr,
+            "SPI: Frame data too long (write %u, read %u, max %u bytes)\n",
+            (unsigned)hdr->write_len, (unsigned)hdr->read_len,
+            (unsigned)XACT_MAX_DATA);
+    return false;
+  }
+  return true;
+}
+
+static void add_seg(struct spidpi_xact *xact, int lanes, uint32_t cycles,
+                    const uint8_t *out, bool in) {
+  if (!cycles) {
+    return;
+  }
+  assert(xact->num_segs < XACT_MAX_SEGS);
+  struct spidpi_xact_seg *seg = &xact->segs[xact->num_segs++];
+  seg->lanes = lanes;
+  seg->cycles = cycles;
+  seg->out = out;
+  seg->in = in;
+}
+
+/**
+ * Split the complete frame in xact->frame into phases, ready to run
+ */
+static void start_frame(struct spidpi_xact *xact) {
+  struct spidpi_xact_hdr hdr;
+  parse_hdr(xact->frame, &hdr);
+
+  int cmd_lanes = 1 << (hdr.lanes & 3);
+  int addr_lanes = 1 << ((hdr.lanes >> 2) & 3);
+  int data_lanes = 1 << ((hdr.lanes >> 4) & 3);
+
+  // The address goes out most significant byte first
+  xact->hdr_out[0] = hdr.opcode;
+  for (int i = 0; i < hdr.addr_len; ++i) {
+    xact->hdr_out[1 + i] = (hdr.addr >> (8 * (hdr.addr_len - 1 - i))) & 0xff;
+  }
+
+  xact->num_segs = 0;
+  add_seg(xact, cmd_lanes, 8 / cmd_lanes, xact->hdr_out, false);
+  add_seg(xact, addr_lanes, hdr.addr_len * 8 / addr_lanes, xact->hdr_out + 1,
+          false);
+  add_seg(xact, data_lanes, hdr.dummy_cycles, NULL, false);
+  add_seg(xact, data_lanes, hdr.write_len * 8 / data_lanes,
+          xact->frame + XACT_HDR_LEN, false);
+  add_seg(xact, data_lanes, hdr.read_len * 8 / data_lanes, NULL, true);
+  xact->seg = 0;
+  xact->seg_cycle = 0;
+
+  // The response is the read length followed by the data
+  xact->resp_len = 4 + hdr.read_len;
+  xact->resp = (uint8_t *)realloc(xact->resp, xact->resp_len);
+  assert(xact->resp);
+  memset(xact->resp, 0, xact->resp_len);
+  put_le32(xact->resp, hdr.read_len);
+  xact->resp_ready = 4;
+  xact->resp_sent = 0;
+
+  xact->frame_len = 0;
+}
+
+/**
+ * Collect the next frame from the host
+ *
+ * @return true once a complete frame is in xact->frame
+ */
+static bool receive_frame(struct spidpi_xact *xact) {
+  size_t want = XACT_HDR_LEN;
+  if (xact->frame_len >= XACT_HDR_LEN) {
+    want += get_le32(xact->frame + 8);
+  }
+  if (xact->frame_cap < want) {
+    xact->frame = (uint8_t *)realloc(xact->frame, want);
+    assert(xact->frame);
+    xact->frame_cap = want;
+  }
+
+  xact->frame_len += tcp_server_read_buf(
+      xact->sock, xact->frame + xact->frame_len, want - xact->frame_len);
+  if (xact->frame_len < want) {
+    return false;
+  }
+  if (want > XACT_HDR_LEN) {
+    return true;
+  }
+
+  // We have just got the header
+  struct spidpi_xact_hdr hdr;
+  parse_hdr(xact->frame, &hdr);
+  if (!check_hdr(&hdr)) {
+    // There's no way to find the start of the next frame, so drop the client
+    xact->frame_len = 0;
+    tcp_server_client_close(xact->sock);
+    return false;
+  }
+  // Fetch any write data
+  return hdr.write_len == 0 || receive_frame(xact);
+}
+
+/**
+ * Set the data pins to the bits for the current cycle of the current phase
+ */
+static void drive_cycle(struct spidpi_ctx *ctx) {
+  struct spidpi_xact *xact = ctx->xact;
+  const struct spidpi_xact_seg *seg = &xact->segs[xact->seg];
+  int drive = ctx->driving & ~(P2D_SDI | P2D_SD_MASK | P2D_SD_EN_MASK);
+
+  if (seg->out) {
+    uint32_t bit = xact->seg_cycle * seg->lanes;
+    int shift = 8 - seg->lanes - (bit & 7);
+    int val = (seg->out[bit / 8] >> shift) & ((1 << seg->lanes) - 1);
+    if (seg->lanes == 1) {
+      drive |= val ? P2D_SDI : 0;
+    } else {
+      int en = (1 << seg->lanes) - 1;
+      drive |= (val << P2D_SD_SHIFT) | (en << P2D_SD_EN_SHIFT);
+    }
+  }
+  ctx->driving = drive;
+}
+
+/**
+ * Capture the data pins for the current cycle of the current phase
+ */
+static void sample_cycle(struct spidpi_ctx *ctx, int d2p) {
+  struct spidpi_xact *xact = ctx->xact;
+  const struct spidpi_xact_seg *seg = &xact->segs[xact->seg];
+  if (!seg->in) {
+    return;
+  }
+
+  int val;
+  if (seg->lanes == 1) {
+    val = (d2p & D2P_SDO) ? 1 : 0;
+  } else {
+    val = (d2p >> D2P_SD_SHIFT) & ((1 << seg->lanes) - 1);
+  }
+  uint32_t bit = xact->seg_cycle * seg->lanes;
+  int shift = 8 - seg->lanes - (bit & 7);
+  xact->resp[4 + bit / 8] |= val << shift;
+  if (!shift) {
+    xact->resp_ready = 4 + bit / 8 + 1;
+  }
+}
+
+/**
+ * Pass as much of the response as is ready to the TCP server
+ *
+ * This never waits for the host to read what it has been sent. If the host
+ * has gone away, the rest of the response is dropped.
+ *
+ * @return true once the whole response has been sent (or dropped)
+ */
+static bool send_resp(struct spidpi_xact *xact) {
+  if (xact->resp_sent < xact->resp_ready) {
+    if (!tcp_server_client_connected(xact->sock)) {
+      fprintf(stderr,
+              "SPI: Host disconnected, dropping the rest of a response "
+              "(%zu bytes)\n",
+              xact->resp_len - xact->resp_sent);
+      xact->resp_ready = xact->resp_sent = xact->resp_len;
+      return true;
+    }
+    xact->resp_sent +=
+        tcp_server_try_write_buf(xact->sock, xact->resp + xact->resp_sent,
+                                 xact->resp_ready - xact->resp_sent);
+  }
+  return xact->resp_sent == xact->resp_len;
+}
+
+/**
+ * Move on to the next SCK cycle
+ *
+ * @return false if that was the last cycle of the frame
+ */
+static bool next_cycle(struct spidpi_xact *xact) {
+  if (++xact->seg_cycle < xact->segs[xact->seg].cycles) {
+    return true;
+  }
+  xact->seg_cycle = 0;
+  return ++xact->seg < xact->num_segs;
+}
+
+/**
+ * Advance transaction mode by one tick
+ *
+ * Between SCK edges, this just counts down and the pins stay as they are, so
+ * most ticks do very little work.
+ *
+ * @return the pins to drive
+ */
+static int xact_tick(struct spidpi_ctx *ctx, int d2p) {
+  struct spidpi_xact *xact = ctx->xact;
+  int sck_idle = ctx->cpol ? P2D_SCK : 0;
+
+  if (xact->state == XS_IDLE) {
+    // Reading from the TCP server doesn't need a system call, so it's cheap
+    // enough to do on every idle tick
+    if (!receive_frame(xact)) {
+      return ctx->driving;
+    }
+    start_frame(xact);
+    // CSB goes low. With CPHA = 0, the first bits must be set up before the
+    // leading edge.
+    ctx->driving = sck_idle;
+    if (!ctx->cpha) {
+      drive_cycle(ctx);
+    }
+    xact->state = XS_LEADING;
+    xact->countdown = xact->half_period;
+    return ctx->driving;
+  }
+
+  if (--xact->countdown > 0) {
+    return ctx->driving;
+  }
+  xact->countdown = xact->half_period;
+
+  switch (xact->state) {
+    case XS_LEADING:
+      ctx->driving ^= P2D_SCK;
+      if (ctx->cpha) {
+        drive_cycle(ctx);
+      } else {
+        sample_cycle(ctx, d2p);
+      }
+      xact->state = XS_TRAILING;
+      break;
+    case XS_TRAILING:
+      ctx->driving ^= P2D_SCK;
+      if (ctx->cpha) {
+        sample_cycle(ctx, d2p);
+      }
+      // Send the read data as it comes in, so that the response never has to
+      // fit in the TCP server's buffer all at once
+      send_resp(xact);
+      if (!next_cycle(xact)) {
+        xact->state = XS_END;
+        break;
+      }
+      if (!ctx->cpha) {
+        drive_cycle(ctx);
+      }
+      xact->state = XS_LEADING;
+      break;
+    case XS_END:
+      // CSB high
+      ctx->driving = P2D_CSB | sck_idle;
+      xact->state = XS_GAP;
+      break;
+    case XS_GAP:
+    default:
+      // Don't start another frame until the host has taken the whole response.
+      // If it isn't reading, try again every half period: the simulation
+      // keeps running, but the SPI bus stays idle.
+      if (send_resp(xact)) {
+        xact->state = XS_IDLE;
+      }
+      break;
+  }
+  return ctx->driving;
+}
+
+/**
+ * Save the tick count in a checkpoint
+ *
+ * Only between transactions, when the host drives the idle signals that a new
+ * context starts with; a transaction in flight can't be carried over.
+ */
+static bool spidpi_save(void *ctx_void, void **state, size_t *len) {
+  struct spidpi_ctx *ctx = (struct spidpi_ctx *)ctx_void;
+  if (ctx->xact ? ctx->xact->state != XS_IDLE || ctx->xact->frame_len
+                : ctx->state != SP_IDLE) {
+    return false;
+  }
+  int *tick = (int *)malloc(sizeof(*tick));
+  assert(tick);
+  *tick = ctx->tick;
+  *state = tick;
+  *len = sizeof(*tick);
+  return true;
+}
+
+static bool spidpi_restore(void *ctx_void, const void *state, size_t len) {
+  struct spidpi_ctx *ctx = (struct spidpi_ctx *)ctx_void;
+  if (!state || len != sizeof(ctx->tick)) {
+    return false;
+  }
+  ctx->tick = *(const int *)state;
+  return true;
+}
+
+static const simctrl_dpi_hooks_t spidpi_hooks = {spidpi_save, spidpi_restore};
+
+void *spidpi_create(const char *name, int mode, int loglevel, int port,
+                    int half_period) {
   struct spidpi_ctx *ctx =
       (struct spidpi_ctx *)calloc(1, sizeof(struct spidpi_ctx));
   assert(ctx);
@@ -82,10 +540,19 @@ void *spidpi_create(const char *name, int mode, int loglevel) {
    * cpol = 0 --> external clock matches internal
    * cpha = 0 --> drive on internal falling edge, capture on rising
    */
-  ctx->cpol = ((mode == 0) || (mode == 2)) ? 0 : 1;
-  ctx->cpha = ((mode == 1) || (mode == 3)) ? 1 : 0;
+  ctx->cpol = (mode >> 1) & 1;
+  ctx->cpha = mode & 1;
   /* CPOL = 1 for clock idle high */
   ctx->driving = P2D_CSB | ((ctx->cpol) ? P2D_SCK : 0);
+
+  if (port) {
+    xact_create(ctx, name, port, half_period);
+    if (!ctx->xact) {
+      free(ctx);
+      return NULL;
+    }
+  }
+
   char cwd[PATH_MAX];
   char *cwd_rv;
   cwd_rv = getcwd(cwd, sizeof(cwd));
@@ -95,23 +562,32 @@ void *spidpi_create(const char *name, int mode, int loglevel) {
   struct termios tty;
   cfmakeraw(&tty);
 
-  rv = openpty(&ctx->host, &ctx->device, 0, &tty, 0);
-  assert(rv != -1);
+  if (!ctx->xact) {
+    rv = openpty(&ctx->host, &ctx->device, 0, &tty, 0);
+    assert(rv != -1);
 
-  rv = ttyname_r(ctx->device, ctx->ptyname, 64);
-  assert(rv == 0 && "ttyname_r failed");
+    rv = ttyname_r(ctx->device, ctx->ptyname, 64);
+    assert(rv == 0 && "ttyname_r failed");
 
-  int cur_flags = fcntl(ctx->host, F_GETFL, 0);
-  assert(cur_flags != -1 && "Unable to read current flags.");
-  int new_flags = fcntl(ctx->host, F_SETFL, cur_flags | O_NONBLOCK);
-  assert(new_flags != -1 && "Unable to set FD flags");
+    int cur_flags = fcntl(ctx->host, F_GETFL, 0);
+    assert(cur_flags != -1 && "Unable to read current flags.");
+    int new_flags = fcntl(ctx->host, F_SETFL, cur_flags | O_NONBLOCK);
+    assert(new_flags != -1 && "Unable to set FD flags");
 
-  printf(
-      "\n"
-      "SPI: Created %s for %s. Connect to it with any terminal program, e.g.\n"
-      "$ screen %s\n"
-      "NOTE: a SPI transaction is run for every 4 characters entered.\n",
-      ctx->ptyname, name, ctx->ptyname);
+    printf(
+        "\n"
+        "SPI: Created %s for %s. Connect to it with any terminal program, "
+        "e.g.\n"
+        "$ screen %s\n"
+        "NOTE: a SPI transaction is run for every 4 characters entered.\n",
+        ctx->ptyname, name, ctx->ptyname);
+  }
+
+  // The monitor is only needed if something is being logged
+  if (!(loglevel & (LOG_BITS | LOG_PACKETS))) {
+    simctrl_dpi_context_created(name, ctx, &spidpi_hooks);
+    return (void *)ctx;
+  }
 
   rv = snprintf(ctx->mon_pathname, PATH_MAX, "%s/%s.log", cwd, name);
   assert(rv <= PATH_MAX && rv > 0);
@@ -128,11 +604,13 @@ void *spidpi_create(const char *name, int mode, int loglevel) {
       "$ tail -f %s\n",
       ctx->mon_pathname, ctx->mon_pathname);
 
+  simctrl_dpi_context_created(name, ctx, &spidpi_hooks);
   return (void *)ctx;
 }
 
-char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
-  struct spidpi_ctx *ctx = (struct spidpi_ctx *)ctx_void;
+int spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
+  struct spidpi_ctx *ctx =
+      (struct spidpi_ctx *)simctrl_dpi_context(ctx_void);
   assert(ctx);
   int d2p = d2p_data->aval;
 
@@ -147,10 +625,16 @@ char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
 #endif
 #endif
 
-  monitor_spi(ctx->mon, ctx->mon_file, ctx->loglevel, ctx->tick, ctx->driving,
-              d2p);
+  if (ctx->mon_file) {
+    monitor_spi(ctx->mon, ctx->mon_file, ctx->loglevel, ctx->tick,
+                ctx->driving, d2p);
+  }
 
-  if (ctx->state == SP_IDLE) {
+  if (ctx->xact) {
+    return xact_tick(ctx, d2p);
+  }
+
+  if (ctx->state == SP_IDLE && (ctx->tick % IDLE_TICKS_PER_READ) == 0) {
     int n = read(ctx->host, &(ctx->buf[ctx->nin]), ctx->nmax - ctx->nin);
     if (n == -1) {
       if (errno != EAGAIN) {
@@ -250,10 +734,20 @@ char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
 }
 
 void spidpi_close(void *ctx_void) {
-  struct spidpi_ctx *ctx = (struct spidpi_ctx *)ctx_void;
+  struct spidpi_ctx *ctx =
+      (struct spidpi_ctx *)simctrl_dpi_context(ctx_void);
   if (!ctx) {
     return;
   }
-  fclose(ctx->mon_file);
+  if (ctx->mon_file) {
+    fclose(ctx->mon_file);
+  }
+  if (ctx->xact) {
+    xact_free(ctx->xact);
+  } else {
+    close(ctx->host);
+    close(ctx->device);
+  }
+  free(ctx->mon);
   free(ctx);
 }
@@ -14,14 +14,39 @@ extern "C" {
 // Bits in data to C
 #define D2P_SDO 0x2
 #define D2P_SDO_EN 0x1
+// Quad data lanes in (sd[3:0]), used for dual and quad transfers
+#define D2P_SD_SHIFT 2
 
-// Bits in char from C
+// Bits in int from C
 #define P2D_SCK 0x1
 #define P2D_CSB 0x2
 #define P2D_SDI 0x4
-
-void *spidpi_create(const char *name, int mode, int loglevel);
-char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data);
+// Quad data lanes out (sd[3:0]) and their output enables, used for dual and
+// quad transfers
+#define P2D_SD_SHIFT 4
+#define P2D_SD_MASK (0xf << P2D_SD_SHIFT)
+#define P2D_SD_EN_SHIFT 8
+#define P2D_SD_EN_MASK (0xf << P2D_SD_EN_SHIFT)
+
+// Bits in loglevel
+#define LOG_BITS 0x1
+#define LOG_PACKETS 0x8
+
+/**
+ * Create a SPI host
+ *
+ * @param name name of the interface (display only)
+ * @param mode SPI mode (CPOL << 1 | CPHA)
+ * @param loglevel what to write to the monitor log (LOG_* bits, 0 for no log)
+ * @param port if non-zero, run in transaction mode, taking command frames from
+ *             a client on this TCP port. Otherwise, run a transaction for every
+ *             4 bytes written to a pseudo-terminal.
+ * @param half_period ticks per half SCK period in transaction mode
+ * @return the context, or NULL on failure
+ */
+void *spidpi_create(const char *name, int mode, int loglevel, int port,
+                    int half_period);
+int spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data);
 void spidpi_close(void *ctx_void);
 
 // monitor
@@ -3,16 +3,26 @@
 // SPDX-License-Identifier: Apache-2.0
 
 // SPIDPI -- act as a simple host for SPI device
+//
+// By default, a SPI transaction is run for every 4 bytes written to a
+// pseudo-terminal. If a TCP port is given with the `SPIDPI_PORT_<NAME>`
+// plusarg, the host instead runs whole command frames sent to that port (see
+// README.md). Dual and quad transfers use the spi_device_sd_* ports, which
+// can be left unconnected if only single-lane transfers are needed.
 
-// Bits in LOG_LEVEL sets what is output on info socket
-// 0x01 -- monitor packets
-// 0x08 -- bit level
+// Bits in LOG_LEVEL set what is written to the monitor log (<NAME>.log). The
+// `SPIDPI_LOG_LEVEL_<NAME>` plusarg overrides it. With a LOG_LEVEL of 0, the
+// monitor is disabled entirely, which is much faster.
+// 0x01 -- bit level
+// 0x08 -- monitor packets
 
 module spidpi
   #(
   parameter string NAME = "spi0",
   parameter int MODE = 0,
-  parameter int LOG_LEVEL = 9
+  parameter int LOG_LEVEL = 9,
+  // Clock cycles per half SCK period in transaction mode
+  parameter int SCK_HALF_PERIOD = 4
   )(
   input  logic clk_i,
   input  logic rst_ni,
@@ -20,22 +30,29 @@ module spidpi
   output logic spi_device_csb_o,
   output logic spi_device_sdi_o,
   input  logic spi_device_sdo_i,
-  input  logic spi_device_sdo_en_i
-
+  input  logic spi_device_sdo_en_i,
+  output logic [3:0] spi_device_sd_o,
+  output logic [3:0] spi_device_sd_en_o,
+  input  logic [3:0] spi_device_sd_i
 );
   import "DPI-C" function
-    chandle spidpi_create(input string name, input int mode, input int loglevel);
+    chandle spidpi_create(input string name, input int mode, input int loglevel,
+                          input int port, input int half_period);
 
   import "DPI-C" function
     void spidpi_close(input chandle ctx);
 
   import "DPI-C" function
-    byte spidpi_tick(input chandle ctx_void, input logic [1:0] d2p_data);
+    int spidpi_tick(input chandle ctx_void, input logic [5:0] d2p_data);
 
   chandle ctx;
+  int port = 0;
+  int log_level = LOG_LEVEL;
 
   initial begin
-    ctx = spidpi_create(NAME, MODE, LOG_LEVEL);
+    $value$plusargs({"SPIDPI_PORT_", NAME, "=%d"}, port);
+    $value$plusargs({"SPIDPI_LOG_LEVEL_", NAME, "=%d"}, log_level);
+    ctx = spidpi_create(NAME, MODE, log_level, port, SCK_HALF_PERIOD);
   end
 
   final begin
@@ -43,16 +60,18 @@ module spidpi
   end
 
   logic       unused_rst = rst_ni;
-  logic [1:0] d2p;
+  logic [5:0] d2p;
   logic       unused_dummy;
 
-  assign d2p = { spi_device_sdo_i, spi_device_sdo_en_i};
+  assign d2p = { spi_device_sd_i, spi_device_sdo_i, spi_device_sdo_en_i};
   always_ff @(posedge clk_i) begin
-    automatic byte p2d = spidpi_tick(ctx, d2p);
+    automatic int p2d = spidpi_tick(ctx, d2p);
     spi_device_sck_o <= p2d[0];
     spi_device_csb_o <= p2d[1];
     spi_device_sdi_o <= p2d[2];
+    spi_device_sd_o <= p2d[7:4];
+    spi_device_sd_en_o <= p2d[11:8];
     // stop verilator warning
-    unused_dummy <= |p2d[7:3];
+    unused_dummy <= |{p2d[31:12], p2d[3]};
   end
 endmodule
@@ -13,12 +13,27 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "simctrl_dpi.h"
+
+// Size of the buffer for bytes read from the pseudo-terminal. This must be a
+// power of two.
+#define RX_BUF_SIZE 4096
+
+// Size of the buffer for bytes written by the device. The buffer is flushed
+// at the end of each line, when it fills up, or when the device hasn't
+// written anything for TX_FLUSH_IDLE_POLLS calls to uartdpi_can_read (so that
+// prompts without a newline still show up).
+#define TX_BUF_SIZE 4096
+#define TX_FLUSH_IDLE_POLLS 4096
+
 // This keeps the necessary uart state.
 struct uartdpi_ctx {
   char ptyname[64];
@@ -26,11 +41,175 @@ struct uartdpi_ctx {
   int device;
   char tmp_read;
   FILE *log_file;
+
+  // Bytes read from the pseudo-terminal by the reader thread. The read and
+  // write pointers count bytes since creation and are only written by the
+  // simulation and reader threads, respectively.
+  unsigned int rx_rptr;
+  unsigned int rx_wptr;
+  char rx_buf[RX_BUF_SIZE];
+
+  // Reader thread, and a pipe that is used to tell it to stop
+  pthread_t reader;
+  bool reader_started;
+  int stop_pipe[2];
+
+  // Bytes written by the device that haven't been flushed yet
+  char tx_buf[TX_BUF_SIZE];
+  size_t tx_len;
+  unsigned int tx_idle_polls;
+  bool tx_dropped;
+
+  // String in the device output which starts tracing (or NULL), the number of
+  // cycles to trace for, and the state of the search for it: the length of
+  // the longest prefix of the string that the output ends with, and the
+  // Knuth-Morris-Pratt failure function of the string.
+  char *trace_trigger;
+  size_t trace_trigger_len;
+  int trace_cycles;
+  size_t trace_matched;
+  size_t *trace_fail;
+};
+
+/**
+ * Thread function that reads from the pseudo-terminal into rx_buf
+ *
+ * The thread sleeps in poll() until there is something to read or it is told
+ * to stop. If rx_buf is full, it leaves the data in the pseudo-terminal until
+ * the simulation has caught up.
+ */
+static void *reader_thread(void *ctx_void) {
+  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+
+  while (1) {
+    unsigned int wptr = ctx->rx_wptr;
+    unsigned int used =
+        wptr - __atomic_load_n(&ctx->rx_rptr, __ATOMIC_ACQUIRE);
+    if (used == RX_BUF_SIZE) {
+      // The UART is much slower than this, so there's no need for anything
+      // cleverer than waiting a bit.
+      usleep(1000);
+      continue;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = ctx->host;
+    fds[0].events = POLLIN;
+    fds[1].fd = ctx->stop_pipe[0];
+    fds[1].events = POLLIN;
+    int rv = poll(fds, 2, -1);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "UART: Unable to poll %s: %s\n", ctx->ptyname,
+              strerror(errno));
+      return NULL;
+    }
+    if (fds[1].revents) {
+      return NULL;
+    }
+    if (!(fds[0].revents & POLLIN)) {
+      continue;
+    }
+
+    // Read into the contiguous free space at the write pointer
+    size_t offset = wptr % RX_BUF_SIZE;
+    size_t space = RX_BUF_SIZE - used;
+    if (space > RX_BUF_SIZE - offset) {
+      space = RX_BUF_SIZE - offset;
+    }
+    ssize_t num_read = read(ctx->host, &ctx->rx_buf[offset], space);
+    if (num_read > 0) {
+      __atomic_store_n(&ctx->rx_wptr, wptr + (unsigned int)num_read,
+                       __ATOMIC_RELEASE);
+    }
+  }
+}
+
+/**
+ * Write out any buffered device output to the pseudo-terminal and log file
+ */
+static void flush_tx(struct uartdpi_ctx *ctx) {
+  if (!ctx->tx_len) {
+    return;
+  }
+
+  size_t done = 0;
+  while (done < ctx->tx_len) {
+    ssize_t rv = write(ctx->host, ctx->tx_buf + done, ctx->tx_len - done);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // Nothing is reading the pseudo-terminal and its buffer is full. Drop
+      // the output rather than stalling the simulation (it still goes to the
+      // log file).
+      if (!ctx->tx_dropped) {
+        fprintf(stderr,
+                "UART: %s is full, dropping output. Connect a terminal to "
+                "see it.\n",
+                ctx->ptyname);
+        ctx->tx_dropped = true;
+      }
+      break;
+    }
+    assert(rv > 0 && "Write to pseudo-terminal failed.");
+    done += rv;
+  }
+
+  if (ctx->log_file) {
+    size_t rv = fwrite(ctx->tx_buf, sizeof(char), ctx->tx_len, ctx->log_file);
+    assert(rv == ctx->tx_len && "Write to log file failed.");
+    (void)rv;
+  }
+
+  ctx->tx_len = 0;
+}
+
+// What a checkpoint carries over: the progress of the search for the trace
+// trigger. Everything else belongs to the pseudo-terminal, which is new.
+struct uartdpi_checkpoint {
+  bool trigger_pending;
+  size_t trace_matched;
 };
 
+static bool uartdpi_save(void *ctx_void, void **state, size_t *len) {
+  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  struct uartdpi_checkpoint *cp =
+      (struct uartdpi_checkpoint *)calloc(1, sizeof(*cp));
+  assert(cp);
+  cp->trigger_pending = ctx->trace_trigger != NULL;
+  cp->trace_matched = ctx->trace_matched;
+  *state = cp;
+  *len = sizeof(*cp);
+  return true;
+}
+
+static bool uartdpi_restore(void *ctx_void, const void *state, size_t len) {
+  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  const struct uartdpi_checkpoint *cp =
+      (const struct uartdpi_checkpoint *)state;
+  if (!cp || len != sizeof(*cp)) {
+    return false;
+  }
+  if (!cp->trigger_pending) {
+    free(ctx->trace_trigger);
+    free(ctx->trace_fail);
+    ctx->trace_trigger = NULL;
+    ctx->trace_fail = NULL;
+  } else if (ctx->trace_trigger && cp->trace_matched < ctx->trace_trigger_len) {
+    ctx->trace_matched = cp->trace_matched;
+  }
+  return true;
+}
+
+static const simctrl_dpi_hooks_t uartdpi_hooks = {uartdpi_save,
+                                                  uartdpi_restore};
+
 void *uartdpi_create(const char *name, const char *log_file_path) {
   struct uartdpi_ctx *ctx =
-      (struct uartdpi_ctx *)malloc(sizeof(struct uartdpi_ctx));
+      (struct uartdpi_ctx *)calloc(1, sizeof(struct uartdpi_ctx));
   assert(ctx);
 
   int rv;
@@ -50,6 +229,17 @@ void *uartdpi_create(const char *name, const char *log_file_path) {
   int new_flags = fcntl(ctx->host, F_SETFL, cur_flags | O_NONBLOCK);
   assert(new_flags != -1 && "Unable to set FD flags");
 
+  // Start the reader thread
+  rv = pipe(ctx->stop_pipe);
+  assert(rv == 0 && "Unable to create pipe");
+  rv = pthread_create(&ctx->reader, NULL, reader_thread, ctx);
+  if (rv != 0) {
+    fprintf(stderr, "UART: Unable to create reader thread for %s\n",
+            ctx->ptyname);
+  } else {
+    ctx->reader_started = true;
+  }
+
   printf(
       "\n"
       "UART: Created %s for %s. Connect to it with any terminal program, e.g.\n"
@@ -84,15 +274,29 @@ void *uartdpi_create(const char *name, const char *log_file_path) {
     }
   }
 
+  simctrl_dpi_context_created(name, ctx, &uartdpi_hooks);
   return (void *)ctx;
 }
 
 void uartdpi_close(void *ctx_void) {
-  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)simctrl_dpi_context(ctx_void);
   if (!ctx) {
     return;
   }
 
+  flush_tx(ctx);
+
+  if (ctx->reader_started) {
+    char stop = 0;
+    ssize_t rv = write(ctx->stop_pipe[1], &stop, 1);
+    assert(rv == 1);
+    (void)rv;
+    pthread_join(ctx->reader, NULL);
+  }
+  close(ctx->stop_pipe[0]);
+  close(ctx->stop_pipe[1]);
+
   close(ctx->host);
   close(ctx->device);
 
@@ -105,36 +309,113 @@ void uartdpi_close(void *ctx_void) {
     }
   }
 
+  free(ctx->trace_trigger);
+  free(ctx->trace_fail);
   free(ctx);
 }
 
+void uartdpi_set_trace_trigger(void *ctx_void, const char *trigger,
+                               int num_cycles) {
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)simctrl_dpi_context(ctx_void);
+  size_t len = strlen(trigger);
+  if (ctx == NULL || len == 0) {
+    return;
+  }
+
+  free(ctx->trace_trigger);
+  free(ctx->trace_fail);
+  ctx->trace_trigger = strdup(trigger);
+  ctx->trace_fail = (size_t *)calloc(len, sizeof(size_t));
+  assert(ctx->trace_trigger && ctx->trace_fail);
+  ctx->trace_trigger_len = len;
+  ctx->trace_cycles = num_cycles;
+  ctx->trace_matched = 0;
+
+  // trace_fail[i] is the length of the longest proper prefix of
+  // trigger[0..i] that is also a suffix of it.
+  size_t k = 0;
+  for (size_t i = 1; i < len; ++i) {
+    while (k && trigger[i] != trigger[k]) {
+      k = ctx->trace_fail[k - 1];
+    }
+    if (trigger[i] == trigger[k]) {
+      ++k;
+    }
+    ctx->trace_fail[i] = k;
+  }
+
+  printf("UART: Tracing will start when the device prints '%s'.\n", trigger);
+}
+
+/**
+ * Advance the search for the trace trigger string by one output character,
+ * and start tracing (once) if it has been found.
+ */
+static void match_trace_trigger(struct uartdpi_ctx *ctx, char c) {
+  size_t k = ctx->trace_matched;
+  while (k && c != ctx->trace_trigger[k]) {
+    k = ctx->trace_fail[k - 1];
+  }
+  if (c == ctx->trace_trigger[k]) {
+    ++k;
+  }
+  ctx->trace_matched = k;
+
+  if (k == ctx->trace_trigger_len) {
+    if (simctrl_dpi_trigger_trace(ctx->trace_cycles)) {
+      printf("UART: Found '%s', starting trace.\n", ctx->trace_trigger);
+    }
+    free(ctx->trace_trigger);
+    free(ctx->trace_fail);
+    ctx->trace_trigger = NULL;
+    ctx->trace_fail = NULL;
+  }
+}
+
 int uartdpi_can_read(void *ctx_void) {
-  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)simctrl_dpi_context(ctx_void);
   if (ctx == NULL) {
     return 0;
   }
-  int rv = read(ctx->host, &ctx->tmp_read, 1);
-  return (rv == 1);
+
+  // This is called whenever the transmitter is idle, so it doubles as a timer
+  // for flushing partial lines of output.
+  if (ctx->tx_len && ++ctx->tx_idle_polls >= TX_FLUSH_IDLE_POLLS) {
+    flush_tx(ctx);
+  }
+
+  unsigned int rptr = ctx->rx_rptr;
+  if (__atomic_load_n(&ctx->rx_wptr, __ATOMIC_ACQUIRE) == rptr) {
+    return 0;
+  }
+  ctx->tmp_read = ctx->rx_buf[rptr % RX_BUF_SIZE];
+  __atomic_store_n(&ctx->rx_rptr, rptr + 1, __ATOMIC_RELEASE);
+  return 1;
 }
 
 char uartdpi_read(void *ctx_void) {
-  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)simctrl_dpi_context(ctx_void);
 
   return ctx->tmp_read;
 }
 
 void uartdpi_write(void *ctx_void, char c) {
-  int rv;
-  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)simctrl_dpi_context(ctx_void);
   if (ctx == NULL) {
     return;
   }
 
-  rv = write(ctx->host, &c, 1);
-  assert(rv == 1 && "Write to pseudo-terminal failed.");
+  if (ctx->trace_trigger) {
+    match_trace_trigger(ctx, c);
+  }
 
-  if (ctx->log_file) {
-    rv = fwrite(&c, sizeof(char), 1, ctx->log_file);
-    assert(rv == 1 && "Write to log file failed.");
+  ctx->tx_buf[ctx->tx_len++] = c;
+  ctx->tx_idle_polls = 0;
+  if (c == '\n' || ctx->tx_len == TX_BUF_SIZE) {
+    flush_tx(ctx);
   }
 }
@@ -15,6 +15,18 @@ int uartdpi_can_read(void *ctx_void);
 char uartdpi_read(void *ctx_void);
 void uartdpi_write(void *ctx_void, char c);
 
+/**
+ * Start tracing once the device has printed trigger
+ *
+ * This calls simctrl_trigger_trace() (see simctrl_dpi.h), so it only has an
+ * effect in Verilator simulations with tracing support.
+ *
+ * @param trigger    String to look for in the output of the device
+ * @param num_cycles Number of cycles to trace for (0: until the end)
+ */
+void uartdpi_set_trace_trigger(void *ctx_void, const char *trigger,
+                               int num_cycles);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -20,6 +20,11 @@ module uartdpi #(
   // Min cycles is 2 for fast test mode
   localparam int CYCLES_PER_SYMBOL = FREQ / BAUD;
 
+  // The symbol length that is actually used. This can be shortened with the
+  // `UARTDPI_CYCLES_PER_SYMBOL_<name>` plusarg for software that programs the
+  // UART with a faster baud rate than the default for the top-level.
+  int cycles_per_symbol = CYCLES_PER_SYMBOL;
+
   import "DPI-C" function
     chandle uartdpi_create(input string name, input string log_file_path);
 
@@ -35,12 +40,30 @@ module uartdpi #(
   import "DPI-C" function
     void uartdpi_write(input chandle ctx, int data);
 
+  import "DPI-C" function
+    void uartdpi_set_trace_trigger(input chandle ctx, input string trigger,
+                                   input int num_cycles);
+
   chandle ctx;
   string log_file_path = DEFAULT_LOG_FILE;
+  // Start tracing when the device prints this string (given with the
+  // `UARTDPI_TRACE_TRIGGER_<name>` plusarg), for the number of cycles given
+  // with `UARTDPI_TRACE_CYCLES_<name>` (default: until the end).
+  string trace_trigger;
+  int trace_cycles = 0;
 
   function automatic void initialize();
     $value$plusargs({"UARTDPI_LOG_", NAME, "=%s"}, log_file_path);
+    if ($value$plusargs({"UARTDPI_CYCLES_PER_SYMBOL_", NAME, "=%d"}, cycles_per_symbol)) begin
+      if (cycles_per_symbol < 2) begin
+        $fatal(1, "uartdpi %s: UARTDPI_CYCLES_PER_SYMBOL must be at least 2", NAME);
+      end
+    end
     ctx = uartdpi_create(NAME, log_file_path);
+    if ($value$plusargs({"UARTDPI_TRACE_TRIGGER_", NAME, "=%s"}, trace_trigger)) begin
+      $value$plusargs({"UARTDPI_TRACE_CYCLES_", NAME, "=%d"}, trace_cycles);
+      uartdpi_set_trace_trigger(ctx, trace_trigger, trace_cycles);
+    end
   endfunction
 
   initial begin
@@ -83,7 +106,7 @@ module uartdpi #(
       end else begin
         txcyccount <= txcyccount + 1;
         tx_o <= txsymbol[txcount];
-        if (txcyccount == CYCLES_PER_SYMBOL - 1) begin
+        if (txcyccount == cycles_per_symbol - 1) begin
           txcyccount <= 0;
           if (txcount == 9)
             txactive <= 0;
@@ -115,7 +138,7 @@ module uartdpi #(
         end
       end else begin
         if (rxcount == 0) begin
-          if (rxcyccount == CYCLES_PER_SYMBOL/2 - 1) begin
+          if (rxcyccount == cycles_per_symbol/2 - 1) begin
             if (rx_i) begin
               rxactive <= 0;
             end else begin
@@ -124,13 +147,13 @@ module uartdpi #(
             end
           end
         end else if (rxcount <= 8) begin
-          if (rxcyccount == CYCLES_PER_SYMBOL - 1) begin
+          if (rxcyccount == cycles_per_symbol - 1) begin
             rxsymbol[rxcount-1] <= rx_i;
             rxcount <= rxcount + 1;
             rxcyccount <= 0;
           end
         end else begin
-          if (rxcyccount == CYCLES_PER_SYMBOL - 1) begin
+          if (rxcyccount == cycles_per_symbol - 1) begin
             rxactive <= 0;
             if (rx_i) begin
               uartdpi_write(ctx, rxsymbol);
@@ -4,9 +4,12 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "usb_utils.h"
 #include "usbdpi.h"
@@ -26,6 +29,28 @@ typedef enum { M_NONE = 0, M_HOST, M_DEVICE } usbmon_driver_t;
 // Number of bytes in max output buffer line
 #define MAX_OBUF 80
 
+// Packet capture file format; nanosecond-resolution pcap with USB 2.0 packets
+// (PID, payload and CRC) as seen on the bus
+#define PCAP_MAGIC_NS 0xa1b23c4dU
+#define PCAP_VERSION_MAJOR 2U
+#define PCAP_VERSION_MINOR 4U
+#define PCAP_SNAPLEN 0xffffU
+#define PCAP_LINKTYPE_USB_2_0 288U
+
+// Size of a pcap record header
+#define PCAP_REC_HDR 16U
+
+// Size of the buffer for capture records awaiting the writer thread. This must
+// be a power of two.
+#define PCAP_BUF_SIZE 0x100000U
+
+// Wake the writer thread early once this much of the buffer is in use
+#define PCAP_BUF_WAKE (PCAP_BUF_SIZE / 4U)
+
+// Interval at which the writer thread flushes the capture file when the bus is
+// quiet, so that captures may be watched live
+#define PCAP_FLUSH_MS 100
+
 /**
  * USB monitor context
  */
@@ -49,6 +74,10 @@ struct usb_monitor_ctx {
   int needbits;
   int sopAt;
   uint8_t lastpid;
+  /**
+   * PID byte of the current packet, even if it is invalid
+   */
+  uint8_t pid;
   /**
    * USB data callback
    */
@@ -60,13 +89,197 @@ struct usb_monitor_ctx {
   /**
    * Byte offset of the next byte to be collected in the data buffer
    */
-  uint8_t byte;
+  uint16_t byte;
   /**
    * Buffer of collected bytes
    */
   uint8_t bytes[MON_BYTES_SIZE + 2];
+  /**
+   * Upper bits of the bus time, and the last time seen, so that capture
+   * timestamps continue beyond the 32-bit wrap of tick_bits
+   */
+  uint32_t tick_hi;
+  uint32_t last_tick;
+  /**
+   * Packet capture file (or NULL), and the writer thread that owns it
+   */
+  FILE *pcap;
+  pthread_t writer;
+  bool writer_started;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  bool stop;
+  /**
+   * Capture records awaiting the writer thread. The read and write pointers
+   * count bytes since creation and are only written by the writer thread and
+   * the simulation, respectively.
+   */
+  uint32_t pcap_rptr;
+  uint32_t pcap_wptr;
+  uint8_t *pcap_buf;
 };
 
+// Write a 32-bit little-endian value
+static inline uint8_t *put_le32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+  return p + 4;
+}
+
+/**
+ * Thread function that writes capture records from pcap_buf to the file
+ *
+ * The thread sleeps until the simulation wakes it or PCAP_FLUSH_MS elapses,
+ * and drains the buffer completely before exiting when asked to stop.
+ */
+static void *pcap_writer(void *mon_v) {
+  usb_monitor_ctx_t *mon = (usb_monitor_ctx_t *)mon_v;
+
+  while (true) {
+    pthread_mutex_lock(&mon->lock);
+    uint32_t rptr = mon->pcap_rptr;
+    if (!mon->stop &&
+        __atomic_load_n(&mon->pcap_wptr, __ATOMIC_ACQUIRE) == rptr) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += PCAP_FLUSH_MS * 1000000L;
+      if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&mon->wake, &mon->lock, &ts);
+    }
+    bool stop = mon->stop;
+    pthread_mutex_unlock(&mon->lock);
+
+    // Write out everything that is available, in at most two contiguous
+    // chunks because the buffer may have wrapped
+    uint32_t wptr = __atomic_load_n(&mon->pcap_wptr, __ATOMIC_ACQUIRE);
+    while (rptr != wptr) {
+      uint32_t offset = rptr % PCAP_BUF_SIZE;
+      uint32_t len = wptr - rptr;
+      if (len > PCAP_BUF_SIZE - offset) {
+        len = PCAP_BUF_SIZE - offset;
+      }
+      size_t written = fwrite(&mon->pcap_buf[offset], 1, len, mon->pcap);
+      assert(written == len && "Write to capture file failed.");
+      (void)written;
+      rptr += len;
+      __atomic_store_n(&mon->pcap_rptr, rptr, __ATOMIC_RELEASE);
+    }
+    fflush(mon->pcap);
+
+    if (stop) {
+      return NULL;
+    }
+  }
+}
+
+// Open the capture file and start its writer thread
+static void pcap_open(usb_monitor_ctx_t *mon, const char *filename) {
+  mon->pcap = fopen(filename, "wb");
+  if (!mon->pcap) {
+    fprintf(stderr, "USBDPI: Unable to open capture file at %s: %s\n",
+            filename, strerror(errno));
+    return;
+  }
+
+  // Global header; timestamps are nanoseconds of simulated time
+  uint8_t hdr[24];
+  uint8_t *p = put_le32(hdr, PCAP_MAGIC_NS);
+  p[0] = PCAP_VERSION_MAJOR;
+  p[1] = 0U;
+  p[2] = PCAP_VERSION_MINOR;
+  p[3] = 0U;
+  p = put_le32(p + 4, 0U);  // thiszone
+  p = put_le32(p, 0U);      // sigfigs
+  p = put_le32(p, PCAP_SNAPLEN);
+  put_le32(p, PCAP_LINKTYPE_USB_2_0);
+  size_t written = fwrite(hdr, 1, sizeof(hdr), mon->pcap);
+  assert(written == sizeof(hdr));
+  (void)written;
+
+  mon->pcap_buf = (uint8_t *)malloc(PCAP_BUF_SIZE);
+  assert(mon->pcap_buf);
+  pthread_mutex_init(&mon->lock, NULL);
+  pthread_cond_init(&mon->wake, NULL);
+  int rv = pthread_create(&mon->writer, NULL, pcap_writer, mon);
+  if (rv != 0) {
+    fprintf(stderr, "USBDPI: Unable to create writer thread for %s\n",
+            filename);
+    fclose(mon->pcap);
+    mon->pcap = NULL;
+    return;
+  }
+  mon->writer_started = true;
+
+  printf("\nUSBDPI: Packet capture file created at %s\n", filename);
+}
+
+// Wake the writer thread
+static void pcap_wake(usb_monitor_ctx_t *mon) {
+  pthread_mutex_lock(&mon->lock);
+  pthread_cond_signal(&mon->wake);
+  pthread_mutex_unlock(&mon->lock);
+}
+
+// Append bytes to the capture buffer at the given write pointer
+static inline uint32_t pcap_put(usb_monitor_ctx_t *mon, uint32_t wptr,
+                                const uint8_t *d, uint32_t len) {
+  uint32_t offset = wptr % PCAP_BUF_SIZE;
+  uint32_t chunk = PCAP_BUF_SIZE - offset;
+  if (chunk > len) {
+    chunk = len;
+  }
+  memcpy(&mon->pcap_buf[offset], d, chunk);
+  memcpy(mon->pcap_buf, d + chunk, len - chunk);
+  return wptr + len;
+}
+
+// Capture the packet that has just ended. The timestamp is that of the SOP.
+static void pcap_packet(usb_monitor_ctx_t *mon) {
+  // The PID is the first byte of the packet; the collected bytes are the
+  // remainder, including any CRC
+  uint32_t len = 1U + mon->byte;
+  uint32_t need = PCAP_REC_HDR + len;
+
+  uint32_t wptr = mon->pcap_wptr;
+  uint32_t used = wptr - __atomic_load_n(&mon->pcap_rptr, __ATOMIC_ACQUIRE);
+  if (used + need > PCAP_BUF_SIZE) {
+    // The writer has fallen behind; wait for it rather than drop packets
+    do {
+      pcap_wake(mon);
+      usleep(100);
+      used = wptr - __atomic_load_n(&mon->pcap_rptr, __ATOMIC_ACQUIRE);
+    } while (used + need > PCAP_BUF_SIZE);
+  }
+
+  // Bus time of the SOP in nanoseconds; each bit interval is 1/12us. The SOP
+  // precedes the current time, so may lie before a 32-bit wrap.
+  uint64_t sop = ((uint64_t)mon->tick_hi << 32) | (uint32_t)mon->sopAt;
+  if ((uint32_t)mon->sopAt > mon->last_tick) {
+    sop -= (uint64_t)1U << 32;
+  }
+  uint64_t ns = (sop * 1000U) / 12U;
+
+  uint8_t hdr[PCAP_REC_HDR + 1U];
+  uint8_t *p = put_le32(hdr, (uint32_t)(ns / 1000000000U));
+  p = put_le32(p, (uint32_t)(ns % 1000000000U));
+  p = put_le32(p, len);
+  p = put_le32(p, len);
+  *p = mon->pid;
+
+  wptr = pcap_put(mon, wptr, hdr, sizeof(hdr));
+  wptr = pcap_put(mon, wptr, mon->bytes, mon->byte);
+  __atomic_store_n(&mon->pcap_wptr, wptr, __ATOMIC_RELEASE);
+
+  if (used < PCAP_BUF_WAKE && used + need >= PCAP_BUF_WAKE) {
+    pcap_wake(mon);
+  }
+}
+
 // Invoke the USB data callback function, if registered
 static inline void data_callback(usb_monitor_ctx_t *mon,
                                  usbmon_data_type_t type, uint8_t d) {
@@ -79,6 +292,7 @@ static inline void data_callback(usb_monitor_ctx_t *mon,
  * Create and initialize a USB monitor instance
  */
 usb_monitor_ctx_t *usb_monitor_init(const char *filename,
+                                    const char *pcap_filename,
                                     usb_monitor_data_callback_t data_cb,
                                     void *data_ctx) {
   usb_monitor_ctx_t *mon =
@@ -94,12 +308,19 @@ usb_monitor_ctx_t *usb_monitor_init(const char *filename,
   mon->data_callback = data_cb;
   mon->data_ctx = data_ctx;
 
+  if (pcap_filename && pcap_filename[0]) {
+    pcap_open(mon, pcap_filename);
+  }
+
+  // The text log is optional; the monitor still decodes the bus without it
+  if (!filename) {
+    return mon;
+  }
   mon->file = fopen(filename, "w");
   if (!mon->file) {
     fprintf(stderr, "USBDPI: Unable to open monitor file at %s: %s\n", filename,
             strerror(errno));
-    free(mon);
-    return NULL;
+    return mon;
   }
 
   // more useful for tail -f
@@ -116,7 +337,22 @@ usb_monitor_ctx_t *usb_monitor_init(const char *filename,
  * Finalize a USB monitor
  */
 void usb_monitor_fin(usb_monitor_ctx_t *mon) {
-  fclose(mon->file);
+  if (mon->writer_started) {
+    pthread_mutex_lock(&mon->lock);
+    mon->stop = true;
+    pthread_cond_signal(&mon->wake);
+    pthread_mutex_unlock(&mon->lock);
+    pthread_join(mon->writer, NULL);
+    fclose(mon->pcap);
+  }
+  if (mon->pcap_buf) {
+    pthread_cond_destroy(&mon->wake);
+    pthread_mutex_destroy(&mon->lock);
+    free(mon->pcap_buf);
+  }
+  if (mon->file) {
+    fclose(mon->file);
+  }
   free(mon);
 }
 
@@ -124,6 +360,9 @@ void usb_monitor_fin(usb_monitor_ctx_t *mon) {
  * Append a formatted message to the USB monitor log file
  */
 void usb_monitor_log(usb_monitor_ctx_t *ctx, const char *fmt, ...) {
+  if (!ctx->file) {
+    return;
+  }
   char obuf[MAX_OBUF];
   va_list ap;
   va_start(ap, fmt);
@@ -177,17 +416,23 @@ char *pid_2data(int pid, unsigned char d0, unsigned char d1) {
  */
 void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
                  bool hdrive, uint32_t p2d, uint32_t d2p, uint8_t *lastpid) {
-  bool log = ((loglevel & 0x2) != 0);
-  bool compact = ((loglevel & 0x1) != 0);
-
   assert(mon);
 
+  bool log = mon->file && (loglevel & LOG_MON_VERBOSE);
+  bool compact = mon->file && (loglevel & LOG_MON);
+
+  // Extend the bus time for capture timestamps
+  if (tick_bits < mon->last_tick) {
+    mon->tick_hi++;
+  }
+  mon->last_tick = tick_bits;
+
   // Ascertain state of D+/D- pair; these may have been swapped in some use
   // cases, but we can ascertain this by looking at the pull-up enables.
   // The DUT is a full speed device so the pull up should be on D+
   int dp, dn;
   if ((d2p & D2P_DP_EN) || (d2p & D2P_DN_EN) || (d2p & D2P_D_EN)) {
-    if (hdrive) {
+    if (hdrive && mon->file) {
       fprintf(mon->file, "mon: %8d: Bus clash\n", tick_bits);
     }
     if (d2p & D2P_TX_USE_D_SE0) {
@@ -310,6 +555,9 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
       fprintf(mon->file, "mon: %8d: (%c) EOP\n", tick_bits,
               mon->driver == M_HOST ? 'H' : 'D');
     }
+    if (mon->writer_started && mon->state == MS_GET_BYTES) {
+      pcap_packet(mon);
+    }
     mon->state = MS_IDLE;
     data_callback(mon, UsbMon_DataType_EOP, 0U);
     return;
@@ -318,7 +566,7 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
   int newbit = (((mon->line & 0xc) >> 2) == (mon->line & 0x3)) ? 1 : 0;
   mon->rawbits = (mon->rawbits << 1) | newbit;
   if ((mon->rawbits & 0x7e) == 0x7e) {
-    if (newbit == 1) {
+    if (newbit == 1 && mon->file) {
       fprintf(mon->file, "mon: %8d: (%c) Bitstuff error, got 1 after 0x%x\n",
               tick_bits, mon->driver == M_HOST ? 'H' : 'D', mon->rawbits);
     }
@@ -337,6 +585,7 @@ void usb_monitor(usb_monitor_ctx_t *mon, int loglevel, uint32_t tick_bits,
       // Any byte for which the upper nibble is not the exact complement
       // of the lower nibble is invalid
       uint8_t pid = (uint8_t)mon->bits;
+      mon->pid = pid;
       if (((pid ^ 0xf0) >> 4) ^ (pid & 0x0f)) {
         if (log) {
           fprintf(mon->file, "mon: %8d: (%c) BAD PID 0x%x\n", tick_bits,
@@ -29,12 +29,17 @@ typedef void (*usb_monitor_data_callback_t)(void *ctx_v,
 /**
  * Create and initialize a USB monitor instance
  *
- * @param  filename  Filename to be used for log file
- * @param  data_cb   USB data callback function
- * @param  data_ctx  Context for data callback
- * @return           USB monitor context
+ * Packets are captured in pcap format (LINKTYPE_USB_2_0) with timestamps in
+ * simulated bus time; the file is written by a separate thread.
+ *
+ * @param  filename       Filename to be used for log file (or NULL for none)
+ * @param  pcap_filename  Filename for packet capture (or NULL/empty for none)
+ * @param  data_cb        USB data callback function
+ * @param  data_ctx       Context for data callback
+ * @return                USB monitor context
  */
 usb_monitor_ctx_t *usb_monitor_init(const char *filename,
+                                    const char *pcap_filename,
                                     usb_monitor_data_callback_t data_cb,
                                     void *data_ctx);
 
@@ -58,7 +63,8 @@ void usb_monitor_log(usb_monitor_ctx_t *mon, const char *fmt, ...);
  *
  * @param mon        USB monitor context
  * @param loglevel   Level of logging information required
- * @param tick_bits  Elapsed simulation time in USB bit intervals (12Mbps)
+ * @param tick_bits  Elapsed simulation time in USB bit intervals (12Mbps),
+ *                   wrapping at 2^32
  * @param hdrive     Indicates whether the host is driving the bus
  * @param d2p        Signals from USBDEV to DPI model
  * @param p2d        Signals from DPI model to USBDEV
@@ -0,0 +1,209 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hw/dv/dpi/usbdpi/usbdpi.h"
+}
+
+namespace usb_monitor_unittest {
+namespace {
+
+// Line states, as the monitor sees them
+const int kSE0 = 0;
+const int kK = 1;
+const int kJ = 2;
+
+// Most bytes that the monitor collects from a packet, after the PID
+const uint32_t kMaxBytes = 1024U;
+
+// A packet as it should appear in the capture
+struct Packet {
+  uint64_t sop;
+  std::vector<uint8_t> data;
+};
+
+// Drives the bus as the host, one bit interval per call of usb_monitor()
+class UsbMonitorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char path[] = "/tmp/usb_monitor_unittest.XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    path_ = path;
+    mon_ = usb_monitor_init(NULL, path_.c_str(), NULL, NULL);
+    ASSERT_TRUE(mon_);
+    // Start shortly before tick_bits wraps
+    tick_ = (1ULL << 32) - 100U;
+    line_ = kJ;
+    ones_ = 0U;
+    lastpid_ = 0U;
+  }
+
+  void TearDown() override {
+    if (mon_) {
+      usb_monitor_fin(mon_);
+    }
+    unlink(path_.c_str());
+  }
+
+  void Drive(int line) {
+    uint32_t p2d = (line == kJ) ? P2D_DP : (line == kK) ? P2D_DN : 0U;
+    usb_monitor(mon_, 0, (uint32_t)tick_++, true, p2d, D2P_DPPU, &lastpid_);
+    line_ = line;
+  }
+
+  void Idle(unsigned bits) {
+    while (bits-- > 0U) {
+      usb_monitor(mon_, 0, (uint32_t)tick_++, false, 0U, D2P_DPPU, &lastpid_);
+    }
+    line_ = kJ;
+  }
+
+  // Send a bit with NRZI encoding and bit stuffing
+  void Bit(bool one) {
+    if (!one) {
+      Drive(line_ == kJ ? kK : kJ);
+      ones_ = 0U;
+    } else {
+      Drive(line_);
+      if (++ones_ == 6U) {
+        Bit(false);
+      }
+    }
+  }
+
+  void Byte(uint8_t d) {
+    for (unsigned bit = 0U; bit < 8U; bit++) {
+      Bit((d >> bit) & 1U);
+    }
+  }
+
+  // Send a packet, returning the time of its SOP; the PID is data[0]
+  uint64_t Send(const std::vector<uint8_t> &data) {
+    // SYNC is KJKJKJKK, and the SOP is the last K
+    for (unsigned bit = 0U; bit < 7U; bit++) {
+      Bit(false);
+    }
+    Bit(true);
+    uint64_t sop = tick_ - 1U;
+    for (uint8_t d : data) {
+      Byte(d);
+    }
+    Drive(kSE0);
+    Drive(kSE0);
+    Drive(kJ);
+    Idle(4U);
+    return sop;
+  }
+
+  static uint32_t Le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+
+  // Close the capture and read it back
+  std::vector<uint8_t> Capture() {
+    usb_monitor_fin(mon_);
+    mon_ = NULL;
+    std::vector<uint8_t> buf;
+    FILE *f = fopen(path_.c_str(), "rb");
+    EXPECT_TRUE(f);
+    if (f) {
+      int c;
+      while ((c = fgetc(f)) != EOF) {
+        buf.push_back((uint8_t)c);
+      }
+      fclose(f);
+    }
+    return buf;
+  }
+
+  std::string path_;
+  usb_monitor_ctx_t *mon_;
+  uint8_t lastpid_;
+  uint64_t tick_;
+  int line_;
+  unsigned ones_;
+};
+
+TEST_F(UsbMonitorTest, CapturesPacketsAcrossWraps) {
+  std::vector<Packet> sent;
+  // The first packet straddles the wrap of tick_bits and is longer than the
+  // monitor collects. The rest are enough to wrap the writer thread's buffer
+  // (1MiB) several times over.
+  size_t records = 0U;
+  for (unsigned idx = 0U; records < 3U * 0x100000U; idx++) {
+    Packet pkt;
+    uint32_t n = idx ? (idx * 389U) % 1100U : 1100U;
+    pkt.data.push_back((idx & 1U) ? USB_PID_DATA1 : USB_PID_DATA0);
+    for (uint32_t i = 0U; i < n; i++) {
+      pkt.data.push_back((uint8_t)(idx + i));
+    }
+    pkt.sop = Send(pkt.data);
+    if (!idx) {
+      ASSERT_LT(pkt.sop, 1ULL << 32);
+      ASSERT_GT(tick_, 1ULL << 32);
+    }
+    if (pkt.data.size() > 1U + kMaxBytes) {
+      pkt.data.resize(1U + kMaxBytes);
+    }
+    records += 16U + pkt.data.size();
+    sent.push_back(pkt);
+  }
+
+  std::vector<uint8_t> cap = Capture();
+  ASSERT_EQ(cap.size(), 24U + records);
+
+  // Global header
+  EXPECT_EQ(Le32(&cap[0]), 0xa1b23c4dU);
+  EXPECT_EQ(cap[4] | (cap[5] << 8), 2);
+  EXPECT_EQ(cap[6] | (cap[7] << 8), 4);
+  EXPECT_EQ(Le32(&cap[16]), 0xffffU);
+  EXPECT_EQ(Le32(&cap[20]), 288U);
+
+  const uint8_t *p = &cap[24];
+  for (size_t idx = 0U; idx < sent.size(); idx++) {
+    const Packet &pkt = sent[idx];
+    uint64_t ns = (pkt.sop * 1000U) / 12U;
+    ASSERT_EQ(Le32(&p[0]), ns / 1000000000U) << "packet " << idx;
+    ASSERT_EQ(Le32(&p[4]), ns % 1000000000U) << "packet " << idx;
+    ASSERT_EQ(Le32(&p[8]), pkt.data.size()) << "packet " << idx;
+    ASSERT_EQ(Le32(&p[12]), pkt.data.size()) << "packet " << idx;
+    ASSERT_EQ(std::vector<uint8_t>(&p[16], &p[16] + pkt.data.size()),
+              pkt.data)
+        << "packet " << idx;
+    p += 16U + pkt.data.size();
+  }
+}
+
+TEST_F(UsbMonitorTest, TruncatedPacketsAreNotCaptured) {
+  // EOP before the PID is complete
+  for (unsigned bit = 0U; bit < 7U; bit++) {
+    Bit(false);
+  }
+  Bit(true);
+  for (unsigned bit = 0U; bit < 4U; bit++) {
+    Bit(true);
+  }
+  Drive(kSE0);
+  Drive(kSE0);
+  Drive(kJ);
+  Idle(4U);
+
+  std::vector<uint8_t> cap = Capture();
+  EXPECT_EQ(cap.size(), 24U);
+}
+
+}  // namespace
+}  // namespace usb_monitor_unittest
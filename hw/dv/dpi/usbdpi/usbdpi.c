@@ -16,6 +16,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "simctrl_dpi.h"
 #include "usb_utils.h"
 #include "usbdpi_test.h"
 
@@ -102,10 +103,50 @@ static void bus_reset(usbdpi_ctx_t *ctx) {
 static void usbdpi_data_callback(void *ctx_v, usbmon_data_type_t type,
                                  uint8_t d);
 
+// State saved in a checkpoint. The host has nothing more to carry over while
+// the device is disconnected, since it starts anew when the device connects.
+struct usbdpi_checkpoint {
+  uint64_t tick;
+  uint32_t driving;
+  uint64_t recovery_time;
+};
+
+static bool usbdpi_save(void *ctx_void, void **state, size_t *len) {
+  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
+  if (ctx->last_pu) {
+    return false;
+  }
+  struct usbdpi_checkpoint *cp =
+      (struct usbdpi_checkpoint *)malloc(sizeof(*cp));
+  assert(cp);
+  cp->tick = ctx->tick;
+  cp->driving = ctx->driving;
+  cp->recovery_time = ctx->recovery_time;
+  *state = cp;
+  *len = sizeof(*cp);
+  return true;
+}
+
+static bool usbdpi_restore(void *ctx_void, const void *state, size_t len) {
+  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
+  const struct usbdpi_checkpoint *cp = (const struct usbdpi_checkpoint *)state;
+  if (!cp || len != sizeof(*cp)) {
+    return false;
+  }
+  ctx->tick = cp->tick;
+  ctx->tick_bits = (uint32_t)(cp->tick >> 2);
+  ctx->driving = cp->driving;
+  ctx->recovery_time = cp->recovery_time;
+  return true;
+}
+
+static const simctrl_dpi_hooks_t usbdpi_hooks = {usbdpi_save, usbdpi_restore};
+
 /**
  * Create a USB DPI instance, returning a 'chandle' for later use
  */
-void *usbdpi_create(const char *name, int loglevel) {
+void *usbdpi_create(const char *name, int loglevel, const char *pcap_path,
+                    const char *script_path, int script_port) {
   // Use calloc for zero-initialisation
   usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)calloc(1, sizeof(usbdpi_ctx_t));
   assert(ctx);
@@ -123,25 +164,33 @@ void *usbdpi_create(const char *name, int loglevel) {
 
   ctx->loglevel = loglevel;
 
-  char cwd[FILENAME_MAX];
-  char *cwd_rv;
-  cwd_rv = getcwd(cwd, sizeof(cwd));
-  assert(cwd_rv != NULL);
-
-  // Monitor log file
-  int rv = snprintf(ctx->mon_pathname, FILENAME_MAX, "%s/%s.log", cwd, name);
-  assert(rv <= FILENAME_MAX && rv > 0);
+  // Monitor log file, if any logging is required
+  const char *mon_pathname = NULL;
+  if (loglevel & (LOG_MON | LOG_MON_VERBOSE | LOG_BIT)) {
+    char cwd[FILENAME_MAX];
+    char *cwd_rv;
+    cwd_rv = getcwd(cwd, sizeof(cwd));
+    assert(cwd_rv != NULL);
+
+    int rv = snprintf(ctx->mon_pathname, FILENAME_MAX, "%s/%s.log", cwd, name);
+    assert(rv <= FILENAME_MAX && rv > 0);
+    mon_pathname = ctx->mon_pathname;
+  }
 
-  ctx->mon = usb_monitor_init(ctx->mon_pathname, usbdpi_data_callback, ctx);
+  ctx->mon = usb_monitor_init(mon_pathname, pcap_path, usbdpi_data_callback,
+                              ctx);
 
   // Prepare the transfer descriptors for use
   usb_transfer_setup(ctx);
 
+  ctx->script = script_create(name, script_path, script_port);
+
+  simctrl_dpi_context_created(name, ctx, &usbdpi_hooks);
   return (void *)ctx;
 }
 
 void usbdpi_device_to_host(void *ctx_void, const svBitVecVal *usb_d2p) {
-  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
+  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)simctrl_dpi_context(ctx_void);
   assert(ctx);
 
   // Ascertain the state of the D+/D- signals from the device
@@ -1113,7 +1162,7 @@ uint32_t inv_driving(usbdpi_ctx_t *ctx, uint32_t d2p) {
 }
 
 uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
-  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
+  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)simctrl_dpi_context(ctx_void);
   assert(ctx);
   int d2p = usb_d2p[0];
   uint32_t last_driving = ctx->driving;
@@ -1126,7 +1175,7 @@ uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
   // TODO - vary the phase over the duration of the test to check device
   //        synchronization
   ctx->tick++;
-  ctx->tick_bits = ctx->tick >> 2;
+  ctx->tick_bits = (uint32_t)(ctx->tick >> 2);
   if (ctx->tick & 3) {
     return ctx->driving;
   }
@@ -1163,13 +1212,13 @@ uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
         printf(
             "[usbdpi] frame 0x%x tick_bits 0x%x error state %d at frame 0x%x "
             "time\n",
-            ctx->frame, ctx->tick, ctx->state, ctx->frame + 1);
+            ctx->frame, ctx->tick_bits, ctx->state, ctx->frame + 1);
       }
       ctx->framepend = true;
     } else {
       if (ctx->framepend) {
         printf("[usbdpi] frame 0x%x tick_bits 0x%x can send frame 0x%x SOF\n",
-               ctx->frame, ctx->tick, ctx->frame + 1);
+               ctx->frame, ctx->tick_bits, ctx->frame + 1);
       }
       ctx->framepend = false;
       ctx->frame++;
@@ -1193,7 +1242,7 @@ uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
         ctx->state = ST_SYNC;
       }
       printf("[usbdpi] frame 0x%x tick_bits 0x%x CRC5 0x%x\n", ctx->frame,
-             ctx->tick, CRC5(ctx->frame, 11));
+             ctx->tick_bits, CRC5(ctx->frame, 11));
 
       if (ctx->hostSt == HS_NEXTFRAME) {
         ctx->step = usbdpi_test_seq_next(ctx, ctx->step);
@@ -1352,6 +1401,11 @@ uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
           streams_service(ctx);
           break;
 
+        case STEP_SCRIPT_SERVICE:
+          // Scripted traffic on any number of endpoints, scheduled per frame
+          script_service(ctx);
+          break;
+
         default:
           if (ctx->step < STEP_IDLE_START || ctx->step >= STEP_IDLE_END) {
             pollRX(ctx, ENDPOINT_SERIAL0, false, false);
@@ -1452,7 +1506,7 @@ uint8_t usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
 
 // Export some internal diagnostic state for visibility in waveforms
 void usbdpi_diags(void *ctx_void, svBitVecVal *diags) {
-  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
+  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)simctrl_dpi_context(ctx_void);
 
   // Check for overflow, which would cause confusion in waveform interpretation.
   assert(ctx->state <= 0xfU);
@@ -1460,6 +1514,13 @@ void usbdpi_diags(void *ctx_void, svBitVecVal *diags) {
   assert(ctx->bus_state <= 0x3fU);
   assert(ctx->step <= 0x7fU);
 
+  // Counters for the endpoint most recently used by a transaction script
+  uint32_t script[3];
+  script_diags(ctx->script, script);
+  diags[5] = script[2];
+  diags[4] = script[1];
+  diags[3] = script[0];
+
   diags[2] = usb_monitor_diags(ctx->mon);
   diags[1] =
       (ctx->step << 25) | (ctx->bus_state << 20) | (ctx->tick_bits >> 12);
@@ -1469,10 +1530,14 @@ void usbdpi_diags(void *ctx_void, svBitVecVal *diags) {
 
 // Close the USBDPI model and release resources
 void usbdpi_close(void *ctx_void) {
-  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)ctx_void;
+  usbdpi_ctx_t *ctx = (usbdpi_ctx_t *)simctrl_dpi_context(ctx_void);
   if (!ctx) {
     return;
   }
+  if (ctx->script) {
+    script_stats_report(ctx);
+    script_close(ctx->script);
+  }
   usb_monitor_fin(ctx->mon);
   free(ctx);
 }
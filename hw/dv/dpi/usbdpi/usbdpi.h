@@ -22,6 +22,7 @@ typedef uint32_t svBitVecVal;
 #include "usb_monitor.h"
 #include "usb_transfer.h"
 #include "usb_utils.h"
+#include "usbdpi_script.h"
 #include "usbdpi_stream.h"
 #include "usbdpi_test.h"
 
@@ -47,8 +48,9 @@ typedef uint32_t svBitVecVal;
 #define SENSE_AT 20 * 8
 
 // Logging level (parameter to module)
-#define LOG_MON 0x01  // USB monitor logging (packet level)
-#define LOG_BIT 0x08  // bit level
+#define LOG_MON 0x01          // USB monitor logging (packet level)
+#define LOG_MON_VERBOSE 0x02  // more verbose monitor
+#define LOG_BIT 0x08          // bit level
 
 // Error insertion
 #define INSERT_ERR_CRC 0
@@ -303,6 +305,11 @@ struct usbdpi_ctx {
    */
   usbdpi_stream_t stream[USBDPI_MAX_STREAMS];
 
+  /**
+   * Script-driven host engine (NULL iff no script was supplied)
+   */
+  usbdpi_script_t *script;
+
   // Diagnostic logging and bus monitoring
   int loglevel;
   char mon_pathname[FILENAME_MAX];
@@ -331,15 +338,15 @@ struct usbdpi_ctx {
   /**
    * Count of clock cycles
    */
-  uint32_t tick;
+  uint64_t tick;
   /**
-   * Current time in USB bit intervals
+   * Current time in USB bit intervals, wrapping at 2^32
    */
   uint32_t tick_bits;
   /**
    * End time of recovery interval (following device attachment)
    */
-  uint32_t recovery_time;
+  uint64_t recovery_time;
 
   /**
    * Test step number
@@ -397,8 +404,22 @@ struct usbdpi_ctx {
 
 /**
  * Create a USB DPI instance, returning a 'chandle' for later use
+ *
+ * If a script file or port is supplied, the host runs the transfers from the
+ * script once the device has been configured, instead of the built-in test
+ * sequence.
+ *
+ * The text log of the bus monitor is written only if the logging level
+ * requests it; a packet capture may be written in addition, or instead.
+ *
+ * @param  name         Name of the instance
+ * @param  loglevel     Logging level (LOG_*)
+ * @param  pcap_path    Packet capture file (or empty for none)
+ * @param  script_path  Transaction script file (or empty for none)
+ * @param  script_port  TCP port from which to read script commands (or 0)
  */
-void *usbdpi_create(const char *name, int loglevel);
+void *usbdpi_create(const char *name, int loglevel, const char *pcap_path,
+                    const char *script_path, int script_port);
 /**
  * Close a USB DPI instance
  */
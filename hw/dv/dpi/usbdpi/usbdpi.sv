@@ -8,6 +8,8 @@
 // 0x01 -- monitor_usb (packet level)
 // 0x02 -- more verbose monitor
 // 0x08 -- bit level
+// With none of these set, no monitor log file is written. LOG_LEVEL may be
+// overridden with the `USBDPI_LOG_LEVEL_<name>` plusarg.
 
 module usbdpi #(
   parameter string NAME = "usb0",
@@ -37,7 +39,9 @@ module usbdpi #(
   input  logic pullupdn_d2p
 );
   import "DPI-C" function
-    chandle usbdpi_create(input string name, input int loglevel);
+    chandle usbdpi_create(input string name, input int loglevel,
+                          input string pcap_path, input string script_path,
+                          input int script_port);
 
   import "DPI-C" function
     void usbdpi_device_to_host(input chandle ctx, input bit [10:0] d2p);
@@ -49,12 +53,27 @@ module usbdpi #(
     byte usbdpi_host_to_device(input chandle ctx, input bit [10:0] d2p);
 
   import "DPI-C" function
-    void usbdpi_diags(input chandle ctx, output bit [95:0] diags);
+    void usbdpi_diags(input chandle ctx, output bit [191:0] diags);
 
   chandle ctx;
 
+  // Transfers may be run from a script instead of the built-in test sequence,
+  // read from a file given by the `USBDPI_SCRIPT_<name>` plusarg and/or from a
+  // TCP port given by the `USBDPI_SCRIPT_PORT_<name>` plusarg.
+  string script_path = "";
+  int script_port = 0;
+
+  // Bus traffic may be captured to a pcap file given by the
+  // `USBDPI_PCAP_<name>` plusarg.
+  string pcap_path = "";
+  int log_level = LOG_LEVEL;
+
   initial begin
-    ctx = usbdpi_create(NAME, LOG_LEVEL);
+    $value$plusargs({"USBDPI_SCRIPT_", NAME, "=%s"}, script_path);
+    $value$plusargs({"USBDPI_SCRIPT_PORT_", NAME, "=%d"}, script_port);
+    $value$plusargs({"USBDPI_PCAP_", NAME, "=%s"}, pcap_path);
+    $value$plusargs({"USBDPI_LOG_LEVEL_", NAME, "=%d"}, log_level);
+    ctx = usbdpi_create(NAME, log_level, pcap_path, script_path, script_port);
   end
 
   final begin
@@ -189,6 +208,9 @@ module usbdpi #(
     // usbdev_stream_test
     STEP_STREAM_SERVICE = 7'h20,
 
+    // Transfers from a transaction script
+    STEP_SCRIPT_SERVICE = 7'h21,
+
     // Disconnect the device and stop
     STEP_BUS_DISCONNECT = 7'h7f
   } usbdpi_test_step_t;
@@ -199,6 +221,12 @@ module usbdpi #(
   bit [3:0] c_mon_bits;
   bit [7:0] c_mon_byte;
   usb_pid_t c_mon_pid;
+  // Make the counters of the endpoint most recently used by a transaction script
+  // viewable in waveforms
+  bit [31:0] c_script_bytes;
+  bit [31:0] c_script_latency;
+  bit [4:0] c_script_slot;
+  bit [26:0] c_script_xfers;
   // Make usbdpi diagnostic information viewable in waveforms
   usbdpi_test_step_t c_step;
   usbdpi_bus_state_t c_bus_state;
@@ -207,9 +235,10 @@ module usbdpi #(
   usbdpi_host_state_t c_hostSt;
   usbdpi_drv_state_t c_state;
   always @(posedge clk_48MHz_i)
-    usbdpi_diags(ctx, {c_spare1, c_mon_state, c_mon_bits, c_mon_byte, c_mon_pid,
-                       c_step, c_bus_state, c_tickbits, c_frame, c_hostSt,
-                       c_state});
+    usbdpi_diags(ctx, {c_script_bytes, c_script_latency, c_script_slot,
+                       c_script_xfers, c_spare1, c_mon_state, c_mon_bits,
+                       c_mon_byte, c_mon_pid, c_step, c_bus_state, c_tickbits,
+                       c_frame, c_hostSt, c_state});
 
   logic [10:0] d2p;
   logic [10:0] d2p_r;
@@ -0,0 +1,840 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "usbdpi_script.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcp_server.h"
+#include "usb_utils.h"
+#include "usbdpi.h"
+
+// Script commands
+#define USBDPI_SCRIPT_OP_XFER 0U
+// Wait for all queued transfers to complete
+#define USBDPI_SCRIPT_OP_SYNC 1U
+// Report the counters
+#define USBDPI_SCRIPT_OP_STATS 2U
+
+// Control Transfer stages
+#define STAGE_SETUP 0U
+#define STAGE_DATA 1U
+#define STAGE_STATUS 2U
+
+// Maximum length of a script line
+#define SCRIPT_MAX_LINE 0x4000U
+
+// Largest transfer that may be requested by a script
+#define SCRIPT_MAX_XFER 0x100000U
+
+// Most IN data reported in hex on the command socket for each transfer
+#define SCRIPT_MAX_REPORT 0x1000U
+
+// Maximum time for transmission of a transaction, as per streams_service
+#define SCRIPT_MIN_TIME_LEFT 800U
+
+// Consecutive failed transactions (timeouts or unexpected responses) after
+// which a transfer is abandoned, as a host controller does after three errors
+#define SCRIPT_MAX_ERRORS 3U
+
+// Verbose logging/diagnostic reporting
+static const bool verbose = false;
+
+struct usbdpi_script {
+  /**
+   * Commands not yet queued on an endpoint, in script order
+   */
+  usbdpi_script_xfer_t *cmds;
+  usbdpi_script_xfer_t **cmds_tail;
+  /**
+   * Transfers queued on each endpoint (in order) and their counters
+   */
+  usbdpi_script_xfer_t *queue[USBDPI_SCRIPT_SLOTS];
+  usbdpi_script_stats_t stats[USBDPI_SCRIPT_SLOTS];
+  /**
+   * Number of transfers queued on all endpoints
+   */
+  unsigned active;
+  /**
+   * Periodic (Isochronous and Interrupt) endpoints still to be serviced in
+   * the current frame; one bit per slot
+   */
+  uint32_t periodic;
+  /**
+   * Endpoint queue of the transaction in progress, and the last one that was
+   * picked for non-periodic traffic (round-robin arbitration)
+   */
+  unsigned slot;
+  unsigned rr_slot;
+  /**
+   * Bus state that indicates the device has responded to the transaction in
+   * progress, and the number of data bytes sent in it
+   */
+  usbdpi_bus_state_t expect;
+  uint32_t pkt_len;
+  /**
+   * Sequence number of the next transfer read from the script
+   */
+  uint32_t next_id;
+  /**
+   * The script file has been read completely and the completion reported
+   */
+  bool file_done;
+  bool reported;
+  /**
+   * Command socket (or NULL), and the partial line read from it
+   */
+  struct tcp_server_ctx *sock;
+  /**
+   * Reports are being dropped because no client is connected
+   */
+  bool dropping;
+  char line[SCRIPT_MAX_LINE];
+  size_t line_len;
+  unsigned lineno;
+};
+
+// Parse a whitespace-separated number, in any base accepted by strtoul
+static bool parse_num(char **save, unsigned long *val) {
+  const char *tok = strtok_r(NULL, " \t\r\n", save);
+  if (!tok) {
+    return false;
+  }
+  char *end;
+  errno = 0;
+  *val = strtoul(tok, &end, 0);
+  return !errno && *end == '\0';
+}
+
+// Parse the optional 'data <hex>' suffix of an OUT transfer, or generate a
+// pattern if there is none
+static bool parse_data(char **save, usbdpi_script_xfer_t *x) {
+  const char *tok = strtok_r(NULL, " \t\r\n", save);
+  if (tok && strcmp(tok, "data")) {
+    return false;
+  }
+  const char *hex = tok ? strtok_r(NULL, " \t\r\n", save) : NULL;
+  if (tok && !hex) {
+    return false;
+  }
+  if (hex) {
+    size_t n = strlen(hex);
+    if ((n & 1U) || n / 2U != x->len) {
+      return false;
+    }
+  }
+  for (uint32_t idx = 0U; idx < x->len; idx++) {
+    if (hex) {
+      char byte[3] = {hex[2 * idx], hex[2 * idx + 1], '\0'};
+      if (!isxdigit((unsigned char)byte[0]) ||
+          !isxdigit((unsigned char)byte[1])) {
+        return false;
+      }
+      x->data[idx] = (uint8_t)strtoul(byte, NULL, 16);
+    } else {
+      x->data[idx] = (uint8_t)idx;
+    }
+  }
+  return true;
+}
+
+// Parse a single script line, appending the command to the script
+static void parse_line(usbdpi_script_t *sc, char *line, unsigned lineno) {
+  char *hash = strchr(line, '#');
+  if (hash) {
+    *hash = '\0';
+  }
+
+  char *save;
+  const char *cmd = strtok_r(line, " \t\r\n", &save);
+  if (!cmd) {
+    return;
+  }
+
+  usbdpi_script_xfer_t *x =
+      (usbdpi_script_xfer_t *)calloc(1, sizeof(usbdpi_script_xfer_t));
+  assert(x);
+  bool ok = true;
+  unsigned long val[5];
+
+  if (!strcmp(cmd, "sync")) {
+    x->op = USBDPI_SCRIPT_OP_SYNC;
+  } else if (!strcmp(cmd, "stats")) {
+    x->op = USBDPI_SCRIPT_OP_STATS;
+  } else if (!strcmp(cmd, "control")) {
+    // control <bmRequestType> <bRequest> <wValue> <wIndex> <wLength>
+    //         [data <hex>]
+    for (unsigned idx = 0U; ok && idx < 5U; idx++) {
+      ok = parse_num(&save, &val[idx]);
+    }
+    ok = ok && val[0] <= 0xffU && val[1] <= 0xffU && val[2] <= 0xffffU &&
+         val[3] <= 0xffffU && val[4] <= 0xffffU;
+    if (ok) {
+      x->type = USB_TRANSFER_TYPE_CONTROL;
+      x->ep = ENDPOINT_ZERO;
+      x->in = (val[0] & 0x80U) != 0U;
+      x->setup[0] = (uint8_t)val[0];
+      x->setup[1] = (uint8_t)val[1];
+      set_le16(&x->setup[2], (uint16_t)val[2]);
+      set_le16(&x->setup[4], (uint16_t)val[3]);
+      set_le16(&x->setup[6], (uint16_t)val[4]);
+      x->len = (uint32_t)val[4];
+    }
+  } else {
+    // <bulk|interrupt|iso> <in|out> <ep> <len> [data <hex>]
+    if (!strcmp(cmd, "bulk")) {
+      x->type = USB_TRANSFER_TYPE_BULK;
+    } else if (!strcmp(cmd, "interrupt")) {
+      x->type = USB_TRANSFER_TYPE_INTERRUPT;
+    } else if (!strcmp(cmd, "iso")) {
+      x->type = USB_TRANSFER_TYPE_ISOCHRONOUS;
+    } else {
+      ok = false;
+    }
+    const char *dir = ok ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+    ok = dir && (!strcmp(dir, "in") || !strcmp(dir, "out"));
+    ok = ok && parse_num(&save, &val[0]) && parse_num(&save, &val[1]);
+    ok = ok && val[0] > 0U && val[0] < USBDPI_MAX_ENDPOINTS;
+    if (ok) {
+      x->ep = (uint8_t)val[0];
+      x->in = !strcmp(dir, "in");
+      x->len = (uint32_t)val[1];
+    }
+  }
+
+  if (ok && x->op == USBDPI_SCRIPT_OP_XFER) {
+    ok = x->len <= SCRIPT_MAX_XFER;
+    if (ok && x->len) {
+      x->data = (uint8_t *)calloc(x->len, 1U);
+      assert(x->data);
+    }
+    if (ok && !x->in) {
+      ok = parse_data(&save, x);
+    }
+    x->id = ++sc->next_id;
+  }
+
+  if (!ok) {
+    fprintf(stderr, "[usbdpi] Script line %u: invalid command '%s'\n", lineno,
+            cmd);
+    free(x->data);
+    free(x);
+    return;
+  }
+
+  *sc->cmds_tail = x;
+  sc->cmds_tail = &x->next;
+}
+
+// Collect any complete lines from the command socket
+static void socket_poll(usbdpi_script_t *sc) {
+  if (!sc->sock) {
+    return;
+  }
+  while (true) {
+    size_t space = sizeof(sc->line) - 1U - sc->line_len;
+    size_t n = tcp_server_read_buf(sc->sock, &sc->line[sc->line_len], space);
+    if (!n) {
+      return;
+    }
+    sc->line_len += n;
+    sc->line[sc->line_len] = '\0';
+
+    char *start = sc->line;
+    char *nl;
+    while ((nl = strchr(start, '\n'))) {
+      *nl = '\0';
+      parse_line(sc, start, ++sc->lineno);
+      start = nl + 1;
+    }
+    sc->line_len -= start - sc->line;
+    memmove(sc->line, start, sc->line_len);
+    if (sc->line_len == sizeof(sc->line) - 1U) {
+      fprintf(stderr, "[usbdpi] Script line too long; discarding\n");
+      sc->line_len = 0U;
+    }
+  }
+}
+
+// Write a whole line to the command socket. This only waits for the socket
+// to take the data while a client is connected to read it; without one, the
+// line is dropped.
+static void socket_write(usbdpi_script_t *sc, const char *buf, size_t len) {
+  while (len) {
+    if (!tcp_server_client_connected(sc->sock)) {
+      if (!sc->dropping) {
+        fprintf(stderr,
+                "[usbdpi] No client on the command socket; dropping "
+                "reports\n");
+        sc->dropping = true;
+      }
+      return;
+    }
+    size_t n = tcp_server_try_write_buf(sc->sock, buf, len);
+    buf += n;
+    len -= n;
+    if (len) {
+      sched_yield();
+    }
+  }
+  sc->dropping = false;
+}
+
+// Write a line to the command socket, if there is one
+static void socket_printf(usbdpi_script_t *sc, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+static void socket_printf(usbdpi_script_t *sc, const char *fmt, ...) {
+  if (!sc->sock) {
+    return;
+  }
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (n > 0) {
+    size_t len = (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1U;
+    socket_write(sc, buf, len);
+  }
+}
+
+usbdpi_script_t *script_create(const char *name, const char *path, int port) {
+  bool have_file = path && path[0];
+  if (!have_file && !port) {
+    return NULL;
+  }
+
+  usbdpi_script_t *sc = (usbdpi_script_t *)calloc(1, sizeof(usbdpi_script_t));
+  assert(sc);
+  sc->cmds_tail = &sc->cmds;
+  for (unsigned slot = 0U; slot < USBDPI_SCRIPT_SLOTS; slot++) {
+    sc->stats[slot].lat_min = UINT32_MAX;
+  }
+
+  if (have_file) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+      fprintf(stderr, "[usbdpi] Unable to open script %s: %s\n", path,
+              strerror(errno));
+    } else {
+      char *line = (char *)malloc(SCRIPT_MAX_LINE);
+      assert(line);
+      unsigned lineno = 0U;
+      while (fgets(line, SCRIPT_MAX_LINE, f)) {
+        parse_line(sc, line, ++lineno);
+      }
+      free(line);
+      fclose(f);
+      printf("[usbdpi] %s: read %u transfer(s) from script %s\n", name,
+             sc->next_id, path);
+    }
+  }
+
+  if (port) {
+    sc->sock = tcp_server_create(name, port);
+  } else {
+    // With no socket, the script ends when the file has been run
+    sc->file_done = true;
+  }
+  return sc;
+}
+
+void script_close(usbdpi_script_t *sc) {
+  if (!sc) {
+    return;
+  }
+  if (sc->sock) {
+    tcp_server_close(sc->sock);
+  }
+  usbdpi_script_xfer_t *lists[USBDPI_SCRIPT_SLOTS + 1U];
+  memcpy(lists, sc->queue, sizeof(sc->queue));
+  lists[USBDPI_SCRIPT_SLOTS] = sc->cmds;
+  for (unsigned idx = 0U; idx <= USBDPI_SCRIPT_SLOTS; idx++) {
+    usbdpi_script_xfer_t *x = lists[idx];
+    while (x) {
+      usbdpi_script_xfer_t *next = x->next;
+      free(x->data);
+      free(x);
+      x = next;
+    }
+  }
+  free(sc);
+}
+
+// Move commands from the script onto the endpoint queues, stopping at a
+// 'sync' or 'stats' until all of the preceding transfers have completed
+static void script_dispatch(usbdpi_ctx_t *ctx, usbdpi_script_t *sc) {
+  while (sc->cmds) {
+    usbdpi_script_xfer_t *x = sc->cmds;
+    if (x->op != USBDPI_SCRIPT_OP_XFER && sc->active) {
+      return;
+    }
+    sc->cmds = x->next;
+    if (!sc->cmds) {
+      sc->cmds_tail = &sc->cmds;
+    }
+    x->next = NULL;
+
+    if (x->op != USBDPI_SCRIPT_OP_XFER) {
+      if (x->op == USBDPI_SCRIPT_OP_STATS) {
+        script_stats_report(ctx);
+      } else {
+        socket_printf(sc, "sync\n");
+      }
+      free(x);
+      continue;
+    }
+
+    unsigned slot = USBDPI_SCRIPT_SLOT(x->ep, x->in);
+    if (x->type == USB_TRANSFER_TYPE_CONTROL) {
+      // Both directions of a Control Transfer use the same queue
+      slot = USBDPI_SCRIPT_SLOT(ENDPOINT_ZERO, false);
+    }
+    x->submit_bits = ctx->tick_bits;
+    if (!sc->stats[slot].xfers && !sc->stats[slot].transactions &&
+        !sc->queue[slot]) {
+      sc->stats[slot].first_bits = ctx->tick_bits;
+    }
+    usbdpi_script_xfer_t **tail = &sc->queue[slot];
+    while (*tail) {
+      tail = &(*tail)->next;
+    }
+    *tail = x;
+    sc->active++;
+  }
+}
+
+// Periodic transfers get one transaction per endpoint in each frame, before
+// any other traffic
+static inline bool is_periodic(const usbdpi_script_xfer_t *x) {
+  return x->type == USB_TRANSFER_TYPE_ISOCHRONOUS ||
+         x->type == USB_TRANSFER_TYPE_INTERRUPT;
+}
+
+// Decide which endpoint queue to service next, or return USBDPI_SCRIPT_SLOTS
+// if there is nothing to do
+static unsigned script_pick(usbdpi_script_t *sc) {
+  while (sc->periodic) {
+    unsigned slot = __builtin_ctz(sc->periodic);
+    sc->periodic &= ~(1U << slot);
+    if (sc->queue[slot] && is_periodic(sc->queue[slot])) {
+      return slot;
+    }
+  }
+  for (unsigned n = 1U; n <= USBDPI_SCRIPT_SLOTS; n++) {
+    unsigned slot = (sc->rr_slot + n) % USBDPI_SCRIPT_SLOTS;
+    if (sc->queue[slot] && !is_periodic(sc->queue[slot])) {
+      sc->rr_slot = slot;
+      return slot;
+    }
+  }
+  return USBDPI_SCRIPT_SLOTS;
+}
+
+// Retire the transfer at the head of the current endpoint queue
+static void script_complete(usbdpi_ctx_t *ctx, usbdpi_script_t *sc,
+                            const char *status) {
+  usbdpi_script_xfer_t *x = sc->queue[sc->slot];
+  usbdpi_script_stats_t *st = &sc->stats[sc->slot];
+  uint32_t latency = ctx->tick_bits - x->submit_bits;
+
+  st->xfers++;
+  st->lat_last = latency;
+  st->lat_sum += latency;
+  if (latency < st->lat_min) {
+    st->lat_min = latency;
+  }
+  if (latency > st->lat_max) {
+    st->lat_max = latency;
+  }
+  st->last_bits = ctx->tick_bits;
+
+  if (verbose) {
+    printf("[usbdpi] Script transfer %u %s (%u bytes, %u bits)\n", x->id,
+           status, x->done, latency);
+  }
+  if (sc->sock) {
+    // The report goes out as a single write, so that a client never sees
+    // part of a line. At most SCRIPT_MAX_REPORT bytes of IN data are sent as
+    // hex, followed by '...' if there was more.
+    static const char hex[] = "0123456789abcdef";
+    char buf[64 + 2U * SCRIPT_MAX_REPORT];
+    int n = snprintf(buf, sizeof(buf), "done %u %s %u", x->id, status,
+                     x->done);
+    assert(n > 0 && (size_t)n < sizeof(buf) - 2U * SCRIPT_MAX_REPORT - 5U);
+    size_t len = (size_t)n;
+    if (x->in && x->done) {
+      uint32_t nreport =
+          x->done < SCRIPT_MAX_REPORT ? x->done : SCRIPT_MAX_REPORT;
+      buf[len++] = ' ';
+      for (uint32_t idx = 0U; idx < nreport; idx++) {
+        buf[len++] = hex[x->data[idx] >> 4];
+        buf[len++] = hex[x->data[idx] & 0xfU];
+      }
+      if (nreport < x->done) {
+        memcpy(&buf[len], "...", 3U);
+        len += 3U;
+      }
+    }
+    buf[len++] = '\n';
+    socket_write(sc, buf, len);
+  }
+
+  sc->queue[sc->slot] = x->next;
+  free(x->data);
+  free(x);
+  sc->active--;
+}
+
+// Count a failed transaction of the transfer at the head of the current
+// endpoint queue, ending the transfer if it keeps failing
+static void script_error(usbdpi_ctx_t *ctx, usbdpi_script_t *sc) {
+  usbdpi_script_xfer_t *x = sc->queue[sc->slot];
+  sc->stats[sc->slot].errors++;
+  if (++x->errors >= SCRIPT_MAX_ERRORS) {
+    printf("[usbdpi] Script: abandoning transfer %u after %u errors\n", x->id,
+           x->errors);
+    script_complete(ctx, sc, "error");
+  }
+}
+
+// Start the next transaction of the transfer at the head of the current
+// endpoint queue
+static void script_issue(usbdpi_ctx_t *ctx, usbdpi_script_t *sc) {
+  usbdpi_transfer_t *tr = ctx->sending;
+  usbdpi_script_xfer_t *x = sc->queue[sc->slot];
+  assert(tr && x);
+  sc->stats[sc->slot].transactions++;
+  sc->pkt_len = 0U;
+
+  bool in = x->in;
+  uint8_t data_pid = ctx->ep_out[x->ep].next_data;
+  usbdpi_bus_state_t token_state;
+  if (x->type == USB_TRANSFER_TYPE_CONTROL) {
+    switch (x->stage) {
+      case STAGE_SETUP:
+        transfer_setup(ctx, tr, x->setup[0], x->setup[1],
+                       get_le16(&x->setup[2]), get_le16(&x->setup[4]),
+                       get_le16(&x->setup[6]));
+        sc->expect = kUsbControlSetupAck;
+        ctx->lastrxpid = 0U;
+        return;
+      case STAGE_DATA:
+        token_state = in ? kUsbControlDataInToken : kUsbControlDataOut;
+        sc->expect = in ? kUsbControlDataInData : kUsbControlDataOutAck;
+        break;
+      default:
+        // The Status stage is in the opposite direction to any Data stage,
+        // and always uses DATA1
+        in = !x->in || !x->len;
+        data_pid = USB_PID_DATA1;
+        token_state = in ? kUsbControlStatusInToken : kUsbControlStatusOut;
+        sc->expect = in ? kUsbControlStatusInData : kUsbControlStatusOutAck;
+        break;
+    }
+  } else {
+    switch (x->type) {
+      case USB_TRANSFER_TYPE_ISOCHRONOUS:
+        token_state = in ? kUsbIsoInToken : kUsbIsoOut;
+        sc->expect = in ? kUsbIsoInData : kUsbIsoOut;
+        // No Data Toggle Synchronization for Isochronous transfers
+        data_pid = USB_PID_DATA0;
+        break;
+      case USB_TRANSFER_TYPE_INTERRUPT:
+        token_state = in ? kUsbInterruptInToken : kUsbInterruptOut;
+        sc->expect = in ? kUsbInterruptInData : kUsbInterruptOutAck;
+        break;
+      default:
+        token_state = in ? kUsbBulkInToken : kUsbBulkOut;
+        sc->expect = in ? kUsbBulkInData : kUsbBulkOutAck;
+        break;
+    }
+  }
+
+  if (in) {
+    transfer_token(tr, USB_PID_IN, ctx->dev_address, x->ep);
+    transfer_send(ctx, tr);
+    ctx->hostSt = HS_WAIT_PKT;
+  } else {
+    transfer_token(tr, USB_PID_OUT, ctx->dev_address, x->ep);
+    if (x->type != USB_TRANSFER_TYPE_CONTROL || x->stage == STAGE_DATA) {
+      sc->pkt_len = x->len - x->done;
+      if (sc->pkt_len > USBDEV_MAX_PACKET_SIZE) {
+        sc->pkt_len = USBDEV_MAX_PACKET_SIZE;
+      }
+    }
+    uint8_t *dp = transfer_data_start(tr, data_pid, sc->pkt_len);
+    if (sc->pkt_len) {
+      memcpy(dp, &x->data[x->done], sc->pkt_len);
+    }
+    transfer_data_end(tr, dp + sc->pkt_len);
+    transfer_send(ctx, tr);
+    ctx->wait = USBDPI_TIMEOUT(ctx, transfer_length(tr) * 10U + 160U);
+    ctx->hostSt = HS_WAITACK;
+  }
+  ctx->bus_state = token_state;
+  ctx->lastrxpid = 0U;
+}
+
+// Record the progress of a transfer after a successful transaction, moving
+// on to the next Control Transfer stage or completing the transfer
+static void script_advance(usbdpi_ctx_t *ctx, usbdpi_script_t *sc,
+                           uint32_t n) {
+  usbdpi_script_xfer_t *x = sc->queue[sc->slot];
+  sc->stats[sc->slot].bytes += n;
+  x->errors = 0U;
+
+  if (x->type == USB_TRANSFER_TYPE_CONTROL) {
+    switch (x->stage) {
+      case STAGE_SETUP:
+        // Data and Status stages start with DATA1
+        ctx->ep_out[ENDPOINT_ZERO].next_data = USB_PID_DATA1;
+        ctx->ep_in[ENDPOINT_ZERO].next_data = USB_PID_DATA1;
+        x->stage = x->len ? STAGE_DATA : STAGE_STATUS;
+        return;
+      case STAGE_DATA:
+        x->done += n;
+        // A short packet ends the Data stage early
+        if (x->done >= x->len || n < USBDEV_MAX_PACKET_SIZE) {
+          x->stage = STAGE_STATUS;
+        }
+        return;
+      default:
+        script_complete(ctx, sc, "ok");
+        return;
+    }
+  }
+
+  x->done += n;
+  bool finished = x->done >= x->len;
+  // A short packet ends an IN transfer, but Isochronous endpoints return
+  // zero-length packets when they have no data
+  if (x->in && x->type != USB_TRANSFER_TYPE_ISOCHRONOUS &&
+      n < USBDEV_MAX_PACKET_SIZE) {
+    finished = true;
+  }
+  if (finished) {
+    script_complete(ctx, sc, "ok");
+  }
+}
+
+// Handle the device's response to an OUT or SETUP transaction
+static void script_out_response(usbdpi_ctx_t *ctx, usbdpi_script_t *sc) {
+  usbdpi_script_xfer_t *x = sc->queue[sc->slot];
+  usbdpi_script_stats_t *st = &sc->stats[sc->slot];
+
+  if (x->type == USB_TRANSFER_TYPE_ISOCHRONOUS) {
+    // No handshake for Isochronous transfers
+    script_advance(ctx, sc, sc->pkt_len);
+  } else if (ctx->bus_state == sc->expect) {
+    switch (ctx->lastrxpid) {
+      case USB_PID_ACK:
+        if (x->type != USB_TRANSFER_TYPE_CONTROL || x->stage == STAGE_DATA) {
+          ctx->ep_out[x->ep].next_data =
+              DATA_TOGGLE_ADVANCE(ctx->ep_out[x->ep].next_data);
+        }
+        script_advance(ctx, sc, sc->pkt_len);
+        break;
+      case USB_PID_NAK:
+        st->naks++;
+        break;
+      case USB_PID_STALL:
+        st->errors++;
+        script_complete(ctx, sc, "stall");
+        break;
+      default:
+        printf("[usbdpi] Script: unexpected PID 0x%02x from device (%s)\n",
+               ctx->lastrxpid, decode_pid(ctx->lastrxpid));
+        script_error(ctx, sc);
+        break;
+    }
+  } else if (ctx->tick_bits >= ctx->wait) {
+    printf("[usbdpi] Script: timed out waiting for OUT response\n");
+    script_error(ctx, sc);
+  } else {
+    // Keep waiting
+    return;
+  }
+  ctx->bus_state = kUsbIdle;
+  ctx->hostSt = HS_REQDATA;
+}
+
+// Handle the device's response to an IN transaction
+static void script_in_response(usbdpi_ctx_t *ctx, usbdpi_script_t *sc) {
+  usbdpi_script_xfer_t *x = sc->queue[sc->slot];
+  usbdpi_script_stats_t *st = &sc->stats[sc->slot];
+  bool iso = (x->type == USB_TRANSFER_TYPE_ISOCHRONOUS);
+
+  if (ctx->bus_state == sc->expect && ctx->recving) {
+    switch (ctx->lastrxpid) {
+      case USB_PID_DATA0:
+      case USB_PID_DATA1: {
+        usbdpi_transfer_t *rx = ctx->recving;
+        uint32_t len = transfer_length(rx);
+        uint32_t n = (len >= 3U) ? len - 3U : 0U;
+        // Data Toggle Synchronization; a packet with the wrong toggle is a
+        // retry of one that we already have, so ACK it but ignore the data
+        bool fresh = iso || ctx->lastrxpid == ctx->ep_in[x->ep].next_data;
+        if (!iso) {
+          transfer_status(ctx, ctx->sending, USB_PID_ACK);
+        }
+        if (!fresh) {
+          break;
+        }
+        if (!iso) {
+          ctx->ep_in[x->ep].next_data =
+              DATA_TOGGLE_ADVANCE(ctx->ep_in[x->ep].next_data);
+        }
+        bool status = (x->type == USB_TRANSFER_TYPE_CONTROL &&
+                       x->stage == STAGE_STATUS);
+        if (!status && n) {
+          const uint8_t *dp = transfer_data_field(rx);
+          uint32_t space = x->len - x->done;
+          if (dp && space) {
+            memcpy(&x->data[x->done], dp, (n < space) ? n : space);
+          }
+          if (n > space) {
+            n = space;
+          }
+        }
+        script_advance(ctx, sc, n);
+      } break;
+      case USB_PID_NAK:
+        if (iso) {
+          printf("[usbdpi] Script: NAK response from Iso endpoint\n");
+          script_error(ctx, sc);
+        } else {
+          st->naks++;
+        }
+        break;
+      case USB_PID_STALL:
+        st->errors++;
+        script_complete(ctx, sc, "stall");
+        break;
+      default:
+        printf("[usbdpi] Script: unexpected PID 0x%02x from device (%s)\n",
+               ctx->lastrxpid, decode_pid(ctx->lastrxpid));
+        script_error(ctx, sc);
+        break;
+    }
+  } else if (ctx->tick_bits >= ctx->wait) {
+    printf("[usbdpi] Script: timed out waiting for IN response\n");
+    script_error(ctx, sc);
+  } else {
+    // Keep waiting
+    return;
+  }
+  ctx->bus_state = kUsbIdle;
+  ctx->hostSt = HS_REQDATA;
+}
+
+// Run scripted traffic
+void script_service(usbdpi_ctx_t *ctx) {
+  usbdpi_script_t *sc = ctx->script;
+  assert(sc);
+
+  switch (ctx->hostSt) {
+    case HS_STARTFRAME:
+      // Schedule each periodic endpoint once in this frame
+      sc->periodic = 0U;
+      for (unsigned slot = 0U; slot < USBDPI_SCRIPT_SLOTS; slot++) {
+        if (sc->queue[slot] && is_periodic(sc->queue[slot])) {
+          sc->periodic |= 1U << slot;
+        }
+      }
+      ctx->hostSt = HS_REQDATA;
+      // Fall through
+    case HS_REQDATA: {
+      socket_poll(sc);
+      script_dispatch(ctx, sc);
+
+      // Is there enough time left in this frame for another transaction?
+      uint32_t next_frame = ctx->frame_start + FRAME_INTERVAL;
+      if ((next_frame - ctx->tick_bits) <= SCRIPT_MIN_TIME_LEFT) {
+        ctx->hostSt = HS_NEXTFRAME;
+        break;
+      }
+
+      unsigned slot = script_pick(sc);
+      if (slot >= USBDPI_SCRIPT_SLOTS) {
+        if (sc->file_done && !sc->cmds && !sc->reported) {
+          printf("[usbdpi] Script complete\n");
+          script_stats_report(ctx);
+          sc->reported = true;
+        }
+        // Nothing to do yet; remain here in case more commands arrive
+        break;
+      }
+      sc->slot = slot;
+      script_issue(ctx, sc);
+    } break;
+
+    case HS_WAITACK:
+      script_out_response(ctx, sc);
+      break;
+
+    case HS_WAIT_PKT:
+      // Wait max time for a response + packet
+      ctx->wait = ctx->tick_bits + 18 + 8 + 8 + 64 * 8 + 16;
+      ctx->hostSt = HS_ACKIFDATA;
+      break;
+
+    case HS_ACKIFDATA:
+      script_in_response(ctx, sc);
+      break;
+
+    default:
+      assert(ctx->hostSt == HS_NEXTFRAME);
+      break;
+  }
+}
+
+// Print the per-endpoint throughput and latency counters
+void script_stats_report(usbdpi_ctx_t *ctx) {
+  usbdpi_script_t *sc = ctx->script;
+  if (!sc) {
+    return;
+  }
+  printf("[usbdpi] Script counters at frame 0x%x:\n", ctx->frame);
+  for (unsigned slot = 0U; slot < USBDPI_SCRIPT_SLOTS; slot++) {
+    const usbdpi_script_stats_t *st = &sc->stats[slot];
+    if (!st->transactions) {
+      continue;
+    }
+    // Bit intervals are 1/12 us at Full Speed
+    uint32_t elapsed = st->last_bits - st->first_bits;
+    double kbps = elapsed ? (double)st->bytes * 12000.0 / elapsed : 0.0;
+    double lat_avg = st->xfers ? (double)st->lat_sum / st->xfers / 12.0 : 0.0;
+    double lat_min = st->xfers ? st->lat_min / 12.0 : 0.0;
+    char line[200];
+    snprintf(line, sizeof(line),
+             "EP%u %-3s xfers %u bytes %llu trans %u naks %u errors %u "
+             "rate %.1f kB/s latency us min %.1f avg %.1f max %.1f\n",
+             slot >> 1, slot ? ((slot & 1U) ? "IN" : "OUT") : "CTL", st->xfers,
+             (unsigned long long)st->bytes, st->transactions, st->naks,
+             st->errors, kbps, lat_min, lat_avg, st->lat_max / 12.0);
+    printf("[usbdpi]   %s", line);
+    socket_printf(sc, "stats %s", line);
+  }
+}
+
+// Diagnostic information for the endpoint queue most recently used
+void script_diags(const usbdpi_script_t *sc, uint32_t diags[3]) {
+  if (!sc) {
+    diags[0] = diags[1] = diags[2] = 0U;
+    return;
+  }
+  const usbdpi_script_stats_t *st = &sc->stats[sc->slot];
+  diags[2] = (uint32_t)st->bytes;
+  diags[1] = st->lat_last;
+  diags[0] = (sc->slot << 27) | (st->xfers & 0x7ffffffU);
+}
@@ -0,0 +1,178 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_DV_DPI_USBDPI_USBDPI_SCRIPT_H_
+#define OPENTITAN_HW_DV_DPI_USBDPI_USBDPI_SCRIPT_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "usb_transfer.h"
+
+// Forwards declaration of USBDPI context
+typedef struct usbdpi_ctx usbdpi_ctx_t;
+
+// Number of endpoint queues; one per endpoint and direction
+#define USBDPI_SCRIPT_SLOTS 32U
+
+// Endpoint queue used for a given endpoint and direction
+#define USBDPI_SCRIPT_SLOT(ep, in) (((ep) << 1) | ((in) ? 1U : 0U))
+
+/**
+ * A transfer (or other command) read from a transaction script
+ */
+typedef struct usbdpi_script_xfer usbdpi_script_xfer_t;
+
+struct usbdpi_script_xfer {
+  /**
+   * Next command in the script, or next transfer queued on the same endpoint
+   */
+  usbdpi_script_xfer_t *next;
+  /**
+   * Script command (USBDPI_SCRIPT_OP_*)
+   */
+  uint8_t op;
+  /**
+   * USB transfer type (USB_TRANSFER_TYPE_*)
+   */
+  uint8_t type;
+  /**
+   * Endpoint number
+   */
+  uint8_t ep;
+  /**
+   * Direction of the data stage
+   */
+  bool in;
+  /**
+   * Current stage of a Control Transfer
+   */
+  uint8_t stage;
+  /**
+   * Setup packet of a Control Transfer
+   */
+  uint8_t setup[8];
+  /**
+   * Sequence number of the transfer within the script, for reporting
+   */
+  uint32_t id;
+  /**
+   * Number of bytes to transfer in the data stage
+   */
+  uint32_t len;
+  /**
+   * Number of bytes transferred so far
+   */
+  uint32_t done;
+  /**
+   * Data to be sent (OUT) or buffer for data received (IN)
+   */
+  uint8_t *data;
+  /**
+   * Time at which the transfer was queued on its endpoint (bit intervals)
+   */
+  uint32_t submit_bits;
+  /**
+   * Number of consecutive failed transactions
+   */
+  uint32_t errors;
+};
+
+/**
+ * Throughput and latency counters for a single endpoint queue
+ */
+typedef struct usbdpi_script_stats {
+  /**
+   * Number of transfers completed
+   */
+  uint32_t xfers;
+  /**
+   * Number of data bytes transferred
+   */
+  uint64_t bytes;
+  /**
+   * Number of transactions, and the number that were NAKed or failed
+   */
+  uint32_t transactions;
+  uint32_t naks;
+  uint32_t errors;
+  /**
+   * Transfer latency from queueing to completion (bit intervals)
+   */
+  uint32_t lat_min;
+  uint32_t lat_max;
+  uint32_t lat_last;
+  uint64_t lat_sum;
+  /**
+   * Time of the first submission and the last completion (bit intervals)
+   */
+  uint32_t first_bits;
+  uint32_t last_bits;
+} usbdpi_script_stats_t;
+
+/**
+ * Script-driven host engine state
+ *
+ * A script is a sequence of lines, each holding one command ('#' starts a
+ * comment):
+ *
+ *   control <bmRequestType> <bRequest> <wValue> <wIndex> <wLength>
+ *           [data <hex>]
+ *   <bulk|interrupt|iso> <in|out> <ep> <len> [data <hex>]
+ *   sync
+ *   stats
+ *
+ * Transfers are queued on their endpoint as soon as they are read, so
+ * transfers to different endpoints proceed concurrently; 'sync' and 'stats'
+ * wait for all preceding transfers to complete. OUT data defaults to a byte
+ * count pattern. Each completed transfer is reported on the command socket as
+ * 'done <id> <status> <len> [<hex data>]', where only the first 4096 bytes of
+ * IN data are given, followed by '...' if there was more. The status is 'ok',
+ * 'stall', or 'error' if three transactions in a row timed out or got an
+ * unexpected response. Reports are dropped while no client is connected to
+ * the command socket.
+ */
+typedef struct usbdpi_script usbdpi_script_t;
+
+/**
+ * Create a script-driven host engine, reading commands from a file and/or a
+ * TCP port
+ *
+ * @param  name      Name of the USBDPI instance (display only)
+ * @param  path      Script file, or NULL/empty for none
+ * @param  port      TCP port on which to accept commands, or 0 for none
+ * @return           Script engine, or NULL if there is no script
+ */
+usbdpi_script_t *script_create(const char *name, const char *path, int port);
+
+/**
+ * Report the final counters and release the script engine
+ *
+ * @param  sc        Script engine (may be NULL)
+ */
+void script_close(usbdpi_script_t *sc);
+
+/**
+ * Run the next step of the scripted traffic; called in the same manner as
+ * streams_service
+ *
+ * @param  ctx       USBDPI context state
+ */
+void script_service(usbdpi_ctx_t *ctx);
+
+/**
+ * Print the per-endpoint throughput and latency counters
+ *
+ * @param  ctx       USBDPI context state
+ */
+void script_stats_report(usbdpi_ctx_t *ctx);
+
+/**
+ * Return diagnostic information for the endpoint queue most recently used
+ *
+ * @param  sc        Script engine (may be NULL)
+ * @param  diags     Receives three words of diagnostic information
+ */
+void script_diags(const usbdpi_script_t *sc, uint32_t diags[3]);
+
+#endif  // OPENTITAN_HW_DV_DPI_USBDPI_USBDPI_SCRIPT_H_
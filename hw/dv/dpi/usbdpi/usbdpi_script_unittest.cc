@@ -0,0 +1,229 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hw/dv/dpi/usbdpi/usbdpi.h"
+}
+
+namespace usbdpi_script_unittest {
+namespace {
+
+// The script engine driven without a simulated device: the test plays the
+// part of the bus, telling the engine what the device sent back, and reads
+// the transfer reports from the command socket.
+class UsbdpiScriptTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ctx_ = (usbdpi_ctx_t *)calloc(1, sizeof(usbdpi_ctx_t));
+    ASSERT_TRUE(ctx_);
+    usb_transfer_setup(ctx_);
+    for (unsigned ep = 0U; ep < USBDPI_MAX_ENDPOINTS; ep++) {
+      ctx_->ep_in[ep].next_data = USB_PID_DATA0;
+      ctx_->ep_out[ep].next_data = USB_PID_DATA0;
+    }
+    ctx_->dev_address = 2U;
+    ctx_->tick_bits = 100U;
+    ctx_->frame_start = ctx_->tick_bits;
+    ctx_->hostSt = HS_STARTFRAME;
+    client_ = -1;
+  }
+
+  void TearDown() override {
+    if (client_ >= 0) {
+      close(client_);
+    }
+    script_close(ctx_->script);
+    free(ctx_);
+  }
+
+  // Start the engine, connect to its command socket and send it a script
+  void Start(const std::string &script) {
+    int port = FreePort();
+    ctx_->script = script_create("test", NULL, port);
+    ASSERT_TRUE(ctx_->script);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // The server is started on a thread of its own, so it may not be
+    // listening yet.
+    for (int tries = 0; client_ < 0 && tries < 100; tries++) {
+      client_ = socket(AF_INET, SOCK_STREAM, 0);
+      ASSERT_GE(client_, 0);
+      if (connect(client_, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(client_);
+        client_ = -1;
+        usleep(10000);
+      }
+    }
+    ASSERT_GE(client_, 0);
+
+    // Reports are dropped until the server has accepted the connection, so
+    // start with a sync, which is reported as soon as it is read.
+    std::string cmds = "sync\n" + script;
+    ASSERT_EQ(send(client_, cmds.data(), cmds.size(), 0),
+              (ssize_t)cmds.size());
+    for (int tries = 0; tries < 1000 && !ClientReadable(10); tries++) {
+      Service();
+    }
+    ASSERT_EQ(ReadLine(), "sync");
+  }
+
+  // Get a port that nothing is listening on
+  static int FreePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    EXPECT_EQ(bind(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    EXPECT_EQ(getsockname(fd, (struct sockaddr *)&addr, &len), 0);
+    close(fd);
+    return ntohs(addr.sin_port);
+  }
+
+  bool ClientReadable(int timeout_ms) {
+    struct pollfd pfd = {client_, POLLIN, 0};
+    return poll(&pfd, 1, timeout_ms) > 0;
+  }
+
+  // Read a report from the command socket, or "" if there is none
+  std::string ReadLine() {
+    while (true) {
+      size_t nl = rx_.find('\n');
+      if (nl != std::string::npos) {
+        std::string line = rx_.substr(0, nl);
+        rx_.erase(0, nl + 1);
+        return line;
+      }
+      char buf[256];
+      ssize_t n = ClientReadable(5000) ? recv(client_, buf, sizeof(buf), 0) : 0;
+      if (n <= 0) {
+        return "";
+      }
+      rx_.append(buf, n);
+    }
+  }
+
+  // Run the engine once, the way the host state machine in usbdpi.c does:
+  // with a transfer descriptor to build a packet in, starting a new frame
+  // when the engine has finished with this one
+  void Service() {
+    if (ctx_->hostSt == HS_NEXTFRAME) {
+      ctx_->frame_start = ctx_->tick_bits;
+      ctx_->hostSt = HS_STARTFRAME;
+    }
+    if (!ctx_->sending) {
+      ctx_->sending = transfer_alloc(ctx_);
+      ASSERT_TRUE(ctx_->sending);
+    }
+    script_service(ctx_);
+  }
+
+  // Run the engine until it has started a transaction and is waiting for the
+  // device to respond
+  void Issue() {
+    for (int tries = 0; tries < 1000 && ctx_->hostSt != HS_WAITACK &&
+                        ctx_->hostSt != HS_ACKIFDATA;
+         tries++) {
+      Service();
+      if (ctx_->hostSt == HS_WAITACK || ctx_->hostSt == HS_WAIT_PKT) {
+        // The packets have gone out on the bus
+        transfer_release(ctx_, ctx_->sending);
+        ctx_->sending = NULL;
+      }
+    }
+    ASSERT_TRUE(ctx_->hostSt == HS_WAITACK || ctx_->hostSt == HS_ACKIFDATA);
+  }
+
+  // Give the engine the device's response to the transaction
+  void Respond(usbdpi_bus_state_t bus_state, uint8_t pid) {
+    ctx_->bus_state = bus_state;
+    ctx_->lastrxpid = pid;
+    Service();
+  }
+
+  // Let the transaction time out
+  void Timeout() {
+    ctx_->tick_bits = ctx_->wait;
+    Service();
+  }
+
+  usbdpi_ctx_t *ctx_;
+  int client_;
+  std::string rx_;
+};
+
+TEST_F(UsbdpiScriptTest, OutTransferCompletes) {
+  Start("bulk out 1 8\n");
+  Issue();
+  EXPECT_EQ(ctx_->bus_state, kUsbBulkOut);
+  Respond(kUsbBulkOutAck, USB_PID_ACK);
+  EXPECT_EQ(ReadLine(), "done 1 ok 8");
+}
+
+TEST_F(UsbdpiScriptTest, NaksAreRetriedWithoutLimit) {
+  Start("bulk out 1 8\n");
+  for (int i = 0; i < 10; i++) {
+    Issue();
+    Respond(kUsbBulkOutAck, USB_PID_NAK);
+  }
+  Issue();
+  Respond(kUsbBulkOutAck, USB_PID_ACK);
+  EXPECT_EQ(ReadLine(), "done 1 ok 8");
+}
+
+TEST_F(UsbdpiScriptTest, TimeoutsEndTransferWithError) {
+  Start("bulk out 1 8\nbulk out 1 4\n");
+  for (int i = 0; i < 3; i++) {
+    Issue();
+    Timeout();
+  }
+  EXPECT_EQ(ReadLine(), "done 1 error 0");
+
+  // The engine moves on to the next transfer
+  Issue();
+  Respond(kUsbBulkOutAck, USB_PID_ACK);
+  EXPECT_EQ(ReadLine(), "done 2 ok 4");
+}
+
+TEST_F(UsbdpiScriptTest, OnlyConsecutiveErrorsCount) {
+  // Two packets, each of which fails twice before it gets through
+  Start("bulk out 1 128\n");
+  for (int pkt = 0; pkt < 2; pkt++) {
+    for (int i = 0; i < 2; i++) {
+      Issue();
+      Timeout();
+    }
+    Issue();
+    Respond(kUsbBulkOutAck, USB_PID_ACK);
+  }
+  EXPECT_EQ(ReadLine(), "done 1 ok 128");
+}
+
+TEST_F(UsbdpiScriptTest, UnexpectedInResponsesEndTransferWithError) {
+  Start("bulk in 1 8\n");
+  ctx_->recving = transfer_alloc(ctx_);
+  for (int i = 0; i < 3; i++) {
+    Issue();
+    EXPECT_EQ(ctx_->bus_state, kUsbBulkInToken);
+    Respond(kUsbBulkInData, USB_PID_ACK);
+  }
+  EXPECT_EQ(ReadLine(), "done 1 error 0");
+}
+
+}  // namespace
+}  // namespace usbdpi_script_unittest
@@ -108,7 +108,12 @@ usbdpi_test_step_t usbdpi_test_seq_next(usbdpi_ctx_t *ctx,
       // this point, reading device qualifier and endpoint information
 
     case STEP_SET_DEVICE_CONFIG:
-      next_step = STEP_GET_TEST_CONFIG;
+      // A transaction script takes over once the device is configured
+      next_step = ctx->script ? STEP_SCRIPT_SERVICE : STEP_GET_TEST_CONFIG;
+      break;
+
+    case STEP_SCRIPT_SERVICE:
+      next_step = STEP_SCRIPT_SERVICE;
       break;
 
     case STEP_SET_TEST_STATUS:
@@ -51,6 +51,9 @@ typedef enum {
   // usbdev_stream_test
   STEP_STREAM_SERVICE = 0x20u,
 
+  // Transfers from a transaction script
+  STEP_SCRIPT_SERVICE = 0x21u,
+
   // Disconnect the device and stop
   STEP_BUS_DISCONNECT = 0x7fu
 } usbdpi_test_step_t;
@@ -5,10 +5,13 @@
 #include "dpi_memutil.h"
 
 #include <cassert>
+#include <chrono>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
+#include <iomanip>
 #include <libelf.h>
+#include <random>
 #include <sstream>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -372,6 +375,130 @@ void DpiMemUtil::PrintMemRegions() const {
   }
 }
 
+// Time a write of data over the whole of mem followed by a read back. Returns
+// the two rates in words per second.
+static std::pair<double, double> BenchmarkMemArea(
+    const std::string &name, const MemArea &mem,
+    const std::vector<uint8_t> &data) {
+  typedef std::chrono::steady_clock Clock;
+
+  auto t0 = Clock::now();
+  mem.Write(0, data);
+  auto t1 = Clock::now();
+  std::vector<uint8_t> read_back = mem.Read(0, mem.GetSizeWords());
+  auto t2 = Clock::now();
+
+  if (read_back != data) {
+    std::ostringstream oss;
+    oss << "Data read back from memory '" << name
+        << "' doesn't match what was written.";
+    throw std::runtime_error(oss.str());
+  }
+
+  std::chrono::duration<double> write_time = t1 - t0;
+  std::chrono::duration<double> read_time = t2 - t1;
+  return std::make_pair(mem.GetSizeWords() / write_time.count(),
+                        mem.GetSizeWords() / read_time.count());
+}
+
+void DpiMemUtil::RunMemBenchmark() const {
+  bool was_enabled = MemArea::GetBlockTransfersEnabled();
+  std::mt19937 rng(0);
+
+  std::cout << "Memory transfer rates (words/s):" << std::endl;
+  std::cout << std::setw(12) << std::left << "Name" << std::setw(10) << "Kind"
+            << std::right << std::setw(10) << "Words" << std::setw(14)
+            << "Write" << std::setw(14) << "Read" << std::setw(14)
+            << "Write/block" << std::setw(14) << "Read/block" << std::endl;
+
+  for (const auto &pr : name_to_mem_) {
+    const MemArea &mem = *mem_areas_[pr.second];
+
+    std::vector<uint8_t> data(mem.GetSizeBytes());
+    for (uint8_t &byte : data) {
+      byte = rng();
+    }
+
+    MemArea::SetBlockTransfersEnabled(false);
+    std::pair<double, double> word_rates =
+        BenchmarkMemArea(pr.first, mem, data);
+    MemArea::SetBlockTransfersEnabled(true);
+    std::pair<double, double> block_rates =
+        BenchmarkMemArea(pr.first, mem, data);
+
+    std::cout << std::setw(12) << std::left << pr.first << std::setw(10)
+              << mem.GetKind() << std::right << std::setw(10)
+              << mem.GetSizeWords() << std::fixed << std::setprecision(0)
+              << std::setw(14) << word_rates.first << std::setw(14)
+              << word_rates.second << std::setw(14) << block_rates.first
+              << std::setw(14) << block_rates.second << std::endl;
+  }
+
+  MemArea::SetBlockTransfersEnabled(was_enabled);
+}
+
+// Helpers for SaveMemories and RestoreMemories. Integers are written in the
+// native byte order: checkpoints are only expected to be restored by the same
+// simulation binary that saved them.
+static void WriteU32(std::ostream &os, uint32_t val) {
+  os.write(reinterpret_cast<const char *>(&val), sizeof val);
+}
+
+static uint32_t ReadU32(std::istream &is) {
+  uint32_t val;
+  if (!is.read(reinterpret_cast<char *>(&val), sizeof val)) {
+    throw std::runtime_error("Truncated memory data in checkpoint.");
+  }
+  return val;
+}
+
+void DpiMemUtil::SaveMemories(std::ostream &os) const {
+  WriteU32(os, mem_areas_.size());
+  for (size_t i = 0; i < mem_areas_.size(); ++i) {
+    const MemArea &mem = *mem_areas_[i];
+    std::vector<uint8_t> data = mem.Read(0, mem.GetSizeWords());
+
+    WriteU32(os, names_[i].size());
+    os.write(names_[i].data(), names_[i].size());
+    WriteU32(os, data.size());
+    os.write(reinterpret_cast<const char *>(data.data()), data.size());
+  }
+}
+
+void DpiMemUtil::RestoreMemories(std::istream &is) const {
+  uint32_t num_mems = ReadU32(is);
+  for (uint32_t i = 0; i < num_mems; ++i) {
+    std::string name(ReadU32(is), '\0');
+    if (!is.read(&name[0], name.size())) {
+      throw std::runtime_error("Truncated memory data in checkpoint.");
+    }
+
+    auto it = name_to_mem_.find(name);
+    if (it == name_to_mem_.end()) {
+      std::ostringstream oss;
+      oss << "Checkpoint contains data for memory '" << name
+          << "', which is not registered.";
+      throw std::runtime_error(oss.str());
+    }
+    const MemArea &mem = *mem_areas_[it->second];
+
+    uint32_t size = ReadU32(is);
+    if (size != mem.GetSizeBytes()) {
+      std::ostringstream oss;
+      oss << "Checkpoint contains 0x" << std::hex << size
+          << " bytes of data for memory '" << name << "', which has size 0x"
+          << mem.GetSizeBytes() << ".";
+      throw std::runtime_error(oss.str());
+    }
+
+    std::vector<uint8_t> data(size);
+    if (!is.read(reinterpret_cast<char *>(data.data()), size)) {
+      throw std::runtime_error("Truncated memory data in checkpoint.");
+    }
+    mem.Write(0, data);
+  }
+}
+
 void DpiMemUtil::LoadFileToNamedMem(bool verbose, const std::string &name,
                                     const std::string &filepath,
                                     MemImageType type) {
@@ -419,7 +546,16 @@ void DpiMemUtil::LoadFileToNamedMem(bool verbose, const std::string &name,
 
 void DpiMemUtil::LoadElfToMemories(bool verbose, const std::string &filepath) {
   // Load the contents of the ELF file into the staging area
-  StageElf(verbose, filepath);
+  auto cache_it = elf_cache_.find(filepath);
+  if (cache_it != elf_cache_.end()) {
+    if (verbose) {
+      std::cout << "Loading ELF file `" << filepath << "' from the cache."
+                << std::endl;
+    }
+    staging_area_ = cache_it->second;
+  } else {
+    StageElf(verbose, filepath);
+  }
 
   for (const auto &pr : staging_area_) {
     const std::string &mem_name = pr.first;
@@ -451,6 +587,14 @@ void DpiMemUtil::LoadElfToMemories(bool verbose, const std::string &filepath) {
   }
 }
 
+void DpiMemUtil::CacheElf(bool verbose, const std::string &path) {
+  if (elf_cache_.count(path)) {
+    return;
+  }
+  StageElf(verbose, path);
+  elf_cache_[path] = staging_area_;
+}
+
 void DpiMemUtil::StageElf(bool verbose, const std::string &path) {
   // Clear out anything that was in the staging area before
   staging_area_.clear();
@@ -4,6 +4,7 @@
 #ifndef OPENTITAN_HW_DV_VERILATOR_CPP_DPI_MEMUTIL_H_
 #define OPENTITAN_HW_DV_VERILATOR_CPP_DPI_MEMUTIL_H_
 
+#include <iostream>
 #include <map>
 #include <memory>
 #include <string>
@@ -58,7 +59,9 @@ class StagedMem {
  * These utilities require the corresponding DPI functions:
  * simutil_memload()
  * simutil_set_mem()
- * to be defined somewhere as SystemVerilog functions.
+ * to be defined somewhere as SystemVerilog functions. If simutil_set_mem_block()
+ * and simutil_get_mem_block() are also defined, they are used to transfer
+ * memory contents in blocks.
  */
 class DpiMemUtil {
  public:
@@ -105,6 +108,34 @@ class DpiMemUtil {
    */
   void PrintMemRegions() const;
 
+  /**
+   * Measure the throughput of writes and reads to each registered memory
+   *
+   * For each memory area, this writes random data over the whole memory and
+   * reads it back, both with and without block transfers over DPI, and
+   * prints the resulting rates in words per second to stdout. This clobbers
+   * the contents of every registered memory. If the data read back doesn't
+   * match what was written, throws a std::runtime_error.
+   */
+  void RunMemBenchmark() const;
+
+  /**
+   * Write the contents of every registered memory to os
+   *
+   * Each memory is written as its name, its size in bytes and then its
+   * contents (as returned by MemArea::Read()).
+   */
+  void SaveMemories(std::ostream &os) const;
+
+  /**
+   * Load memory contents that were written by SaveMemories() from is
+   *
+   * Throws a std::runtime_error if the data names a memory that isn't
+   * registered, if the size of a memory doesn't match or if the data is
+   * truncated.
+   */
+  void RestoreMemories(std::istream &is) const;
+
   /**
    * Load the file at filepath into the named memory. If type is
    * kMemImageUnknown, the file type is determined from the path.
@@ -115,10 +146,25 @@ class DpiMemUtil {
   /**
    * Load an ELF file, placing segments in memories by LMA.
    *
-   * Replaces any data currently in the staging area.
+   * Replaces any data currently in the staging area. If the file has been
+   * cached with CacheElf(), the cached data is used instead of reading the
+   * file again.
    */
   void LoadElfToMemories(bool verbose, const std::string &filepath);
 
+  /**
+   * Stage an ELF file and keep a copy of the staged data
+   *
+   * Later calls to LoadElfToMemories() with the same path use the copy. This
+   * is meant for simulations which load the same files many times, such as
+   * batch runs that fork a process per job. Note that OnElfLoaded() isn't
+   * called again when a cached file is loaded.
+   *
+   * If the load fails, raises a std::exception with information about what
+   * happened.
+   */
+  void CacheElf(bool verbose, const std::string &path);
+
   /**
    * Load an ELF file into a staging area in this object, which can then be
    * accessed with GetMemoryData().
@@ -159,6 +205,9 @@ class DpiMemUtil {
   std::map<std::string, StagedMem> staging_area_;
   const StagedMem empty_;
 
+  // Staging areas of the files loaded with CacheElf(), keyed by path
+  std::map<std::string, std::map<std::string, StagedMem>> elf_cache_;
+
   /**
    * Find the index of a memory area containing the given segment's addresses.
    * Raises a std::exception if none is found.
@@ -4,6 +4,7 @@
 
 #include "ecc32_mem_area.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <stdexcept>
@@ -35,19 +36,25 @@ Ecc32MemArea::EccWords Ecc32MemArea::ReadWithIntegrity(
   assert(word_offset + num_words <= num_words_);
 
   // See MemArea::Write for an explanation for this buffer.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  uint8_t blockbuf[SV_MEM_BLOCK_WORDS * SV_MEM_WIDTH_BYTES];
+  uint32_t phys_addrs[SV_MEM_BLOCK_WORDS];
+  memset(blockbuf, 0, sizeof blockbuf);
+  assert(width_byte_ <= SV_MEM_WIDTH_BYTES);
 
   EccWords ret;
   ret.reserve(num_words);
 
-  for (uint32_t i = 0; i < num_words; ++i) {
-    uint32_t src_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(src_word);
+  for (uint32_t i = 0; i < num_words; i += SV_MEM_BLOCK_WORDS) {
+    uint32_t count = std::min(num_words - i, (uint32_t)SV_MEM_BLOCK_WORDS);
 
-    ReadToMinibuf(minibuf, phys_addr);
-    ReadBufferWithIntegrity(ret, minibuf, src_word);
+    for (uint32_t j = 0; j < count; ++j) {
+      phys_addrs[j] = ToPhysAddr(word_offset + i + j);
+    }
+    ReadToBlock(blockbuf, count, phys_addrs);
+    for (uint32_t j = 0; j < count; ++j) {
+      ReadBufferWithIntegrity(ret, &blockbuf[j * SV_MEM_WIDTH_BYTES],
+                              word_offset + i + j);
+    }
   }
 
   return ret;
@@ -56,9 +63,10 @@ Ecc32MemArea::EccWords Ecc32MemArea::ReadWithIntegrity(
 void Ecc32MemArea::WriteWithIntegrity(uint32_t word_offset,
                                       const EccWords &data) const {
   // See MemArea::Write for an explanation for this buffer.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  uint8_t blockbuf[SV_MEM_BLOCK_WORDS * SV_MEM_WIDTH_BYTES];
+  uint32_t phys_addrs[SV_MEM_BLOCK_WORDS];
+  memset(blockbuf, 0, sizeof blockbuf);
+  assert(width_byte_ <= SV_MEM_WIDTH_BYTES);
 
   uint32_t width_32 = width_byte_ / 4;
   uint32_t to_write = data.size() / width_32;
@@ -66,12 +74,16 @@ void Ecc32MemArea::WriteWithIntegrity(uint32_t word_offset,
   assert((data.size() % width_32) == 0);
   assert(word_offset + to_write <= num_words_);
 
-  for (uint32_t i = 0; i < to_write; ++i) {
-    uint32_t dst_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(dst_word);
+  for (uint32_t i = 0; i < to_write; i += SV_MEM_BLOCK_WORDS) {
+    uint32_t count = std::min(to_write - i, (uint32_t)SV_MEM_BLOCK_WORDS);
 
-    WriteBufferWithIntegrity(minibuf, data, i * width_32, dst_word);
-    WriteFromMinibuf(phys_addr, minibuf, dst_word);
+    for (uint32_t j = 0; j < count; ++j) {
+      uint32_t dst_word = word_offset + i + j;
+      phys_addrs[j] = ToPhysAddr(dst_word);
+      WriteBufferWithIntegrity(&blockbuf[j * SV_MEM_WIDTH_BYTES], data,
+                               (i + j) * width_32, dst_word);
+    }
+    WriteFromBlock(phys_addrs, count, blockbuf, word_offset + i);
   }
 }
 
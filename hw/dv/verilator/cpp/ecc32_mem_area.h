@@ -24,6 +24,8 @@ class Ecc32MemArea : public MemArea {
 
   void LoadVmem(const std::string &path) const override;
 
+  const char *GetKind() const override { return "ecc32"; }
+
   typedef std::pair<bool, uint32_t> EccWord;
   typedef std::vector<EccWord> EccWords;
 
@@ -38,7 +40,8 @@ class Ecc32MemArea : public MemArea {
    *
    * @param num_words   The number of words to read.
    */
-  EccWords ReadWithIntegrity(uint32_t word_offset, uint32_t num_words) const;
+  virtual EccWords ReadWithIntegrity(uint32_t word_offset,
+                                     uint32_t num_words) const;
 
   /** Write data with validity bits, starting at the given offset
    *
@@ -51,7 +54,8 @@ class Ecc32MemArea : public MemArea {
    *
    * @param data        The data that should be written.
    */
-  void WriteWithIntegrity(uint32_t word_offset, const EccWords &data) const;
+  virtual void WriteWithIntegrity(uint32_t word_offset,
+                                  const EccWords &data) const;
 
  protected:
   void WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
@@ -11,13 +11,27 @@
 
 #include "sv_scoped.h"
 
-// DPI exports, defined in prim_util_memload.svh
+// DPI exports, defined in prim_util_memload.svh. The block transfer functions
+// are declared weak so that we can fall back to word-by-word transfers if the
+// simulation was built without them.
 extern "C" {
 void simutil_memload(const char *file);
 int simutil_set_mem(int index, const svBitVecVal *val);
 int simutil_get_mem(int index, svBitVecVal *val);
+int simutil_set_mem_block(int count, const int *indices,
+                          const svBitVecVal *vals) __attribute__((weak));
+int simutil_get_mem_block(int count, const int *indices, svBitVecVal *vals)
+    __attribute__((weak));
 }
 
+static bool block_transfers_enabled = true;
+
+void MemArea::SetBlockTransfersEnabled(bool enabled) {
+  block_transfers_enabled = enabled;
+}
+
+bool MemArea::GetBlockTransfersEnabled() { return block_transfers_enabled; }
+
 MemArea::MemArea(const std::string &scope, uint32_t num_words,
                  uint32_t width_byte)
     : scope_(scope), num_words_(num_words), width_byte_(width_byte) {
@@ -27,26 +41,32 @@ MemArea::MemArea(const std::string &scope, uint32_t num_words,
 
 void MemArea::Write(uint32_t word_offset,
                     const std::vector<uint8_t> &data) const {
-  // This "mini buffer" is used to transfer each write to SystemVerilog.
+  // This "block buffer" is used to transfer writes to SystemVerilog. It holds
+  // up to SV_MEM_BLOCK_WORDS "mini buffers", one per memory word.
   // `simutil_set_mem` takes a fixed SV_MEM_WIDTH_BITS-bit vector but it will
   // only use the bits required for the RAM width. As an example, for a 32-bit
-  // wide RAM only elements 3:0 of `minibuf` will be written to memory. Since
-  // the simulator may still read bits from minibuf it does not use, we must
-  // use a fixed allocation of the full bit vector size to avoid an out of
-  // bounds access.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  // wide RAM only elements 3:0 of each mini buffer will be written to memory.
+  // Since the simulator may still read bits from a mini buffer it does not
+  // use, we must use a fixed allocation of the full bit vector size to avoid
+  // an out of bounds access.
+  uint8_t blockbuf[SV_MEM_BLOCK_WORDS * SV_MEM_WIDTH_BYTES];
+  uint32_t phys_addrs[SV_MEM_BLOCK_WORDS];
+  memset(blockbuf, 0, sizeof blockbuf);
+  assert(width_byte_ <= SV_MEM_WIDTH_BYTES);
 
   uint32_t data_words = (data.size() + width_byte_ - 1) / width_byte_;
   assert(word_offset + data_words <= num_words_);
 
-  for (uint32_t i = 0; i < data_words; ++i) {
-    uint32_t dst_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(dst_word);
+  for (uint32_t i = 0; i < data_words; i += SV_MEM_BLOCK_WORDS) {
+    uint32_t count = std::min(data_words - i, (uint32_t)SV_MEM_BLOCK_WORDS);
 
-    WriteBuffer(minibuf, data, i * width_byte_, dst_word);
-    WriteFromMinibuf(phys_addr, minibuf, dst_word);
+    for (uint32_t j = 0; j < count; ++j) {
+      uint32_t dst_word = word_offset + i + j;
+      phys_addrs[j] = ToPhysAddr(dst_word);
+      WriteBuffer(&blockbuf[j * SV_MEM_WIDTH_BYTES], data,
+                  (i + j) * width_byte_, dst_word);
+    }
+    WriteFromBlock(phys_addrs, count, blockbuf, word_offset + i);
   }
 }
 
@@ -58,19 +78,24 @@ std::vector<uint8_t> MemArea::Read(uint32_t word_offset,
   assert(num_words <= num_bytes);
 
   // See Write for an explanation for this buffer.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  uint8_t blockbuf[SV_MEM_BLOCK_WORDS * SV_MEM_WIDTH_BYTES];
+  uint32_t phys_addrs[SV_MEM_BLOCK_WORDS];
+  memset(blockbuf, 0, sizeof blockbuf);
+  assert(width_byte_ <= SV_MEM_WIDTH_BYTES);
 
   std::vector<uint8_t> ret;
   ret.reserve(num_bytes);
 
-  for (uint32_t i = 0; i < num_words; ++i) {
-    uint32_t src_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(src_word);
+  for (uint32_t i = 0; i < num_words; i += SV_MEM_BLOCK_WORDS) {
+    uint32_t count = std::min(num_words - i, (uint32_t)SV_MEM_BLOCK_WORDS);
 
-    ReadToMinibuf(minibuf, phys_addr);
-    ReadBuffer(ret, minibuf, src_word);
+    for (uint32_t j = 0; j < count; ++j) {
+      phys_addrs[j] = ToPhysAddr(word_offset + i + j);
+    }
+    ReadToBlock(blockbuf, count, phys_addrs);
+    for (uint32_t j = 0; j < count; ++j) {
+      ReadBuffer(ret, &blockbuf[j * SV_MEM_WIDTH_BYTES], word_offset + i + j);
+    }
   }
 
   return ret;
@@ -121,3 +146,51 @@ void MemArea::WriteFromMinibuf(uint32_t phys_addr, const uint8_t *minibuf,
     throw std::runtime_error(oss.str());
   }
 }
+
+void MemArea::ReadToBlock(uint8_t *blockbuf, uint32_t count,
+                          const uint32_t *phys_addrs) const {
+  assert(count <= SV_MEM_BLOCK_WORDS);
+
+  if (!block_transfers_enabled || !simutil_get_mem_block) {
+    for (uint32_t i = 0; i < count; ++i) {
+      ReadToMinibuf(&blockbuf[i * SV_MEM_WIDTH_BYTES], phys_addrs[i]);
+    }
+    return;
+  }
+
+  int indices[SV_MEM_BLOCK_WORDS] = {0};
+  std::copy_n(phys_addrs, count, indices);
+
+  SVScoped scoped(scope_);
+  if (!simutil_get_mem_block(count, indices, (svBitVecVal *)blockbuf)) {
+    std::ostringstream oss;
+    oss << "Could not read " << count
+        << " memory words starting at physical index 0x" << std::hex
+        << phys_addrs[0] << ".";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void MemArea::WriteFromBlock(const uint32_t *phys_addrs, uint32_t count,
+                             const uint8_t *blockbuf, uint32_t dst_word) const {
+  assert(count <= SV_MEM_BLOCK_WORDS);
+
+  if (!block_transfers_enabled || !simutil_set_mem_block) {
+    for (uint32_t i = 0; i < count; ++i) {
+      WriteFromMinibuf(phys_addrs[i], &blockbuf[i * SV_MEM_WIDTH_BYTES],
+                       dst_word + i);
+    }
+    return;
+  }
+
+  int indices[SV_MEM_BLOCK_WORDS] = {0};
+  std::copy_n(phys_addrs, count, indices);
+
+  SVScoped scoped(scope_);
+  if (!simutil_set_mem_block(count, indices, (const svBitVecVal *)blockbuf)) {
+    std::ostringstream oss;
+    oss << "Could not set " << count << " memory words at byte offset 0x"
+        << std::hex << dst_word * width_byte_ << ".";
+    throw std::runtime_error(oss.str());
+  }
+}
@@ -18,6 +18,11 @@
 // using the svBitVecVal type, we have to round up to the next 32-bit word.
 #define SV_MEM_WIDTH_BYTES (4 * ((SV_MEM_WIDTH_BITS + 31) / 32))
 
+// This is the number of memory words that can be transferred with a single
+// call to simutil_set_mem_block or simutil_get_mem_block (see
+// prim_util_memload.svh).
+#define SV_MEM_BLOCK_WORDS 64
+
 /**
  * A "memory area", representing a memory in the simulated design.
  */
@@ -43,7 +48,10 @@ class MemArea {
    *
    * This assumes that the result will fit in the memory. If the scope cannot
    * be set, this throws an SVScoped::Error. If a call to \c simutil_set_mem
-   * fails, this throws a \c std::runtime_error.
+   * or \c simutil_set_mem_block fails, this throws a \c std::runtime_error.
+   *
+   * Words are transferred in blocks of up to SV_MEM_BLOCK_WORDS words per DPI
+   * call if block transfers are enabled (see SetBlockTransfersEnabled()).
    *
    * @param word_offset The offset, in words, of the first word that should be
    *                    written.
@@ -61,7 +69,8 @@ class MemArea {
    * memory. Returns a vector with <tt>num_words * width_byte_</tt> elements.
    *
    * If the scope cannot be set, this throws an SVScoped::Error. If a call to
-   * simutil_get_mem fails, this throws a std::runtime_error.
+   * simutil_get_mem or simutil_get_mem_block fails, this throws a
+   * std::runtime_error.
    *
    * @param word_offset The offset, in words, of the first word that should be
    *                    written.
@@ -80,6 +89,19 @@ class MemArea {
   uint32_t GetWidthByte() const { return width_byte_; }
   uint32_t GetWidth() const { return 8 * width_byte_; }
 
+  /** A short name for the kind of memory, used in diagnostic messages */
+  virtual const char *GetKind() const { return "plain"; }
+
+  /** Enable or disable block transfers over DPI for all memory areas
+   *
+   * Block transfers are enabled by default. If they are disabled (or if the
+   * simulation doesn't provide \c simutil_set_mem_block and \c
+   * simutil_get_mem_block), every memory word is transferred with its own
+   * call to \c simutil_set_mem or \c simutil_get_mem.
+   */
+  static void SetBlockTransfersEnabled(bool enabled);
+  static bool GetBlockTransfersEnabled();
+
  protected:
   std::string scope_;    ///< Design scope (used for accesses over DPI)
   uint32_t num_words_;   ///< Size of the memory area in words
@@ -145,6 +167,24 @@ class MemArea {
    */
   void WriteFromMinibuf(uint32_t phys_addr, const uint8_t *minibuf,
                         uint32_t dst_word) const;
+
+  /** Read count memory words at phys_addrs into blockbuf
+   *
+   * blockbuf should be at least SV_MEM_BLOCK_WORDS * SV_MEM_WIDTH_BYTES in
+   * size and word i is stored at offset i * SV_MEM_WIDTH_BYTES. count must be
+   * at most SV_MEM_BLOCK_WORDS. This falls back to ReadToMinibuf() for each
+   * word if block transfers aren't available.
+   */
+  void ReadToBlock(uint8_t *blockbuf, uint32_t count,
+                   const uint32_t *phys_addrs) const;
+
+  /** Write count memory words from blockbuf to phys_addrs
+   *
+   * The layout of blockbuf is as for ReadToBlock(). dst_word is the logical
+   * address of the first word (only used for error messages).
+   */
+  void WriteFromBlock(const uint32_t *phys_addrs, uint32_t count,
+                      const uint8_t *blockbuf, uint32_t dst_word) const;
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_CPP_MEM_AREA_H_
@@ -5,9 +5,13 @@
 #include "scrambled_ecc32_mem_area.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 #include "scramble_model.h"
 #include "sv_scoped.h"
@@ -17,33 +21,12 @@
 static const uint32_t kScrMaxNonceWidth = 320;
 static const uint32_t kScrMaxNonceWidthByte = (kScrMaxNonceWidth + 7) / 8;
 
-// Functions to convert from integer address to/from a little-endian vector of
-// bytes, addr_width is given in bits
-static std::vector<uint8_t> AddrIntToBytes(uint32_t addr, uint32_t addr_width) {
-  uint32_t addr_width_bytes = (addr_width + 7) / 8;
-  std::vector<uint8_t> addr_bytes(addr_width_bytes);
+// Writes of fewer words than this are encoded on the calling thread: for small
+// writes, the cost of starting worker threads outweighs the speed-up.
+static const uint32_t kMinParallelEncodeWords = 1024;
 
-  for (uint32_t i = 0; i < addr_width_bytes; ++i) {
-    addr_bytes[i] = addr & 0xff;
-    addr >>= 8;
-  }
-
-  return addr_bytes;
-}
-
-static uint32_t AddrBytesToInt(const std::vector<uint8_t> &addr) {
-  assert(addr.size() <= 4);
-
-  uint32_t addr_out = 0;
-  int cur_shift = 0;
-
-  for (uint8_t byte : addr) {
-    addr_out |= ((uint32_t)byte << cur_shift);
-    cur_shift += 8;
-  }
-
-  return addr_out;
-}
+// The number of words that a worker thread claims at a time when encoding
+static const uint32_t kEncodeChunkWords = 256;
 
 // Converts svBitVecVal (bit[m:n] SV type) into a byte vector
 static std::vector<uint8_t> ByteVecFromSV(svBitVecVal sv_val[],
@@ -62,6 +45,48 @@ static std::vector<uint8_t> ByteVecFromSV(svBitVecVal sv_val[],
   return vec;
 }
 
+// Call fn(i) for each i in [0, count), spreading the work over a pool of
+// worker threads. Each worker repeatedly claims the next kEncodeChunkWords
+// indices until there are none left. fn must be safe to call concurrently for
+// different indices (in particular, it must not make any DPI calls).
+static void ParallelFor(uint32_t count,
+                        const std::function<void(uint32_t)> &fn) {
+  uint32_t num_threads = std::thread::hardware_concurrency();
+  num_threads = std::min(
+      num_threads, (count + kEncodeChunkWords - 1) / kEncodeChunkWords);
+
+  if (count < kMinParallelEncodeWords || num_threads <= 1) {
+    for (uint32_t i = 0; i < count; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::atomic<uint32_t> next_chunk(0);
+  auto worker = [&]() {
+    for (;;) {
+      uint32_t lo = next_chunk.fetch_add(kEncodeChunkWords);
+      if (lo >= count)
+        return;
+      uint32_t hi = std::min(count, lo + kEncodeChunkWords);
+      for (uint32_t i = lo; i < hi; ++i) {
+        fn(i);
+      }
+    }
+  };
+
+  // The calling thread does its share of the work too.
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (uint32_t i = 0; i < num_threads - 1; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
 // Analogous to the vbits SystemVerilog function from prim_util_pkg.sv. It
 // calculates the number of bits needed to address size items.
 static uint32_t vbits(uint32_t size) {
@@ -150,6 +175,39 @@ uint32_t ScrambledEcc32MemArea::GetNonceWidthByte() const {
   return GetPrinceReplications() * 8;
 }
 
+void ScrambledEcc32MemArea::Write(uint32_t word_offset,
+                                  const std::vector<uint8_t> &data) const {
+  uint32_t data_words = (data.size() + width_byte_ - 1) / width_byte_;
+  assert(word_offset + data_words <= num_words_);
+
+  // Read the key and nonce over DPI once, rather than for every word. This
+  // also means that the encoding below doesn't need to touch the simulation,
+  // so it can run on other threads.
+  std::vector<uint8_t> key = GetScrambleKey();
+  std::vector<uint8_t> nonce = GetScrambleNonce();
+
+  // Physical memory contents, stored as consecutive "mini buffers" of
+  // SV_MEM_WIDTH_BYTES bytes each (see MemArea::Write), and the physical
+  // address for each of them.
+  std::vector<uint8_t> phys_data(data_words * SV_MEM_WIDTH_BYTES, 0);
+  std::vector<uint32_t> phys_addrs(data_words);
+
+  ParallelFor(data_words, [&](uint32_t i) {
+    uint32_t dst_word = word_offset + i;
+    uint8_t *buf = &phys_data[i * SV_MEM_WIDTH_BYTES];
+
+    phys_addrs[i] = ToPhysAddrWith(dst_word, nonce);
+    Ecc32MemArea::WriteBuffer(buf, data, i * width_byte_, dst_word);
+    ScrambleBufferWith(buf, dst_word, key, nonce);
+  });
+
+  for (uint32_t i = 0; i < data_words; i += SV_MEM_BLOCK_WORDS) {
+    uint32_t count = std::min(data_words - i, (uint32_t)SV_MEM_BLOCK_WORDS);
+    WriteFromBlock(&phys_addrs[i], count, &phys_data[i * SV_MEM_WIDTH_BYTES],
+                   word_offset + i);
+  }
+}
+
 void ScrambledEcc32MemArea::WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
                                         const std::vector<uint8_t> &data,
                                         size_t start_idx,
@@ -159,28 +217,118 @@ void ScrambledEcc32MemArea::WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
   ScrambleBuffer(buf, dst_word);
 }
 
-std::vector<uint8_t> ScrambledEcc32MemArea::ReadUnscrambled(
-    const uint8_t buf[SV_MEM_WIDTH_BYTES], uint32_t src_word) const {
-  std::vector<uint8_t> scrambled_data(buf, buf + GetPhysWidthByte());
-  return scramble_decrypt_data(scrambled_data, GetPhysWidth(), 39,
-                               AddrIntToBytes(src_word, addr_width_),
-                               addr_width_, GetScrambleNonce(),
-                               GetScrambleKey(), repeat_keystream_, false);
+std::vector<uint8_t> ScrambledEcc32MemArea::Read(uint32_t word_offset,
+                                                 uint32_t num_words) const {
+  std::vector<uint8_t> ret;
+  ret.reserve(width_byte_ * num_words);
+  ReadUnscrambledBlocks(word_offset, num_words,
+                        [&](const uint8_t *unscrambled, uint32_t src_word) {
+                          // Strip integrity to give final result
+                          Ecc32MemArea::ReadBuffer(ret, unscrambled, src_word);
+                        });
+  return ret;
+}
+
+Ecc32MemArea::EccWords ScrambledEcc32MemArea::ReadWithIntegrity(
+    uint32_t word_offset, uint32_t num_words) const {
+  EccWords ret;
+  ret.reserve(num_words * (width_byte_ / 4));
+  ReadUnscrambledBlocks(word_offset, num_words,
+                        [&](const uint8_t *unscrambled, uint32_t src_word) {
+                          Ecc32MemArea::ReadBufferWithIntegrity(
+                              ret, unscrambled, src_word);
+                        });
+  return ret;
+}
+
+void ScrambledEcc32MemArea::WriteWithIntegrity(uint32_t word_offset,
+                                               const EccWords &data) const {
+  uint8_t blockbuf[SV_MEM_BLOCK_WORDS * SV_MEM_WIDTH_BYTES];
+  uint32_t phys_addrs[SV_MEM_BLOCK_WORDS];
+  memset(blockbuf, 0, sizeof blockbuf);
+
+  uint32_t width_32 = width_byte_ / 4;
+  uint32_t to_write = data.size() / width_32;
+
+  assert((data.size() % width_32) == 0);
+  assert(word_offset + to_write <= num_words_);
+
+  std::vector<uint8_t> key = GetScrambleKey();
+  std::vector<uint8_t> nonce = GetScrambleNonce();
+
+  for (uint32_t i = 0; i < to_write; i += SV_MEM_BLOCK_WORDS) {
+    uint32_t count = std::min(to_write - i, (uint32_t)SV_MEM_BLOCK_WORDS);
+
+    for (uint32_t j = 0; j < count; ++j) {
+      uint32_t dst_word = word_offset + i + j;
+      uint8_t *buf = &blockbuf[j * SV_MEM_WIDTH_BYTES];
+      phys_addrs[j] = ToPhysAddrWith(dst_word, nonce);
+      Ecc32MemArea::WriteBufferWithIntegrity(buf, data, (i + j) * width_32,
+                                             dst_word);
+      ScrambleBufferWith(buf, dst_word, key, nonce);
+    }
+    WriteFromBlock(phys_addrs, count, blockbuf, word_offset + i);
+  }
+}
+
+void ScrambledEcc32MemArea::ReadUnscrambled(
+    uint8_t dst[SV_MEM_WIDTH_BYTES], const uint8_t buf[SV_MEM_WIDTH_BYTES],
+    uint32_t src_word, const std::vector<uint8_t> &key,
+    const std::vector<uint8_t> &nonce) const {
+  memset(dst, 0, SV_MEM_WIDTH_BYTES);
+  scramble_decrypt_buf(buf, dst, GetPhysWidth(), 39, src_word, addr_width_,
+                       &nonce[0], &key[0], repeat_keystream_, false);
+}
+
+void ScrambledEcc32MemArea::ReadUnscrambledBlocks(
+    uint32_t word_offset, uint32_t num_words,
+    const std::function<void(const uint8_t *, uint32_t)> &fn) const {
+  assert(word_offset + num_words <= num_words_);
+
+  // See MemArea::Write for an explanation for this buffer.
+  uint8_t blockbuf[SV_MEM_BLOCK_WORDS * SV_MEM_WIDTH_BYTES];
+  uint32_t phys_addrs[SV_MEM_BLOCK_WORDS];
+  memset(blockbuf, 0, sizeof blockbuf);
+
+  // Read the key and nonce over DPI once and use them both to scramble the
+  // addresses and to unscramble the data of every word.
+  std::vector<uint8_t> key = GetScrambleKey();
+  std::vector<uint8_t> nonce = GetScrambleNonce();
+
+  for (uint32_t i = 0; i < num_words; i += SV_MEM_BLOCK_WORDS) {
+    uint32_t count = std::min(num_words - i, (uint32_t)SV_MEM_BLOCK_WORDS);
+
+    for (uint32_t j = 0; j < count; ++j) {
+      phys_addrs[j] = ToPhysAddrWith(word_offset + i + j, nonce);
+    }
+    ReadToBlock(blockbuf, count, phys_addrs);
+    for (uint32_t j = 0; j < count; ++j) {
+      uint8_t unscrambled_data[SV_MEM_WIDTH_BYTES];
+      uint32_t src_word = word_offset + i + j;
+      ReadUnscrambled(unscrambled_data, &blockbuf[j * SV_MEM_WIDTH_BYTES],
+                      src_word, key, nonce);
+      fn(unscrambled_data, src_word);
+    }
+  }
 }
 
 void ScrambledEcc32MemArea::ReadBuffer(std::vector<uint8_t> &data,
                                        const uint8_t buf[SV_MEM_WIDTH_BYTES],
                                        uint32_t src_word) const {
-  std::vector<uint8_t> unscrambled_data = ReadUnscrambled(buf, src_word);
+  uint8_t unscrambled_data[SV_MEM_WIDTH_BYTES];
+  ReadUnscrambled(unscrambled_data, buf, src_word, GetScrambleKey(),
+                  GetScrambleNonce());
   // Strip integrity to give final result
-  Ecc32MemArea::ReadBuffer(data, &unscrambled_data[0], src_word);
+  Ecc32MemArea::ReadBuffer(data, unscrambled_data, src_word);
 }
 
 void ScrambledEcc32MemArea::ReadBufferWithIntegrity(
     EccWords &data, const uint8_t buf[SV_MEM_WIDTH_BYTES],
     uint32_t src_word) const {
-  std::vector<uint8_t> unscrambled_data = ReadUnscrambled(buf, src_word);
-  Ecc32MemArea::ReadBufferWithIntegrity(data, &unscrambled_data[0], src_word);
+  uint8_t unscrambled_data[SV_MEM_WIDTH_BYTES];
+  ReadUnscrambled(unscrambled_data, buf, src_word, GetScrambleKey(),
+                  GetScrambleNonce());
+  Ecc32MemArea::ReadBufferWithIntegrity(data, unscrambled_data, src_word);
 }
 
 void ScrambledEcc32MemArea::WriteBufferWithIntegrity(
@@ -192,21 +340,24 @@ void ScrambledEcc32MemArea::WriteBufferWithIntegrity(
 
 void ScrambledEcc32MemArea::ScrambleBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
                                            uint32_t dst_word) const {
-  std::vector<uint8_t> scramble_buf(buf, buf + GetPhysWidthByte());
-
-  // Scramble data with integrity
-  scramble_buf = scramble_encrypt_data(
-      scramble_buf, GetPhysWidth(), 39, AddrIntToBytes(dst_word, addr_width_),
-      addr_width_, GetScrambleNonce(), GetScrambleKey(), repeat_keystream_,
-      false);
+  ScrambleBufferWith(buf, dst_word, GetScrambleKey(), GetScrambleNonce());
+}
 
-  // Copy scrambled data to write buffer
-  std::copy(scramble_buf.begin(), scramble_buf.end(), &buf[0]);
+void ScrambledEcc32MemArea::ScrambleBufferWith(
+    uint8_t buf[SV_MEM_WIDTH_BYTES], uint32_t dst_word,
+    const std::vector<uint8_t> &key, const std::vector<uint8_t> &nonce) const {
+  // Scramble data with integrity (in place)
+  scramble_encrypt_buf(buf, buf, GetPhysWidth(), 39, dst_word, addr_width_,
+                       &nonce[0], &key[0], repeat_keystream_, false);
 }
 
 uint32_t ScrambledEcc32MemArea::ToPhysAddr(uint32_t logical_addr) const {
+  return ToPhysAddrWith(logical_addr, GetScrambleNonce());
+}
+
+uint32_t ScrambledEcc32MemArea::ToPhysAddrWith(
+    uint32_t logical_addr, const std::vector<uint8_t> &nonce) const {
   // Scramble logical address to get physical address
-  return AddrBytesToInt(scramble_addr(AddrIntToBytes(logical_addr, addr_width_),
-                                      addr_width_, GetScrambleNonce(),
-                                      GetNonceWidth()));
+  return scramble_addr_int(logical_addr, addr_width_, &nonce[0],
+                           GetNonceWidth());
 }
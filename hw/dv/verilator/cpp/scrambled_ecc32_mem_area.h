@@ -5,6 +5,7 @@
 #ifndef OPENTITAN_HW_DV_VERILATOR_CPP_SCRAMBLED_ECC32_MEM_AREA_H_
 #define OPENTITAN_HW_DV_VERILATOR_CPP_SCRAMBLED_ECC32_MEM_AREA_H_
 
+#include <functional>
 #include <vector>
 
 #include "ecc32_mem_area.h"
@@ -32,13 +33,60 @@ class ScrambledEcc32MemArea : public Ecc32MemArea {
   ScrambledEcc32MemArea(const std::string &scope, uint32_t size,
                         uint32_t width_32, bool repeat_keystream = true);
 
+  const char *GetKind() const override { return "scrambled"; }
+
+  /** Write data to this memory area at the given word offset
+   *
+   * This behaves like MemArea::Write, but reads the scrambling key and nonce
+   * once and then computes the physical contents of every word (integrity
+   * bits followed by scrambling) in a pool of worker threads before passing
+   * them to the simulation in blocks.
+   */
+  void Write(uint32_t word_offset,
+             const std::vector<uint8_t> &data) const override;
+
+  /** Read data from this memory area, starting at the given offset
+   *
+   * This behaves like MemArea::Read, but reads the scrambling key and nonce
+   * once for the whole read rather than once per word.
+   */
+  std::vector<uint8_t> Read(uint32_t word_offset,
+                            uint32_t num_words) const override;
+
+  /** Read data with validity bits, starting at the given offset
+   *
+   * As with Read, the key and nonce are only read once.
+   */
+  EccWords ReadWithIntegrity(uint32_t word_offset,
+                             uint32_t num_words) const override;
+
+  /** Write data with validity bits, starting at the given offset
+   *
+   * As with Write, the key and nonce are only read once.
+   */
+  void WriteWithIntegrity(uint32_t word_offset,
+                          const EccWords &data) const override;
+
  private:
   void WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
                    const std::vector<uint8_t> &data, size_t start_idx,
                    uint32_t dst_word) const override;
 
-  std::vector<uint8_t> ReadUnscrambled(const uint8_t buf[SV_MEM_WIDTH_BYTES],
-                                       uint32_t src_word) const;
+  // Unscramble the physical memory contents in buf for the logical address
+  // src_word, writing the result (with integrity bits) to dst. This doesn't
+  // make any DPI calls.
+  void ReadUnscrambled(uint8_t dst[SV_MEM_WIDTH_BYTES],
+                       const uint8_t buf[SV_MEM_WIDTH_BYTES],
+                       uint32_t src_word, const std::vector<uint8_t> &key,
+                       const std::vector<uint8_t> &nonce) const;
+
+  // Read num_words physical words starting at the logical address
+  // word_offset, in blocks, with their addresses scrambled by nonce. For each
+  // word, call fn with its unscrambled contents (with integrity bits) and its
+  // logical address.
+  void ReadUnscrambledBlocks(
+      uint32_t word_offset, uint32_t num_words,
+      const std::function<void(const uint8_t *, uint32_t)> &fn) const;
 
   void ReadBuffer(std::vector<uint8_t> &data,
                   const uint8_t buf[SV_MEM_WIDTH_BYTES],
@@ -54,8 +102,24 @@ class ScrambledEcc32MemArea : public Ecc32MemArea {
 
   void ScrambleBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES], uint32_t dst_word) const;
 
+  /** Scramble buf in place with an explicitly supplied key and nonce
+   *
+   * Unlike ScrambleBuffer, this doesn't make any DPI calls so it's safe to
+   * call from threads other than the simulation thread.
+   */
+  void ScrambleBufferWith(uint8_t buf[SV_MEM_WIDTH_BYTES], uint32_t dst_word,
+                          const std::vector<uint8_t> &key,
+                          const std::vector<uint8_t> &nonce) const;
+
   uint32_t ToPhysAddr(uint32_t logical_addr) const override;
 
+  /** Scramble a logical address with an explicitly supplied nonce
+   *
+   * Like ScrambleBufferWith, this doesn't make any DPI calls.
+   */
+  uint32_t ToPhysAddrWith(uint32_t logical_addr,
+                          const std::vector<uint8_t> &nonce) const;
+
   uint32_t GetPhysWidth() const;
   uint32_t GetPhysWidthByte() const;
   uint32_t GetPrinceReplications() const;
@@ -80,6 +80,11 @@ static void PrintHelp() {
                "  Print registered memory regions\n\n"
                "--verbose-mem-load\n"
                "  Print a message for each memory load\n\n"
+               "--mem-benchmark\n"
+               "  Measure DPI transfer rates for all memory regions and exit\n"
+               "  (clobbers the memory contents)\n\n"
+               "--no-mem-block-transfers\n"
+               "  Transfer memory contents over DPI one word at a time\n\n"
                "-h|--help\n"
                "  Show help\n\n";
 }
@@ -102,11 +107,14 @@ bool VerilatorMemUtil::ParseCLIArguments(int argc, char **argv,
       {"meminit", required_argument, nullptr, 'l'},
       {"verbose-mem-load", no_argument, nullptr, 'V'},
       {"load-elf", required_argument, nullptr, 'E'},
+      {"mem-benchmark", no_argument, nullptr, 'B'},
+      {"no-mem-block-transfers", no_argument, nullptr, 'W'},
       {"help", no_argument, nullptr, 'h'},
       {nullptr, no_argument, nullptr, 0}};
 
   std::vector<LoadArg> load_args;
   bool verbose = false;
+  bool run_benchmark = false;
 
   // Reset the command parsing index in-case other utils have already parsed
   // some arguments
@@ -162,6 +170,12 @@ bool VerilatorMemUtil::ParseCLIArguments(int argc, char **argv,
         load_args.push_back(
             {.name = "", .filepath = optarg, .type = kMemImageElf});
         break;
+      case 'B':
+        run_benchmark = true;
+        break;
+      case 'W':
+        MemArea::SetBlockTransfersEnabled(false);
+        break;
       case 'h':
         PrintHelp();
         return true;
@@ -175,6 +189,17 @@ bool VerilatorMemUtil::ParseCLIArguments(int argc, char **argv,
     }
   }
 
+  if (run_benchmark) {
+    try {
+      mem_util_->RunMemBenchmark();
+    } catch (const std::exception &err) {
+      std::cerr << "ERROR: " << err.what() << std::endl;
+      return false;
+    }
+    exit_app = true;
+    return true;
+  }
+
   for (const LoadArg &arg : load_args) {
     try {
       if (!arg.name.empty()) {
@@ -192,3 +217,18 @@ bool VerilatorMemUtil::ParseCLIArguments(int argc, char **argv,
 
   return true;
 }
+
+void VerilatorMemUtil::PrepareBatch(const std::vector<std::string> &elf_paths) {
+  // Parse the ELF files once, rather than once per job.
+  for (const std::string &path : elf_paths) {
+    mem_util_->CacheElf(false, path);
+  }
+}
+
+void VerilatorMemUtil::SaveCheckpoint(std::ostream &os) {
+  mem_util_->SaveMemories(os);
+}
+
+void VerilatorMemUtil::RestoreCheckpoint(std::istream &is) {
+  mem_util_->RestoreMemories(is);
+}
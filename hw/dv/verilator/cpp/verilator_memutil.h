@@ -22,6 +22,12 @@ class VerilatorMemUtil : public SimCtrlExtension {
 
   // Declared in SimCtrlExtension
   bool ParseCLIArguments(int argc, char **argv, bool &exit_app) override;
+  void SaveCheckpoint(std::ostream &os) override;
+  void RestoreCheckpoint(std::istream &is) override;
+  void PrepareBatch(const std::vector<std::string> &elf_paths) override;
+  // Memory loading happens before the simulation runs: there's nothing to do
+  // on clock edges.
+  unsigned long GetClockPeriod() const override { return 0; }
 
   // Get underlying DpiMemUtil object
   DpiMemUtil *GetUnderlying() { return mem_util_; }
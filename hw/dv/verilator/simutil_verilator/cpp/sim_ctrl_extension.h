@@ -5,6 +5,10 @@
 #ifndef OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_SIM_CTRL_EXTENSION_H_
 #define OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_SIM_CTRL_EXTENSION_H_
 
+#include <iostream>
+#include <string>
+#include <vector>
+
 class SimCtrlExtension {
  public:
   virtual ~SimCtrlExtension() = default;
@@ -29,20 +33,65 @@ class SimCtrlExtension {
     return true;
   }
 
+  /**
+   * Function to be called before the jobs of a batch run are started
+   *
+   * In batch mode (see VerilatorSimCtrl::RunBatch()), each job runs in a
+   * process forked from the batch process, and loads one of the ELF files in
+   * elf_paths. Extensions can prepare shared data here, such as parsing these
+   * files once. If something goes wrong, throw a std::exception.
+   */
+  virtual void PrepareBatch(const std::vector<std::string> &elf_paths) {}
+
   /**
    * Function to be called prior to executing the simulation
    */
   virtual void PreExec() {}
 
   /**
-   * Function to be called every clock cycle
+   * Function to be called on rising clock edges
+   *
+   * This is called every GetClockPeriod() cycles, and on the cycles requested
+   * with VerilatorSimCtrl::ScheduleOnClock().
+   *
+   * Extensions can start tracing from here when they observe an event of
+   * interest (see VerilatorSimCtrl::TriggerTrace()).
    */
   virtual void OnClock(unsigned long sim_time) {}
 
+  /**
+   * Get the number of clock cycles between calls to OnClock()
+   *
+   * The default of 1 calls OnClock() every cycle. Extensions which only need
+   * to act occasionally should return a larger period, or 0 to only be called
+   * on the cycles they request with VerilatorSimCtrl::ScheduleOnClock().
+   * The period is read once, when the simulation starts.
+   */
+  virtual unsigned long GetClockPeriod() const { return 1; }
+
   /**
    * Function to be called after executing the simulation
    */
   virtual void PostExec() {}
+
+  /**
+   * Function to be called when saving a checkpoint of the simulation
+   *
+   * The state of the simulated design is saved by the simulation controller.
+   * Extensions that keep other state (or that want to save it in a different
+   * form) should write it to os. If something goes wrong, throw a
+   * std::exception.
+   */
+  virtual void SaveCheckpoint(std::ostream &os) {}
+
+  /**
+   * Function to be called when restoring a checkpoint of the simulation
+   *
+   * This runs after the state of the simulated design has been restored. is
+   * contains exactly the data that was written by SaveCheckpoint(). If
+   * something goes wrong, throw a std::exception.
+   */
+  virtual void RestoreCheckpoint(std::istream &is) {}
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_SIM_CTRL_EXTENSION_H_
@@ -9,6 +9,7 @@
 #error "TOPLEVEL_NAME must be set to the name of the toplevel."
 #endif
 
+#include <string>
 #include <verilated.h>
 
 #define STR(s) #s
@@ -43,6 +44,24 @@
 #endif
 #endif
 
+// The asynchronous trace writer (see verilator_trace_writer.h) replaces the
+// file backend of the VCD tracer. The FST tracer doesn't support this.
+#if VM_TRACE == 1 && !defined(VM_TRACE_FMT_FST)
+#define VM_TRACE_WRITER 1
+#else
+#define VM_TRACE_WRITER 0
+#endif
+
+// VM_SAVABLE must be set by the user when calling Verilator with --savable.
+// It enables saving and restoring the state of the model in checkpoints.
+#ifndef VM_SAVABLE
+#define VM_SAVABLE 0
+#endif
+
+#if VM_SAVABLE == 1
+#include "verilated_save.h"
+#endif
+
 #if VM_TRACE == 1
 /**
  * "Base" for all tracers in Verilator with common functionality
@@ -67,6 +86,36 @@ class VerilatedTracer {
 
   void dump(vluint64_t timeui) { impl_->dump(timeui); }
 
+  void flush() { impl_->flush(); }
+
+  /**
+   * Only trace the signals in scope hier (and levels below it)
+   *
+   * This must be called before the trace is opened. The first call restricts
+   * the trace to hier, further calls add more scopes.
+   */
+  void dumpvars(int levels, const std::string &hier) {
+    impl_->dumpvars(levels, hier);
+  }
+
+#if VM_TRACE_WRITER == 1
+  /**
+   * Write the trace through filep instead of a file
+   *
+   * This must be called before the trace is opened.
+   */
+  void setFile(VerilatedVcdFile *filep) {
+    assert(!isOpen());
+    delete impl_;
+    impl_ = new VerilatedVcdC(filep);
+  }
+
+  /**
+   * Close the trace and open it again, starting with a full dump
+   */
+  void openNext() { impl_->openNext(false); }
+#endif
+
   operator VM_TRACE_CLASS_NAME *() const {
     assert(impl_);
     return impl_;
@@ -87,6 +136,8 @@ class VerilatedTracer {
   void open(const char *filename){};
   void close(){};
   void dump(vluint64_t timeui) {}
+  void flush(){};
+  void dumpvars(int levels, const std::string &hier){};
 };
 #endif  // VM_TRACE == 1
 
@@ -122,6 +173,10 @@ class VerilatedToplevel {
   virtual void final() = 0;
   virtual const char *name() const = 0;
   virtual void trace(VerilatedTracer &tfp, int levels, int options) = 0;
+#if VM_SAVABLE == 1
+  virtual void save(VerilatedSerialize &os) = 0;
+  virtual void restore(VerilatedDeserialize &os) = 0;
+#endif
 
   /**
    * Get the Verilator-generated device under test
@@ -150,6 +205,14 @@ class TOPLEVEL_NAME : public VERILATED_TOPLEVEL_NAME, public VerilatedToplevel {
     assert(0 && "Tracing not enabled.");
 #endif
   }
+#if VM_SAVABLE == 1
+  void save(VerilatedSerialize &os) {
+    os << *static_cast<VERILATED_TOPLEVEL_NAME *>(this);
+  }
+  void restore(VerilatedDeserialize &os) {
+    os >> *static_cast<VERILATED_TOPLEVEL_NAME *>(this);
+  }
+#endif
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_VERILATED_TOPLEVEL_H_
@@ -4,17 +4,147 @@
 
 #include "verilator_sim_ctrl.h"
 
+#include <algorithm>
+#include <climits>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
 #include <getopt.h>
+#include <iomanip>
 #include <iostream>
+#include <sched.h>
 #include <signal.h>
+#include <sstream>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <verilated.h>
 
+#include "simctrl_dpi.h"
+
 // This is defined by Verilator and passed through the command line
 #ifndef VM_TRACE
 #define VM_TRACE 0
 #endif
 
+// This must be defined by the user when building with --savable (see
+// verilated_toplevel.h)
+#ifndef VM_SAVABLE
+#define VM_SAVABLE 0
+#endif
+
+// Written at the start of checkpoint data (after the Verilated model) to catch
+// restoring files that weren't written by SaveCheckpoint().
+static const uint32_t kCheckpointMagic = 0x4f54434b;  // "OTCK"
+
+/**
+ * Get the IDs of all threads of this process, in ascending order
+ *
+ * The main thread has the same ID as the process and comes first.
+ */
+static std::vector<pid_t> get_thread_ids() {
+  std::vector<pid_t> tids;
+  DIR *dir = opendir("/proc/self/task");
+  if (!dir) {
+    return tids;
+  }
+  while (struct dirent *entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') {
+      tids.push_back(atoi(entry->d_name));
+    }
+  }
+  closedir(dir);
+  std::sort(tids.begin(), tids.end());
+  return tids;
+}
+
+/**
+ * Get the name of the thread with ID tid
+ */
+static std::string get_thread_name(pid_t tid) {
+  std::ifstream comm("/proc/self/task/" + std::to_string(tid) + "/comm");
+  std::string name;
+  std::getline(comm, name);
+  return name;
+}
+
+/**
+ * Get the user and system CPU time of the thread with ID tid in clock ticks
+ *
+ * @return false if the thread doesn't exist (any more)
+ */
+static bool get_thread_ticks(pid_t tid, unsigned long *ticks) {
+  std::ifstream stat_file("/proc/self/task/" + std::to_string(tid) + "/stat");
+  std::string stat;
+  if (!std::getline(stat_file, stat)) {
+    return false;
+  }
+
+  // The second field is the thread name in parentheses, which might contain
+  // spaces. utime and stime are the 12th and 13th field after it.
+  size_t name_end = stat.rfind(')');
+  if (name_end == std::string::npos) {
+    return false;
+  }
+  std::istringstream fields(stat.substr(name_end + 1));
+  std::string field;
+  for (int i = 0; i < 11; ++i) {
+    fields >> field;
+  }
+  unsigned long utime, stime;
+  if (!(fields >> utime >> stime)) {
+    return false;
+  }
+  *ticks = utime + stime;
+  return true;
+}
+
+/**
+ * Get the CPU time of all threads of this process in clock ticks
+ */
+static std::map<pid_t, unsigned long> get_all_thread_ticks() {
+  std::map<pid_t, unsigned long> all_ticks;
+  for (pid_t tid : get_thread_ids()) {
+    unsigned long ticks;
+    if (get_thread_ticks(tid, &ticks)) {
+      all_ticks[tid] = ticks;
+    }
+  }
+  return all_ticks;
+}
+
+/**
+ * Quote and escape str as a JSON string
+ */
+static std::string json_string(const std::string &str) {
+  std::ostringstream oss;
+  oss << '"';
+  for (char c : str) {
+    switch (c) {
+      case '"':
+        oss << "\\\"";
+        break;
+      case '\\':
+        oss << "\\\\";
+        break;
+      case '\n':
+        oss << "\\n";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          oss << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+              << static_cast<int>(c) << std::dec << std::setfill(' ');
+        } else {
+          oss << c;
+        }
+    }
+  }
+  oss << '"';
+  return oss.str();
+}
+
 /**
  * Get the current simulation time
  *
@@ -34,6 +164,31 @@ void vl_stop(const char *filename, int linenum, const char *hier) VL_MT_UNSAFE {
 }
 #endif
 
+/**
+ * Record a DPI context for checkpoints (see simctrl_dpi.h)
+ */
+extern "C" void simctrl_register_dpi_context(const char *name, void *ctx,
+                                             const simctrl_dpi_hooks_t *hooks) {
+  VerilatorSimCtrl::GetInstance().RegisterDpiContext(name, ctx, hooks);
+}
+
+bool simctrl_dpi_contexts_restored = false;
+
+/**
+ * Map a context pointer from a restored design (see simctrl_dpi.h)
+ */
+extern "C" void *simctrl_restored_dpi_context(void *handle) {
+  return VerilatorSimCtrl::GetInstance().RestoredDpiContext(handle);
+}
+
+/**
+ * Start tracing from the design or a DPI model (see simctrl_dpi.h)
+ */
+extern "C" void simctrl_trigger_trace(int num_cycles) {
+  VerilatorSimCtrl::GetInstance().TriggerTrace(num_cycles > 0 ? num_cycles
+                                                              : 0);
+}
+
 VerilatorSimCtrl &VerilatorSimCtrl::GetInstance() {
   static VerilatorSimCtrl instance;
   return instance;
@@ -56,6 +211,15 @@ std::pair<int, bool> VerilatorSimCtrl::Exec(int argc, char **argv) {
 
   RunSimulation();
 
+  // Report the result to the batch process
+  if (batch_result_) {
+    batch_result_->success = WasSimulationSuccessful();
+    batch_result_->timed_out = timed_out_;
+    batch_result_->cycles = time_ / 2;
+    batch_result_->exec_time_ms = GetExecutionTimeMs();
+    batch_result_->done = true;
+  }
+
   int retcode = WasSimulationSuccessful() ? 0 : 1;
   return std::make_pair(retcode, true);
 }
@@ -111,6 +275,17 @@ bool VerilatorSimCtrl::ParseCommandArgs(int argc, char **argv, bool &exit_app) {
   const struct option long_options[] = {
       {"term-after-cycles", required_argument, nullptr, 'c'},
       {"trace", optional_argument, nullptr, 't'},
+      {"trace-async", no_argument, nullptr, 'a'},
+      {"trace-buffer", required_argument, nullptr, 'b'},
+      {"trace-flight-recorder", required_argument, nullptr, 'F'},
+      {"trace-start", required_argument, nullptr, 'x'},
+      {"trace-stop", required_argument, nullptr, 'y'},
+      {"trace-depth", required_argument, nullptr, 'd'},
+      {"trace-scope", required_argument, nullptr, 's'},
+      {"save-checkpoint", required_argument, nullptr, 'S'},
+      {"restore-checkpoint", required_argument, nullptr, 'R'},
+      {"threads", required_argument, nullptr, 'T'},
+      {"thread-affinity", required_argument, nullptr, 'A'},
       {"help", no_argument, nullptr, 'h'},
       {nullptr, no_argument, nullptr, 0}};
 
@@ -139,12 +314,113 @@ bool VerilatorSimCtrl::ParseCommandArgs(int argc, char **argv, bool &exit_app) {
         }
         TraceOn();
         break;
+      case 'a':
+        if (!CheckTraceWriterPossible("trace-async")) {
+          exit_app = true;
+          return false;
+        }
+        trace_async_ = true;
+        break;
+      case 'b':
+        if (!CheckTraceWriterPossible("trace-buffer") ||
+            !read_ul_arg(&trace_buffer_mb_, "trace-buffer", optarg)) {
+          exit_app = true;
+          return false;
+        }
+        break;
+      case 'F':
+        if (!CheckTraceWriterPossible("trace-flight-recorder") ||
+            !read_ul_arg(&flight_recorder_cycles_, "trace-flight-recorder",
+                         optarg)) {
+          exit_app = true;
+          return false;
+        }
+        if (flight_recorder_cycles_ == 0) {
+          std::cerr << "ERROR: trace-flight-recorder must keep at least one "
+                       "cycle."
+                    << std::endl;
+          exit_app = true;
+          return false;
+        }
+        // The flight recorder traces all the time, but only writes the trace
+        // file on request.
+        TraceOn();
+        break;
+      case 'x':
+      case 'y':
+      case 'd':
+      case 's':
+        if (!tracing_possible_) {
+          std::cerr << "ERROR: Tracing has not been enabled at compile time."
+                    << std::endl;
+          exit_app = true;
+          return false;
+        }
+        if ((c == 'x' &&
+             !read_ul_arg(&trace_start_cycle_, "trace-start", optarg)) ||
+            (c == 'y' &&
+             !read_ul_arg(&trace_stop_cycle_, "trace-stop", optarg)) ||
+            (c == 'd' &&
+             !read_ul_arg(&trace_depth_, "trace-depth", optarg))) {
+          exit_app = true;
+          return false;
+        }
+        if (c == 's') {
+#if VERILATOR_VERSION_INTEGER >= 5004000
+          trace_scopes_.push_back(optarg);
+#else
+          std::cerr << "ERROR: --trace-scope needs Verilator 5.004 or newer."
+                    << std::endl;
+          exit_app = true;
+          return false;
+#endif
+        }
+        break;
       case 'c':
         if (!read_ul_arg(&term_after_cycles_, "term-after-cycles", optarg)) {
           exit_app = true;
           return false;
         }
         break;
+      case 'S':
+      case 'R':
+        if (!VM_SAVABLE) {
+          std::cerr << "ERROR: Checkpoints have not been enabled at compile "
+                       "time."
+                    << std::endl;
+          exit_app = true;
+          return false;
+        }
+        if (c == 'R') {
+          restore_checkpoint_path_.assign(optarg);
+        } else if (!ParseSaveCheckpointArg(optarg)) {
+          exit_app = true;
+          return false;
+        }
+        break;
+      case 'T': {
+        unsigned long num_threads;
+        if (!read_ul_arg(&num_threads, "threads", optarg)) {
+          exit_app = true;
+          return false;
+        }
+        // The thread count has been applied by ParseThreadArgs() already if
+        // the simulation supports it. Otherwise, check if the model happens
+        // to run with the requested number of threads.
+        if (!num_threads_applied_ || num_threads != num_threads_) {
+          if (!SetThreads(num_threads)) {
+            exit_app = true;
+            return false;
+          }
+        }
+        break;
+      }
+      case 'A':
+        if (!ParseThreadAffinityArg(optarg)) {
+          exit_app = true;
+          return false;
+        }
+        break;
       case 'h':
         PrintHelp();
         exit_app = true;
@@ -160,6 +436,19 @@ bool VerilatorSimCtrl::ParseCommandArgs(int argc, char **argv, bool &exit_app) {
     }
   }
 
+  if (trace_stop_cycle_ && trace_stop_cycle_ <= trace_start_cycle_) {
+    std::cerr << "ERROR: trace-stop must be after trace-start." << std::endl;
+    exit_app = true;
+    return false;
+  }
+  // With --trace-start, tracing begins at the given cycle (also if --trace
+  // was given to choose the trace file).
+  if (trace_start_cycle_) {
+    tracing_enabled_ = false;
+    tracing_enabled_changed_ = false;
+    tracing_ever_enabled_ = false;
+  }
+
   // Pass args to verilator
   Verilated::commandArgs(argc, argv);
 
@@ -176,11 +465,348 @@ bool VerilatorSimCtrl::ParseCommandArgs(int argc, char **argv, bool &exit_app) {
   return true;
 }
 
+bool VerilatorSimCtrl::ParseThreadArgs(int argc, char **argv,
+                                       bool &exit_app) {
+  const struct option long_options[] = {
+      {"threads", required_argument, nullptr, 'T'},
+      {nullptr, no_argument, nullptr, 0}};
+
+  // Disable error reporting by getopt: all other arguments are handled later
+  opterr = 0;
+  bool success = true;
+  while (1) {
+    int c = getopt_long(argc, argv, "-:", long_options, nullptr);
+    if (c == -1) {
+      break;
+    }
+    if (c != 'T') {
+      continue;
+    }
+
+    unsigned long num_threads;
+    if (!read_ul_arg(&num_threads, "threads", optarg) ||
+        !SetThreads(num_threads)) {
+      success = false;
+      break;
+    }
+    num_threads_applied_ = true;
+  }
+
+  // Allow ParseCommandArgs() to parse all arguments again
+  optind = 1;
+  if (!success) {
+    exit_app = true;
+  }
+  return success;
+}
+
+bool VerilatorSimCtrl::RunBatch(int &argc, char **&argv, bool &exit_app) {
+  const struct option long_options[] = {
+      {"batch", required_argument, nullptr, 'M'},
+      {"batch-jobs", required_argument, nullptr, 'J'},
+      {"batch-out", required_argument, nullptr, 'O'},
+      {nullptr, no_argument, nullptr, 0}};
+
+  // Disable error reporting by getopt: all other arguments are handled later
+  opterr = 0;
+  bool good_cmdline = true;
+  while (1) {
+    int c = getopt_long(argc, argv, "-:", long_options, nullptr);
+    if (c == -1) {
+      break;
+    }
+    if (c == 'M') {
+      batch_manifest_path_.assign(optarg);
+    } else if (c == 'O') {
+      batch_out_dir_.assign(optarg);
+    } else if (c == 'J') {
+      good_cmdline &= read_ul_arg(&batch_num_procs_, "batch-jobs", optarg);
+    }
+  }
+  optind = 1;
+
+  if (!good_cmdline) {
+    exit_app = true;
+    return false;
+  }
+  if (batch_manifest_path_.empty()) {
+    return true;
+  }
+
+  std::vector<BatchJob> jobs;
+  if (!ReadBatchManifest(batch_manifest_path_, jobs)) {
+    exit_app = true;
+    return false;
+  }
+
+  std::vector<std::string> elf_paths;
+  for (const BatchJob &job : jobs) {
+    if (std::find(elf_paths.begin(), elf_paths.end(), job.elf_path) ==
+        elf_paths.end()) {
+      elf_paths.push_back(job.elf_path);
+    }
+  }
+  for (SimCtrlExtension *ext : extension_array_) {
+    try {
+      ext->PrepareBatch(elf_paths);
+    } catch (const std::exception &err) {
+      std::cerr << "ERROR: " << err.what() << std::endl;
+      exit_app = true;
+      return false;
+    }
+  }
+
+  if (mkdir(batch_out_dir_.c_str(), 0777) != 0 && errno != EEXIST) {
+    std::cerr << "ERROR: Cannot create batch output directory `"
+              << batch_out_dir_ << "': " << strerror(errno) << std::endl;
+    exit_app = true;
+    return false;
+  }
+
+  // The job processes write their results to shared memory.
+  size_t results_size = jobs.size() * sizeof(BatchJobResult);
+  void *results_mem = mmap(nullptr, results_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (results_mem == MAP_FAILED) {
+    std::cerr << "ERROR: Cannot allocate memory for batch results: "
+              << strerror(errno) << std::endl;
+    exit_app = true;
+    return false;
+  }
+  BatchJobResult *results = static_cast<BatchJobResult *>(results_mem);
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    results[i] = BatchJobResult();
+  }
+
+  unsigned long num_procs = batch_num_procs_;
+  if (num_procs == 0) {
+    num_procs = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+  }
+  std::cout << "Running " << jobs.size() << " batch jobs with " << num_procs
+            << " processes." << std::endl;
+
+  // Start a process for the next job whenever fewer than num_procs are
+  // running.
+  std::map<pid_t, size_t> running;
+  size_t next_job = 0, num_finished = 0, num_passed = 0;
+  while (next_job < jobs.size() || !running.empty()) {
+    while (next_job < jobs.size() && running.size() < num_procs) {
+      size_t job_idx = next_job++;
+      std::cout.flush();
+      std::cerr.flush();
+      pid_t pid = fork();
+      if (pid == 0) {
+        // Continue with the job in the child process
+        exit_app = !SetupBatchJob(jobs[job_idx], job_idx, &results[job_idx],
+                                  argc, argv);
+        return !exit_app;
+      }
+      if (pid < 0) {
+        std::cerr << "ERROR: Cannot start batch job " << job_idx << ": "
+                  << strerror(errno) << std::endl;
+        ++num_finished;
+        continue;
+      }
+      running[pid] = job_idx;
+    }
+
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    auto it = running.find(pid);
+    if (it == running.end()) {
+      continue;
+    }
+    size_t job_idx = it->second;
+    running.erase(it);
+
+    const BatchJobResult &result = results[job_idx];
+    ++num_finished;
+    std::cout << "[" << num_finished << "/" << jobs.size() << "] "
+              << jobs[job_idx].elf_path << ": ";
+    if (!result.done) {
+      std::cout << "crashed";
+    } else {
+      num_passed += result.success && !result.timed_out;
+      std::cout << (result.timed_out ? "timeout"
+                                     : result.success ? "passed" : "failed")
+                << " after " << result.cycles << " cycles";
+    }
+    std::cout << " (log: " << GetBatchLogPath(job_idx) << ")" << std::endl;
+  }
+
+  bool summary_written = WriteBatchSummary(jobs, results);
+  munmap(results_mem, results_size);
+
+  std::cout << std::endl
+            << num_passed << " of " << jobs.size() << " batch jobs passed."
+            << std::endl
+            << "Summary written to " << batch_out_dir_ << "/summary.json"
+            << std::endl;
+
+  exit_app = true;
+  return summary_written && num_passed == jobs.size();
+}
+
+bool VerilatorSimCtrl::ReadBatchManifest(const std::string &path,
+                                         std::vector<BatchJob> &jobs) const {
+  std::ifstream manifest(path);
+  if (!manifest) {
+    std::cerr << "ERROR: Cannot open batch manifest `" << path << "'."
+              << std::endl;
+    return false;
+  }
+
+  std::string line;
+  unsigned int line_num = 0;
+  while (std::getline(manifest, line)) {
+    ++line_num;
+    std::istringstream fields(line);
+    BatchJob job;
+    std::string timeout_str;
+    if (!(fields >> job.elf_path) || job.elf_path[0] == '#') {
+      continue;
+    }
+    if (!(fields >> timeout_str) ||
+        !read_ul_arg(&job.timeout_cycles, "batch timeout",
+                     timeout_str.c_str())) {
+      std::cerr << "ERROR: Line " << line_num << " of batch manifest `"
+                << path << "' must be in the format `ELF TIMEOUT [ARGS...]'."
+                << std::endl;
+      return false;
+    }
+    std::string arg;
+    while (fields >> arg) {
+      job.args.push_back(arg);
+    }
+    jobs.push_back(job);
+  }
+
+  if (jobs.empty()) {
+    std::cerr << "ERROR: Batch manifest `" << path << "' contains no jobs."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool VerilatorSimCtrl::SetupBatchJob(const BatchJob &job, size_t job_idx,
+                                     BatchJobResult *result, int &argc,
+                                     char **&argv) {
+  batch_result_ = result;
+
+  std::string log_path = GetBatchLogPath(job_idx);
+  int log_fd = open(log_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  if (log_fd < 0) {
+    std::cerr << "ERROR: Cannot open log file `" << log_path
+              << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+  dup2(log_fd, STDOUT_FILENO);
+  dup2(log_fd, STDERR_FILENO);
+  close(log_fd);
+
+  // Keep the arguments given to the batch process (except for the batch
+  // options) and add those of the job.
+  for (int i = 0; i < argc; ++i) {
+    std::string arg(argv[i]);
+    bool is_batch_arg = false;
+    for (const char *batch_arg : {"--batch", "--batch-jobs", "--batch-out"}) {
+      std::string prefix = std::string(batch_arg) + "=";
+      if (arg == batch_arg || arg.compare(0, prefix.size(), prefix) == 0) {
+        // Also skip the value if it is given as a separate argument
+        i += arg == batch_arg;
+        is_batch_arg = true;
+      }
+    }
+    if (!is_batch_arg) {
+      batch_job_args_.push_back(arg);
+    }
+  }
+  batch_job_args_.push_back("--load-elf=" + job.elf_path);
+  if (job.timeout_cycles) {
+    batch_job_args_.push_back("--term-after-cycles=" +
+                              std::to_string(job.timeout_cycles));
+  }
+  batch_job_args_.insert(batch_job_args_.end(), job.args.begin(),
+                         job.args.end());
+
+  for (std::string &arg : batch_job_args_) {
+    batch_job_argv_.push_back(&arg[0]);
+  }
+  batch_job_argv_.push_back(nullptr);
+  argc = batch_job_args_.size();
+  argv = batch_job_argv_.data();
+
+  std::cout << "Batch job " << job_idx << ":";
+  for (const std::string &arg : batch_job_args_) {
+    std::cout << " " << arg;
+  }
+  std::cout << std::endl;
+  return true;
+}
+
+bool VerilatorSimCtrl::WriteBatchSummary(const std::vector<BatchJob> &jobs,
+                                         const BatchJobResult *results) const {
+  std::string path = batch_out_dir_ + "/summary.json";
+  std::ofstream summary(path);
+  if (!summary) {
+    std::cerr << "ERROR: Cannot write batch summary `" << path << "'."
+              << std::endl;
+    return false;
+  }
+
+  summary << "{\n  \"jobs\": [\n";
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const BatchJob &job = jobs[i];
+    const BatchJobResult &result = results[i];
+
+    const char *status = !result.done       ? "crashed"
+                         : result.timed_out ? "timeout"
+                         : result.success   ? "passed"
+                                            : "failed";
+    double speed_khz =
+        result.exec_time_ms ? result.cycles / (double)result.exec_time_ms : 0;
+
+    summary << "    {\n"
+            << "      \"elf\": " << json_string(job.elf_path) << ",\n"
+            << "      \"args\": [";
+    for (size_t j = 0; j < job.args.size(); ++j) {
+      summary << (j ? ", " : "") << json_string(job.args[j]);
+    }
+    summary << "],\n"
+            << "      \"timeout_cycles\": " << job.timeout_cycles << ",\n"
+            << "      \"status\": \"" << status << "\",\n"
+            << "      \"cycles\": " << result.cycles << ",\n"
+            << "      \"wallclock_s\": " << result.exec_time_ms / 1000.0
+            << ",\n"
+            << "      \"speed_khz\": " << speed_khz << ",\n"
+            << "      \"log\": " << json_string(GetBatchLogPath(i)) << "\n"
+            << "    }" << (i + 1 < jobs.size() ? "," : "") << "\n";
+  }
+  summary << "  ]\n}\n";
+  return summary.good();
+}
+
+std::string VerilatorSimCtrl::GetBatchLogPath(size_t job_idx) const {
+  return batch_out_dir_ + "/job_" + std::to_string(job_idx) + ".log";
+}
+
 void VerilatorSimCtrl::RunSimulation() {
   RegisterSignalHandler();
 
   // Print helper message for tracing
-  if (TracingPossible()) {
+  if (flight_recorder_cycles_) {
+    std::cout << "The flight recorder trace can be written by sending SIGUSR1 "
+                 "to this process:"
+              << std::endl
+              << "$ kill -USR1 " << getpid() << std::endl;
+  } else if (TracingPossible()) {
     std::cout << "Tracing can be toggled by sending SIGUSR1 to this process:"
               << std::endl
               << "$ kill -USR1 " << getpid() << std::endl;
@@ -224,6 +850,78 @@ void VerilatorSimCtrl::RequestStop(bool simulation_success) {
 
 void VerilatorSimCtrl::RegisterExtension(SimCtrlExtension *ext) {
   extension_array_.push_back(ext);
+  ext_last_clock_.push_back(0);
+}
+
+void VerilatorSimCtrl::ScheduleOnClock(SimCtrlExtension *ext,
+                                       unsigned long cycle) {
+  auto it = std::find(extension_array_.begin(), extension_array_.end(), ext);
+  assert(it != extension_array_.end() && "Use RegisterExtension() first.");
+  size_t ext_idx = it - extension_array_.begin();
+
+  // If the extension has been called in this cycle already (e.g. it schedules
+  // itself from OnClock()), call it again on the next rising edge.
+  unsigned long cur_cycle = time_ / 2;
+  if (cycle <= cur_cycle && ext_last_clock_[ext_idx] == cur_cycle + 1) {
+    cycle = cur_cycle + 1;
+  }
+  clock_events_.push({cycle, ext_idx, /*period=*/0});
+}
+
+unsigned long VerilatorSimCtrl::GetMaxSkipCycles() const {
+  unsigned long cycle = time_ / 2;
+  unsigned long max_cycles = ULONG_MAX;
+
+  // The first cycle after the skip that is evaluated is cycle + num_cycles + 1,
+  // which must not be after any cycle that needs attention.
+  unsigned long targets[] = {
+      initial_reset_delay_cycles_,
+      initial_reset_delay_cycles_ + reset_duration_cycles_,
+      save_checkpoint_path_.empty() ? 0 : save_checkpoint_cycle_,
+      trace_start_cycle_,
+      trace_stop_cycle_,
+      term_after_cycles_};
+  for (unsigned long target : targets) {
+    if (target <= cycle) {
+      continue;
+    }
+    max_cycles = std::min(max_cycles, target - cycle - 1);
+  }
+  // Don't skip while the reset is being applied.
+  if (cycle < initial_reset_delay_cycles_ + reset_duration_cycles_) {
+    max_cycles = 0;
+  }
+  return max_cycles;
+}
+
+void VerilatorSimCtrl::SkipCycles(unsigned long num_cycles) {
+  assert(num_cycles <= GetMaxSkipCycles());
+  time_ += 2 * num_cycles;
+  skipped_cycles_ += num_cycles;
+}
+
+void VerilatorSimCtrl::TriggerTrace(unsigned long num_cycles) {
+  if (!TraceOn()) {
+    return;
+  }
+  // Keep the earliest stop, so --trace-stop isn't discarded.
+  if (num_cycles) {
+    unsigned long stop_cycle = time_ / 2 + num_cycles;
+    if (!trace_stop_cycle_ || trace_stop_cycle_ <= time_ / 2 ||
+        stop_cycle < trace_stop_cycle_) {
+      trace_stop_cycle_ = stop_cycle;
+    }
+  }
+}
+
+void VerilatorSimCtrl::RegisterDpiContext(
+    const std::string &name, void *ctx, const struct simctrl_dpi_hooks *hooks) {
+  dpi_contexts_.push_back({name, ctx, hooks});
+}
+
+void *VerilatorSimCtrl::RestoredDpiContext(void *handle) const {
+  auto it = restored_dpi_contexts_.find(handle);
+  return it == restored_dpi_contexts_.end() ? handle : it->second;
 }
 
 VerilatorSimCtrl::VerilatorSimCtrl()
@@ -243,7 +941,24 @@ VerilatorSimCtrl::VerilatorSimCtrl()
       request_stop_(false),
       simulation_success_(true),
       tracer_(VerilatedTracer()),
-      term_after_cycles_(0) {
+      trace_async_(false),
+      trace_buffer_mb_(64),
+      flight_recorder_cycles_(0),
+      trace_start_cycle_(0),
+      trace_stop_cycle_(0),
+      trace_depth_(99),
+      trace_segment_start_(0),
+      flight_recorder_write_requested_(false),
+      term_after_cycles_(0),
+      skipped_cycles_(0),
+      timed_out_(false),
+      batch_out_dir_("batch_out"),
+      batch_num_procs_(0),
+      batch_result_(nullptr),
+      save_checkpoint_cycle_(0),
+      run_start_time_(0),
+      num_threads_(0),
+      num_threads_applied_(false) {
 }
 
 void VerilatorSimCtrl::RegisterSignalHandler() {
@@ -265,7 +980,11 @@ void VerilatorSimCtrl::SignalHandler(int sig) {
       simctrl.RequestStop(true);
       break;
     case SIGUSR1:
-      if (simctrl.TracingEnabled()) {
+      // Files can't be written from a signal handler: Trace() writes the
+      // flight recorder trace from the main loop.
+      if (simctrl.flight_recorder_cycles_) {
+        simctrl.flight_recorder_write_requested_ = true;
+      } else if (simctrl.TracingEnabled()) {
         simctrl.TraceOff();
       } else {
         simctrl.TraceOn();
@@ -281,7 +1000,57 @@ void VerilatorSimCtrl::PrintHelp() const {
                  "   --trace=FILE\n"
                  "  Write a trace file from the start\n\n";
   }
-  std::cout << "-c|--term-after-cycles=N\n"
+  if (VM_TRACE_WRITER) {
+    std::cout << "--trace-async\n"
+                 "  Write the trace file from a separate thread\n\n"
+                 "--trace-buffer=MB\n"
+                 "  Buffer up to MB megabytes of trace data for --trace-async "
+                 "(default: 64)\n\n"
+                 "--trace-flight-recorder=N\n"
+                 "  Keep (at least) the last N cycles of the trace in memory "
+                 "and write\n"
+                 "  them to the trace file at the end of the simulation or on "
+                 "SIGUSR1\n\n";
+  }
+  if (VM_SAVABLE) {
+    std::cout << "--save-checkpoint=CYCLE:FILE\n"
+                 "  Save a checkpoint to FILE once CYCLE cycles have run\n\n"
+                 "--restore-checkpoint=FILE\n"
+                 "  Start the simulation from the checkpoint in FILE\n\n";
+  }
+  if (tracing_possible_) {
+    std::cout << "--trace-start=CYCLE\n"
+                 "  Start tracing at CYCLE (use --trace=FILE to choose the "
+                 "file)\n\n"
+                 "--trace-stop=CYCLE\n"
+                 "  Stop tracing at CYCLE\n\n"
+                 "  Tracing can also be started by the design or a DPI model "
+                 "calling\n"
+                 "  simctrl_trigger_trace(), e.g. with "
+                 "+UARTDPI_TRACE_TRIGGER_<name>=STRING\n"
+                 "  to start when a UART prints STRING.\n\n"
+                 "--trace-depth=N\n"
+                 "  Trace N levels of the hierarchy (default: 99)\n\n"
+                 "--trace-scope=SCOPE\n"
+                 "  Only trace signals in SCOPE and below, e.g. "
+                 "TOP.chip_sim_tb.u_dut.\n"
+                 "  Can be given multiple times. Needs Verilator 5.004 or "
+                 "newer.\n\n";
+  }
+  std::cout << "--batch=MANIFEST\n"
+               "  Run the jobs in MANIFEST, one per line as "
+               "`ELF TIMEOUT [ARGS...]'\n\n"
+               "--batch-jobs=N\n"
+               "  Run up to N batch jobs at the same time (default: number "
+               "of CPUs)\n\n"
+               "--batch-out=DIR\n"
+               "  Write job logs and summary.json to DIR (default: "
+               "batch_out)\n\n"
+               "--threads=N\n"
+               "  Evaluate the model with N threads (requires Verilator 5)\n\n"
+               "--thread-affinity=LIST\n"
+               "  Pin the simulation threads to the CPUs in LIST (e.g. 0-3,8)\n\n"
+               "-c|--term-after-cycles=N\n"
                "  Terminate simulation after N cycles. 0 means no timeout.\n\n"
                "-h|--help\n"
                "  Show help\n\n"
@@ -310,22 +1079,72 @@ bool VerilatorSimCtrl::TraceOff() {
 }
 
 void VerilatorSimCtrl::PrintStatistics() const {
-  double speed_hz = time_ / 2 / (GetExecutionTimeMs() / 1000.0);
+  // Cycles before a restored checkpoint weren't run by this process
+  unsigned long run_cycles = (time_ - run_start_time_) / 2;
+  double speed_hz = run_cycles / (GetExecutionTimeMs() / 1000.0);
   double speed_khz = speed_hz / 1000.0;
 
   std::cout << std::endl
             << "Simulation statistics" << std::endl
-            << "=====================" << std::endl
-            << "Executed cycles:  " << std::dec << time_ / 2 << std::endl
+            << "=====================" << std::endl;
+  if (run_start_time_) {
+    std::cout << "Restored at cycle: " << std::dec << run_start_time_ / 2
+              << std::endl;
+  }
+  std::cout << "Executed cycles:  " << std::dec << run_cycles << std::endl
             << "Wallclock time:   " << GetExecutionTimeMs() / 1000.0 << " s"
             << std::endl
             << "Simulation speed: " << speed_hz << " cycles/s "
             << "(" << speed_khz << " kHz)" << std::endl;
+  if (skipped_cycles_ && run_cycles) {
+    std::cout << "Skipped cycles:   " << skipped_cycles_ << " ("
+              << std::fixed << std::setprecision(1)
+              << 100.0 * skipped_cycles_ / run_cycles << " %)"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+  }
 
   int trace_size_byte;
   if (tracing_enabled_ && FileSize(GetTraceFileName(), trace_size_byte)) {
     std::cout << "Trace file size:  " << trace_size_byte << " B" << std::endl;
   }
+#if VM_TRACE_WRITER == 1
+  if (trace_writer_ && trace_async_) {
+    std::cout << "Trace writer stalls: " << trace_writer_->GetStallCount()
+              << std::endl;
+  }
+#endif
+
+  PrintThreadStatistics();
+}
+
+void VerilatorSimCtrl::PrintThreadStatistics() const {
+  if (thread_ticks_end_.empty()) {
+    return;
+  }
+
+  long ticks_per_s = sysconf(_SC_CLK_TCK);
+  double exec_time_s = GetExecutionTimeMs() / 1000.0;
+
+  std::cout << std::endl
+            << "Thread statistics (CPU time during the run)" << std::endl;
+  for (const auto &end : thread_ticks_end_) {
+    // Threads that were started during the run have used no CPU time before
+    auto begin = thread_ticks_begin_.find(end.first);
+    unsigned long ticks =
+        end.second -
+        (begin == thread_ticks_begin_.end() ? 0 : begin->second);
+    double cpu_time_s = ticks / static_cast<double>(ticks_per_s);
+
+    std::cout << "  Thread " << std::setw(7) << std::left << end.first
+              << std::setw(16) << get_thread_name(end.first) << std::right
+              << cpu_time_s << " s";
+    if (exec_time_s > 0) {
+      std::cout << " (" << std::fixed << std::setprecision(1)
+                << 100.0 * cpu_time_s / exec_time_s << " %)"
+                << std::defaultfloat << std::setprecision(6);
+    }
+    std::cout << std::endl;
+  }
 }
 
 std::string VerilatorSimCtrl::GetTraceFileName() const {
@@ -337,20 +1156,56 @@ void VerilatorSimCtrl::Run() {
 
   // We always need to enable this as tracing can be enabled at runtime
   if (tracing_possible_) {
+    SetupTraceWriter();
     Verilated::traceEverOn(true);
-    top_->trace(tracer_, 99, 0);
+    top_->trace(tracer_, trace_depth_, 0);
+#if VERILATOR_VERSION_INTEGER >= 5004000
+    // A level of 0 would clear the filter rather than add to it.
+    for (const std::string &scope : trace_scopes_) {
+      tracer_.dumpvars(trace_depth_ ? trace_depth_ : 99, scope);
+    }
+#endif
   }
 
   // Evaluate all initial blocks, including the DPI setup routines
   top_->eval();
 
+  // Fail early rather than at the checkpoint cycle if the DPI models have
+  // set up state that can't be checkpointed.
+  if (!save_checkpoint_path_.empty() && !CheckpointsPossible("save")) {
+    RequestStop(false);
+    time_begin_ = time_end_ = std::chrono::steady_clock::now();
+    return;
+  }
+
+  // Restore the model on top of the state computed by the initial blocks
+  bool restored = false;
+  if (!restore_checkpoint_path_.empty()) {
+    if (!RestoreCheckpoint(restore_checkpoint_path_)) {
+      RequestStop(false);
+      time_begin_ = time_end_ = std::chrono::steady_clock::now();
+      return;
+    }
+    restored = true;
+  }
+  run_start_time_ = time_;
+
+  // All threads of the model (and the DPI models) exist by now
+  ApplyThreadAffinity();
+
   std::cout << std::endl
             << "Simulation running, end by pressing CTRL-c." << std::endl;
 
+  thread_ticks_begin_ = get_all_thread_ticks();
   time_begin_ = std::chrono::steady_clock::now();
-  UnsetReset();
+  // A restored model has its own value for the reset signal
+  if (!restored) {
+    UnsetReset();
+  }
   Trace();
 
+  SchedulePeriodicClockEvents(time_ / 2);
+
   unsigned long start_reset_cycle_ = initial_reset_delay_cycles_;
   unsigned long end_reset_cycle_ = start_reset_cycle_ + reset_duration_cycles_;
 
@@ -363,14 +1218,14 @@ void VerilatorSimCtrl::Run() {
       UnsetReset();
     }
 
+    UpdateTraceWindow();
+
     *sig_clk_ = !*sig_clk_;
 
-    // Call all extension on-clock methods
-    if (*sig_clk_) {
-      for (auto it = extension_array_.begin(); it != extension_array_.end();
-           ++it) {
-        (*it)->OnClock(time_);
-      }
+    // Call the on-clock methods of all extensions which are due
+    if (*sig_clk_ && !clock_events_.empty() &&
+        clock_events_.top().cycle <= cycle_) {
+      DispatchClockEvents(cycle_);
     }
 
     top_->eval();
@@ -378,6 +1233,13 @@ void VerilatorSimCtrl::Run() {
 
     Trace();
 
+    if (!save_checkpoint_path_.empty() &&
+        time_ == 2 * save_checkpoint_cycle_) {
+      if (!SaveCheckpoint(save_checkpoint_path_)) {
+        RequestStop(false);
+      }
+    }
+
     if (request_stop_) {
       std::cout << "Received stop request, shutting down simulation."
                 << std::endl;
@@ -391,16 +1253,21 @@ void VerilatorSimCtrl::Run() {
     if (term_after_cycles_ && (time_ / 2 >= term_after_cycles_)) {
       std::cout << "Simulation timeout of " << term_after_cycles_
                 << " cycles reached, shutting down simulation." << std::endl;
+      timed_out_ = true;
       break;
     }
   }
 
   top_->final();
   time_end_ = std::chrono::steady_clock::now();
+  thread_ticks_end_ = get_all_thread_ticks();
 
   if (TracingEverEnabled()) {
     tracer_.close();
   }
+  if (flight_recorder_cycles_) {
+    WriteFlightRecorder();
+  }
 }
 
 std::string VerilatorSimCtrl::GetName() const {
@@ -467,4 +1334,444 @@ void VerilatorSimCtrl::Trace() {
   }
 
   tracer_.dump(GetTime());
+
+#if VM_TRACE_WRITER == 1
+  if (flight_recorder_cycles_) {
+    if (flight_recorder_write_requested_) {
+      flight_recorder_write_requested_ = false;
+      tracer_.flush();
+      WriteFlightRecorder();
+    }
+    // Start a new segment of the trace every flight_recorder_cycles_. The
+    // flight recorder keeps the previous segment, so that at least the last
+    // flight_recorder_cycles_ are available.
+    if (time_ - trace_segment_start_ >= 2 * flight_recorder_cycles_) {
+      tracer_.openNext();
+      trace_segment_start_ = time_;
+    }
+  }
+#endif
+}
+
+void VerilatorSimCtrl::SchedulePeriodicClockEvents(unsigned long cycle) {
+  for (size_t i = 0; i < extension_array_.size(); ++i) {
+    unsigned long period = extension_array_[i]->GetClockPeriod();
+    if (period) {
+      clock_events_.push({cycle, i, period});
+    }
+  }
+}
+
+void VerilatorSimCtrl::DispatchClockEvents(unsigned long cycle) {
+  while (!clock_events_.empty() && clock_events_.top().cycle <= cycle) {
+    ClockEvent event = clock_events_.top();
+    clock_events_.pop();
+    if (event.period) {
+      clock_events_.push({cycle + event.period, event.ext_idx, event.period});
+    }
+
+    // An extension might be due for several reasons: only call it once.
+    if (ext_last_clock_[event.ext_idx] == cycle + 1) {
+      continue;
+    }
+    ext_last_clock_[event.ext_idx] = cycle + 1;
+    extension_array_[event.ext_idx]->OnClock(time_);
+  }
+}
+
+void VerilatorSimCtrl::UpdateTraceWindow() {
+  if (time_ % 2) {
+    return;
+  }
+  unsigned long cycle = time_ / 2;
+  if (trace_start_cycle_ && cycle == trace_start_cycle_) {
+    TraceOn();
+  }
+  if (trace_stop_cycle_ && cycle == trace_stop_cycle_) {
+    TraceOff();
+    trace_stop_cycle_ = 0;
+  }
+}
+
+bool VerilatorSimCtrl::CheckTraceWriterPossible(const char *arg_name) const {
+  if (!tracing_possible_) {
+    std::cerr << "ERROR: Tracing has not been enabled at compile time."
+              << std::endl;
+    return false;
+  }
+  if (!VM_TRACE_WRITER) {
+    std::cerr << "ERROR: " << arg_name
+              << " requires VCD tracing. Build the simulation without "
+                 "--trace-fst, or use Verilator's --trace-threads option to "
+                 "write FST traces from a separate thread."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void VerilatorSimCtrl::SetupTraceWriter() {
+#if VM_TRACE_WRITER == 1
+  if (flight_recorder_cycles_) {
+    trace_writer_.reset(new VerilatorTraceWriter(
+        VerilatorTraceWriter::kModeFlightRecorder, 0));
+  } else if (trace_async_) {
+    trace_writer_.reset(new VerilatorTraceWriter(
+        VerilatorTraceWriter::kModeAsync, trace_buffer_mb_ * 1024 * 1024));
+  } else {
+    return;
+  }
+  tracer_.setFile(trace_writer_.get());
+#endif
+}
+
+void VerilatorSimCtrl::WriteFlightRecorder() {
+#if VM_TRACE_WRITER == 1
+  if (!trace_writer_ || !TracingEverEnabled()) {
+    return;
+  }
+  if (trace_writer_->WriteOut()) {
+    std::cout << "Wrote the last " << flight_recorder_cycles_
+              << " cycles (or more) of the trace to " << GetTraceFileName()
+              << std::endl;
+  }
+#endif
+}
+
+bool VerilatorSimCtrl::SetThreads(unsigned long num_threads) {
+  if (num_threads == 0) {
+    std::cerr << "ERROR: The number of threads must be at least 1."
+              << std::endl;
+    return false;
+  }
+
+#if VERILATOR_VERSION_INTEGER >= 5000000
+  VerilatedContext *contextp = Verilated::threadContextp();
+  if (contextp->threads() != num_threads) {
+    // The thread pool is created together with the model.
+    if (top_) {
+      std::cerr << "ERROR: The model has been constructed with "
+                << contextp->threads()
+                << " threads already. Call ParseThreadArgs() before "
+                   "constructing the model to support --threads."
+                << std::endl;
+      return false;
+    }
+    contextp->threads(num_threads);
+  }
+  num_threads_ = num_threads;
+  return true;
+#else
+  std::cerr << "ERROR: Setting the number of threads at runtime requires "
+               "Verilator 5. Build the model with --threads "
+            << num_threads << " instead." << std::endl;
+  return false;
+#endif
+}
+
+bool VerilatorSimCtrl::ParseThreadAffinityArg(const char *arg) {
+  std::istringstream list(arg);
+  std::string range;
+  thread_affinity_.clear();
+  while (std::getline(list, range, ',')) {
+    size_t dash = range.find('-');
+    std::string first_str = range.substr(0, dash);
+    std::string last_str =
+        dash == std::string::npos ? first_str : range.substr(dash + 1);
+
+    unsigned long first, last;
+    if (!read_ul_arg(&first, "thread-affinity", first_str.c_str()) ||
+        !read_ul_arg(&last, "thread-affinity", last_str.c_str())) {
+      return false;
+    }
+    if (first > last || last >= CPU_SETSIZE) {
+      std::cerr << "ERROR: Bad CPU range `" << range
+                << "' in thread-affinity argument." << std::endl;
+      return false;
+    }
+    for (unsigned long cpu = first; cpu <= last; ++cpu) {
+      thread_affinity_.push_back(cpu);
+    }
+  }
+
+  if (thread_affinity_.empty()) {
+    std::cerr << "ERROR: thread-affinity requires a list of CPUs."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void VerilatorSimCtrl::ApplyThreadAffinity() const {
+  if (thread_affinity_.empty()) {
+    return;
+  }
+
+  std::vector<pid_t> tids = get_thread_ids();
+  for (size_t i = 0; i < tids.size(); ++i) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(thread_affinity_[i % thread_affinity_.size()], &cpu_set);
+    if (sched_setaffinity(tids[i], sizeof cpu_set, &cpu_set) != 0) {
+      std::cerr << "WARNING: Cannot set the affinity of thread " << tids[i]
+                << ": " << strerror(errno) << std::endl;
+    }
+  }
+}
+
+bool VerilatorSimCtrl::ParseSaveCheckpointArg(const char *arg) {
+  std::string arg_str(arg);
+  size_t colon = arg_str.find(':');
+  if (colon == std::string::npos || colon + 1 == arg_str.size()) {
+    std::cerr << "ERROR: save-checkpoint must be in the format `CYCLE:FILE'. "
+                 "Got: `"
+              << arg_str << "'." << std::endl;
+    return false;
+  }
+
+  std::string cycle_str = arg_str.substr(0, colon);
+  if (!read_ul_arg(&save_checkpoint_cycle_, "save-checkpoint",
+                   cycle_str.c_str())) {
+    return false;
+  }
+  save_checkpoint_path_ = arg_str.substr(colon + 1);
+  return true;
+}
+
+bool VerilatorSimCtrl::CheckpointsPossible(const char *what) const {
+  std::vector<std::string> refused;
+  for (const DpiContext &context : dpi_contexts_) {
+    if (!context.hooks) {
+      refused.push_back(context.name);
+    }
+  }
+  if (refused.empty()) {
+    return true;
+  }
+
+  std::cerr << "ERROR: Cannot " << what
+            << " checkpoints: these DPI models hold state outside of the "
+               "design that they can't save:";
+  for (const std::string &name : refused) {
+    std::cerr << " " << name;
+  }
+  std::cerr << std::endl;
+  return false;
+}
+
+// Each context is saved as its name, the pointer that the design holds for it
+// and the state from its save hook. All sizes are 64 bits.
+bool VerilatorSimCtrl::SaveDpiContexts(std::ostream &os) const {
+  uint64_t num_contexts = dpi_contexts_.size();
+  os.write(reinterpret_cast<const char *>(&num_contexts), sizeof num_contexts);
+  for (const DpiContext &context : dpi_contexts_) {
+    void *state = nullptr;
+    size_t len = 0;
+    if (context.hooks->save &&
+        !context.hooks->save(context.ctx, &state, &len)) {
+      std::cerr << "ERROR: Failed to save checkpoint: DPI model "
+                << context.name << " can't be saved now." << std::endl;
+      return false;
+    }
+
+    uint64_t name_size = context.name.size();
+    uint64_t handle = reinterpret_cast<uintptr_t>(context.ctx);
+    uint64_t state_size = state ? len : 0;
+    os.write(reinterpret_cast<const char *>(&name_size), sizeof name_size);
+    os.write(context.name.data(), name_size);
+    os.write(reinterpret_cast<const char *>(&handle), sizeof handle);
+    os.write(reinterpret_cast<const char *>(&state_size), sizeof state_size);
+    os.write(static_cast<const char *>(state), state_size);
+    free(state);
+  }
+  return true;
+}
+
+bool VerilatorSimCtrl::RestoreDpiContexts(std::istream &is) {
+  // The initial blocks have run, so the contexts of this process exist. They
+  // must be the ones the saving process had, in the same order.
+  uint64_t num_contexts = 0;
+  is.read(reinterpret_cast<char *>(&num_contexts), sizeof num_contexts);
+  if (!is || num_contexts != dpi_contexts_.size()) {
+    std::cerr << "ERROR: The checkpoint has " << num_contexts
+              << " DPI contexts, but the design created "
+              << dpi_contexts_.size() << "." << std::endl;
+    return false;
+  }
+
+  std::unordered_map<void *, void *> restored;
+  for (const DpiContext &context : dpi_contexts_) {
+    uint64_t name_size = 0, handle = 0, state_size = 0;
+    is.read(reinterpret_cast<char *>(&name_size), sizeof name_size);
+    std::string name(is ? name_size : 0, '\0');
+    is.read(&name[0], name.size());
+    is.read(reinterpret_cast<char *>(&handle), sizeof handle);
+    is.read(reinterpret_cast<char *>(&state_size), sizeof state_size);
+    std::string state(is ? state_size : 0, '\0');
+    is.read(&state[0], state.size());
+    if (!is || name != context.name) {
+      std::cerr << "ERROR: The checkpoint has no state for DPI model "
+                << context.name << "." << std::endl;
+      return false;
+    }
+
+    if (context.hooks->restore) {
+      if (!context.hooks->restore(context.ctx,
+                                  state.empty() ? nullptr : state.data(),
+                                  state.size())) {
+        std::cerr << "ERROR: Failed to restore DPI model " << context.name
+                  << "." << std::endl;
+        return false;
+      }
+    } else if (!state.empty()) {
+      std::cerr << "ERROR: DPI model " << context.name
+                << " can't restore the state in the checkpoint." << std::endl;
+      return false;
+    }
+    restored[reinterpret_cast<void *>(static_cast<uintptr_t>(handle))] =
+        context.ctx;
+  }
+
+  // A pointer in the design could belong to either process. That's only a
+  // problem if it names different contexts in the two, which is very
+  // unlikely, but would otherwise go unnoticed.
+  for (const DpiContext &context : dpi_contexts_) {
+    auto it = restored.find(context.ctx);
+    if (it != restored.end() && it->second != context.ctx) {
+      std::cerr << "ERROR: Cannot tell the DPI contexts of this process from "
+                   "those in the checkpoint. Try again."
+                << std::endl;
+      return false;
+    }
+  }
+
+  restored_dpi_contexts_.clear();
+  for (const auto &entry : restored) {
+    if (entry.first != entry.second) {
+      restored_dpi_contexts_.insert(entry);
+    }
+  }
+  simctrl_dpi_contexts_restored = !restored_dpi_contexts_.empty();
+  return true;
+}
+
+bool VerilatorSimCtrl::SaveCheckpoint(const std::string &path) {
+#if VM_SAVABLE == 1
+  if (!CheckpointsPossible("save")) {
+    return false;
+  }
+
+  // Collect the state of the extensions first: they might fail.
+  std::vector<std::string> ext_states;
+  for (SimCtrlExtension *ext : extension_array_) {
+    std::ostringstream oss;
+    try {
+      ext->SaveCheckpoint(oss);
+    } catch (const std::exception &err) {
+      std::cerr << "ERROR: Failed to save checkpoint: " << err.what()
+                << std::endl;
+      return false;
+    }
+    ext_states.push_back(oss.str());
+  }
+  std::ostringstream dpi_oss;
+  if (!SaveDpiContexts(dpi_oss)) {
+    return false;
+  }
+  std::string dpi_state = dpi_oss.str();
+
+  VerilatedSave os;
+  os.open(path.c_str());
+  if (!os.isOpen()) {
+    std::cerr << "ERROR: Cannot open `" << path << "' to save checkpoint."
+              << std::endl;
+    return false;
+  }
+
+  top_->save(os);
+
+  uint32_t magic = kCheckpointMagic;
+  uint64_t time = time_;
+  uint64_t num_exts = ext_states.size();
+  os.write(&magic, sizeof magic);
+  os.write(&time, sizeof time);
+  os.write(&num_exts, sizeof num_exts);
+  for (const std::string &state : ext_states) {
+    uint64_t size = state.size();
+    os.write(&size, sizeof size);
+    os.write(state.data(), size);
+  }
+  uint64_t dpi_size = dpi_state.size();
+  os.write(&dpi_size, sizeof dpi_size);
+  os.write(dpi_state.data(), dpi_size);
+  os.close();
+
+  std::cout << "Saved checkpoint at cycle " << time_ / 2 << " to " << path
+            << std::endl;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool VerilatorSimCtrl::RestoreCheckpoint(const std::string &path) {
+#if VM_SAVABLE == 1
+  if (!CheckpointsPossible("restore")) {
+    return false;
+  }
+
+  VerilatedRestore os;
+  os.open(path.c_str());
+  if (!os.isOpen()) {
+    std::cerr << "ERROR: Cannot open checkpoint `" << path << "'."
+              << std::endl;
+    return false;
+  }
+
+  top_->restore(os);
+
+  uint32_t magic;
+  uint64_t time, num_exts;
+  os.read(&magic, sizeof magic);
+  os.read(&time, sizeof time);
+  os.read(&num_exts, sizeof num_exts);
+  if (magic != kCheckpointMagic || num_exts != extension_array_.size()) {
+    std::cerr << "ERROR: Checkpoint `" << path
+              << "' was not saved by this simulation." << std::endl;
+    return false;
+  }
+
+  for (SimCtrlExtension *ext : extension_array_) {
+    uint64_t size;
+    os.read(&size, sizeof size);
+    std::string state(size, '\0');
+    os.read(&state[0], size);
+
+    std::istringstream iss(state);
+    try {
+      ext->RestoreCheckpoint(iss);
+    } catch (const std::exception &err) {
+      std::cerr << "ERROR: Failed to restore checkpoint `" << path
+                << "': " << err.what() << std::endl;
+      return false;
+    }
+  }
+
+  uint64_t dpi_size;
+  os.read(&dpi_size, sizeof dpi_size);
+  std::string dpi_state(dpi_size, '\0');
+  os.read(&dpi_state[0], dpi_size);
+  os.close();
+  std::istringstream dpi_iss(dpi_state);
+  if (!RestoreDpiContexts(dpi_iss)) {
+    return false;
+  }
+
+  time_ = time;
+  std::cout << "Restored checkpoint at cycle " << time_ / 2 << " from "
+            << path << std::endl;
+  return true;
+#else
+  return false;
+#endif
 }
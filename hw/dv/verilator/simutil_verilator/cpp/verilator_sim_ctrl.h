@@ -6,11 +6,20 @@
 #define OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_VERILATOR_SIM_CTRL_H_
 
 #include <chrono>
+#include <map>
+#include <memory>
+#include <queue>
 #include <string>
+#include <sys/types.h>
+#include <unordered_map>
 #include <vector>
 
 #include "sim_ctrl_extension.h"
 #include "verilated_toplevel.h"
+#include "verilator_trace_writer.h"
+
+// Checkpoint hooks of a DPI context (see simctrl_dpi.h)
+struct simctrl_dpi_hooks;
 
 enum VerilatorSimCtrlFlags {
   Defaults = 0,
@@ -68,6 +77,51 @@ class VerilatorSimCtrl {
    */
   bool ParseCommandArgs(int argc, char **argv, bool &exit_app);
 
+  /**
+   * Parse the --threads command line argument and apply it
+   *
+   * The number of threads used to evaluate the model can only be changed
+   * before the Verilated model is constructed (and requires Verilator 5 or
+   * newer). Call this function before constructing the model and before
+   * ParseCommandArgs() if the simulation should support --threads. Other
+   * arguments are left for ParseCommandArgs() to handle.
+   *
+   * @param argc, argv Standard C command line arguments
+   * @param exit_app Indicate that program should terminate
+   * @return Return code, true == success
+   */
+  bool ParseThreadArgs(int argc, char **argv, bool &exit_app);
+
+  /**
+   * Run a batch of simulations if requested with --batch=MANIFEST
+   *
+   * Each line of the manifest describes a job as "ELF TIMEOUT [ARGS...]":
+   * the ELF file to load, the timeout in cycles (0 for none) and further
+   * command line arguments, separated by whitespace. Empty lines and lines
+   * starting with # are ignored.
+   *
+   * The batch process parses the ELF files once (see
+   * SimCtrlExtension::PrepareBatch()) and then forks a process for each job,
+   * running up to --batch-jobs=N (default: number of CPUs) at the same time.
+   * Each job writes its output to a log file in the --batch-out=DIR directory
+   * (default: batch_out), and the batch process writes a summary of the
+   * results to DIR/summary.json.
+   *
+   * Call this function before constructing the model, since forking a process
+   * with a multi-threaded model isn't possible, and after registering all
+   * extensions. It returns in each job process with argc and argv replaced by
+   * the arguments of the job. The caller should then construct the model and
+   * run the simulation with Exec() as usual. In the batch process, it sets
+   * exit_app once all jobs have run, and returns true if all of them passed.
+   *
+   * Without --batch, this function does nothing.
+   *
+   * @param argc, argv Standard C command line arguments
+   * @param exit_app Indicate that program should terminate
+   * @return Return code, true == success
+   */
+  bool RunBatch(int &argc, char **&argv, bool &exit_app);
+
   /**
    * A helper function to execute a standard set of run commands.
    *
@@ -116,6 +170,71 @@ class VerilatorSimCtrl {
    */
   void RegisterExtension(SimCtrlExtension *ext);
 
+  /**
+   * Call OnClock() of ext on the rising clock edge of the given cycle
+   *
+   * This is in addition to the periodic calls (see
+   * SimCtrlExtension::GetClockPeriod()). If the cycle has passed already,
+   * OnClock() is called on the next rising clock edge. ext must have been
+   * registered with RegisterExtension().
+   */
+  void ScheduleOnClock(SimCtrlExtension *ext, unsigned long cycle);
+
+  /**
+   * Start tracing now, e.g. when an extension or a DPI model sees an event of
+   * interest
+   *
+   * This must be called from the simulation thread (such as from
+   * SimCtrlExtension::OnClock() or a DPI function). It has no effect if
+   * tracing support hasn't been compiled into the simulation. The design and
+   * C DPI models can call it through the simctrl_trigger_trace() DPI function
+   * (see simctrl_dpi.h).
+   *
+   * @param num_cycles Stop tracing after this many cycles. 0 keeps tracing
+   *                   until the end of the simulation (or --trace-stop).
+   */
+  void TriggerTrace(unsigned long num_cycles = 0);
+
+  /**
+   * Get the number of cycles that SkipCycles() can skip from the current cycle
+   *
+   * Skipping must not pass the cycles in which the simulation controller acts
+   * itself (reset, checkpoints, trace windows and the timeout).
+   */
+  unsigned long GetMaxSkipCycles() const;
+
+  /**
+   * Advance the simulation time by num_cycles without evaluating the model
+   *
+   * This is for extensions which can bring the model into the state it would
+   * have after num_cycles (e.g. because it is idle). It must be called from
+   * SimCtrlExtension::OnClock(). num_cycles must not be larger than
+   * GetMaxSkipCycles(). Calls to OnClock() which are due during the skipped
+   * cycles happen on the next rising clock edge.
+   */
+  void SkipCycles(unsigned long num_cycles);
+
+  /**
+   * Record that a DPI model has created a context which the design refers to
+   *
+   * See simctrl_register_dpi_context() in simctrl_dpi.h, which DPI models
+   * call. Checkpoints save and restore the context with the hooks, and can't
+   * be saved or restored once a context without hooks has been registered.
+   *
+   * @param name Name of the DPI model instance
+   * @param ctx The context
+   * @param hooks Checkpoint hooks, or nullptr
+   */
+  void RegisterDpiContext(const std::string &name, void *ctx,
+                          const struct simctrl_dpi_hooks *hooks);
+
+  /**
+   * Map a context pointer from a restored design to a context of this process
+   *
+   * See simctrl_restored_dpi_context() in simctrl_dpi.h.
+   */
+  void *RestoredDpiContext(void *handle) const;
+
   /**
    * Get the current time in ticks
    */
@@ -139,8 +258,96 @@ class VerilatorSimCtrl {
   std::chrono::steady_clock::time_point time_begin_;
   std::chrono::steady_clock::time_point time_end_;
   VerilatedTracer tracer_;
+  bool trace_async_;
+  unsigned long trace_buffer_mb_;
+  unsigned long flight_recorder_cycles_;
+  unsigned long trace_start_cycle_;
+  unsigned long trace_stop_cycle_;
+  unsigned long trace_depth_;
+  std::vector<std::string> trace_scopes_;
+  unsigned long trace_segment_start_;
+  volatile bool flight_recorder_write_requested_;
+#if VM_TRACE_WRITER == 1
+  std::unique_ptr<VerilatorTraceWriter> trace_writer_;
+#endif
   unsigned long term_after_cycles_;
   std::vector<SimCtrlExtension *> extension_array_;
+  unsigned long skipped_cycles_;
+  bool timed_out_;
+
+  /**
+   * A job of a batch run (see RunBatch())
+   */
+  struct BatchJob {
+    std::string elf_path;
+    unsigned long timeout_cycles;
+    std::vector<std::string> args;
+  };
+
+  /**
+   * Result of a batch job, written by the job process to memory shared with
+   * the batch process
+   */
+  struct BatchJobResult {
+    bool done;
+    bool success;
+    bool timed_out;
+    unsigned long cycles;
+    unsigned int exec_time_ms;
+  };
+
+  std::string batch_manifest_path_;
+  std::string batch_out_dir_;
+  unsigned long batch_num_procs_;
+  // Where to report the result when running as a batch job, or nullptr
+  BatchJobResult *batch_result_;
+  // Arguments of the batch job, which argv points into
+  std::vector<std::string> batch_job_args_;
+  std::vector<char *> batch_job_argv_;
+
+  /**
+   * A pending call to SimCtrlExtension::OnClock()
+   */
+  struct ClockEvent {
+    unsigned long cycle;
+    // Index into extension_array_
+    size_t ext_idx;
+    // Cycles until the next call, or 0 for a single call
+    unsigned long period;
+
+    // Events are dispatched in cycle order and, within a cycle, in the order
+    // the extensions have been registered.
+    bool operator>(const ClockEvent &other) const {
+      return cycle != other.cycle ? cycle > other.cycle
+                                  : ext_idx > other.ext_idx;
+    }
+  };
+  std::priority_queue<ClockEvent, std::vector<ClockEvent>,
+                      std::greater<ClockEvent>>
+      clock_events_;
+  // The cycle in which OnClock() was last called for each extension, plus one
+  std::vector<unsigned long> ext_last_clock_;
+  unsigned long save_checkpoint_cycle_;
+  std::string save_checkpoint_path_;
+  std::string restore_checkpoint_path_;
+  // The time at which this run started (non-zero if restored from a
+  // checkpoint)
+  unsigned long run_start_time_;
+  // Contexts of DPI models, in the order they were created
+  struct DpiContext {
+    std::string name;
+    void *ctx;
+    const struct simctrl_dpi_hooks *hooks;
+  };
+  std::vector<DpiContext> dpi_contexts_;
+  // Contexts of the simulation that saved a restored checkpoint, mapped to
+  // the matching contexts of this one
+  std::unordered_map<void *, void *> restored_dpi_contexts_;
+  unsigned long num_threads_;
+  bool num_threads_applied_;
+  std::vector<int> thread_affinity_;
+  std::map<pid_t, unsigned long> thread_ticks_begin_;
+  std::map<pid_t, unsigned long> thread_ticks_end_;
 
   /**
    * Default constructor
@@ -248,6 +455,160 @@ class VerilatorSimCtrl {
    * Perform tracing in Verilator if required
    */
   void Trace();
+
+  /**
+   * Schedule the periodic OnClock() calls of all extensions, starting in cycle
+   */
+  void SchedulePeriodicClockEvents(unsigned long cycle);
+
+  /**
+   * Call OnClock() of all extensions which are due in cycle
+   */
+  void DispatchClockEvents(unsigned long cycle);
+
+  /**
+   * Start or stop tracing at the cycles given with --trace-start and
+   * --trace-stop (or by TriggerTrace())
+   */
+  void UpdateTraceWindow();
+
+  /**
+   * Check that the trace can be written asynchronously
+   *
+   * @param arg_name Name of the command line argument that requested it
+   * @return true if possible
+   */
+  bool CheckTraceWriterPossible(const char *arg_name) const;
+
+  /**
+   * Set up the asynchronous trace writer or the flight recorder if requested
+   *
+   * This must be called before the model is attached to the tracer.
+   */
+  void SetupTraceWriter();
+
+  /**
+   * Write the trace kept by the flight recorder to the trace file
+   *
+   * Flush the tracer before calling this function if it is open.
+   */
+  void WriteFlightRecorder();
+
+  /**
+   * Read the jobs of a batch run from the manifest at path
+   *
+   * @return true on success
+   */
+  bool ReadBatchManifest(const std::string &path,
+                         std::vector<BatchJob> &jobs) const;
+
+  /**
+   * Set up the current process to run the batch job with the given index
+   *
+   * Replaces argc and argv with the arguments of the job.
+   *
+   * @return true on success
+   */
+  bool SetupBatchJob(const BatchJob &job, size_t job_idx,
+                     BatchJobResult *result, int &argc, char **&argv);
+
+  /**
+   * Write the summary of a batch run to DIR/summary.json
+   *
+   * @return true on success
+   */
+  bool WriteBatchSummary(const std::vector<BatchJob> &jobs,
+                         const BatchJobResult *results) const;
+
+  /**
+   * Get the path of the log file of the batch job with the given index
+   */
+  std::string GetBatchLogPath(size_t job_idx) const;
+
+  /**
+   * Set the number of threads used to evaluate the model
+   *
+   * @return true on success
+   */
+  bool SetThreads(unsigned long num_threads);
+
+  /**
+   * Parse the argument of --thread-affinity (a list of CPUs such as 0-3,8)
+   *
+   * @return true on success
+   */
+  bool ParseThreadAffinityArg(const char *arg);
+
+  /**
+   * Pin all threads of this process to the CPUs given with --thread-affinity
+   *
+   * Threads are assigned to the CPUs in the list in a round-robin fashion,
+   * starting with the main thread.
+   */
+  void ApplyThreadAffinity() const;
+
+  /**
+   * Print the CPU time used by each thread during the run
+   */
+  void PrintThreadStatistics() const;
+
+  /**
+   * Parse the argument of --save-checkpoint (CYCLE:FILE)
+   *
+   * @return true on success
+   */
+  bool ParseSaveCheckpointArg(const char *arg);
+
+  /**
+   * Save a checkpoint to the file at path
+   *
+   * The checkpoint contains the state of the Verilated model (this requires a
+   * model built with --savable and VM_SAVABLE), the simulation time and the
+   * state saved by each registered extension.
+   *
+   * @return true on success
+   */
+  bool SaveCheckpoint(const std::string &path);
+
+  /**
+   * Restore a checkpoint written by SaveCheckpoint() from the file at path
+   *
+   * This must be called after the first evaluation of the model, so that the
+   * initial blocks have set up the host-side state of this process. The
+   * restored model state then replaces the state that they computed.
+   *
+   * @return true on success
+   */
+  bool RestoreCheckpoint(const std::string &path);
+
+  /**
+   * Check that the design can be checkpointed
+   *
+   * Host-side contexts of DPI models (such as those that uartdpi or the OTBN
+   * model create from initial blocks) live in the address space of this
+   * process, and the design only holds pointers to them. A checkpoint carries
+   * each one over to the matching context of the restored process with the
+   * hooks its model registered (see RegisterDpiContext()). Checkpoints are
+   * refused if a model didn't register any.
+   *
+   * @param what The operation, for the error message
+   * @return true if every context has checkpoint hooks
+   */
+  bool CheckpointsPossible(const char *what) const;
+
+  /**
+   * Write the state of the DPI contexts to a checkpoint
+   *
+   * @return false if a context can't be saved now
+   */
+  bool SaveDpiContexts(std::ostream &os) const;
+
+  /**
+   * Load the state of the DPI contexts from a checkpoint
+   *
+   * @return false if the saved contexts don't match those of this process
+   */
+  bool RestoreDpiContexts(std::istream &is);
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_VERILATOR_SIM_CTRL_H_
@@ -0,0 +1,188 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "verilator_trace_writer.h"
+
+#if VM_TRACE_WRITER == 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+
+// The end of the VCD header, which is followed by the value changes
+static const char kVcdEndDefinitions[] = "$enddefinitions $end";
+
+/**
+ * Split a VCD trace into its header and the value changes that follow it
+ *
+ * Each segment recorded by the flight recorder is a trace of its own. Only the
+ * first segment might have a header, depending on the Verilator version.
+ */
+static void split_vcd(const std::string &trace, std::string *header,
+                      std::string *body) {
+  size_t end_defs = std::string::npos;
+  if (!trace.empty() && trace[0] == '$') {
+    end_defs = trace.find(kVcdEndDefinitions);
+  }
+  if (end_defs == std::string::npos) {
+    header->clear();
+    *body = trace;
+    return;
+  }
+
+  size_t body_start = trace.find('\n', end_defs);
+  body_start = body_start == std::string::npos ? trace.size() : body_start + 1;
+  *header = trace.substr(0, body_start);
+  *body = trace.substr(body_start);
+}
+
+VerilatorTraceWriter::VerilatorTraceWriter(Mode mode, size_t max_queued_bytes)
+    : mode_(mode),
+      fd_(-1),
+      max_queued_bytes_(max_queued_bytes),
+      queued_bytes_(0),
+      stop_(false),
+      write_error_(false),
+      stall_count_(0) {}
+
+VerilatorTraceWriter::~VerilatorTraceWriter() { close(); }
+
+bool VerilatorTraceWriter::open(const std::string &name) {
+  filename_ = name;
+
+  if (mode_ == kModeFlightRecorder) {
+    // Start a new segment
+    if (!cur_segment_.empty()) {
+      prev_segment_.swap(cur_segment_);
+      cur_segment_.clear();
+    }
+    return true;
+  }
+
+  fd_ = ::open(name.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  if (fd_ < 0) {
+    return false;
+  }
+  stop_ = false;
+  write_error_ = false;
+  writer_thread_ = std::thread(&VerilatorTraceWriter::WriterLoop, this);
+  return true;
+}
+
+void VerilatorTraceWriter::close() {
+  if (mode_ == kModeFlightRecorder || fd_ < 0) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  data_cv_.notify_one();
+  writer_thread_.join();
+
+  ::close(fd_);
+  fd_ = -1;
+}
+
+ssize_t VerilatorTraceWriter::write(const char *bufp, ssize_t len) {
+  if (mode_ == kModeFlightRecorder) {
+    cur_segment_.append(bufp, len);
+    return len;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Always accept data into an empty queue, even if it is larger than the
+  // buffer, to guarantee progress.
+  auto has_space = [&] {
+    return queued_bytes_ == 0 || queued_bytes_ + len <= max_queued_bytes_;
+  };
+  if (!has_space()) {
+    ++stall_count_;
+    space_cv_.wait(lock, has_space);
+  }
+  queue_.emplace_back(bufp, len);
+  queued_bytes_ += len;
+  lock.unlock();
+
+  data_cv_.notify_one();
+  return len;
+}
+
+bool VerilatorTraceWriter::WriteOut() {
+  assert(mode_ == kModeFlightRecorder);
+
+  std::string header, prev_body, cur_header, cur_body;
+  split_vcd(prev_segment_, &header, &prev_body);
+  split_vcd(cur_segment_, &cur_header, &cur_body);
+  if (header.empty()) {
+    header = cur_header;
+  }
+
+  int fd = ::open(filename_.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  if (fd < 0) {
+    std::cerr << "ERROR: Cannot open trace file `" << filename_
+              << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+  // The first value dump of each segment is a full dump, so the value changes
+  // of the current segment can simply follow those of the previous one.
+  bool success = WriteAll(fd, header) && WriteAll(fd, prev_body) &&
+                 WriteAll(fd, cur_body);
+  ::close(fd);
+
+  if (!success) {
+    std::cerr << "ERROR: Cannot write trace file `" << filename_
+              << "': " << strerror(errno) << std::endl;
+  }
+  return success;
+}
+
+void VerilatorTraceWriter::WriterLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (1) {
+    data_cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      // stop_ is set and all data has been written
+      break;
+    }
+
+    std::string data;
+    data.swap(queue_.front());
+    queue_.pop_front();
+
+    // Write without holding the lock, so that the simulation can continue to
+    // queue data.
+    lock.unlock();
+    bool success = write_error_ || WriteAll(fd_, data);
+    lock.lock();
+
+    if (!success && !write_error_) {
+      std::cerr << "ERROR: Cannot write trace file `" << filename_
+                << "': " << strerror(errno) << std::endl;
+      write_error_ = true;
+    }
+    queued_bytes_ -= data.size();
+    space_cv_.notify_one();
+  }
+}
+
+bool VerilatorTraceWriter::WriteAll(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t ret = ::write(fd, data.data() + written, data.size() - written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += ret;
+  }
+  return true;
+}
+
+#endif  // VM_TRACE_WRITER == 1
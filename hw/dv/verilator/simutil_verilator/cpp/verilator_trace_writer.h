@@ -0,0 +1,111 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_VERILATOR_TRACE_WRITER_H_
+#define OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_VERILATOR_TRACE_WRITER_H_
+
+#include "verilated_toplevel.h"
+
+#if VM_TRACE_WRITER == 1
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * File backend for the VCD tracer which takes file I/O off the simulation
+ * thread
+ *
+ * The tracer still samples the model on the simulation thread, but hands the
+ * formatted trace data to this class instead of writing it to a file. There
+ * are two modes:
+ *
+ * - Asynchronous: The data is queued in a buffer of bounded size and written
+ *   to the file by a writer thread. If the buffer is full, the simulation
+ *   waits for the writer thread to catch up.
+ *
+ * - Flight recorder: The data is kept in memory and only written to the file
+ *   when WriteOut() is called. The tracer must be restarted (see
+ *   VerilatedTracer::openNext()) at regular intervals; each restart begins a
+ *   new segment of the trace, and only the current and the previous segment
+ *   are kept.
+ */
+class VerilatorTraceWriter : public VerilatedVcdFile {
+ public:
+  enum Mode {
+    kModeAsync,
+    kModeFlightRecorder,
+  };
+
+  /**
+   * Constructor
+   *
+   * @param mode Write the data asynchronously or keep it in memory
+   * @param max_queued_bytes Size of the buffer in asynchronous mode
+   */
+  VerilatorTraceWriter(Mode mode, size_t max_queued_bytes);
+  ~VerilatorTraceWriter() override;
+
+  VerilatorTraceWriter(const VerilatorTraceWriter &) = delete;
+  void operator=(const VerilatorTraceWriter &) = delete;
+
+  // VerilatedVcdFile interface, called by the tracer
+  bool open(const std::string &name) override;
+  void close() override;
+  ssize_t write(const char *bufp, ssize_t len) override;
+
+  /**
+   * Write the segments recorded in flight recorder mode to the file
+   *
+   * Data which the tracer hasn't passed on yet isn't included: flush the
+   * tracer first. Recording continues afterwards.
+   *
+   * @return true on success
+   */
+  bool WriteOut();
+
+  /**
+   * Number of times the simulation had to wait for the writer thread
+   */
+  unsigned long GetStallCount() const { return stall_count_; }
+
+ private:
+  Mode mode_;
+  std::string filename_;
+
+  // Asynchronous mode
+  int fd_;
+  size_t max_queued_bytes_;
+  size_t queued_bytes_;
+  std::deque<std::string> queue_;
+  bool stop_;
+  bool write_error_;
+  unsigned long stall_count_;
+  std::mutex mutex_;
+  std::condition_variable data_cv_;
+  std::condition_variable space_cv_;
+  std::thread writer_thread_;
+
+  // Flight recorder mode
+  std::string prev_segment_;
+  std::string cur_segment_;
+
+  /**
+   * Main function of the writer thread
+   */
+  void WriterLoop();
+
+  /**
+   * Write all of data to fd
+   *
+   * @return true on success
+   */
+  static bool WriteAll(int fd, const std::string &data);
+};
+
+#endif  // VM_TRACE_WRITER == 1
+
+#endif  // OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_VERILATOR_TRACE_WRITER_H_
@@ -15,6 +15,7 @@
 #include <stdexcept>
 
 #include "scrambled_ecc32_mem_area.h"
+#include "simctrl_dpi.h"
 #include "sv_scoped.h"
 #include "sv_utils.h"
 
@@ -45,6 +46,8 @@ void OtbnMemUtil::OnElfLoaded(Elf *elf_file) {
 
   expected_end_addr_ = -1;
   loop_warp_.clear();
+  imem_symbols_.clear();
+  global_symbol_addrs_.clear();
 
   // Look through the symbol table of elf_file for an expected end
   // address and any loop warping symbols.
@@ -68,6 +71,19 @@ void OtbnMemUtil::OnElfLoaded(Elf *elf_file) {
         continue;
 
       OnSymbol(sym_name, sym.st_value);
+
+      // Symbols in executable sections label code. Their types are usually
+      // STT_NOTYPE, since OTBN code doesn't tend to mark functions.
+      int sym_type = GELF_ST_TYPE(sym.st_info);
+      if ((sym_type == STT_NOTYPE || sym_type == STT_FUNC) &&
+          sym.st_shndx != SHN_UNDEF && sym.st_shndx < SHN_LORESERVE) {
+        Elf_Scn *sym_scn = elf_getscn(elf_file, sym.st_shndx);
+        Elf32_Shdr *sym_shdr = sym_scn ? elf32_getshdr(sym_scn) : nullptr;
+        if (sym_shdr && (sym_shdr->sh_flags & SHF_EXECINSTR)) {
+          OnCodeSymbol(sym_name, sym.st_value,
+                       GELF_ST_BIND(sym.st_info) == STB_GLOBAL);
+        }
+      }
     }
     break;
   }
@@ -111,6 +127,23 @@ void OtbnMemUtil::OnSymbol(const std::string &name, uint32_t value) {
   }
 }
 
+void OtbnMemUtil::OnCodeSymbol(const std::string &name, uint32_t value,
+                               bool is_global) {
+  // Skip assembler-local labels
+  if (name.empty() || name.compare(0, 2, ".L") == 0 || name[0] == '$')
+    return;
+
+  // Keep the first symbol at each address, unless it's local and this one is
+  // global.
+  bool have_global = global_symbol_addrs_.count(value) != 0;
+  if (imem_symbols_.count(value) && (have_global || !is_global))
+    return;
+
+  imem_symbols_[value] = name;
+  if (is_global)
+    global_symbol_addrs_.insert(value);
+}
+
 void OtbnMemUtil::AddLoopWarp(uint32_t addr, uint32_t from_cnt,
                               uint32_t to_cnt) {
   auto key = std::make_pair(addr, from_cnt);
@@ -129,7 +162,10 @@ void OtbnMemUtil::AddLoopWarp(uint32_t addr, uint32_t from_cnt,
 
 extern "C" OtbnMemUtil *OtbnMemUtilMake(const char *top_scope) {
   try {
-    return new OtbnMemUtil(top_scope);
+    OtbnMemUtil *mem_util = new OtbnMemUtil(top_scope);
+    // The symbols and loop warps loaded from the ELF aren't checkpointed.
+    simctrl_dpi_context_created(top_scope, mem_util, nullptr);
+    return mem_util;
   } catch (const std::exception &err) {
     std::cerr << "Failed to create OtbnMemUtil: " << err.what() << "\n";
     return nullptr;
@@ -5,6 +5,8 @@
 #define OPENTITAN_HW_IP_OTBN_DV_MEMUTIL_OTBN_MEMUTIL_H_
 
 #include <map>
+#include <set>
+#include <string>
 #include <svdpi.h>
 #include <vector>
 
@@ -14,6 +16,7 @@
 class OtbnMemUtil : public DpiMemUtil {
  public:
   typedef std::map<std::pair<uint32_t, uint32_t>, uint32_t> LoopWarps;
+  typedef std::map<uint32_t, std::string> Symbols;
 
   // Constructor. top_scope is the SV scope that contains IMEM and
   // DMEM memories as u_imem and u_dmem, respectively.
@@ -43,18 +46,29 @@ class OtbnMemUtil : public DpiMemUtil {
   // Read-only access to the table of loop warps
   const LoopWarps &GetLoopWarps() const { return loop_warp_; }
 
+  // Read-only access to the code symbols in the ELF file (labels in
+  // executable sections), keyed by address. If there are several symbols at an
+  // address, a global one is preferred.
+  const Symbols &GetImemSymbols() const { return imem_symbols_; }
+
  private:
   void OnElfLoaded(Elf *elf_file) override;
 
   // Called by OnElfLoaded for each symbol in the symbol table
   void OnSymbol(const std::string &name, uint32_t value);
 
+  // Called by OnElfLoaded for each symbol that labels code
+  void OnCodeSymbol(const std::string &name, uint32_t value, bool is_global);
+
   // Add an entry to loop_warp_
   void AddLoopWarp(uint32_t addr, uint32_t from_cnt, uint32_t to_cnt);
 
   ScrambledEcc32MemArea imem_, dmem_;
   int expected_end_addr_;
   LoopWarps loop_warp_;
+  Symbols imem_symbols_;
+  // The addresses in imem_symbols_ that have a global symbol
+  std::set<uint32_t> global_symbol_addrs_;
 };
 
 // DPI-accessible wrappers
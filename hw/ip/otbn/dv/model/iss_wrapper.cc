@@ -17,8 +17,12 @@
 #include <regex>
 #include <signal.h>
 #include <sstream>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include "otbn_trace_checker.h"
 
@@ -202,6 +206,20 @@ static std::string find_otbn_model() {
   return std::string(abs_path.get());
 }
 
+// The version of the binary protocol that we speak. This must match
+// BINARY_PROTOCOL_VERSION in stepped.py.
+static const unsigned kBinaryProtocolVersion = 2;
+
+// Opcodes for binary frames (see the documentation at the top of stepped.py)
+static const uint8_t kOpText = 0;
+static const uint8_t kOpStep = 1;
+static const uint8_t kOpStepN = 2;
+
+// Names of the external registers that the ISS might update on a step, in the
+// order of ISSWrapper::StepUpdates.
+static const char *const kStepRegNames[] = {
+    "STATUS", "INSN_CNT", "ERR_BITS", "STOP_PC", "RND_REQ", "WIPE_START"};
+
 // Read 8 hex characters from str as a uint32_t.
 static uint32_t read_hex_32(const char *str) {
   char buf[9];
@@ -211,11 +229,12 @@ static uint32_t read_hex_32(const char *str) {
 }
 
 // Read through trace output (in the lines argument) to pick up any write to
-// the named CSR register, updating *dest.
-static void read_ext_reg(const std::string &reg_name,
+// the named CSR register, updating *dest. Returns true if there was a write.
+static bool read_ext_reg(const std::string &reg_name,
                          const std::vector<std::string> &lines,
                          uint32_t *dest) {
   assert(dest);
+  bool found = false;
 
   // We're interested in lines that show an update to the external register
   // called reg_name. These look something like this:
@@ -231,30 +250,210 @@ static void read_ext_reg(const std::string &reg_name,
       // failure or overflow.
       assert(match.size() == 2);
       *dest = (uint32_t)strtoul(match[1].str().c_str(), nullptr, 16);
+      found = true;
     }
   }
+
+  return found;
 }
 
-// A specialized version of read_ext_reg that updates a boolean flag
-// (assuming that the ISS will always signal the register as having
-// value 0 or 1). Prints a message to stderr and returns false on
-// error.
-static bool read_ext_flag(const std::string &reg_name,
-                          const std::vector<std::string> &lines, bool *dest) {
-  assert(dest);
+// Read a little-endian uint32_t from buf at *pos, advancing *pos. Raises a
+// runtime_error if buf is too short.
+static uint32_t unpack_u32(const std::string &buf, size_t *pos) {
+  assert(pos);
+  if (buf.size() < 4 || *pos > buf.size() - 4) {
+    throw std::runtime_error("Truncated binary response from ISS.");
+  }
 
-  uint32_t dest32 = *dest ? 1 : 0;
-  read_ext_reg(reg_name, lines, &dest32);
+  const unsigned char *p =
+      reinterpret_cast<const unsigned char *>(buf.data() + *pos);
+  *pos += 4;
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
 
-  if (dest32 > 1) {
-    std::cerr << "ERROR: Unexpected update to " << reg_name << " with value 0x"
-              << std::hex << dest32 << std::dec
-              << " when we expected a boolean flag.";
-    return false;
+// Unpack a list of records from buf at *pos, advancing *pos. If dst is not
+// null, append each record to it. Raises a runtime_error if buf is malformed.
+static void unpack_records(const std::string &buf, size_t *pos,
+                           std::vector<std::string> *dst) {
+  assert(pos);
+  uint32_t count = unpack_u32(buf, pos);
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t len = unpack_u32(buf, pos);
+    if (len > buf.size() - *pos) {
+      throw std::runtime_error("Truncated record in binary response from ISS.");
+    }
+    if (dst) {
+      dst->emplace_back(buf, *pos, len);
+    }
+    *pos += len;
   }
+}
 
-  *dest = dest32 != 0;
-  return true;
+// Unpack a blob (a 32-bit length, followed by that many bytes) from buf at
+// *pos into *dst, advancing *pos.
+static void unpack_blob(const std::string &buf, size_t *pos, std::string *dst) {
+  assert(pos && dst);
+  uint32_t len = unpack_u32(buf, pos);
+  if (len > buf.size() - *pos) {
+    throw std::runtime_error("Truncated blob in binary response from ISS.");
+  }
+  dst->assign(buf, *pos, len);
+  *pos += len;
+}
+
+// Read the value of the OTBN_MODEL_STEP_BATCH environment variable (1 if it
+// isn't set).
+static uint32_t get_step_batch() {
+  const char *batch_str = getenv("OTBN_MODEL_STEP_BATCH");
+  if (!batch_str)
+    return 1;
+
+  char *end;
+  unsigned long batch = strtoul(batch_str, &end, 0);
+  if (*batch_str == '\0' || *end != '\0' || batch == 0 ||
+      batch > UINT32_MAX) {
+    std::ostringstream oss;
+    oss << "Invalid value for OTBN_MODEL_STEP_BATCH: `" << batch_str << "'.";
+    throw std::runtime_error(oss.str());
+  }
+
+  return batch;
+}
+
+// Connect to a Unix socket at path. Returns the connected fd, or -1 if
+// nothing is listening there (or if path is too long to be a socket address).
+static int connect_unix_socket(const std::string &path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    return -1;
+  memcpy(addr.sun_path, path.c_str(), path.size());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Start an ISS fork server (see stepped.py) in the background, listening on
+// a Unix socket at server_path. The server runs in a session of its own, so it
+// outlives this simulation and can serve the simulations that come after it.
+// If another simulation started a server at the same time, one of them just
+// exits.
+static void spawn_iss_server(const std::string &model_path,
+                             const std::string &server_path) {
+  pid_t pid = fork();
+  if (pid == -1)
+    return;
+
+  if (pid == 0) {
+    // Fork again so that the server isn't our child (and is reparented once
+    // this intermediate process exits).
+    setsid();
+    if (fork() != 0)
+      _exit(0);
+
+    // Keep stderr, so that errors from the server can be seen, but don't
+    // hold on to any other files that the simulation has open.
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+      dup2(null_fd, 0);
+      dup2(null_fd, 1);
+    }
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    for (long fd = 3; fd < (max_fd > 0 ? max_fd : 1024); ++fd) {
+      close(fd);
+    }
+
+    execl("/usr/bin/env", "/usr/bin/env", "python3", "-u", model_path.c_str(),
+          "--server", server_path.c_str(), NULL);
+    _exit(1);
+  }
+
+  waitpid(pid, NULL, 0);
+}
+
+// Ask the ISS fork server at server_path to start an ISS whose stdin and
+// stdout are child_stdin and child_stdout (and which shares our stderr). If
+// the server isn't running, start it first. Returns the PID of the ISS, or -1
+// if the server can't be used.
+static pid_t fork_from_iss_server(const std::string &model_path,
+                                  const std::string &server_path,
+                                  int child_stdin, int child_stdout) {
+  int sock = connect_unix_socket(server_path);
+  if (sock < 0) {
+    spawn_iss_server(model_path, server_path);
+
+    // Starting Python and importing the simulator takes a while, especially
+    // on a loaded machine. Wait for up to 60s for the server to appear.
+    for (int i = 0; i < 6000 && sock < 0; ++i) {
+      usleep(10000);
+      sock = connect_unix_socket(server_path);
+    }
+    if (sock < 0)
+      return -1;
+  }
+
+  int fds[3] = {child_stdin, child_stdout, 2};
+  char cmsg_buf[CMSG_SPACE(sizeof(fds))];
+  memset(cmsg_buf, 0, sizeof(cmsg_buf));
+
+  char byte = 0;
+  struct iovec iov;
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (sendmsg(sock, &msg, 0) != 1) {
+    close(sock);
+    return -1;
+  }
+
+  // The server replies with the PID of the child as a little-endian word. If
+  // it closes the connection instead (because it is shutting down), give up.
+  unsigned char pid_buf[4];
+  size_t got = 0;
+  while (got < sizeof(pid_buf)) {
+    ssize_t n = read(sock, pid_buf + got, sizeof(pid_buf) - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  close(sock);
+  if (got < sizeof(pid_buf))
+    return -1;
+
+  return (pid_t)((uint32_t)pid_buf[0] | ((uint32_t)pid_buf[1] << 8) |
+                 ((uint32_t)pid_buf[2] << 16) | ((uint32_t)pid_buf[3] << 24));
+}
+
+// Append a little-endian uint32_t to buf
+static void pack_u32(uint32_t value, std::string *buf) {
+  for (int i = 0; i < 4; ++i) {
+    buf->push_back((char)((value >> (8 * i)) & 0xff));
+  }
 }
 
 void MirroredRegs::reset() {
@@ -266,7 +465,13 @@ void MirroredRegs::reset() {
   wipe_start = false;
 }
 
-ISSWrapper::ISSWrapper() : tmpdir(new TmpDir()) {
+ISSWrapper::ISSWrapper()
+    : child_is_ours_(true),
+      binary_protocol(false),
+      protocol_pending_(false),
+      step_batch_(get_step_batch()),
+      tmpdir(new TmpDir()),
+      shared_mems_() {
   std::string model_path(find_otbn_model());
 
   // We want two pipes: one for writing to the child process, and the other for
@@ -291,7 +496,28 @@ ISSWrapper::ISSWrapper() : tmpdir(new TmpDir()) {
   // We'll attach fds[0] to the child's stdin and fds[3] to the child's stdout.
   // That means we write to fds[1] to send data to the child and read from
   // fds[2] to get data back.
-  pid_t pid = fork();
+  //
+  // If the OTBN_ISS_SERVER environment variable is set, it is the path of a
+  // Unix socket for an ISS fork server (see stepped.py), which is shared by
+  // all the simulations that use the same path. The server has already
+  // started Python and imported the simulator, so it can start an ISS much
+  // more quickly than we can. If that doesn't work, fall back to starting the
+  // ISS ourselves.
+  pid_t pid = -1;
+  const char *server_path = getenv("OTBN_ISS_SERVER");
+  if (server_path && *server_path) {
+    pid = fork_from_iss_server(model_path, server_path, fds[0], fds[3]);
+    if (pid > 0) {
+      child_is_ours_ = false;
+    } else {
+      std::cerr << "WARNING: Couldn't get an ISS from the server at `"
+                << server_path << "'. Starting one directly instead.\n";
+    }
+  }
+
+  if (child_is_ours_)
+    pid = fork();
+
   if (pid == -1) {
     // Something went wrong.
     std::ostringstream oss;
@@ -335,32 +561,93 @@ ISSWrapper::ISSWrapper() : tmpdir(new TmpDir()) {
   // valid). Add an assertion to make sure nothing weird happens.
   assert(child_write_file);
   assert(child_read_file);
+
+  request_protocol();
 }
 
 ISSWrapper::~ISSWrapper() {
   // Stop the child process if it's still running. No need to be nice: we'll
   // just send a SIGKILL. Also, no need to check whether it's running first: we
   // can just fire off the signal and ignore whether it worked or not.
-  kill(child_pid, SIGKILL);
-
-  // Now wait for the child. This should be a very short wait.
-  waitpid(child_pid, NULL, 0);
+  //
+  // A child that came from an ISS server isn't ours to kill or wait for (and
+  // its PID might even have been reused by now). It exits when it sees EOF on
+  // its stdin, which happens when we close child_write_file below.
+  if (child_is_ours_) {
+    kill(child_pid, SIGKILL);
+
+    // Now wait for the child. This should be a very short wait.
+    waitpid(child_pid, NULL, 0);
+  }
 
   // Close the child file handles.
   fclose(child_write_file);
   fclose(child_read_file);
+
+  for (const SharedMem &mem : shared_mems_) {
+    if (mem.words)
+      munmap(mem.words, mem.num_words * sizeof(uint64_t));
+  }
 }
 
-void ISSWrapper::load_d(const std::string &path) {
+uint64_t *ISSWrapper::get_shared_mem(bool is_imem, size_t num_words) {
+  SharedMem &mem = shared_mems_[is_imem];
+  if (mem.words) {
+    if (mem.num_words == num_words)
+      return mem.words;
+
+    // This ISS was used for a design with a different memory size before it
+    // was returned to the pool (see ISSPool). Map the memory again.
+    munmap(mem.words, mem.num_words * sizeof(uint64_t));
+    mem.words = nullptr;
+  }
+
+  // The memory is a file in the temporary directory, which we map in both
+  // processes. This works on Linux and MacOS, and the data only goes through
+  // the page cache.
+  const char *mem_name = is_imem ? "imem" : "dmem";
+  std::string path = make_tmp_path(std::string(mem_name) + ".shm");
+  size_t num_bytes = num_words * sizeof(uint64_t);
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0 || ftruncate(fd, num_bytes) != 0) {
+    std::ostringstream oss;
+    oss << "Cannot create shared memory for " << mem_name << " at '" << path
+        << "': " << strerror(errno);
+    if (fd >= 0)
+      close(fd);
+    throw std::runtime_error(oss.str());
+  }
+
+  void *addr =
+      mmap(nullptr, num_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    std::ostringstream oss;
+    oss << "Cannot map shared memory for " << mem_name << ": "
+        << strerror(errno);
+    throw std::runtime_error(oss.str());
+  }
+
+  mem.words = static_cast<uint64_t *>(addr);
+  mem.num_words = num_words;
+
   std::ostringstream oss;
-  oss << "load_d " << path << "\n";
+  oss << "map_shared_mem " << mem_name << " " << path << " " << num_words
+      << "\n";
   run_command(oss.str(), nullptr);
+
+  return mem.words;
 }
 
-void ISSWrapper::load_i(const std::string &path) {
-  std::ostringstream oss;
-  oss << "load_i " << path << "\n";
-  run_command(oss.str(), nullptr);
+void ISSWrapper::load_d() {
+  assert(shared_mems_[0].words);
+  run_command("load_shared_mem dmem\n", nullptr);
+}
+
+void ISSWrapper::load_i() {
+  assert(shared_mems_[1].words);
+  run_command("load_shared_mem imem\n", nullptr);
 }
 
 void ISSWrapper::add_loop_warp(uint32_t addr, uint32_t from_cnt,
@@ -375,10 +662,10 @@ void ISSWrapper::clear_loop_warps() {
   run_command("clear_loop_warps\n", nullptr);
 }
 
-void ISSWrapper::dump_d(const std::string &path) const {
-  std::ostringstream oss;
-  oss << "dump_d " << path << "\n";
-  run_command(oss.str(), nullptr);
+const uint64_t *ISSWrapper::dump_d(size_t num_words) {
+  const uint64_t *words = get_shared_mem(false, num_words);
+  run_command("dump_shared_mem dmem\n", nullptr);
+  return words;
 }
 
 void ISSWrapper::start_operation(command_t command) {
@@ -451,36 +738,86 @@ void ISSWrapper::set_keymgr_value(const std::array<uint32_t, 12> &key0_arr,
 }
 
 int ISSWrapper::step(bool gen_trace) {
-  std::vector<std::string> lines;
+  StepResult result;
+
+  await_protocol();
+
+  if (binary_protocol && step_batch_ > 1) {
+    if (run_ahead_.empty())
+      run_binary_step_n(step_batch_, &run_ahead_);
+
+    result = std::move(run_ahead_.front());
+    run_ahead_.pop_front();
+  } else if (binary_protocol) {
+    run_binary_step(&result);
+  } else {
+    run_command("step\n", &result.lines);
+
+    StepUpdates &updates = result.updates;
+    updates.mask = 0;
+    for (int i = 0; i < StepUpdates::NumRegs; ++i) {
+      updates.values[i] = 0;
+      if (read_ext_reg(kStepRegNames[i], result.lines, &updates.values[i]))
+        updates.mask |= 1u << i;
+    }
+  }
 
-  run_command("step\n", &lines);
-  if (gen_trace && lines.size()) {
-    if (!OtbnTraceChecker::get().OnIssTrace(lines)) {
-      return -1;
+  const StepUpdates &updates = result.updates;
+
+  if (gen_trace) {
+    // With the binary protocol, the ISS gives us a trace record that the
+    // checker can use directly. With the text protocol, it has to parse the
+    // lines.
+    OtbnTraceChecker &checker = OtbnTraceChecker::get();
+    bool good = true;
+    if (binary_protocol && !result.trace.Empty()) {
+      good = checker.OnIssTrace(result.trace, result.mnemonic);
+    } else if (!binary_protocol && result.lines.size()) {
+      good = checker.OnIssTrace(result.lines);
     }
+    if (!good)
+      return -1;
   }
 
-  // Try to read STATUS, which is written when execution ends. Execution has
-  // finished if status_ is either 0 (IDLE) or 0xff (LOCKED)
+  // STATUS is written when execution ends. Execution has finished if status_
+  // is either 0 (IDLE) or 0xff (LOCKED)
   bool was_stopped = mirrored_.stopped();
-  read_ext_reg("STATUS", lines, &mirrored_.status);
+  if (!apply_step_updates(updates))
+    return -1;
   bool is_stopped = mirrored_.stopped();
   bool done = is_stopped && !was_stopped;
 
-  // Also try to read INSN_CNT, ERR_BITS and STOP_PC plus some associated
-  // flags. Some of these flags only get updated around the end of an operation
+  return done ? 1 : 0;
+}
+
+bool ISSWrapper::apply_step_updates(const StepUpdates &updates) {
+  // Some of these registers only get updated around the end of an operation
   // but the precise timing is slightly fiddly, so it's easiest to just allow
   // updates whenever they arrive.
-  read_ext_reg("INSN_CNT", lines, &mirrored_.insn_cnt);
-  read_ext_reg("ERR_BITS", lines, &mirrored_.err_bits);
-  read_ext_reg("STOP_PC", lines, &mirrored_.stop_pc);
+  uint32_t *regs[] = {&mirrored_.status, &mirrored_.insn_cnt,
+                      &mirrored_.err_bits, &mirrored_.stop_pc};
+  for (int i = 0; i < StepUpdates::RndReq; ++i) {
+    if ((updates.mask >> i) & 1)
+      *regs[i] = updates.values[i];
+  }
 
-  if (!read_ext_flag("RND_REQ", lines, &mirrored_.rnd_req))
-    return -1;
-  if (!read_ext_flag("WIPE_START", lines, &mirrored_.wipe_start))
-    return -1;
+  // RND_REQ and WIPE_START are boolean flags (the ISS should always signal
+  // them as having value 0 or 1).
+  bool *flags[] = {&mirrored_.rnd_req, &mirrored_.wipe_start};
+  for (int i = StepUpdates::RndReq; i < StepUpdates::NumRegs; ++i) {
+    if (!((updates.mask >> i) & 1))
+      continue;
 
-  return done ? 1 : 0;
+    if (updates.values[i] > 1) {
+      std::cerr << "ERROR: Unexpected update to " << kStepRegNames[i]
+                << " with value 0x" << std::hex << updates.values[i]
+                << std::dec << " when we expected a boolean flag.";
+      return false;
+    }
+    *flags[i - StepUpdates::RndReq] = updates.values[i] != 0;
+  }
+
+  return true;
 }
 
 void ISSWrapper::invalidate_imem() {
@@ -523,6 +860,8 @@ void ISSWrapper::reset(bool gen_trace) {
   if (gen_trace)
     OtbnTraceChecker::get().Flush();
 
+  // Any cycles that the ISS ran ahead are thrown away with its state.
+  run_ahead_.clear();
   run_command("reset\n", nullptr);
 
   // Reset all mirrored registers.
@@ -713,11 +1052,63 @@ bool ISSWrapper::read_child_response(std::vector<std::string> *dst) const {
   }
 }
 
+void ISSWrapper::request_protocol() {
+  const char *text_str = getenv("OTBN_MODEL_TEXT_PROTOCOL");
+  if (text_str && strcmp(text_str, "1") == 0)
+    return;
+
+  fprintf(child_write_file, "protocol binary %u\n", kBinaryProtocolVersion);
+  fflush(child_write_file);
+  protocol_pending_ = true;
+}
+
+void ISSWrapper::await_protocol() const {
+  if (!protocol_pending_)
+    return;
+
+  protocol_pending_ = false;
+
+  std::vector<std::string> lines;
+  if (!read_child_response(&lines)) {
+    throw std::runtime_error(
+        "Failed to start ISS: EOF when waiting for protocol response.");
+  }
+
+  // The child responds with "PROTOCOL binary <ver>" if it has switched, and
+  // "PROTOCOL text" if it doesn't support our version.
+  std::ostringstream expected;
+  expected << "PROTOCOL binary " << kBinaryProtocolVersion;
+  binary_protocol = lines.size() == 1 && lines[0] == expected.str();
+}
+
 void ISSWrapper::run_command(const std::string &cmd,
                              std::vector<std::string> *dst) const {
   assert(cmd.size() > 0);
   assert(cmd.back() == '\n');
 
+  await_protocol();
+
+  // If the ISS has run ahead of the caller (see step()), its state is from a
+  // later cycle than the one the command is meant for. The exception is
+  // step_crc, which doesn't look at the state at all.
+  if (!run_ahead_.empty() && cmd.compare(0, 9, "step_crc ") != 0) {
+    std::ostringstream oss;
+    std::string cmd_line = cmd.substr(0, cmd.size() - 1);
+    oss << "Cannot run command '" << cmd_line << "': the ISS has run "
+        << run_ahead_.size()
+        << " cycles ahead. Unset OTBN_MODEL_STEP_BATCH for "
+           "simulations that interact with OTBN during execution.";
+    throw std::runtime_error(oss.str());
+  }
+
+  if (binary_protocol) {
+    std::string response;
+    size_t pos = 0;
+    run_binary_command(kOpText, cmd.substr(0, cmd.size() - 1), &response);
+    unpack_records(response, &pos, dst);
+    return;
+  }
+
   fputs(cmd.c_str(), child_write_file);
   fflush(child_write_file);
   if (!read_child_response(dst)) {
@@ -727,3 +1118,110 @@ void ISSWrapper::run_command(const std::string &cmd,
     throw std::runtime_error(oss.str());
   }
 }
+
+void ISSWrapper::run_binary_command(uint8_t opcode, const std::string &payload,
+                                    std::string *response) const {
+  assert(binary_protocol);
+  assert(response);
+
+  std::string frame;
+  frame.reserve(5 + payload.size());
+  pack_u32(1 + payload.size(), &frame);
+  frame.push_back((char)opcode);
+  frame += payload;
+
+  fwrite(frame.data(), 1, frame.size(), child_write_file);
+  fflush(child_write_file);
+
+  char hdr[4];
+  if (fread(hdr, 1, sizeof hdr, child_read_file) == sizeof hdr) {
+    size_t pos = 0;
+    uint32_t len = unpack_u32(std::string(hdr, sizeof hdr), &pos);
+
+    response->resize(len);
+    if (len == 0 || fread(&response->at(0), 1, len, child_read_file) == len)
+      return;
+  }
+
+  std::ostringstream oss;
+  oss << "Failed to run binary command with opcode " << (int)opcode
+      << ": EOF from ISS.";
+  throw std::runtime_error(oss.str());
+}
+
+void ISSWrapper::unpack_step(const std::string &buf, size_t *pos,
+                             StepResult *result) {
+  assert(pos && result);
+
+  result->updates.mask = unpack_u32(buf, pos);
+  for (int i = 0; i < StepUpdates::NumRegs; ++i) {
+    result->updates.values[i] = unpack_u32(buf, pos);
+  }
+
+  // The trace record is a blob, which is empty if nothing was traced
+  std::string blob;
+  unpack_blob(buf, pos, &blob);
+  size_t blob_pos = 0;
+  result->trace.Clear();
+  if (!blob.empty() && !(result->trace.Unpack(blob, &blob_pos) &&
+                         blob_pos == blob.size())) {
+    throw std::runtime_error("Malformed trace record in response from ISS.");
+  }
+
+  unpack_blob(buf, pos, &result->mnemonic);
+}
+
+void ISSWrapper::run_binary_step(StepResult *result) const {
+  assert(result);
+
+  std::string response;
+  run_binary_command(kOpStep, "", &response);
+
+  size_t pos = 0;
+  unpack_step(response, &pos, result);
+}
+
+void ISSWrapper::run_binary_step_n(uint32_t max_cycles,
+                                   std::deque<StepResult> *results) const {
+  assert(results);
+
+  std::string payload, response;
+  pack_u32(max_cycles, &payload);
+  run_binary_command(kOpStepN, payload, &response);
+
+  size_t pos = 0;
+  uint32_t count = unpack_u32(response, &pos);
+  if (count == 0 || count > max_cycles) {
+    std::ostringstream oss;
+    oss << "ISS ran " << count << " cycles when asked for at most "
+        << max_cycles << ".";
+    throw std::runtime_error(oss.str());
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    results->emplace_back();
+    unpack_step(response, &pos, &results->back());
+  }
+}
+
+ISSPool &ISSPool::get() {
+  static ISSPool pool;
+  return pool;
+}
+
+void ISSPool::set_size(size_t size) {
+  if (idle_.size() > size)
+    idle_.resize(size);
+  while (idle_.size() < size) {
+    idle_.emplace_back(new ISSWrapper());
+  }
+}
+
+std::unique_ptr<ISSWrapper> ISSPool::lease() {
+  if (idle_.empty())
+    return std::unique_ptr<ISSWrapper>(new ISSWrapper());
+
+  std::unique_ptr<ISSWrapper> iss = std::move(idle_.back());
+  idle_.pop_back();
+  return iss;
+}
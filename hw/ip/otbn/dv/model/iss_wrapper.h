@@ -7,11 +7,14 @@
 #include <array>
 #include <cstdint>
 #include <cstdio>
+#include <deque>
 #include <memory>
 #include <string>
 #include <unistd.h>
 #include <vector>
 
+#include "otbn_trace_record.h"
+
 // Forward declaration (the implementation is private in iss_wrapper.cc)
 struct TmpDir;
 
@@ -57,9 +60,21 @@ struct ISSWrapper {
   ISSWrapper();
   ~ISSWrapper();
 
-  // Load new contents of DMEM / IMEM
-  void load_d(const std::string &path);
-  void load_i(const std::string &path);
+  // IMEM and DMEM are passed to and from the ISS through memory that is
+  // shared with it. Each 32-bit word of memory is stored as a uint64_t: bits
+  // 31:0 hold the data and bit 32 (kMemWordValid) is set if the word has
+  // valid integrity bits. The data of an invalid word is zero, so two copies
+  // of a memory can be compared word by word as integers.
+  static const uint64_t kMemWordValid = (uint64_t)1 << 32;
+
+  // Return the words of the memory shared with the ISS for IMEM or DMEM,
+  // mapping it on the first call (or if num_words has changed). num_words is
+  // the size of the memory in 32-bit words.
+  uint64_t *get_shared_mem(bool is_imem, size_t num_words);
+
+  // Load new contents of DMEM / IMEM from the shared memory
+  void load_d();
+  void load_i();
 
   // Add a loop warp instruction to the simulation
   void add_loop_warp(uint32_t addr, uint32_t from_cnt, uint32_t to_cnt);
@@ -67,8 +82,9 @@ struct ISSWrapper {
   // Clear any loop warp instructions from the simulation
   void clear_loop_warps();
 
-  // Dump the contents of DMEM to a file
-  void dump_d(const std::string &path) const;
+  // Dump the contents of DMEM to the shared memory, returning its words.
+  // num_words is as for get_shared_mem().
+  const uint64_t *dump_d(size_t num_words);
 
   // Start an operation (execute, dmem wipe or imem wipe)
   void start_operation(command_t command);
@@ -112,6 +128,14 @@ struct ISSWrapper {
   // Updates mirrored versions of STATUS and INSN_CNT registers. If execution
   // finishes (so we return 1), also updates mirrored versions of ERR_BITS and
   // the final PC (see get_stop_pc()).
+  //
+  // If the OTBN_MODEL_STEP_BATCH environment variable is set to some N > 1,
+  // the ISS runs up to N cycles ahead while its execution doesn't depend on
+  // anything outside it (see can_run_ahead() in stepped.py). The results are
+  // buffered here and handed out one cycle at a time, so this needs a round
+  // trip to the ISS much less often. Other commands can't be run while the
+  // ISS is ahead (they raise a runtime_error), so this is only suitable for
+  // simulations that don't inject errors or escalations during execution.
   int step(bool gen_trace);
 
   // Mark all of IMEM as invalid so that any fetch causes an integrity error.
@@ -155,6 +179,37 @@ struct ISSWrapper {
   std::string make_tmp_path(const std::string &relative) const;
 
  private:
+  // External registers that the ISS might update on a step, with the values
+  // that it wrote. Bit i of mask is set if values[i] was written. The order
+  // of the registers matches the fixed fields of a binary step response.
+  struct StepUpdates {
+    enum { Status, InsnCnt, ErrBits, StopPc, RndReq, WipeStart, NumRegs };
+
+    uint32_t mask;
+    uint32_t values[NumRegs];
+  };
+
+  // The result of stepping the ISS for a cycle. With the binary protocol,
+  // the ISS sends a structured trace record (and the mnemonic of any
+  // instruction that completed). With the text protocol, it sends lines of
+  // text instead.
+  struct StepResult {
+    std::vector<std::string> lines;
+    OtbnTraceRecord trace;
+    std::string mnemonic;
+    StepUpdates updates;
+  };
+
+  // Ask the child to switch to the binary protocol. Stays with the text
+  // protocol if the child doesn't support it or if the OTBN_MODEL_TEXT_PROTOCOL
+  // environment variable is set to 1.
+  //
+  // This doesn't wait for the response: the child can start up (which takes
+  // a while) in the background. The response is read by await_protocol(),
+  // which must be called before sending anything else to the child.
+  void request_protocol();
+  void await_protocol() const;
+
   // Read line by line from the child process until we get ".\n".
   // Return true if we got the ".\n" terminator, false if EOF. If dst
   // is not null, append to it each line that was read.
@@ -164,15 +219,95 @@ struct ISSWrapper {
   // response, raise a runtime_error.
   void run_command(const std::string &cmd, std::vector<std::string> *dst) const;
 
+  // Send a binary frame with the given opcode and payload to the child and
+  // read the payload of the response frame into *response. If the child
+  // doesn't respond, raise a runtime_error.
+  void run_binary_command(uint8_t opcode, const std::string &payload,
+                          std::string *response) const;
+
+  // Unpack the response to a single step in the binary protocol from buf at
+  // *pos, advancing *pos. Raises a runtime_error if buf is malformed.
+  static void unpack_step(const std::string &buf, size_t *pos,
+                          StepResult *result);
+
+  // Run a step with the binary protocol, filling in the trace record and the
+  // updates to external registers.
+  void run_binary_step(StepResult *result) const;
+
+  // Run up to max_cycles steps with the binary protocol, appending the
+  // results to *results.
+  void run_binary_step_n(uint32_t max_cycles,
+                         std::deque<StepResult> *results) const;
+
+  // Apply updates from a step to the mirrored registers. Prints a message to
+  // stderr and returns false on error.
+  bool apply_step_updates(const StepUpdates &updates);
+
   pid_t child_pid;
+
+  // False if the child was started by an ISS server (see OTBN_ISS_SERVER in
+  // the constructor), rather than by this process.
+  bool child_is_ours_;
+
   FILE *child_write_file;
   FILE *child_read_file;
 
+  // True if we have switched to the binary protocol. These are mutable
+  // because they are updated when we first talk to the child (see
+  // await_protocol()), which might be in a const method.
+  mutable bool binary_protocol;
+
+  // True if we haven't read the response to the protocol request yet
+  mutable bool protocol_pending_;
+
+  // The maximum number of cycles that the ISS may run ahead (see step())
+  uint32_t step_batch_;
+
+  // Results of the cycles that the ISS has run ahead, which haven't been
+  // handed out by step() yet.
+  std::deque<StepResult> run_ahead_;
+
   // A temporary directory for communicating with the child process
   std::unique_ptr<TmpDir> tmpdir;
 
+  // Memory shared with the child process for IMEM (index 1) and DMEM (index
+  // 0). See get_shared_mem().
+  struct SharedMem {
+    uint64_t *words;
+    size_t num_words;
+  };
+  SharedMem shared_mems_[2];
+
   // Mirrored copies of registers
   MirroredRegs mirrored_;
 };
 
+// ISS processes that were started ahead of time.
+//
+// Starting an ISS means starting a Python interpreter and importing the
+// simulator, which takes a while. A simulation can start the ISS processes
+// for its models at time zero, so that they start up in the background while
+// the simulation runs. Each process belongs to a single simulation: to share
+// the startup cost between simulations, use an ISS server (see OTBN_ISS_SERVER
+// in the ISSWrapper constructor).
+class ISSPool {
+ public:
+  // Get the (singleton) pool
+  static ISSPool &get();
+
+  // Start ISS processes (or stop idle ones) until there are size idle ones.
+  // This is normally the number of OTBN models in the design: the pool isn't
+  // refilled as models take ISS processes from it.
+  void set_size(size_t size);
+
+  // Take an ISS from the pool, starting a new one if the pool is empty.
+  // Raises a runtime_error if an ISS can't be started.
+  std::unique_ptr<ISSWrapper> lease();
+
+ private:
+  ISSPool() {}
+
+  std::vector<std::unique_ptr<ISSWrapper>> idle_;
+};
+
 #endif  // OPENTITAN_HW_IP_OTBN_DV_MODEL_ISS_WRAPPER_H_
@@ -64,6 +64,11 @@ module otbn_core_model
   // Create and destroy an object through which we can talk to the ISS.
   chandle model_handle;
   initial begin
+    int unsigned iss_pool_size;
+    // Start this many ISS processes in the background, ready for the models in this simulation.
+    if ($value$plusargs("otbn_iss_pool_size=%d", iss_pool_size)) begin
+      otbn_model_set_iss_pool_size(iss_pool_size);
+    end
     model_handle = otbn_model_init(MemScope, DesignScope);
     assert(model_handle != null);
   end
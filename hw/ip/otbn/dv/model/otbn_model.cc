@@ -7,7 +7,6 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
-#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -15,6 +14,7 @@
 #include "iss_wrapper.h"
 #include "otbn_model_dpi.h"
 #include "otbn_trace_checker.h"
+#include "simctrl_dpi.h"
 #include "sv_scoped.h"
 #include "sv_utils.h"
 
@@ -40,85 +40,37 @@ int otbn_stack_element_peek(int index, svBitVecVal *val);
 #define STATUS_BUSY_SEC_WIPE_INT 0x04
 #define STATUS_LOCKED 0xFF
 
-// Read (the start of) the contents of a file at path as a vector of bytes.
-// Expects num_bytes bytes of data. On failure, throws a std::runtime_error.
-static Ecc32MemArea::EccWords read_words_from_file(const std::string &path,
-                                                   size_t num_words) {
-  std::filebuf fb;
-  if (!fb.open(path.c_str(), std::ios::in | std::ios::binary)) {
-    std::ostringstream oss;
-    oss << "Cannot open the file '" << path << "'.";
-    throw std::runtime_error(oss.str());
+// Pack a word of memory into the format of ISSWrapper::get_shared_mem().
+static uint64_t pack_mem_word(const Ecc32MemArea::EccWord &word) {
+  return word.first ? (ISSWrapper::kMemWordValid | word.second) : 0;
+}
+
+// Copy words to the start of the memory shared with the ISS for IMEM or DMEM.
+// num_words is the size of the shared memory.
+static void words_to_shared_mem(ISSWrapper &iss, bool is_imem,
+                                size_t num_words,
+                                const Ecc32MemArea::EccWords &words) {
+  assert(words.size() <= num_words);
+
+  uint64_t *dst = iss.get_shared_mem(is_imem, num_words);
+  for (size_t i = 0; i < words.size(); ++i) {
+    dst[i] = pack_mem_word(words[i]);
   }
+}
 
+// Unpack num_words words of memory from the format of
+// ISSWrapper::get_shared_mem().
+static Ecc32MemArea::EccWords unpack_mem_words(const uint64_t *src,
+                                               size_t num_words) {
   Ecc32MemArea::EccWords ret;
   ret.reserve(num_words);
-
-  char minibuf[5];
   for (size_t i = 0; i < num_words; ++i) {
-    std::streamsize chars_in = fb.sgetn(minibuf, 5);
-    if (chars_in != 5) {
-      std::ostringstream oss;
-      oss << "Cannot read word " << i << " from " << path
-          << " (expected 5 bytes, but actually got " << chars_in << ").";
-      throw std::runtime_error(oss.str());
-    }
-
-    // The layout should be a validity byte (either 0 or 1), followed
-    // by 4 bytes with a little-endian 32-bit word.
-    uint8_t vld_byte = minibuf[0];
-    if (vld_byte > 2) {
-      std::ostringstream oss;
-      oss << "Word " << i << " at " << path
-          << " had a validity byte with value " << (int)vld_byte
-          << "; not 0 or 1.";
-      throw std::runtime_error(oss.str());
-    }
-    bool valid = vld_byte == 1;
-
-    uint32_t word = 0;
-    for (int j = 0; j < 4; ++j) {
-      word |= (uint32_t)(uint8_t)minibuf[j + 1] << 8 * j;
-    }
-
-    ret.push_back(std::make_pair(valid, word));
+    ret.push_back(std::make_pair((src[i] & ISSWrapper::kMemWordValid) != 0,
+                                 (uint32_t)src[i]));
   }
-
   return ret;
 }
 
-// Write some words to a new file at path. On failure, throws a
-// std::runtime_error.
-static void write_words_to_file(const std::string &path,
-                                const Ecc32MemArea::EccWords &words) {
-  std::filebuf fb;
-  if (!fb.open(path.c_str(), std::ios::out | std::ios::binary)) {
-    std::ostringstream oss;
-    oss << "Cannot open the file '" << path << "'.";
-    throw std::runtime_error(oss.str());
-  }
-
-  for (const Ecc32MemArea::EccWord &word : words) {
-    uint8_t bytes[5];
-
-    bool valid = word.first;
-    uint32_t w32 = word.second;
-
-    bytes[0] = valid ? 1 : 0;
-    for (int j = 0; j < 4; ++j) {
-      bytes[j + 1] = (w32 >> (8 * j)) & 0xff;
-    }
-
-    std::streamsize chars_out =
-        fb.sputn(reinterpret_cast<const char *>(&bytes), 5);
-    if (chars_out != 5) {
-      std::ostringstream oss;
-      oss << "Failed to write to " << path << ".";
-      throw std::runtime_error(oss.str());
-    }
-  }
-}
-
 template <typename T>
 static std::array<T, 32> get_rtl_regs(const std::string &reg_scope) {
   std::array<T, 32> ret;
@@ -239,14 +191,14 @@ int OtbnModel::start_operation(command_t command) {
         cmd_desc = "execute";
         iss_command = ISSWrapper::Execute;
 
-        std::string dfname(iss->make_tmp_path("dmem"));
-        std::string ifname(iss->make_tmp_path("imem"));
+        Ecc32MemArea::EccWords dmem_words = get_sim_memory(false);
+        Ecc32MemArea::EccWords imem_words = get_sim_memory(true);
 
-        write_words_to_file(dfname, get_sim_memory(false));
-        write_words_to_file(ifname, get_sim_memory(true));
+        words_to_shared_mem(*iss, false, dmem_words.size(), dmem_words);
+        words_to_shared_mem(*iss, true, imem_words.size(), imem_words);
 
-        iss->load_d(dfname);
-        iss->load_i(ifname);
+        iss->load_d();
+        iss->load_i();
       } break;
 
       case DmemWipe:
@@ -497,12 +449,10 @@ int OtbnModel::load_dmem() {
 
   const MemArea &dmem = mem_util_.GetMemArea(false);
 
-  std::string dfname(iss->make_tmp_path("dmem_out"));
   try {
     // Read DMEM from the ISS
-    iss->dump_d(dfname);
-    set_sim_memory(false,
-                   read_words_from_file(dfname, dmem.GetSizeBytes() / 4));
+    size_t num_words = dmem.GetSizeBytes() / 4;
+    set_sim_memory(false, unpack_mem_words(iss->dump_d(num_words), num_words));
   } catch (const std::exception &err) {
     std::cerr << "Error when loading dmem from ISS: " << err.what() << "\n";
     return -1;
@@ -656,7 +606,7 @@ bool OtbnModel::is_at_start_of_wipe() const {
 ISSWrapper *OtbnModel::ensure_wrapper() {
   if (!iss_) {
     try {
-      iss_.reset(new ISSWrapper());
+      iss_ = ISSPool::get().lease();
     } catch (const std::runtime_error &err) {
       std::cerr << "Error when constructing ISS wrapper: " << err.what()
                 << "\n";
@@ -677,67 +627,108 @@ void OtbnModel::set_sim_memory(bool is_imem,
   mem_util_.GetMemArea(is_imem).WriteWithIntegrity(0, words);
 }
 
+// Return true if a word of DMEM from the ISS doesn't match the word from the
+// RTL. Both words are in the format of ISSWrapper::get_shared_mem().
+static bool dmem_word_mismatch(uint64_t iss_word, uint64_t rtl_word) {
+  // Two invalid words are both zero, so this also covers the case where
+  // neither word has valid checksum bits.
+  if (iss_word == rtl_word)
+    return false;
+
+  // TODO: At the moment, the ISS doesn't track validity bits properly in
+  //       DMEM, which means that we might have a situation where RTL says a
+  //       word is invalid, but the ISS doesn't. To avoid spurious failures
+  //       until we've implemented things, skip the check in this case. Once
+  //       the ISS handles validity bits properly, delete this block.
+  if ((iss_word & ISSWrapper::kMemWordValid) &&
+      !(rtl_word & ISSWrapper::kMemWordValid))
+    return false;
+
+  return true;
+}
+
+// Print a range of mismatching words in DMEM, [first, last], to stderr. The
+// ISS and RTL words are in the format of ISSWrapper::get_shared_mem().
+static void print_dmem_mismatch(size_t first, size_t last,
+                                const uint64_t *iss_words,
+                                const uint64_t *rtl_words) {
+  bool iss_valid = (iss_words[first] & ISSWrapper::kMemWordValid) != 0;
+  bool rtl_valid = (rtl_words[first] & ISSWrapper::kMemWordValid) != 0;
+  uint32_t iss_w32 = (uint32_t)iss_words[first];
+  uint32_t rtl_w32 = (uint32_t)rtl_words[first];
+
+  std::cerr << " @offset 0x" << std::setw(3) << 4 * first;
+  if (last > first) {
+    std::cerr << "..0x" << std::setw(3) << 4 * last + 3 << " ("
+              << std::dec << last - first + 1 << " words, showing the first)"
+              << std::hex;
+  }
+  std::cerr << ": ";
+
+  if (iss_valid != rtl_valid) {
+    std::cerr << "mismatching validity bits (rtl = " << rtl_valid
+              << "; iss = " << iss_valid << ")";
+  } else {
+    assert(iss_valid && rtl_valid && iss_w32 != rtl_w32);
+    std::cerr << "rtl has 0x" << std::setw(8) << rtl_w32 << "; iss has 0x"
+              << std::setw(8) << iss_w32;
+  }
+  std::cerr << "\n";
+}
+
 bool OtbnModel::check_dmem(ISSWrapper &iss) const {
   const MemArea &dmem = mem_util_.GetMemArea(false);
-  uint32_t dmem_bytes = dmem.GetSizeBytes();
-
-  std::string dfname(iss.make_tmp_path("dmem_out"));
+  size_t num_words = dmem.GetSizeBytes() / 4;
 
-  iss.dump_d(dfname);
-  Ecc32MemArea::EccWords iss_words =
-      read_words_from_file(dfname, dmem_bytes / 4);
-  assert(iss_words.size() == dmem_bytes / 4);
+  const uint64_t *iss_words = iss.dump_d(num_words);
 
-  Ecc32MemArea::EccWords rtl_words = get_sim_memory(false);
-  assert(rtl_words.size() == dmem_bytes / 4);
+  Ecc32MemArea::EccWords rtl_ecc_words = get_sim_memory(false);
+  assert(rtl_ecc_words.size() == num_words);
+  std::vector<uint64_t> rtl_words;
+  rtl_words.reserve(num_words);
+  for (const Ecc32MemArea::EccWord &word : rtl_ecc_words) {
+    rtl_words.push_back(pack_mem_word(word));
+  }
 
   std::ios old_state(nullptr);
   old_state.copyfmt(std::cerr);
 
+  // Skip over whole blocks of words that match (which will normally be most
+  // of DMEM) and report mismatching words as ranges of consecutive words.
+  const size_t block_words = 8;
   int bad_count = 0;
-  for (size_t i = 0; i < dmem_bytes / 4; ++i) {
-    bool iss_valid = iss_words[i].first;
-    bool rtl_valid = rtl_words[i].first;
-    uint32_t iss_w32 = iss_words[i].second;
-    uint32_t rtl_w32 = rtl_words[i].second;
-
-    // If neither word has valid checksum bits, all is well.
-    if (!iss_valid && !rtl_valid)
+  size_t i = 0;
+  while (i < num_words) {
+    if (i % block_words == 0 && i + block_words <= num_words &&
+        memcmp(&iss_words[i], &rtl_words[i], block_words * sizeof(uint64_t)) ==
+            0) {
+      i += block_words;
       continue;
+    }
 
-    // If both words have valid checksum bits and equal data, all is well.
-    if (iss_valid && rtl_valid && iss_w32 == rtl_w32)
+    if (!dmem_word_mismatch(iss_words[i], rtl_words[i])) {
+      ++i;
       continue;
+    }
 
-    // TODO: At the moment, the ISS doesn't track validity bits properly in
-    //       DMEM, which means that we might have a situation where RTL says a
-    //       word is invalid, but the ISS doesn't. To avoid spurious failures
-    //       until we've implemented things, skip the check in this case. Once
-    //       the ISS handles validity bits properly, delete this block.
-    if (iss_valid && !rtl_valid)
-      continue;
+    size_t first = i;
+    while (i + 1 < num_words &&
+           dmem_word_mismatch(iss_words[i + 1], rtl_words[i + 1]))
+      ++i;
 
-    // Otherwise, something has gone wrong. Print out a banner if this is the
-    // first mismatch.
+    // Print out a banner if this is the first mismatch.
     if (bad_count == 0) {
       std::cerr << "ERROR: Mismatches in dmem data:\n"
                 << std::hex << std::setfill('0');
     }
-
-    std::cerr << " @offset 0x" << std::setw(3) << 4 * i << ": ";
-    if (iss_valid != rtl_valid) {
-      std::cerr << "mismatching validity bits (rtl = " << rtl_valid
-                << "; iss = " << iss_valid << ")\n";
-    } else {
-      assert(iss_valid && rtl_valid && iss_w32 != rtl_w32);
-      std::cerr << "rtl has 0x" << std::setw(8) << rtl_w32 << "; iss has 0x"
-                << std::setw(8) << iss_w32 << "\n";
-    }
-    ++bad_count;
     if (bad_count == 10) {
       std::cerr << " (skipping further errors...)\n";
       break;
     }
+
+    print_dmem_mismatch(first, i, iss_words, rtl_words.data());
+    ++bad_count;
+    ++i;
   }
   std::cerr.copyfmt(old_state);
   return bad_count == 0;
@@ -850,11 +841,23 @@ int OtbnModel::initial_secure_wipe() {
 
 OtbnModel *otbn_model_init(const char *mem_scope, const char *design_scope) {
   assert(mem_scope && design_scope);
-  return new OtbnModel(mem_scope, design_scope);
+  OtbnModel *model = new OtbnModel(mem_scope, design_scope);
+  // The model drives an ISS subprocess, whose state can't be checkpointed.
+  simctrl_dpi_context_created(design_scope, model, nullptr);
+  return model;
 }
 
 void otbn_model_destroy(OtbnModel *model) { delete model; }
 
+void otbn_model_set_iss_pool_size(unsigned size) {
+  try {
+    ISSPool::get().set_size(size);
+  } catch (const std::runtime_error &err) {
+    std::cerr << "Error when starting ISS processes for the pool: "
+              << err.what() << "\n";
+  }
+}
+
 void otbn_take_loop_warps(OtbnModel *model, OtbnMemUtil *memutil) {
   assert(model && memutil);
   model->take_loop_warps(*memutil);
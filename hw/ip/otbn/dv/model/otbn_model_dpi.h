@@ -21,6 +21,10 @@ OtbnModel *otbn_model_init(const char *mem_scope, const char *design_scope);
 // Delete an OtbnModel
 void otbn_model_destroy(OtbnModel *model);
 
+// Start this many ISS processes in the background (see ISSPool), ready for
+// the models in this simulation to use.
+void otbn_model_set_iss_pool_size(unsigned size);
+
 // Take loop warps from an OtbnMemUtil
 void otbn_take_loop_warps(OtbnModel *model, OtbnMemUtil *memutil);
 
@@ -40,7 +40,7 @@ OtbnTraceChecker &OtbnTraceChecker::get() {
   return *trace_checker;
 }
 
-void OtbnTraceChecker::AcceptTraceString(const std::string &trace,
+void OtbnTraceChecker::AcceptTraceRecord(const OtbnTraceRecord &record,
                                          unsigned int cycle_count) {
   assert(!(rtl_pending_ && iss_pending_));
 
@@ -49,10 +49,7 @@ void OtbnTraceChecker::AcceptTraceString(const std::string &trace,
 
   done_ = false;
   OtbnTraceEntry trace_entry;
-  if (!trace_entry.from_rtl_trace(trace)) {
-    seen_err_ = true;
-    return;
-  }
+  trace_entry.from_rtl_record(record);
   if (trace_entry.trace_type() == OtbnTraceEntry::Invalid) {
     std::cerr << "ERROR: Invalid RTL trace entry with invalid header:\n";
     trace_entry.print("  ", std::cerr);
@@ -139,19 +136,29 @@ void OtbnTraceChecker::AcceptTraceString(const std::string &trace,
   }
 }
 
-bool OtbnTraceChecker::OnIssTrace(const std::vector<std::string> &lines) {
-  assert(!(rtl_pending_ && iss_pending_));
-
-  if (seen_err_) {
-    return false;
-  }
+bool OtbnTraceChecker::OnIssTrace(const OtbnTraceRecord &record,
+                                  const std::string &mnemonic) {
+  OtbnIssTraceEntry trace_entry;
+  trace_entry.from_iss_record(record, mnemonic);
+  return OnIssEntry(trace_entry);
+}
 
+bool OtbnTraceChecker::OnIssTrace(const std::vector<std::string> &lines) {
   OtbnIssTraceEntry trace_entry;
   if (!trace_entry.from_iss_trace(lines)) {
     // Error parsing ISS trace. This has already printed a message to stderr.
     // Just return false to pass the error code along.
     return false;
   }
+  return OnIssEntry(trace_entry);
+}
+
+bool OtbnTraceChecker::OnIssEntry(OtbnIssTraceEntry &trace_entry) {
+  assert(!(rtl_pending_ && iss_pending_));
+
+  if (seen_err_) {
+    return false;
+  }
 
   done_ = false;
 
@@ -52,12 +52,18 @@ class OtbnTraceChecker : public OtbnTraceListener {
 
   // Take a trace entry from the wrapped RTL. Any mismatch error is stored
   // until the next call to an API function that can respond with the error.
-  void AcceptTraceString(const std::string &trace,
+  void AcceptTraceRecord(const OtbnTraceRecord &record,
                          unsigned int cycle_count) override;
 
-  // Take a trace entry from the wrapped ISS.
+  // Take a trace entry from the wrapped ISS, together with the mnemonic of
+  // the instruction that completed (if any).
   //
   // Prints an error message to stderr and returns false on mismatch.
+  bool OnIssTrace(const OtbnTraceRecord &record, const std::string &mnemonic);
+
+  // Take a trace entry from the wrapped ISS, as the lines printed by the
+  // text protocol. This parses the lines and then behaves like the function
+  // above.
   bool OnIssTrace(const std::vector<std::string> &lines);
 
   // Flush any pending entries. We need to do this on reset, to handle
@@ -87,6 +93,10 @@ class OtbnTraceChecker : public OtbnTraceListener {
   // message to stderr and return false.
   bool MatchPair();
 
+  // The common part of the OnIssTrace functions, once the ISS entry has been
+  // built. This might modify trace_entry.
+  bool OnIssEntry(OtbnIssTraceEntry &trace_entry);
+
   bool rtl_started_;
   bool rtl_pending_;
   OtbnTraceEntry rtl_entry_;
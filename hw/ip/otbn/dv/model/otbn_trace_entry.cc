@@ -6,86 +6,67 @@
 
 #include <cassert>
 #include <iostream>
-#include <regex>
 #include <sstream>
 
-bool OtbnTraceBodyLine::fill_from_string(const std::string &src,
-                                         const std::string &line) {
-  // A valid line matches the following regex
-  std::regex re("(.) ([^:]+): (.+)");
-  std::smatch match;
-
-  if (!std::regex_match(line, match, re)) {
-    std::cerr << "OTBN trace body line from " << src
-              << " does not have expected format. Saw: `" << line << "'.\n";
+bool OtbnTraceEntry::Header::operator==(const Header &other) const {
+  if (kind != other.kind || flags != other.flags)
     return false;
-  }
-
-  assert(match.size() == 4);
-
-  raw_ = line;
-  type_ = match[1].str()[0];
-  loc_ = match[2].str();
-  value_ = match[3].str();
-  return true;
-}
 
-bool OtbnTraceBodyLine::operator==(const OtbnTraceBodyLine &other) const {
-  // If the raw lines are identical, the two objects are identical and no
-  // further checks are required.
-  if (raw_ == other.raw_) {
+  // Wipe headers have no other information
+  if (kind != 'S' && kind != 'E')
     return true;
-  }
-
-  // If the raw lines are not identical, the two objects can be identical if one
-  // of them contains unknown values.
 
-  // Type and location have to be identical, though.
-  if (type_ != other.type_ || loc_ != other.loc_) {
+  if ((flags & OtbnTraceRecord::kHasPc) && pc != other.pc)
     return false;
-  }
 
-  // The values have to be of identical length.
-  if (value_.size() != other.value_.size()) {
-    return false;
+  return !(flags & OtbnTraceRecord::kInsnKnown) || insn == other.insn;
+}
+
+void OtbnTraceEntry::set_header(const OtbnTraceRecord &record) {
+  // The header is the first header line of the record: the instruction if
+  // there is one and otherwise the wipe.
+  hdr_.flags = 0;
+  hdr_.pc = 0;
+  hdr_.insn = 0;
+  if (record.insn_kind) {
+    hdr_.kind = record.insn_kind;
+    hdr_.flags = record.insn_flags;
+    hdr_.pc = record.pc;
+    hdr_.insn = record.insn;
+  } else {
+    hdr_.kind = record.wipe_kind;
   }
 
-  // Compare values digit by digit and treat `x` as unknown value, which is
-  // identical to any other value.
-  std::string::const_iterator other_it = other.value_.begin();
-  for (std::string::const_iterator it = value_.begin(); it != value_.end();
-       it++) {
-    if (*it != *other_it && !(*it == 'x' || *other_it == 'x')) {
-      return false;
-    }
-    other_it++;
+  switch (hdr_.kind) {
+    case 'S':
+      trace_type_ = Stall;
+      break;
+    case 'E':
+      trace_type_ = Exec;
+      break;
+    case 'U':
+      trace_type_ = WipeInProgress;
+      break;
+    case 'V':
+      trace_type_ = WipeComplete;
+      break;
+    default:
+      trace_type_ = Invalid;
   }
-  return true;
-}
 
-bool OtbnTraceEntry::from_rtl_trace(const std::string &trace) {
-  size_t eol = trace.find('\n');
-  hdr_ = trace.substr(0, eol);
-  trace_type_ = hdr_to_trace_type(hdr_);
+  writes_.clear();
+}
 
-  while (eol != std::string::npos) {
-    size_t bol = eol + 1;
-    eol = trace.find('\n', bol);
-    size_t line_len =
-        (eol == std::string::npos) ? std::string::npos : eol - bol;
-    std::string line = trace.substr(bol, line_len);
+void OtbnTraceEntry::from_rtl_record(const OtbnTraceRecord &record) {
+  set_header(record);
 
+  for (const OtbnTraceLine &line : record.lines) {
     // We're only interested in register writes
-    if (!(line.size() > 0 && line[0] == '>'))
+    if (line.type != '>')
       continue;
 
-    OtbnTraceBodyLine parsed_line;
-    if (!parsed_line.fill_from_string("RTL", line)) {
-      return false;
-    }
-    writes_[parsed_line.get_loc()].push_back(parsed_line);
+    writes_.push_back(Write{line.loc, line.value});
   }
-  return true;
 }
 
 bool OtbnTraceEntry::compare_rtl_iss_entries(const OtbnTraceEntry &other,
@@ -93,31 +74,68 @@ bool OtbnTraceEntry::compare_rtl_iss_entries(const OtbnTraceEntry &other,
                                              std::string *err_desc) const {
   assert(err_desc);
 
-  if (hdr_ != other.hdr_) {
+  if (!(hdr_ == other.hdr_)) {
     *err_desc = "Headers don't match.";
     return false;
   }
 
-  for (const auto &rtlptr : writes_) {
-    auto isskey = other.writes_.find(rtlptr.first);
-    if (isskey == other.writes_.end()) {
+  // There are only a few writes in an entry (at most two per register, for a
+  // secure wipe), so we can afford to look at every pair of them rather than
+  // building an index.
+  size_t rtl_locs = 0;
+  for (size_t i = 0; i < writes_.size(); ++i) {
+    uint16_t loc = writes_[i].loc;
+
+    // Skip this write if we've already looked at its location
+    bool seen = false;
+    for (size_t j = 0; j < i && !seen; ++j) {
+      seen = writes_[j].loc == loc;
+    }
+    if (seen)
+      continue;
+    ++rtl_locs;
+
+    size_t rtl_count = 0;
+    const OtbnTraceValue *rtl_last = nullptr;
+    for (size_t j = i; j < writes_.size(); ++j) {
+      if (writes_[j].loc == loc) {
+        ++rtl_count;
+        rtl_last = &writes_[j].value;
+      }
+    }
+
+    const OtbnTraceValue *iss_last = nullptr;
+    for (const Write &write : other.writes_) {
+      if (write.loc == loc)
+        iss_last = &write.value;
+    }
+    if (!iss_last) {
       std::ostringstream oss;
-      oss << "RTL had a write to `" << rtlptr.first
+      oss << "RTL had a write to `" << OtbnTraceLoc::Name(loc)
           << "', but the ISS doesn't have a write to that location.";
       *err_desc = oss.str();
       return false;
     }
-    // compare rtlptr.second and isskey.second
-    if (!check_entries_compatible(trace_type_, rtlptr.first, rtlptr.second,
-                                  isskey->second, no_sec_wipe_data_chk,
-                                  err_desc))
+
+    if (!check_entries_compatible(trace_type_, loc, rtl_count,
+                                  writes_[i].value, *rtl_last, *iss_last,
+                                  no_sec_wipe_data_chk, err_desc))
       return false;
   }
 
-  if (writes_.size() != other.writes_.size()) {
+  size_t iss_locs = 0;
+  for (size_t i = 0; i < other.writes_.size(); ++i) {
+    bool seen = false;
+    for (size_t j = 0; j < i && !seen; ++j) {
+      seen = other.writes_[j].loc == other.writes_[i].loc;
+    }
+    iss_locs += !seen;
+  }
+
+  if (rtl_locs != iss_locs) {
     std::ostringstream oss;
-    oss << "RTL wrote to " << writes_.size() << " locations; the ISS wrote to "
-        << other.writes_.size() << ".";
+    oss << "RTL wrote to " << rtl_locs << " locations; the ISS wrote to "
+        << iss_locs << ".";
     *err_desc = oss.str();
     return false;
   }
@@ -126,29 +144,43 @@ bool OtbnTraceEntry::compare_rtl_iss_entries(const OtbnTraceEntry &other,
 }
 
 void OtbnTraceEntry::print(const std::string &indent, std::ostream &os) const {
-  os << indent << hdr_ << "\n";
-  for (const auto &pr : writes_) {
-    for (const auto &line : pr.second) {
-      os << indent << line.get_string() << "\n";
-    }
+  // Build a record with just the header and the writes, to format them the
+  // same way as the tracer.
+  OtbnTraceRecord record;
+  if (hdr_.kind == 'S' || hdr_.kind == 'E') {
+    record.insn_kind = hdr_.kind;
+    record.insn_flags = hdr_.flags;
+    record.pc = hdr_.pc;
+    record.insn = hdr_.insn;
+  } else {
+    record.wipe_kind = hdr_.kind;
+  }
+  for (const Write &write : writes_) {
+    OtbnTraceLine line;
+    line.type = '>';
+    line.flags = 0;
+    line.loc = write.loc;
+    line.addr = 0;
+    line.value = write.value;
+    record.lines.push_back(line);
+  }
+
+  std::istringstream iss(record.ToString());
+  std::string line;
+  while (std::getline(iss, line)) {
+    os << indent << line << "\n";
   }
 }
 
 void OtbnTraceEntry::take_writes(const OtbnTraceEntry &other,
                                  bool other_first) {
-  for (const auto &pr : other.writes_) {
-    std::vector<OtbnTraceBodyLine> &so_far = writes_[pr.first];
-    if (other_first) {
-      // If other_first is true, we should prepend the writes from other. We do
-      // so by creating a temporary vector (with a copy of the writes from
-      // other) and then appending any writes we had before.
-      std::vector<OtbnTraceBodyLine> tmp(pr.second);
-      tmp.insert(tmp.end(), so_far.begin(), so_far.end());
-      writes_[pr.first] = tmp;
-    } else {
-      // If other_first is false, we should append the writes from other. We
-      // can do that with just a call to insert.
-      so_far.insert(so_far.end(), pr.second.begin(), pr.second.end());
+  if (other_first) {
+    // If other_first is true, we should prepend the writes from other.
+    writes_.insert(0, other.writes_.begin(), other.writes_.end());
+  } else {
+    // If other_first is false, we should append the writes from other.
+    for (const Write &write : other.writes_) {
+      writes_.push_back(write);
     }
   }
 }
@@ -174,15 +206,11 @@ bool OtbnTraceEntry::is_compatible(const OtbnTraceEntry &prev) const {
   // and that's fine. So the rule is:
   //
   //   - Check the types are compatible (S then S or E; U then U or V)
-  //   - Compare the two lines from character 1 onwards.
-  //   - If they match: accept.
-  //   - Otherwise, if the second line has no '?' then reject.
-  //   - If there is a '?' and they match up to that point, accept.
-  //   - Otherwise: reject
+  //   - Check the PCs match
+  //   - If the instruction bits are known, check they match too
   //
-  // (This wrongly accepts some malformed examples, but that's fine: it's just
-  // meant as a quick check to make sure our trace machinery isn't dropping
-  // entries)
+  // (This is just meant as a quick check to make sure our trace machinery
+  // isn't dropping entries)
   bool matching_types;
   switch (prev.trace_type()) {
     case Stall:
@@ -198,16 +226,18 @@ bool OtbnTraceEntry::is_compatible(const OtbnTraceEntry &prev) const {
   if (!matching_types)
     return false;
 
-  bool exact_match =
-      0 == hdr_.compare(1, std::string::npos, prev.hdr_, 1, std::string::npos);
-  if (exact_match)
+  // Wipe headers have no other information
+  if (trace_type_ == WipeInProgress || trace_type_ == WipeComplete)
     return true;
 
-  size_t first_qm = hdr_.find('?', 1);
-  if (first_qm == std::string::npos)
+  if (hdr_.pc != prev.hdr_.pc)
     return false;
 
-  return 0 == hdr_.compare(1, first_qm - 1, prev.hdr_, 1, first_qm - 1);
+  if (!(hdr_.flags & OtbnTraceRecord::kInsnKnown))
+    return true;
+
+  return (prev.hdr_.flags & OtbnTraceRecord::kInsnKnown) &&
+         hdr_.insn == prev.hdr_.insn;
 }
 
 bool OtbnTraceEntry::is_partial() const {
@@ -221,23 +251,25 @@ bool OtbnTraceEntry::is_final() const {
 }
 
 bool OtbnTraceEntry::check_entries_compatible(
-    trace_type_t type, const std::string &key,
-    const std::vector<OtbnTraceBodyLine> &rtl_lines,
-    const std::vector<OtbnTraceBodyLine> &iss_lines, bool no_sec_wipe_data_chk,
+    trace_type_t type, uint16_t loc, size_t rtl_count,
+    const OtbnTraceValue &rtl_first, const OtbnTraceValue &rtl_last,
+    const OtbnTraceValue &iss_last, bool no_sec_wipe_data_chk,
     std::string *err_desc) {
-  assert(rtl_lines.size() && iss_lines.size());
+  assert(rtl_count);
   assert(type == WipeComplete || type == Exec);
   assert(err_desc);
 
-  if (type == WipeComplete && key != "FLAGS0" && key != "FLAGS1") {
-    if (rtl_lines.size() != 2) {
+  const std::string &key = OtbnTraceLoc::Name(loc);
+
+  if (type == WipeComplete && !OtbnTraceLoc::IsFlags(loc)) {
+    if (rtl_count != 2) {
       std::ostringstream oss;
-      oss << "There are " << rtl_lines.size() << "RTL lines for key `" << key
+      oss << "There are " << rtl_count << "RTL lines for key `" << key
           << "'; we expected 2.";
       *err_desc = oss.str();
       return false;
     }
-    if (!no_sec_wipe_data_chk && rtl_lines.front() == rtl_lines.back()) {
+    if (!no_sec_wipe_data_chk && rtl_first.Matches(rtl_last)) {
       std::ostringstream oss;
       oss << "Repeated identical RTL lines for key `" << key << "'.";
       *err_desc = oss.str();
@@ -245,7 +277,7 @@ bool OtbnTraceEntry::check_entries_compatible(
     }
   }
 
-  if (!(rtl_lines.back() == iss_lines.back())) {
+  if (!rtl_last.Matches(iss_last)) {
     std::ostringstream oss;
     oss << "Final values of ISS and RTL don't match for key `" << key << "'.";
     *err_desc = oss.str();
@@ -255,24 +287,63 @@ bool OtbnTraceEntry::check_entries_compatible(
   return true;
 }
 
-OtbnTraceEntry::trace_type_t OtbnTraceEntry::hdr_to_trace_type(
-    const std::string &hdr) {
-  if (hdr.empty()) {
-    return Invalid;
+void OtbnIssTraceEntry::from_iss_record(const OtbnTraceRecord &record,
+                                        const std::string &mnemonic) {
+  set_header(record);
+
+  for (const OtbnTraceLine &line : record.lines) {
+    writes_.push_back(Write{line.loc, line.value});
   }
 
-  switch (hdr[0]) {
-    case 'S':
-      return Stall;
-    case 'E':
-      return Exec;
-    case 'U':
-      return WipeInProgress;
-    case 'V':
-      return WipeComplete;
-    default:
-      return Invalid;
+  data_.insn_addr = record.pc;
+  data_.mnemonic = mnemonic;
+}
+
+// Parse "0x" followed by 8 hex digits from str at pos. Returns false if they
+// aren't there.
+static bool parse_hex32(const std::string &str, size_t pos, uint32_t *dst) {
+  if (str.compare(pos, 2, "0x") != 0 || str.size() < pos + 10)
+    return false;
+
+  OtbnTraceValue value;
+  if (!value.Parse(str.substr(pos, 10), false) || value.unknown[0])
+    return false;
+
+  *dst = value.words[0];
+  return true;
+}
+
+// Parse a header line from the ISS (in the format of
+// OtbnTraceRecord::ToString) into record. Returns false if it is malformed.
+static bool parse_iss_header(const std::string &line,
+                             OtbnTraceRecord *record) {
+  if (line == "STALL") {
+    record->insn_kind = 'S';
+    return true;
+  }
+  if (line == "U " || line == "V ") {
+    record->wipe_kind = line[0];
+    return true;
   }
+
+  // Expect "E PC: 0x%08x, insn: 0x%08x" (or "insn: ??")
+  static const char kPcPrefix[] = "E PC: ";
+  static const char kInsnPrefix[] = ", insn: ";
+  const size_t insn_pos = sizeof kPcPrefix - 1 + 10;
+  const size_t bits_pos = insn_pos + sizeof kInsnPrefix - 1;
+  if (line.compare(0, sizeof kPcPrefix - 1, kPcPrefix) != 0 ||
+      !parse_hex32(line, sizeof kPcPrefix - 1, &record->pc) ||
+      line.compare(insn_pos, sizeof kInsnPrefix - 1, kInsnPrefix) != 0)
+    return false;
+
+  record->insn_kind = 'E';
+  record->insn_flags = OtbnTraceRecord::kHasPc;
+  if (line.compare(bits_pos, std::string::npos, "??") == 0)
+    return true;
+
+  record->insn_flags |= OtbnTraceRecord::kInsnKnown;
+  return parse_hex32(line, bits_pos, &record->insn) &&
+         line.size() == bits_pos + 10;
 }
 
 bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
@@ -280,18 +351,20 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
   // lines); state 2 = read writes
   int state = 0;
 
-  std::regex re("# @0x([0-9a-f]{8}): (.*)");
-  std::smatch match;
+  OtbnTraceRecord record;
+  std::string mnemonic;
 
   for (const std::string &line : lines) {
     switch (state) {
       case 0:
-        hdr_ = line;
-        trace_type_ = hdr_to_trace_type(hdr_);
-        state = (!line.empty() && line[0] == 'E') ? 1 : 2;
+        if (!parse_iss_header(line, &record)) {
+          std::cerr << "Bad header line for ISS trace: `" << line << "'.\n";
+          return false;
+        }
+        state = record.insn_kind == 'E' ? 1 : 2;
         break;
 
-      case 1:
+      case 1: {
         // This some "special" extra data from the ISS that we use for
         // functional coverage calculations. The line should be of the form
         //
@@ -299,30 +372,44 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
         //
         // where ADDR is an 8-digit instruction address (in hex) and mnemonic
         // is the string mnemonic.
-        if (!std::regex_match(line, match, re)) {
-          std::cerr << "Bad 'special' line for ISS trace with header `" << hdr_
-                    << "': `" << line << "'.\n";
+        uint32_t addr;
+        if (line.compare(0, 3, "# @") != 0 || !parse_hex32(line, 3, &addr) ||
+            line.compare(13, 2, ": ") != 0) {
+          std::cerr << "Bad 'special' line for ISS trace with header `"
+                    << lines[0] << "': `" << line << "'.\n";
           return false;
         }
-        assert(match.size() == 3);
-        data_.insn_addr =
-            (uint32_t)strtoul(match[1].str().c_str(), nullptr, 16);
-        data_.mnemonic = match[2].str();
+        mnemonic = line.substr(15);
         state = 2;
         break;
+      }
 
       default: {
         assert(state == 2);
         // Ignore '!' lines (which are used to tell the simulation about
         // external register changes, not tracked by the RTL core simulation)
-        bool is_bang = (line.size() > 0 && line[0] == '!');
-        if (!is_bang) {
-          OtbnTraceBodyLine parsed_line;
-          if (!parsed_line.fill_from_string("ISS", line)) {
-            return false;
-          }
-          writes_[parsed_line.get_loc()].push_back(parsed_line);
+        if (line.size() > 0 && line[0] == '!')
+          break;
+
+        // Other lines should be register writes, of the form "> LOC: VALUE"
+        size_t colon = line.find(": ", 2);
+        OtbnTraceLine parsed_line;
+        bool good = line.compare(0, 2, "> ") == 0 &&
+                    colon != std::string::npos && colon > 2;
+        if (good) {
+          parsed_line.type = '>';
+          parsed_line.flags = 0;
+          parsed_line.loc = OtbnTraceLoc::Intern(line.substr(2, colon - 2));
+          parsed_line.addr = 0;
+          good = parsed_line.value.Parse(line.substr(colon + 2),
+                                         OtbnTraceLoc::IsFlags(parsed_line.loc));
+        }
+        if (!good) {
+          std::cerr << "OTBN trace body line from ISS does not have expected "
+                    << "format. Saw: `" << line << "'.\n";
+          return false;
         }
+        record.lines.push_back(parsed_line);
         break;
       }
     }
@@ -331,10 +418,11 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
   // We shouldn't be in state 1 here: that would mean an E line with no
   // follow-up '#' line.
   if (state == 1) {
-    std::cerr << "No 'special' line for ISS trace with header `" << hdr_
+    std::cerr << "No 'special' line for ISS trace with header `" << lines[0]
               << "'.\n";
     return false;
   }
 
+  from_iss_record(record, mnemonic);
   return true;
 }
@@ -4,40 +4,19 @@
 #ifndef OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_TRACE_ENTRY_H_
 #define OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_TRACE_ENTRY_H_
 
-#include <map>
+#include <cstdint>
+#include <iosfwd>
 #include <string>
 #include <vector>
 
-// This models a body line in an OTBN trace entry (type '<', '>', 'R' or 'W').
-// Each of these lines is of the format
-//
-//   TYPE ' ' LOC ': ' VALUE
-//
-// and we parse them accordingly here. The point is that we want to merge
-// successive writes to the same location and thus need to unpack things enough
-// to see them.
-class OtbnTraceBodyLine {
- public:
-  // Parse a line into this object, based on the format above. On success,
-  // return true. On failure, write an error message to stderr (using src to
-  // say where the line came from) and return false.
-  bool fill_from_string(const std::string &src, const std::string &line);
-
-  bool operator==(const OtbnTraceBodyLine &other) const;
-
-  // Return the location that is being read or written
-  const std::string &get_loc() const { return loc_; }
-
-  // Return the original string format for the entry
-  const std::string &get_string() const { return raw_; }
-
- private:
-  std::string raw_;
-  char type_;
-  std::string loc_;
-  std::string value_;
-};
+#include "otbn_trace_record.h"
 
+// An entry in the trace checker: the header of a trace record, together with
+// the register writes that it (and any partial entries that were merged into
+// it) made.
+//
+// Entries are built from the structured records that come from the RTL tracer
+// and the ISS, so comparing them doesn't need any text to be parsed.
 class OtbnTraceEntry {
  public:
   enum trace_type_t {
@@ -48,11 +27,11 @@ class OtbnTraceEntry {
     WipeComplete,
   };
 
+  OtbnTraceEntry() : trace_type_(Invalid), hdr_() {}
   virtual ~OtbnTraceEntry(){};
 
-  // Parse a trace entry from the RTL into this object. On an error, print a
-  // message to stderr and return false.
-  bool from_rtl_trace(const std::string &trace);
+  // Fill in this object from a trace record from the RTL
+  void from_rtl_record(const OtbnTraceRecord &record);
 
   bool compare_rtl_iss_entries(const OtbnTraceEntry &other,
                                bool no_sec_wipe_data_chk,
@@ -75,25 +54,53 @@ class OtbnTraceEntry {
   bool is_final() const;
 
  protected:
-  static bool check_entries_compatible(
-      trace_type_t type, const std::string &key,
-      const std::vector<OtbnTraceBodyLine> &rtl_lines,
-      const std::vector<OtbnTraceBodyLine> &iss_lines,
-      bool no_sec_wipe_data_chk, std::string *err_desc);
+  // A register write, to a location from OtbnTraceLoc
+  struct Write {
+    uint16_t loc;
+    OtbnTraceValue value;
+  };
 
-  static trace_type_t hdr_to_trace_type(const std::string &hdr);
+  // The header of the entry (the first header line of the record)
+  struct Header {
+    // 'S', 'E', 'U' or 'V' (or zero if there was no header)
+    char kind;
+    // Flags from OtbnTraceRecord::HeaderFlags
+    uint8_t flags;
+    uint32_t pc;
+    uint32_t insn;
+
+    bool operator==(const Header &other) const;
+  };
+
+  // Fill in the header and trace type from a record and clear the writes
+  void set_header(const OtbnTraceRecord &record);
+
+  static bool check_entries_compatible(trace_type_t type, uint16_t loc,
+                                       size_t rtl_count,
+                                       const OtbnTraceValue &rtl_first,
+                                       const OtbnTraceValue &rtl_last,
+                                       const OtbnTraceValue &iss_last,
+                                       bool no_sec_wipe_data_chk,
+                                       std::string *err_desc);
 
   trace_type_t trace_type_;
-  std::string hdr_;
-  // The register writes for this trace entry, keyed by destination
-  std::map<std::string, std::vector<OtbnTraceBodyLine>> writes_;
+  Header hdr_;
+  // The register writes for this trace entry, in the order they happened
+  OtbnSmallVector<Write, 8> writes_;
 };
 
 class OtbnIssTraceEntry : public OtbnTraceEntry {
  public:
+  // Fill in this object from a trace record from the ISS, together with the
+  // mnemonic of the instruction that completed (if any).
+  void from_iss_record(const OtbnTraceRecord &record,
+                       const std::string &mnemonic);
+
+  // Fill in this object from the lines that the ISS prints for a step in the
+  // text protocol. On an error, print a message to stderr and return false.
   bool from_iss_trace(const std::vector<std::string> &lines);
 
-  // Fields that are populated from the "special" line for ISS entries
+  // Fields that are populated from the "special" data for ISS entries
   struct IssData {
     uint32_t insn_addr;
     std::string mnemonic;
@@ -130,6 +130,33 @@ class Dmem:
         else:
             self._load_4byte_le_words(data)
 
+    def load_words(self, words: Sequence[Optional[int]]) -> None:
+        '''Replace the start of memory with words
+
+        Each entry is a 32-bit word, or None if the word should have invalid
+        integrity bits.
+
+        '''
+        if len(words) > len(self.data):
+            raise ValueError('Trying to load {} words of data, but DMEM '
+                             'is only {} words long.'
+                             .format(len(words), len(self.data)))
+
+        self.data[:len(words)] = words
+
+    def peek_words(self, num_words: int) -> List[Optional[int]]:
+        '''Return the first num_words words of memory
+
+        Like dump_le_words, this applies pending stores and represents a word
+        with invalid integrity bits as None.
+
+        '''
+        ret = self.data[:num_words]
+        for idx, u32 in self.pending.items():
+            if idx < num_words:
+                ret[idx] = u32
+        return ret
+
     def dump_le_words(self) -> bytes:
         '''Return the contents of memory as bytes.
 
@@ -70,15 +70,126 @@ prefixed with "0x" if they are hexadecimal.
     send_err_escalation     React to an injected error.
 
     set_software_errs_fatal Set software_errs_fatal bit.
+
+    map_shared_mem <mem> <path> <num_words>
+
+                            Map the file at <path> as shared memory for <mem>
+                            (either imem or dmem), holding <num_words> words.
+                            Each 32-bit word is stored as a native-endian
+                            64-bit word. Bits 31:0 hold the data and bit 32 is
+                            set if the word has valid integrity bits (the data
+                            of an invalid word is zero).
+
+    load_shared_mem <mem>   Replace the current contents of IMEM or DMEM with
+                            the words in its shared memory.
+
+    dump_shared_mem dmem    Write the current contents of DMEM to its shared
+                            memory.
+
+    protocol binary <ver>   Switch to the binary protocol (see below) if this
+                            simulator supports version <ver> of it. Prints
+                            "PROTOCOL binary <ver>" if so (and then expects
+                            binary frames) or "PROTOCOL text" if not.
+
+The binary protocol avoids formatting and parsing text for the step command,
+which is run on every cycle. Each request and each response is a frame: a
+32-bit little-endian payload length, followed by the payload. The first byte
+of a request payload is an opcode:
+
+    OP_TEXT (0)             The rest of the payload is a command from the list
+                            above. The response payload contains the lines the
+                            command would have printed, as records (see
+                            below).
+
+    OP_STEP (1)             Run one instruction, like the step command. The
+                            response payload starts with seven 32-bit words: a
+                            mask of the external registers that were written,
+                            followed by the values of STATUS, INSN_CNT,
+                            ERR_BITS, STOP_PC, RND_REQ and WIPE_START (in
+                            order, matching the bits of the mask). After
+                            those come two blobs: the trace record for the
+                            cycle (empty if nothing was traced) and the
+                            mnemonic of the instruction that completed (empty
+                            if none did). The trace record is packed in the
+                            format described in otbn_trace_record.cc, which is
+                            the format that the RTL trace checker works with.
+
+    OP_STEP_N (2)           The rest of the payload is a 32-bit word, N. Run
+                            up to N cycles, stopping early after a cycle where
+                            the next cycle might depend on something outside
+                            the ISS (see can_run_ahead()). The response
+                            payload is a 32-bit count of cycles run, followed
+                            by the response to OP_STEP for each of them.
+
+A list of records is a 32-bit count, followed by that many records. Each record
+is a 32-bit length followed by that many bytes of text. A blob is a 32-bit
+length followed by that many bytes. All words are little-endian.
+
+When run with --server <path>, this script doesn't simulate anything itself.
+Instead, it listens on a Unix socket at <path> and acts as a fork server, so
+that a new simulator doesn't have to pay for starting Python and importing the
+simulator code. Each client connects, sends a single byte with its stdin,
+stdout and stderr file descriptors attached (as SCM_RIGHTS ancillary data)
+and gets back the PID of a forked child as a 32-bit little-endian word. The
+child then runs the REPL above on those file descriptors, exiting at EOF. The
+server exits once it has seen no clients for --idle-timeout seconds.
 '''
 
+import argparse
+import array
 import binascii
+import contextlib
+import io
+import mmap
+import os
+import signal
+import socket
+import struct
 import sys
-from typing import List, Optional
+import traceback
+from typing import BinaryIO, Dict, List, NoReturn, Optional, Tuple
 
-from sim.decode import decode_file
+from sim.decode import decode_file, decode_words
+from sim.ext_regs import TraceExtRegChange
+from sim.flags import TraceFlags
+from sim.isa import OTBNInsn
 from sim.load_elf import load_elf
+from sim.reg import TraceRegister
 from sim.sim import OTBNSim
+from sim.state import FsmState
+from sim.trace import Trace
+from sim.wsr import TraceWSR
+
+# The version of the binary protocol that we support. This must match
+# kBinaryProtocolVersion in iss_wrapper.cc.
+BINARY_PROTOCOL_VERSION = 2
+
+OP_TEXT = 0
+OP_STEP = 1
+OP_STEP_N = 2
+
+# External registers that are reported in the fixed fields of the response to
+# OP_STEP. The order matches the bits of the mask and the order of the values.
+STEP_EXT_REGS = ['STATUS', 'INSN_CNT', 'ERR_BITS', 'STOP_PC',
+                 'RND_REQ', 'WIPE_START']
+
+# IDs for the locations in trace records, matching OtbnTraceLoc in
+# otbn_trace_record.h
+TRACE_LOCS = {'MOD': 64, 'RND': 65, 'ACC': 66, 'URND': 67,
+              'FLAGS0': 68, 'FLAGS1': 69}  # type: Dict[str, int]
+TRACE_LOCS.update({'x{:02}'.format(i): i for i in range(32)})
+TRACE_LOCS.update({'w{:02}'.format(i): 32 + i for i in range(32)})
+
+# Flags in the header of a trace record (OtbnTraceRecord::HeaderFlags)
+TRACE_INSN_KNOWN = 1 << 0
+TRACE_HAS_PC = 1 << 1
+
+# The flag in a word of shared memory that says it has valid integrity bits
+SHARED_MEM_VALID = 1 << 32
+
+# Shared memory mapped by map_shared_mem, keyed by memory name. These are kept
+# across a reset (which replaces the OTBNSim object).
+_SHARED_MEMS = {}  # type: Dict[str, memoryview]
 
 
 def read_word(arg_name: str, word_data: str, bits: int) -> int:
@@ -132,10 +243,17 @@ def on_start_operation(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     return None
 
 
-def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
-    '''Step one instruction'''
-    check_arg_count('step', 0, args)
+def step_changes(sim: OTBNSim) -> Tuple[Optional[str], Optional[OTBNInsn],
+                                         int, List[Trace]]:
+    '''Step one instruction, returning what should be traced
+
+    Returns a tuple (hdr, insn, pc, changes). hdr is the type of the trace
+    entry: 'E' for an instruction that completed (which will be insn, at pc),
+    'S' for a stall, 'U' or 'V' for a wipe that is in progress or has
+    completed, or None if there is nothing to trace. changes are the changes
+    that have an RTL trace.
 
+    '''
     pc = sim.state.pc
     assert 0 == pc & 3
 
@@ -144,25 +262,19 @@ def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     insn, changes = sim.step(verbose=False)
 
     if insn is not None:
-        hdr = insn.rtl_trace(pc)  # type: Optional[str]
+        hdr = 'E'  # type: Optional[str]
     elif was_wiping:
-        # The trailing space is a bit naff but matches the behaviour in the RTL
-        # tracer, where it's rather difficult to change.
-        hdr = 'U ' if sim.state.wiping() else 'V '
+        hdr = 'U' if sim.state.wiping() else 'V'
     elif sim.state.executing():
-        hdr = 'STALL'
+        hdr = 'S'
     else:
         hdr = None
 
     # When locking immediately, drop headers that get cancelled by RTL.
-    if sim.state.lock_immediately and hdr in ['V ', 'STALL']:
+    if sim.state.lock_immediately and hdr in ['V', 'S']:
         hdr = None
 
-    rtl_changes = []
-    for c in changes:
-        rt = c.rtl_trace()
-        if rt is not None:
-            rtl_changes.append(rt)
+    traced_changes = [c for c in changes if c.rtl_trace() is not None]
 
     # This is a bit of a hack. Very occasionally, we'll see traced changes when
     # there's not actually an instruction in flight. For example, this happens
@@ -170,13 +282,51 @@ def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     # case, we might see a change where we drop the REQ signal after the secure
     # wipe has finished. Rather than define a special "do-nothing" trace entry
     # format for this situation, we cheat and use STALL.
-    if hdr is None and rtl_changes:
-        hdr = 'STALL'
+    if hdr is None and traced_changes:
+        hdr = 'S'
 
-    if hdr is not None:
-        print(hdr)
-        for rt in rtl_changes:
-            print(rt)
+    if hdr is None:
+        return (None, None, pc, [])
+
+    return (hdr, insn, pc, traced_changes)
+
+
+def step_trace(sim: OTBNSim) -> Tuple[List[str], List[Trace]]:
+    '''Step one instruction, returning the trace lines and traced changes
+
+    The changes are those that have an RTL trace (and so appear in the lines).
+
+    '''
+    hdr, insn, pc, changes = step_changes(sim)
+    if hdr is None:
+        return ([], [])
+
+    if hdr == 'E':
+        assert insn is not None
+        hdr_line = insn.rtl_trace(pc)
+    elif hdr == 'S':
+        hdr_line = 'STALL'
+    else:
+        # The trailing space is a bit naff but matches the behaviour in the RTL
+        # tracer, where it's rather difficult to change.
+        hdr_line = hdr + ' '
+
+    rtl_changes = []
+    for c in changes:
+        rt = c.rtl_trace()
+        assert rt is not None
+        rtl_changes.append(rt)
+
+    return ([hdr_line] + rtl_changes, changes)
+
+
+def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Step one instruction'''
+    check_arg_count('step', 0, args)
+
+    lines, _ = step_trace(sim)
+    for line in lines:
+        print(line)
 
     return None
 
@@ -265,6 +415,70 @@ def on_dump_d(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     return None
 
 
+def get_shared_mem(mem: str) -> memoryview:
+    '''Get the shared memory for the memory called mem'''
+    if mem not in ['imem', 'dmem']:
+        raise ValueError(f'Unknown memory: {mem!r}.')
+
+    words = _SHARED_MEMS.get(mem)
+    if words is None:
+        raise RuntimeError(f'No shared memory is mapped for {mem}.')
+
+    return words
+
+
+def on_map_shared_mem(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Map a file as shared memory for IMEM or DMEM'''
+    check_arg_count('map_shared_mem', 3, args)
+
+    mem = args[0]
+    if mem not in ['imem', 'dmem']:
+        raise ValueError(f'Unknown memory: {mem!r}.')
+    path = args[1]
+    num_words = read_word('num_words', args[2], 32)
+
+    # The mapping stays valid after we close the file.
+    with open(path, 'r+b') as handle:
+        mapping = mmap.mmap(handle.fileno(), 8 * num_words)
+    _SHARED_MEMS[mem] = memoryview(mapping).cast('Q')
+
+    return None
+
+
+def on_load_shared_mem(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Load the contents of IMEM or DMEM from its shared memory'''
+    check_arg_count('load_shared_mem', 1, args)
+
+    mem = args[0]
+    words = get_shared_mem(mem)
+    if mem == 'imem':
+        sim.load_program(decode_words(0, [(bool(w & SHARED_MEM_VALID),
+                                           w & 0xffffffff) for w in words]))
+    else:
+        sim.state.dmem.load_words([w & 0xffffffff
+                                   if w & SHARED_MEM_VALID else None
+                                   for w in words])
+
+    return None
+
+
+def on_dump_shared_mem(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Write the contents of DMEM to its shared memory'''
+    check_arg_count('dump_shared_mem', 1, args)
+
+    mem = args[0]
+    if mem != 'dmem':
+        raise ValueError(f'Cannot dump {mem!r}.')
+    words = get_shared_mem(mem)
+
+    values = sim.state.dmem.peek_words(len(words))
+    words[:len(values)] = array.array('Q', [
+        SHARED_MEM_VALID | u32 if u32 is not None else 0 for u32 in values
+    ])
+
+    return None
+
+
 def on_print_regs(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     '''Print registers to stdout'''
     check_arg_count('print_regs', 0, args)
@@ -411,6 +625,9 @@ _HANDLERS = {
     'load_d': on_load_d,
     'load_i': on_load_i,
     'dump_d': on_dump_d,
+    'map_shared_mem': on_map_shared_mem,
+    'load_shared_mem': on_load_shared_mem,
+    'dump_shared_mem': on_dump_shared_mem,
     'print_regs': on_print_regs,
     'print_call_stack': on_print_call_stack,
     'reset': on_reset,
@@ -430,8 +647,8 @@ _HANDLERS = {
 }
 
 
-def on_input(sim: OTBNSim, line: str) -> Optional[OTBNSim]:
-    '''Process an input command'''
+def run_command(sim: OTBNSim, line: str) -> Optional[OTBNSim]:
+    '''Run an input command, without ending its output'''
     words = line.split()
 
     # Just ignore empty lines
@@ -443,17 +660,251 @@ def on_input(sim: OTBNSim, line: str) -> Optional[OTBNSim]:
     if handler is None:
         raise RuntimeError('Unknown command: {!r}'.format(verb))
 
-    ret = handler(sim, words[1:])
-    print('.')
-    sys.stdout.flush()
+    return handler(sim, words[1:])
+
 
+def on_input(sim: OTBNSim, line: str) -> Optional[OTBNSim]:
+    '''Process an input command'''
+    ret = run_command(sim, line)
+    end_command()
     return ret
 
 
+def is_protocol_request(line: str) -> Optional[bool]:
+    '''Check whether line is a protocol command
+
+    Returns None if not. Otherwise, returns whether it asks for a version of
+    the binary protocol that we support.
+
+    '''
+    words = line.split()
+    if not words or words[0] != 'protocol':
+        return None
+
+    check_arg_count('protocol', 2, words[1:])
+    if words[1] != 'binary':
+        raise ValueError(f'Unknown protocol: {words[1]!r}.')
+    return read_word('ver', words[2], 32) == BINARY_PROTOCOL_VERSION
+
+
+def read_frame(stream: BinaryIO) -> Optional[bytes]:
+    '''Read a frame from stream, returning its payload (None on EOF)'''
+    hdr = stream.read(4)
+    if len(hdr) < 4:
+        return None
+
+    length = struct.unpack('<I', hdr)[0]
+    payload = stream.read(length)
+    if len(payload) < length:
+        return None
+
+    return payload
+
+
+def write_frame(stream: BinaryIO, payload: bytes) -> None:
+    '''Write a frame with the given payload to stream and flush it'''
+    stream.write(struct.pack('<I', len(payload)))
+    stream.write(payload)
+    stream.flush()
+
+
+def pack_records(lines: List[str]) -> bytes:
+    '''Pack lines of text as a list of records'''
+    parts = [struct.pack('<I', len(lines))]
+    for line in lines:
+        data = line.encode('utf-8')
+        parts.append(struct.pack('<I', len(data)))
+        parts.append(data)
+    return b''.join(parts)
+
+
+def pack_blob(data: bytes) -> bytes:
+    '''Pack bytes as a blob (a 32-bit length, followed by the data)'''
+    return struct.pack('<I', len(data)) + data
+
+
+def pack_trace_value(value: Optional[int], width: int) -> bytes:
+    '''Pack a value in a trace record, where None means an unknown value'''
+    num_words = (width + 31) // 32
+    if value is None:
+        return struct.pack(f'<BBH{2 * num_words}I', num_words, 1, 0,
+                           *([0] * num_words + [0xffffffff] * num_words))
+
+    words = [(value >> (32 * i)) & 0xffffffff for i in range(num_words)]
+    return struct.pack(f'<BBH{num_words}I', num_words, 0, 0, *words)
+
+
+def pack_trace_write(change: Trace) -> Optional[bytes]:
+    '''Pack a change as a register write line in a trace record
+
+    Returns None for a change that the trace checker doesn't compare (a write
+    to an external register).
+
+    '''
+    if isinstance(change, TraceRegister):
+        name, width, value = change.name, change.width, change.new_value
+    elif isinstance(change, TraceWSR):
+        name, width, value = change.wsr_name, 256, change.new_value
+    elif isinstance(change, TraceFlags):
+        name, width = f'FLAGS{change.group}', 32
+        value = (int(change.value.C) | (int(change.value.M) << 1) |
+                 (int(change.value.L) << 2) | (int(change.value.Z) << 3))
+    elif isinstance(change, TraceExtRegChange):
+        return None
+    else:
+        raise RuntimeError('No packed trace format for {!r}'
+                           .format(change.rtl_trace()))
+
+    loc = TRACE_LOCS.get(name)
+    if loc is None:
+        raise RuntimeError(f'Unknown location in trace: {name!r}')
+
+    return (struct.pack('<BBHI', ord('>'), 0, loc, 0) +
+            pack_trace_value(value, width))
+
+
+def pack_trace_record(hdr: str, insn: Optional[OTBNInsn],
+                      pc: int, changes: List[Trace]) -> bytes:
+    '''Pack the results of step_changes() as a trace record'''
+    insn_kind = wipe_kind = 0
+    flags = 0
+    insn_bits = 0
+    if hdr == 'E':
+        assert insn is not None
+        insn_kind = ord('E')
+        flags = TRACE_HAS_PC
+        if insn.has_bits:
+            flags |= TRACE_INSN_KNOWN
+            insn_bits = insn.raw
+    elif hdr == 'S':
+        # The ISS doesn't say where a stall is (see the STALL header in
+        # step_trace()), so there is no PC.
+        insn_kind = ord('S')
+    else:
+        wipe_kind = ord(hdr)
+
+    lines = []
+    for change in changes:
+        packed = pack_trace_write(change)
+        if packed is not None:
+            lines.append(packed)
+
+    return (struct.pack('<BBBBIII', insn_kind, wipe_kind, flags, 0,
+                        pc if flags & TRACE_HAS_PC else 0,
+                        insn_bits, len(lines)) +
+            b''.join(lines))
+
+
+def binary_step(sim: OTBNSim) -> Tuple[bytes, int]:
+    '''Step one instruction, returning the response and the mask of writes'''
+    hdr, insn, pc, changes = step_changes(sim)
+
+    mask = 0
+    values = [0] * len(STEP_EXT_REGS)
+    for change in changes:
+        if isinstance(change, TraceExtRegChange):
+            try:
+                idx = STEP_EXT_REGS.index(change.name)
+            except ValueError:
+                continue
+            mask |= 1 << idx
+            values[idx] = change.erc.new_value
+
+    trace = b''
+    mnemonic = ''
+    if hdr is not None:
+        trace = pack_trace_record(hdr, insn, pc, changes)
+        if insn is not None:
+            mnemonic = insn.insn.mnemonic if insn.has_bits else '??'
+
+    return (struct.pack('<7I', mask, *values) +
+            pack_blob(trace) + pack_blob(mnemonic.encode('utf-8')),
+            mask)
+
+
+def can_run_ahead(sim: OTBNSim, mask: int) -> bool:
+    '''Check whether the next cycle only depends on state inside the ISS
+
+    This is true while we are executing code and nothing on the RTL side has
+    anything to react to. mask is the mask of external registers that were
+    written on the cycle that we just ran.
+
+    '''
+    # INSN_CNT changes all the time, but nothing on the RTL side reacts to it.
+    # A write to any other register might trigger something (such as a
+    # request to EDN or a check on the start of a secure wipe).
+    if mask & ~(1 << STEP_EXT_REGS.index('INSN_CNT')):
+        return False
+
+    # Outside of execution, the ISS is waiting for commands, EDN data or a
+    # wipe to finish.
+    if sim.state.get_fsm_state() != FsmState.EXEC:
+        return False
+
+    # While waiting for RND data from EDN, what happens depends on when it
+    # arrives.
+    if sim.state.ext_regs.read('RND_REQ', True):
+        return False
+
+    return True
+
+
+def on_binary_step_n(sim: OTBNSim, max_cycles: int) -> bytes:
+    '''Step up to max_cycles, returning the payload of the response'''
+    responses = []
+    while len(responses) < max_cycles:
+        response, mask = binary_step(sim)
+        responses.append(response)
+        if not can_run_ahead(sim, mask):
+            break
+
+    return struct.pack('<I', len(responses)) + b''.join(responses)
+
+
+def binary_main(sim: OTBNSim) -> int:
+    '''Process binary frames from stdin until EOF'''
+    in_stream = sys.stdin.buffer
+    out_stream = sys.stdout.buffer
+
+    while True:
+        frame = read_frame(in_stream)
+        if not frame:
+            return 0
+
+        opcode = frame[0]
+        if opcode == OP_STEP:
+            write_frame(out_stream, binary_step(sim)[0])
+        elif opcode == OP_STEP_N:
+            max_cycles = struct.unpack('<I', frame[1:5])[0]
+            write_frame(out_stream, on_binary_step_n(sim, max_cycles))
+        elif opcode == OP_TEXT:
+            # Capture anything that the handler prints and send it as records
+            output = io.StringIO()
+            with contextlib.redirect_stdout(output):
+                ret = run_command(sim, frame[1:].decode('utf-8'))
+            if ret is not None:
+                sim = ret
+            write_frame(out_stream, pack_records(output.getvalue().splitlines()))
+        else:
+            raise RuntimeError(f'Unknown opcode in binary frame: {opcode}')
+
+
 def main() -> int:
     sim = OTBNSim()
     try:
+        # The wrapper only sends binary frames once it has seen our reply to
+        # the protocol command, so nothing is left buffered in sys.stdin when
+        # we switch to reading sys.stdin.buffer.
         for line in sys.stdin:
+            binary = is_protocol_request(line)
+            if binary is not None:
+                print('PROTOCOL binary {}'.format(BINARY_PROTOCOL_VERSION)
+                      if binary else 'PROTOCOL text')
+                end_command()
+                if binary:
+                    return binary_main(sim)
+                continue
+
             ret = on_input(sim, line)
             if ret is not None:
                 sim = ret
@@ -464,5 +915,122 @@ def main() -> int:
     return 0
 
 
+def recv_stdio_fds(conn: socket.socket) -> Optional[List[int]]:
+    '''Receive a client's stdin, stdout and stderr fds over conn
+
+    Returns None (having closed anything that did arrive) if the client didn't
+    send exactly three file descriptors.
+
+    '''
+    fds = array.array('i')
+    msg, ancdata, _, _ = conn.recvmsg(1, socket.CMSG_SPACE(3 * fds.itemsize))
+    for level, ctype, data in ancdata:
+        if level == socket.SOL_SOCKET and ctype == socket.SCM_RIGHTS:
+            usable = len(data) - (len(data) % fds.itemsize)
+            fds.frombytes(data[:usable])
+
+    if len(msg) == 1 and len(fds) == 3:
+        return list(fds)
+
+    for fd in fds:
+        os.close(fd)
+    return None
+
+
+def run_forked_child(fds: List[int]) -> NoReturn:
+    '''Run the REPL in a child of the fork server and then exit
+
+    fds are the client's stdin, stdout and stderr. The child must never return
+    to the server's loop, so this always ends with os._exit().
+
+    '''
+    ret = 1
+    try:
+        signal.signal(signal.SIGCHLD, signal.SIG_DFL)
+        for target, fd in enumerate(fds):
+            os.dup2(fd, target)
+            os.close(fd)
+        ret = main()
+        sys.stdout.flush()
+    except BaseException:
+        traceback.print_exc()
+    finally:
+        os._exit(ret)
+
+
+def serve(path: str, idle_timeout: float) -> int:
+    '''Run as a fork server on a Unix socket at path (see the docstring)'''
+    listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        listener.bind(path)
+    except OSError:
+        # Either another server is already listening on path (in which case we
+        # leave it to serve the clients) or a server died without removing
+        # its socket (in which case we replace it).
+        probe = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            probe.connect(path)
+            return 0
+        except ConnectionRefusedError:
+            os.unlink(path)
+            listener.bind(path)
+        finally:
+            probe.close()
+
+    listener.listen()
+    listener.settimeout(idle_timeout)
+
+    # Children are reaped automatically. Clients stop their ISS by closing its
+    # stdin, after which it exits.
+    signal.signal(signal.SIGCHLD, signal.SIG_IGN)
+
+    try:
+        while True:
+            try:
+                conn, _ = listener.accept()
+            except socket.timeout:
+                break
+
+            with conn:
+                conn.settimeout(None)
+                try:
+                    fds = recv_stdio_fds(conn)
+                except OSError:
+                    # The client went away before sending its request
+                    continue
+                if fds is None:
+                    continue
+
+                pid = os.fork()
+                if pid == 0:
+                    listener.close()
+                    conn.close()
+                    run_forked_child(fds)
+
+                for fd in fds:
+                    os.close(fd)
+                # If the client has gone away, the child sees EOF and exits.
+                with contextlib.suppress(OSError):
+                    conn.sendall(struct.pack('<I', pid))
+    finally:
+        # Close the listener before removing the socket. A client that
+        # connected after the last accept() then sees its connection closed
+        # and can start its ISS some other way.
+        listener.close()
+        with contextlib.suppress(FileNotFoundError):
+            os.unlink(path)
+
+    return 0
+
+
 if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--server', metavar='PATH',
+                        help='Run as a fork server, listening on PATH')
+    parser.add_argument('--idle-timeout', type=float, default=300,
+                        help=('With --server, exit after this many seconds '
+                              'without a client (default: %(default)s)'))
+    args = parser.parse_args()
+    if args.server is not None:
+        sys.exit(serve(args.server, args.idle_timeout))
     sys.exit(main())
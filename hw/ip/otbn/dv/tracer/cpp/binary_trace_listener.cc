@@ -0,0 +1,21 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "binary_trace_listener.h"
+
+#include <iostream>
+
+BinaryTraceListener::BinaryTraceListener(const std::string &filename)
+    : writer_(filename) {}
+
+BinaryTraceListener::~BinaryTraceListener() {
+  if (!writer_.Close()) {
+    std::cerr << "ERROR: Failed to write OTBN binary trace." << std::endl;
+  }
+}
+
+void BinaryTraceListener::AcceptTraceRecord(const OtbnTraceRecord &record,
+                                            unsigned int cycle_count) {
+  writer_.Write(record, cycle_count);
+}
@@ -0,0 +1,41 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_LISTENER_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_LISTENER_H_
+
+#include <string>
+
+#include "otbn_binary_trace.h"
+#include "otbn_trace_listener.h"
+
+/**
+ * An OtbnTraceListener that writes the trace to a file in the binary trace
+ * format (see otbn_binary_trace.h).
+ *
+ * The file is much smaller than the one written by LogTraceListener and can be
+ * read back from any cycle with otbn_trace_tool, which can also convert it to
+ * the same log format.
+ */
+class BinaryTraceListener : public OtbnTraceListener {
+ private:
+  OtbnBinaryTraceWriter writer_;
+
+ public:
+  /**
+   * Constructor that takes a filename to write the trace to. It throws
+   * std::runtime_error if the file cannot be opened.
+   */
+  BinaryTraceListener(const std::string &filename);
+
+  /**
+   * Destructor, which writes out the index and closes the file
+   */
+  ~BinaryTraceListener() override;
+
+  void AcceptTraceRecord(const OtbnTraceRecord &record,
+                         unsigned int cycle_count) override;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_BINARY_TRACE_LISTENER_H_
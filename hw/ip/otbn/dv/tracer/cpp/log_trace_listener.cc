@@ -23,7 +23,11 @@ LogTraceListener::LogTraceListener(const std::string &log_filename)
 void LogTraceListener::AcceptTraceString(const std::string &trace,
                                          unsigned int cycle_count) {
   assert(trace_log.is_open());
+  WriteTrace(trace_log, trace, cycle_count);
+}
 
+void LogTraceListener::WriteTrace(std::ostream &os, const std::string &trace,
+                                  unsigned int cycle_count) {
   // Split the trace up into a vector of strings, one per line
   auto trace_lines = SplitTraceLines(trace);
 
@@ -40,28 +44,28 @@ void LogTraceListener::AcceptTraceString(const std::string &trace,
         // special '!' line, only giving the cycle count, is output if the first
         // line isn't an 'E' or 'S' line.
         std::ios old_state(nullptr);
-        old_state.copyfmt(trace_log);
-        trace_log << (is_e_or_s_line ? line[0] : '!') << " " << std::setw(9)
-                  << std::setfill('0') << cycle_count;
-        trace_log.copyfmt(old_state);
+        old_state.copyfmt(os);
+        os << (is_e_or_s_line ? line[0] : '!') << " " << std::setw(9)
+           << std::setfill('0') << cycle_count;
+        os.copyfmt(old_state);
 
         if (is_e_or_s_line) {
           // If this is an expected 'E' or 'S' line write the rest of it out
-          trace_log << line.substr(1) << "\n";
+          os << line.substr(1) << "\n";
         } else {
           // Otherwise leave the '!' line on it's own and dump this line out
           // indented.
-          trace_log << "\n    " << line << "\n";
+          os << "\n    " << line << "\n";
         }
       } else {
-        trace_log << "ERR: Bad line at " << cycle_count
+        os << "ERR: Bad line at " << cycle_count
                   << " line should be more than 1 character: " << line << "\n";
       }
 
       first_line = false;
     } else {
       // All lines other than the first are indented.
-      trace_log << "    " << line << "\n";
+      os << "    " << line << "\n";
     }
   }
 }
@@ -6,6 +6,7 @@
 #define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_LOG_TRACE_LISTENER_H_
 
 #include <fstream>
+#include <ostream>
 #include <string>
 
 #include "otbn_trace_listener.h"
@@ -35,6 +36,13 @@ class LogTraceListener : public OtbnTraceListener {
   LogTraceListener(const std::string &log_filename);
   void AcceptTraceString(const std::string &trace,
                          unsigned int cycle_count) override;
+
+  /**
+   * Write a trace record to os in the log format described above. This is
+   * also used by tools that convert other trace formats to a log.
+   */
+  static void WriteTrace(std::ostream &os, const std::string &trace,
+                         unsigned int cycle_count);
 };
 
 #endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_LOG_TRACE_LISTENER_H_
@@ -0,0 +1,440 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "otbn_binary_trace.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <zlib.h>
+
+static const char kFileMagic[8] = {'O', 'T', 'B', 'N', 'T', 'R', 'C', '\0'};
+static const char kTrailerMagic[8] = {'O', 'T', 'B', 'N', 'T', 'E', 'N', 'D'};
+static const uint32_t kFileVersion = 1;
+// "OTBB" and "OTBI" as little-endian words
+static const uint32_t kBlockMagic = 0x4242544f;
+static const uint32_t kIndexMagic = 0x4942544f;
+
+// File header: magic (8 bytes), u32 version, u32 reserved
+static const size_t kFileHeaderSize = 16;
+// The fields of a block after the offset: 11 u32s
+static const size_t kBlockFieldsSize = 44;
+// Block header: u32 magic, then the block fields
+static const size_t kBlockHeaderSize = 4 + kBlockFieldsSize;
+// Index entry: u64 offset, then the block fields
+static const size_t kIndexEntrySize = 8 + kBlockFieldsSize;
+// Trailer: u64 index offset, magic (8 bytes)
+static const size_t kTrailerSize = 16;
+
+static void put_u32(uint32_t value, std::string *dst) {
+  for (int i = 0; i < 4; ++i) {
+    dst->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+static void put_u64(uint64_t value, std::string *dst) {
+  put_u32(value, dst);
+  put_u32(value >> 32, dst);
+}
+
+static uint32_t get_u32(const char *src) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= (uint32_t)(uint8_t)src[i] << (8 * i);
+  }
+  return value;
+}
+
+static uint64_t get_u64(const char *src) {
+  return get_u32(src) | ((uint64_t)get_u32(src + 4) << 32);
+}
+
+static void put_block_fields(const OtbnBinaryTraceBlock &block,
+                             std::string *dst) {
+  put_u32(block.compressed_size, dst);
+  put_u32(block.uncompressed_size, dst);
+  put_u32(block.num_records, dst);
+  put_u32(block.first_cycle, dst);
+  put_u32(block.last_cycle, dst);
+  put_u32(block.pc_min, dst);
+  put_u32(block.pc_max, dst);
+  for (uint32_t word : block.loc_mask) {
+    put_u32(word, dst);
+  }
+}
+
+static void get_block_fields(const char *src, OtbnBinaryTraceBlock *block) {
+  block->compressed_size = get_u32(src);
+  block->uncompressed_size = get_u32(src + 4);
+  block->num_records = get_u32(src + 8);
+  block->first_cycle = get_u32(src + 12);
+  block->last_cycle = get_u32(src + 16);
+  block->pc_min = get_u32(src + 20);
+  block->pc_max = get_u32(src + 24);
+  for (int i = 0; i < OtbnBinaryTraceBlock::kLocMaskWords; ++i) {
+    block->loc_mask[i] = get_u32(src + 28 + 4 * i);
+  }
+}
+
+static std::runtime_error trace_error(const std::string &filename,
+                                      const std::string &msg) {
+  std::ostringstream oss;
+  oss << "Bad OTBN binary trace `" << filename << "': " << msg;
+  return std::runtime_error(oss.str());
+}
+
+void OtbnBinaryTraceBlock::Clear() {
+  offset = 0;
+  compressed_size = 0;
+  uncompressed_size = 0;
+  num_records = 0;
+  first_cycle = 0;
+  last_cycle = 0;
+  pc_min = UINT32_MAX;
+  pc_max = 0;
+  memset(loc_mask, 0, sizeof(loc_mask));
+}
+
+void OtbnBinaryTraceBlock::Add(const OtbnTraceRecord &record,
+                               unsigned cycle_count) {
+  if (num_records == 0) {
+    first_cycle = cycle_count;
+  }
+  last_cycle = cycle_count;
+  ++num_records;
+
+  if (record.insn_kind && (record.insn_flags & OtbnTraceRecord::kHasPc)) {
+    pc_min = std::min(pc_min, record.pc);
+    pc_max = std::max(pc_max, record.pc);
+  }
+  for (const OtbnTraceLine &line : record.lines) {
+    unsigned bit = LocBit(line.loc);
+    loc_mask[bit / 32] |= 1u << (bit % 32);
+  }
+}
+
+unsigned OtbnBinaryTraceBlock::LocBit(uint16_t loc) {
+  const unsigned last_bit = 32 * kLocMaskWords - 1;
+  return std::min<unsigned>(loc, last_bit);
+}
+
+bool OtbnBinaryTraceBlock::HasLoc(uint16_t loc) const {
+  unsigned bit = LocBit(loc);
+  return (loc_mask[bit / 32] >> (bit % 32)) & 1;
+}
+
+OtbnTraceFilter::OtbnTraceFilter()
+    : match_pc(false),
+      pc_min(0),
+      pc_max(0),
+      match_insn(false),
+      insn(0),
+      insn_mask(0) {}
+
+bool OtbnTraceFilter::Matches(const OtbnTraceRecord &record) const {
+  if (match_pc) {
+    if (!record.insn_kind || !(record.insn_flags & OtbnTraceRecord::kHasPc) ||
+        record.pc < pc_min || record.pc > pc_max)
+      return false;
+  }
+  if (match_insn) {
+    if (!record.insn_kind ||
+        !(record.insn_flags & OtbnTraceRecord::kInsnKnown) ||
+        (record.insn & insn_mask) != (insn & insn_mask))
+      return false;
+  }
+  if (!locs.empty()) {
+    for (const OtbnTraceLine &line : record.lines) {
+      if (std::find(locs.begin(), locs.end(), line.loc) != locs.end())
+        return true;
+    }
+    return false;
+  }
+  return true;
+}
+
+bool OtbnTraceFilter::MayMatch(const OtbnBinaryTraceBlock &block) const {
+  if (match_pc && (block.pc_min > pc_max || block.pc_max < pc_min))
+    return false;
+  if (!locs.empty()) {
+    for (uint16_t loc : locs) {
+      if (block.HasLoc(loc))
+        return true;
+    }
+    return false;
+  }
+  return true;
+}
+
+OtbnBinaryTraceWriter::OtbnBinaryTraceWriter(const std::string &filename,
+                                             unsigned block_records)
+    : filename_(filename),
+      file_(filename, std::ios::out | std::ios::binary | std::ios::trunc),
+      block_records_(std::max(1u, block_records)),
+      write_error_(false),
+      offset_(0) {
+  if (!file_.is_open()) {
+    std::ostringstream oss;
+    oss << "Could not open binary trace file: " << filename;
+    throw std::runtime_error(oss.str());
+  }
+
+  std::string header(kFileMagic, sizeof(kFileMagic));
+  put_u32(kFileVersion, &header);
+  put_u32(0, &header);
+  assert(header.size() == kFileHeaderSize);
+  file_.write(header.data(), header.size());
+  offset_ = header.size();
+
+  block_.Clear();
+}
+
+OtbnBinaryTraceWriter::~OtbnBinaryTraceWriter() { Close(); }
+
+void OtbnBinaryTraceWriter::Write(const OtbnTraceRecord &record,
+                                  unsigned cycle_count) {
+  assert(file_.is_open());
+
+  // Keep the cycle counts in a block in order, so that the block summary
+  // describes the range of cycles it holds.
+  if (block_.num_records && cycle_count < block_.last_cycle) {
+    FlushBlock();
+  }
+
+  put_u32(cycle_count, &block_data_);
+  record.Pack(&block_data_);
+  block_.Add(record, cycle_count);
+
+  if (block_.num_records >= block_records_) {
+    FlushBlock();
+  }
+}
+
+void OtbnBinaryTraceWriter::FlushBlock() {
+  if (block_.num_records == 0)
+    return;
+
+  uLongf compressed_size = compressBound(block_data_.size());
+  compressed_.resize(compressed_size);
+  int ret = compress2(reinterpret_cast<Bytef *>(&compressed_[0]),
+                      &compressed_size,
+                      reinterpret_cast<const Bytef *>(block_data_.data()),
+                      block_data_.size(), Z_BEST_SPEED);
+  assert(ret == Z_OK);
+  (void)ret;
+
+  block_.offset = offset_;
+  block_.compressed_size = compressed_size;
+  block_.uncompressed_size = block_data_.size();
+
+  std::string header;
+  put_u32(kBlockMagic, &header);
+  put_block_fields(block_, &header);
+  assert(header.size() == kBlockHeaderSize);
+
+  file_.write(header.data(), header.size());
+  file_.write(compressed_.data(), compressed_size);
+  offset_ += header.size() + compressed_size;
+
+  index_.push_back(block_);
+  block_.Clear();
+  block_data_.clear();
+}
+
+bool OtbnBinaryTraceWriter::Close() {
+  if (!file_.is_open())
+    return !write_error_;
+
+  FlushBlock();
+
+  std::string index;
+  put_u32(kIndexMagic, &index);
+  put_u32(index_.size(), &index);
+  for (const OtbnBinaryTraceBlock &block : index_) {
+    put_u64(block.offset, &index);
+    put_block_fields(block, &index);
+  }
+  put_u64(offset_, &index);
+  index.append(kTrailerMagic, sizeof(kTrailerMagic));
+  file_.write(index.data(), index.size());
+
+  file_.close();
+  write_error_ = file_.fail();
+  return !write_error_;
+}
+
+OtbnBinaryTraceReader::OtbnBinaryTraceReader(const std::string &filename)
+    : filename_(filename),
+      file_(filename, std::ios::in | std::ios::binary),
+      recovered_(false),
+      monotonic_(true) {
+  if (!file_.is_open()) {
+    std::ostringstream oss;
+    oss << "Could not open binary trace file: " << filename;
+    throw std::runtime_error(oss.str());
+  }
+
+  file_.seekg(0, std::ios::end);
+  uint64_t file_size = file_.tellg();
+  file_.seekg(0);
+
+  char header[kFileHeaderSize];
+  if (file_size < kFileHeaderSize || !file_.read(header, sizeof(header)) ||
+      memcmp(header, kFileMagic, sizeof(kFileMagic)) != 0) {
+    throw trace_error(filename_, "not an OTBN binary trace");
+  }
+  uint32_t version = get_u32(header + sizeof(kFileMagic));
+  if (version != kFileVersion) {
+    std::ostringstream oss;
+    oss << "unsupported version " << version;
+    throw trace_error(filename_, oss.str());
+  }
+
+  if (!ReadIndex(file_size)) {
+    recovered_ = true;
+    ScanBlocks(file_size);
+  }
+  CheckMonotonic();
+}
+
+void OtbnBinaryTraceReader::CheckMonotonic() {
+  monotonic_ = true;
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    if (blocks_[i].first_cycle > blocks_[i].last_cycle ||
+        (i && blocks_[i].first_cycle < blocks_[i - 1].last_cycle)) {
+      monotonic_ = false;
+      return;
+    }
+  }
+}
+
+bool OtbnBinaryTraceReader::ReadIndex(uint64_t file_size) {
+  if (file_size < kFileHeaderSize + kTrailerSize + 8)
+    return false;
+
+  char trailer[kTrailerSize];
+  file_.seekg(file_size - kTrailerSize);
+  if (!file_.read(trailer, sizeof(trailer)) ||
+      memcmp(trailer + 8, kTrailerMagic, sizeof(kTrailerMagic)) != 0)
+    return false;
+
+  uint64_t index_offset = get_u64(trailer);
+  if (index_offset < kFileHeaderSize ||
+      index_offset + 8 + kTrailerSize > file_size)
+    return false;
+
+  std::string index(file_size - kTrailerSize - index_offset, '\0');
+  file_.seekg(index_offset);
+  if (!file_.read(&index[0], index.size()) ||
+      get_u32(&index[0]) != kIndexMagic)
+    return false;
+
+  uint32_t num_blocks = get_u32(&index[4]);
+  if (index.size() != 8 + (uint64_t)num_blocks * kIndexEntrySize)
+    return false;
+
+  blocks_.resize(num_blocks);
+  for (uint32_t i = 0; i < num_blocks; ++i) {
+    const char *entry = &index[8 + i * kIndexEntrySize];
+    blocks_[i].offset = get_u64(entry);
+    get_block_fields(entry + 8, &blocks_[i]);
+  }
+  return true;
+}
+
+void OtbnBinaryTraceReader::ScanBlocks(uint64_t file_size) {
+  blocks_.clear();
+
+  uint64_t offset = kFileHeaderSize;
+  char header[kBlockHeaderSize];
+  while (offset + kBlockHeaderSize <= file_size) {
+    file_.seekg(offset);
+    if (!file_.read(header, sizeof(header)) ||
+        get_u32(header) != kBlockMagic)
+      break;
+
+    OtbnBinaryTraceBlock block;
+    block.offset = offset;
+    get_block_fields(header + 4, &block);
+
+    // Stop at a block that was only partly written
+    uint64_t end = offset + kBlockHeaderSize + block.compressed_size;
+    if (end > file_size)
+      break;
+
+    blocks_.push_back(block);
+    offset = end;
+  }
+  file_.clear();
+}
+
+void OtbnBinaryTraceReader::LoadBlock(const OtbnBinaryTraceBlock &block) {
+  compressed_.resize(block.compressed_size);
+  file_.seekg(block.offset + kBlockHeaderSize);
+  if (!file_.read(&compressed_[0], compressed_.size())) {
+    file_.clear();
+    throw trace_error(filename_, "truncated block");
+  }
+
+  block_data_.resize(block.uncompressed_size);
+  uLongf size = block_data_.size();
+  int ret = uncompress(reinterpret_cast<Bytef *>(&block_data_[0]), &size,
+                       reinterpret_cast<const Bytef *>(compressed_.data()),
+                       compressed_.size());
+  if (ret != Z_OK || size != block.uncompressed_size) {
+    throw trace_error(filename_, "corrupt block");
+  }
+}
+
+void OtbnBinaryTraceReader::Read(uint32_t first_cycle, uint32_t last_cycle,
+                                 const OtbnTraceFilter &filter,
+                                 const Visitor &visitor) {
+  // If the blocks are in cycle order, find the first one that ends at or
+  // after first_cycle and stop at the first one that starts after last_cycle.
+  // Otherwise (if the design was reset during the trace), look at every
+  // block.
+  auto it = blocks_.begin();
+  if (monotonic_) {
+    it = std::lower_bound(
+        blocks_.begin(), blocks_.end(), first_cycle,
+        [](const OtbnBinaryTraceBlock &block, uint32_t cycle) {
+          return block.last_cycle < cycle;
+        });
+  }
+
+  OtbnTraceRecord record;
+  for (; it != blocks_.end(); ++it) {
+    if (it->first_cycle > last_cycle) {
+      if (monotonic_)
+        return;
+      continue;
+    }
+    if (it->last_cycle < first_cycle || !filter.MayMatch(*it))
+      continue;
+
+    LoadBlock(*it);
+    size_t pos = 0;
+    for (uint32_t i = 0; i < it->num_records; ++i) {
+      if (pos + 4 > block_data_.size())
+        throw trace_error(filename_, "truncated record");
+      uint32_t cycle_count = get_u32(&block_data_[pos]);
+      pos += 4;
+      if (!record.Unpack(block_data_, &pos))
+        throw trace_error(filename_, "malformed record");
+
+      // The records in a block are in cycle order
+      if (cycle_count > last_cycle) {
+        if (monotonic_)
+          return;
+        break;
+      }
+      if (cycle_count < first_cycle || !filter.Matches(record))
+        continue;
+      if (!visitor(record, cycle_count))
+        return;
+    }
+  }
+}
@@ -0,0 +1,196 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_BINARY_TRACE_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_BINARY_TRACE_H_
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "otbn_trace_record.h"
+
+// A compact binary format for OTBN traces, which can be read back quickly
+// from any cycle.
+//
+// The file starts with a header (the magic string "OTBNTRC\0" and a u32
+// version) and is followed by blocks. Each block holds a run of trace records,
+// compressed with zlib, and starts with a header giving the compressed and
+// uncompressed sizes and a summary of the records (see OtbnBinaryTraceBlock).
+// Inside a block, each record is a u32 cycle count followed by the record in
+// the packed format of OtbnTraceRecord::Pack.
+//
+// When the file is closed, the writer appends an index of the blocks, which
+// maps cycle counts to file offsets, followed by a trailer that gives the
+// offset of the index. A reader that doesn't find the trailer (because the
+// simulation didn't finish cleanly) rebuilds the index by scanning the block
+// headers.
+//
+// The cycle counts within a block never decrease: the writer starts a new
+// block if a record's cycle count is lower than the last one (which happens
+// when the design is reset, because the tracer's cycle counter restarts). If
+// the blocks are also in cycle order, a reader finds the blocks for a range
+// of cycles with a binary search of the index. Otherwise, it checks the range
+// of every block and returns the matching records from each, in file order.
+//
+// All integers are little-endian.
+
+// Summary of a block of records, stored in its header and in the index. The
+// summary lets a reader skip blocks that can't contain anything it's looking
+// for without decompressing them.
+struct OtbnBinaryTraceBlock {
+  enum { kLocMaskWords = 4 };
+
+  // Offset of the block header in the file
+  uint64_t offset;
+  uint32_t compressed_size;
+  uint32_t uncompressed_size;
+
+  uint32_t num_records;
+  uint32_t first_cycle;
+  uint32_t last_cycle;
+  // The range of PCs of instructions in the block (pc_min > pc_max if there
+  // are none)
+  uint32_t pc_min;
+  uint32_t pc_max;
+  // A bit for each location (from OtbnTraceLoc) that is read or written in
+  // the block. The last bit covers all locations that don't have a bit of
+  // their own.
+  uint32_t loc_mask[kLocMaskWords];
+
+  // Clear the summary, ready for a new block
+  void Clear();
+
+  // Add a record to the summary
+  void Add(const OtbnTraceRecord &record, unsigned cycle_count);
+
+  static unsigned LocBit(uint16_t loc);
+  bool HasLoc(uint16_t loc) const;
+};
+
+// Which records to read from a trace. An empty filter matches everything.
+struct OtbnTraceFilter {
+  OtbnTraceFilter();
+
+  // Only records that read or write one of these locations (or any records if
+  // this is empty)
+  std::vector<uint16_t> locs;
+
+  // Only records with an instruction whose PC is in [pc_min, pc_max]
+  bool match_pc;
+  uint32_t pc_min;
+  uint32_t pc_max;
+
+  // Only records with an instruction whose bits match insn under insn_mask
+  bool match_insn;
+  uint32_t insn;
+  uint32_t insn_mask;
+
+  bool Matches(const OtbnTraceRecord &record) const;
+
+  // False if no record in the block can match
+  bool MayMatch(const OtbnBinaryTraceBlock &block) const;
+};
+
+// Writes trace records to a file in the binary trace format
+class OtbnBinaryTraceWriter {
+ public:
+  /**
+   * Constructor, which opens the file. Throws std::runtime_error if the file
+   * cannot be opened.
+   *
+   * @param filename The file to write
+   * @param block_records The maximum number of records in a block
+   */
+  OtbnBinaryTraceWriter(const std::string &filename,
+                        unsigned block_records = 4096);
+
+  // Closes the file if that hasn't been done already
+  ~OtbnBinaryTraceWriter();
+
+  OtbnBinaryTraceWriter(const OtbnBinaryTraceWriter &) = delete;
+  void operator=(const OtbnBinaryTraceWriter &) = delete;
+
+  // Add a record to the trace. If cycle_count is lower than that of the
+  // previous record, the record starts a new block.
+  void Write(const OtbnTraceRecord &record, unsigned cycle_count);
+
+  // Write out the last block and the index and close the file. Returns false
+  // if there was an error writing the file.
+  bool Close();
+
+ private:
+  void FlushBlock();
+
+  std::string filename_;
+  std::ofstream file_;
+  unsigned block_records_;
+  bool write_error_;
+
+  uint64_t offset_;
+  OtbnBinaryTraceBlock block_;
+  std::string block_data_;
+  std::string compressed_;
+  std::vector<OtbnBinaryTraceBlock> index_;
+};
+
+// Reads a file in the binary trace format
+class OtbnBinaryTraceReader {
+ public:
+  // Called for each record that is read. Return false to stop reading.
+  typedef std::function<bool(const OtbnTraceRecord &record,
+                             unsigned cycle_count)>
+      Visitor;
+
+  /**
+   * Constructor, which opens the file and reads its index. Throws
+   * std::runtime_error if the file cannot be read or is malformed.
+   */
+  explicit OtbnBinaryTraceReader(const std::string &filename);
+
+  // The blocks in the file, in order
+  const std::vector<OtbnBinaryTraceBlock> &Blocks() const { return blocks_; }
+
+  // True if the index was rebuilt because the file had no trailer
+  bool Recovered() const { return recovered_; }
+
+  // True if the blocks are in cycle order (so no cycle count appears twice,
+  // except at the boundary between two blocks)
+  bool Monotonic() const { return monotonic_; }
+
+  /**
+   * Read the records with cycle counts in [first_cycle, last_cycle] that
+   * match filter, in file order, passing each one to visitor.
+   *
+   * Only the blocks that might contain matching records are read. Throws
+   * std::runtime_error if a block is malformed.
+   */
+  void Read(uint32_t first_cycle, uint32_t last_cycle,
+            const OtbnTraceFilter &filter, const Visitor &visitor);
+
+ private:
+  // Read the index from the end of the file. Returns false if there isn't one.
+  bool ReadIndex(uint64_t file_size);
+
+  // Build the index by scanning the block headers
+  void ScanBlocks(uint64_t file_size);
+
+  // Set monotonic_ from the cycle ranges of the blocks
+  void CheckMonotonic();
+
+  // Read and decompress a block into block_data_
+  void LoadBlock(const OtbnBinaryTraceBlock &block);
+
+  std::string filename_;
+  std::ifstream file_;
+  std::vector<OtbnBinaryTraceBlock> blocks_;
+  bool recovered_;
+  bool monotonic_;
+
+  std::string compressed_;
+  std::string block_data_;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_BINARY_TRACE_H_
@@ -0,0 +1,243 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "hw/ip/otbn/dv/tracer/cpp/otbn_binary_trace.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace otbn_binary_trace_unittest {
+namespace {
+
+// A record read back from a trace: its cycle count and its text
+typedef std::pair<unsigned, std::string> ReadRecord;
+
+// Make the record for a cycle. Every fourth cycle is a stall and the others
+// complete an instruction at a PC that depends on the cycle, writing x1 (or
+// w2, on every third cycle).
+OtbnTraceRecord MakeRecord(unsigned cycle) {
+  OtbnTraceRecord record;
+  record.insn_kind = cycle % 4 ? 'E' : 'S';
+  record.insn_flags = OtbnTraceRecord::kHasPc | OtbnTraceRecord::kInsnKnown;
+  record.pc = 4 * (cycle % 100);
+  record.insn = 0x13 + cycle;
+
+  OtbnTraceLine line;
+  line.type = '>';
+  line.flags = 0;
+  line.addr = 0;
+  if (cycle % 3) {
+    uint32_t value = cycle;
+    line.loc = OtbnTraceLoc::X0 + 1;
+    line.value.Set(1, &value);
+  } else {
+    uint32_t words[OtbnTraceValue::kMaxWords] = {cycle, 1, 2, 3, 4, 5, 6, 7};
+    line.loc = OtbnTraceLoc::W0 + 2;
+    line.value.Set(OtbnTraceValue::kMaxWords, words);
+  }
+  record.lines.push_back(line);
+  return record;
+}
+
+std::string TracePath(const std::string &name) {
+  return ::testing::TempDir() + "/" + name;
+}
+
+// Write a trace with a record for each of the given cycles
+void WriteTrace(const std::string &path, const std::vector<unsigned> &cycles,
+                unsigned block_records) {
+  OtbnBinaryTraceWriter writer(path, block_records);
+  for (unsigned cycle : cycles) {
+    writer.Write(MakeRecord(cycle), cycle);
+  }
+  ASSERT_TRUE(writer.Close());
+}
+
+std::vector<unsigned> CycleRange(unsigned first, unsigned last) {
+  std::vector<unsigned> cycles;
+  for (unsigned cycle = first; cycle <= last; ++cycle) {
+    cycles.push_back(cycle);
+  }
+  return cycles;
+}
+
+std::vector<ReadRecord> ReadTrace(OtbnBinaryTraceReader *reader,
+                                  uint32_t first_cycle, uint32_t last_cycle,
+                                  const OtbnTraceFilter &filter) {
+  std::vector<ReadRecord> records;
+  reader->Read(first_cycle, last_cycle, filter,
+               [&](const OtbnTraceRecord &record, unsigned cycle_count) {
+                 records.emplace_back(cycle_count, record.ToString());
+                 return true;
+               });
+  return records;
+}
+
+std::vector<ReadRecord> Expected(const std::vector<unsigned> &cycles) {
+  std::vector<ReadRecord> records;
+  for (unsigned cycle : cycles) {
+    records.emplace_back(cycle, MakeRecord(cycle).ToString());
+  }
+  return records;
+}
+
+TEST(OtbnBinaryTraceTest, RoundTrip) {
+  const std::string path = TracePath("round_trip.otbntrc");
+  std::vector<unsigned> cycles = CycleRange(0, 999);
+  WriteTrace(path, cycles, 64);
+
+  OtbnBinaryTraceReader reader(path);
+  EXPECT_FALSE(reader.Recovered());
+  EXPECT_TRUE(reader.Monotonic());
+
+  // Check the index
+  const std::vector<OtbnBinaryTraceBlock> &blocks = reader.Blocks();
+  ASSERT_EQ(blocks.size(), 16u);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    EXPECT_EQ(blocks[i].first_cycle, 64 * i);
+    EXPECT_EQ(blocks[i].last_cycle, std::min<unsigned>(64 * i + 63, 999));
+    EXPECT_TRUE(blocks[i].HasLoc(OtbnTraceLoc::X0 + 1));
+    EXPECT_TRUE(blocks[i].HasLoc(OtbnTraceLoc::W0 + 2));
+    EXPECT_FALSE(blocks[i].HasLoc(OtbnTraceLoc::Acc));
+  }
+
+  EXPECT_EQ(ReadTrace(&reader, 0, UINT32_MAX, OtbnTraceFilter()),
+            Expected(cycles));
+}
+
+TEST(OtbnBinaryTraceTest, SeekThroughIndex) {
+  const std::string path = TracePath("seek.otbntrc");
+  WriteTrace(path, CycleRange(0, 999), 64);
+  OtbnBinaryTraceReader reader(path);
+
+  // A range that starts and ends in the middle of blocks
+  EXPECT_EQ(ReadTrace(&reader, 500, 700, OtbnTraceFilter()),
+            Expected(CycleRange(500, 700)));
+
+  // Exactly one block, then a single cycle
+  EXPECT_EQ(ReadTrace(&reader, 128, 191, OtbnTraceFilter()),
+            Expected(CycleRange(128, 191)));
+  EXPECT_EQ(ReadTrace(&reader, 999, 999, OtbnTraceFilter()),
+            Expected(CycleRange(999, 999)));
+
+  // Nothing past the end
+  EXPECT_TRUE(ReadTrace(&reader, 1000, 2000, OtbnTraceFilter()).empty());
+
+  // The visitor can stop early
+  unsigned seen = 0;
+  reader.Read(300, UINT32_MAX, OtbnTraceFilter(),
+              [&](const OtbnTraceRecord &, unsigned cycle_count) {
+                EXPECT_EQ(cycle_count, 300 + seen);
+                return ++seen < 5;
+              });
+  EXPECT_EQ(seen, 5u);
+}
+
+TEST(OtbnBinaryTraceTest, Filters) {
+  const std::string path = TracePath("filters.otbntrc");
+  WriteTrace(path, CycleRange(0, 999), 64);
+  OtbnBinaryTraceReader reader(path);
+
+  OtbnTraceFilter pc_filter;
+  pc_filter.match_pc = true;
+  pc_filter.pc_min = 40;
+  pc_filter.pc_max = 40;
+  std::vector<unsigned> pc_cycles;
+  for (unsigned cycle = 10; cycle < 1000; cycle += 100) {
+    pc_cycles.push_back(cycle);
+  }
+  EXPECT_EQ(ReadTrace(&reader, 0, UINT32_MAX, pc_filter),
+            Expected(pc_cycles));
+
+  OtbnTraceFilter loc_filter;
+  loc_filter.locs.push_back(OtbnTraceLoc::W0 + 2);
+  std::vector<unsigned> loc_cycles;
+  for (unsigned cycle = 0; cycle < 100; cycle += 3) {
+    loc_cycles.push_back(cycle);
+  }
+  EXPECT_EQ(ReadTrace(&reader, 0, 99, loc_filter), Expected(loc_cycles));
+
+  OtbnTraceFilter no_match;
+  no_match.locs.push_back(OtbnTraceLoc::Acc);
+  EXPECT_TRUE(ReadTrace(&reader, 0, UINT32_MAX, no_match).empty());
+}
+
+// If the simulation doesn't finish cleanly, there is no index or trailer
+TEST(OtbnBinaryTraceTest, RecoverWithoutIndex) {
+  const std::string path = TracePath("recover.otbntrc");
+  WriteTrace(path, CycleRange(0, 999), 64);
+
+  // Find where the index starts (the end of the last block) and cut the file
+  // there, then also cut off half of the last block.
+  uint64_t index_offset, last_block_offset;
+  {
+    OtbnBinaryTraceReader reader(path);
+    const OtbnBinaryTraceBlock &last = reader.Blocks().back();
+    last_block_offset = last.offset;
+    index_offset = last.offset + 48 + last.compressed_size;
+  }
+  std::string contents;
+  {
+    std::ifstream in(path, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+  }
+
+  const std::string cut_path = TracePath("recover_cut.otbntrc");
+  for (uint64_t size : {index_offset, (last_block_offset + index_offset) / 2}) {
+    {
+      std::ofstream out(cut_path, std::ios::binary | std::ios::trunc);
+      out.write(contents.data(), size);
+    }
+
+    OtbnBinaryTraceReader reader(cut_path);
+    EXPECT_TRUE(reader.Recovered());
+    bool whole = size == index_offset;
+    ASSERT_EQ(reader.Blocks().size(), whole ? 16u : 15u);
+    EXPECT_EQ(ReadTrace(&reader, 0, UINT32_MAX, OtbnTraceFilter()),
+              Expected(CycleRange(0, whole ? 999 : 959)));
+    EXPECT_EQ(ReadTrace(&reader, 900, 910, OtbnTraceFilter()),
+              Expected(CycleRange(900, 910)));
+  }
+}
+
+// The tracer's cycle count restarts when OTBN is reset, so a trace can hold
+// the same cycle counts more than once.
+TEST(OtbnBinaryTraceTest, CycleCountRestarts) {
+  const std::string path = TracePath("reset.otbntrc");
+  std::vector<unsigned> first_run = CycleRange(0, 99),
+                        second_run = CycleRange(0, 49);
+  std::vector<unsigned> cycles(first_run);
+  cycles.insert(cycles.end(), second_run.begin(), second_run.end());
+  WriteTrace(path, cycles, 64);
+
+  OtbnBinaryTraceReader reader(path);
+  EXPECT_FALSE(reader.Monotonic());
+  // The reset splits the second block: [0, 63], [64, 99], [0, 49]
+  ASSERT_EQ(reader.Blocks().size(), 3u);
+  for (const OtbnBinaryTraceBlock &block : reader.Blocks()) {
+    EXPECT_LE(block.first_cycle, block.last_cycle);
+  }
+
+  EXPECT_EQ(ReadTrace(&reader, 0, UINT32_MAX, OtbnTraceFilter()),
+            Expected(cycles));
+
+  // A range of cycles gives the matching records from both runs, in order
+  std::vector<unsigned> expected = CycleRange(40, 70);
+  std::vector<unsigned> from_second = CycleRange(40, 49);
+  expected.insert(expected.end(), from_second.begin(), from_second.end());
+  EXPECT_EQ(ReadTrace(&reader, 40, 70, OtbnTraceFilter()), Expected(expected));
+
+  EXPECT_EQ(ReadTrace(&reader, 80, 90, OtbnTraceFilter()),
+            Expected(CycleRange(80, 90)));
+}
+
+}  // namespace
+}  // namespace otbn_binary_trace_unittest
@@ -0,0 +1,383 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "otbn_profile_listener.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+
+// Calls nested more deeply than this are treated as jumps. Real OTBN code has
+// an 8-entry call stack, so this only matters if the code uses JAL x1 for
+// something other than a call.
+static const unsigned kMaxDepth = 256;
+
+static bool is_loop(uint32_t insn) {
+  // LOOP and LOOPI share an opcode and differ in funct3
+  return (insn & 0x707f) == 0x7b || (insn & 0x707f) == 0x107b;
+}
+
+static unsigned insn_rd(uint32_t insn) { return (insn >> 7) & 0x1f; }
+static unsigned insn_rs1(uint32_t insn) { return (insn >> 15) & 0x1f; }
+static bool is_jal(uint32_t insn) { return (insn & 0x7f) == 0x6f; }
+static bool is_jalr(uint32_t insn) { return (insn & 0x707f) == 0x67; }
+
+// A JAL or JALR that writes the return address to x1
+static bool is_call(uint32_t insn) {
+  return (is_jal(insn) || is_jalr(insn)) && insn_rd(insn) == 1;
+}
+
+// A JALR through x1 that doesn't link (the "ret" pseudo-instruction)
+static bool is_return(uint32_t insn) {
+  return is_jalr(insn) && insn_rd(insn) == 0 && insn_rs1(insn) == 1;
+}
+
+static bool reads_rnd(const OtbnTraceRecord &record) {
+  for (const OtbnTraceLine &line : record.lines) {
+    if (line.type == '<' && line.loc == OtbnTraceLoc::Rnd) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+  return total ? 100.0 * part / total : 0.0;
+}
+
+OtbnProfileListener::OtbnProfileListener(const SymbolTable *symbols)
+    : symbol_table_(symbols),
+      symbols_loaded_(false),
+      unknown_symbol_(-1),
+      wipe_symbol_(-1),
+      last_lo_(1),
+      last_hi_(0),
+      last_symbol_(-1),
+      cur_node_(0),
+      pending_(kPendingNone),
+      insn_stall_cycles_(0),
+      have_prev_cycle_(false),
+      prev_cycle_(0),
+      total_cycles_(0) {
+  nodes_.push_back(Node{-1, -1, 0, 0, 0, {}});
+}
+
+void OtbnProfileListener::LoadSymbols() {
+  if (symbol_table_) {
+    for (const auto &sym : *symbol_table_) {
+      symbol_addrs_.push_back(sym.first);
+      symbol_names_.push_back(sym.second);
+    }
+  }
+
+  unknown_symbol_ = symbol_names_.size();
+  symbol_names_.push_back("[unknown]");
+  wipe_symbol_ = symbol_names_.size();
+  symbol_names_.push_back("[secure wipe]");
+
+  stats_.resize(symbol_names_.size(), SymbolStats{0, 0, 0, 0, 0});
+  symbols_loaded_ = true;
+}
+
+int OtbnProfileListener::SymbolAt(uint32_t pc) {
+  // Consecutive instructions are almost always in the same symbol, so check
+  // the range of the last one before searching.
+  if (last_lo_ <= pc && pc <= last_hi_) {
+    return last_symbol_;
+  }
+
+  auto it = std::upper_bound(symbol_addrs_.begin(), symbol_addrs_.end(), pc);
+  if (it == symbol_addrs_.begin()) {
+    last_lo_ = 0;
+    last_hi_ = symbol_addrs_.empty() ? UINT32_MAX : symbol_addrs_[0] - 1;
+    last_symbol_ = unknown_symbol_;
+  } else {
+    last_lo_ = *(it - 1);
+    last_hi_ = it == symbol_addrs_.end() ? UINT32_MAX : *it - 1;
+    last_symbol_ = it - symbol_addrs_.begin() - 1;
+  }
+  return last_symbol_;
+}
+
+int OtbnProfileListener::Child(int node, int symbol) {
+  auto it = nodes_[node].children.find(symbol);
+  if (it != nodes_[node].children.end()) {
+    return it->second;
+  }
+
+  int child = nodes_.size();
+  nodes_.push_back(Node{symbol, node, nodes_[node].depth + 1, 0, 0, {}});
+  nodes_[node].children[symbol] = child;
+  return child;
+}
+
+void OtbnProfileListener::AcceptTraceRecord(const OtbnTraceRecord &record,
+                                            unsigned int cycle_count) {
+  if (!symbols_loaded_) {
+    LoadSymbols();
+  }
+
+  // Each record covers the cycles since the previous one. There are no
+  // records while OTBN is idle, so the first record of a run is one cycle.
+  uint64_t cycles = 1;
+  if (have_prev_cycle_ && cycle_count > prev_cycle_) {
+    cycles = cycle_count - prev_cycle_;
+  }
+  have_prev_cycle_ = true;
+  prev_cycle_ = cycle_count;
+  total_cycles_ += cycles;
+
+  bool has_pc =
+      record.insn_kind && (record.insn_flags & OtbnTraceRecord::kHasPc);
+  bool insn_known =
+      has_pc && (record.insn_flags & OtbnTraceRecord::kInsnKnown);
+
+  if (!has_pc) {
+    int symbol = record.wipe_kind ? wipe_symbol_ : unknown_symbol_;
+    int node = Child(0, symbol);
+    stats_[symbol].cycles += cycles;
+    nodes_[node].self_cycles += cycles;
+
+    if (record.wipe_kind == 'V') {
+      // The end of a run: the next one starts with an empty call stack. Count
+      // the wipe as a call, so the call graph shows how many there were.
+      ++nodes_[node].calls;
+      cur_node_ = 0;
+      pending_ = kPendingNone;
+      insn_stall_cycles_ = 0;
+      have_prev_cycle_ = false;
+    }
+    return;
+  }
+
+  int symbol = SymbolAt(record.pc);
+
+  // Apply a call or return from the previous instruction, now that we know
+  // where it went.
+  if (cur_node_ == 0) {
+    cur_node_ = Child(0, symbol);
+    ++nodes_[cur_node_].calls;
+  } else if (pending_ == kPendingCall && nodes_[cur_node_].depth < kMaxDepth) {
+    cur_node_ = Child(cur_node_, symbol);
+    ++nodes_[cur_node_].calls;
+  } else if (pending_ == kPendingReturn) {
+    cur_node_ = nodes_[cur_node_].parent;
+    if (cur_node_ == 0) {
+      // A return from the function that started the run (or from a function
+      // that we didn't see being called). Start again from the top.
+      cur_node_ = Child(0, symbol);
+      ++nodes_[cur_node_].calls;
+    }
+  }
+  pending_ = kPendingNone;
+
+  SymbolStats &stats = stats_[symbol];
+  stats.cycles += cycles;
+  nodes_[cur_node_].self_cycles += cycles;
+
+  if (insn_known && is_loop(record.insn)) {
+    stats.loop_cycles += cycles;
+  }
+
+  if (record.insn_kind == 'S') {
+    stats.stall_cycles += cycles;
+    insn_stall_cycles_ += cycles;
+    return;
+  }
+
+  // The instruction completed. If it read RND, its stalls were spent waiting
+  // for random data.
+  ++stats.insns;
+  if (insn_stall_cycles_ && reads_rnd(record)) {
+    stats.rnd_cycles += insn_stall_cycles_;
+  }
+  insn_stall_cycles_ = 0;
+
+  if (insn_known) {
+    if (is_call(record.insn)) {
+      pending_ = kPendingCall;
+    } else if (is_return(record.insn)) {
+      pending_ = kPendingReturn;
+    }
+  }
+}
+
+std::vector<uint64_t> OtbnProfileListener::SubtreeCycles() const {
+  // Children always come after their parents in nodes_, so walking backwards
+  // visits every child before its parent.
+  std::vector<uint64_t> subtree(nodes_.size());
+  for (size_t i = nodes_.size(); i-- > 0;) {
+    subtree[i] += nodes_[i].self_cycles;
+    if (nodes_[i].parent >= 0) {
+      subtree[nodes_[i].parent] += subtree[i];
+    }
+  }
+  return subtree;
+}
+
+std::vector<uint64_t> OtbnProfileListener::InclusiveCycles(
+    const std::vector<uint64_t> &subtree) const {
+  // Add up the subtrees of the outermost node for each symbol on each path, so
+  // that a recursive call isn't counted twice.
+  std::vector<uint64_t> inclusive(symbol_names_.size());
+  for (size_t i = 1; i < nodes_.size(); ++i) {
+    bool outermost = true;
+    for (int p = nodes_[i].parent; p > 0; p = nodes_[p].parent) {
+      if (nodes_[p].symbol == nodes_[i].symbol) {
+        outermost = false;
+        break;
+      }
+    }
+    if (outermost) {
+      inclusive[nodes_[i].symbol] += subtree[i];
+    }
+  }
+  return inclusive;
+}
+
+void OtbnProfileListener::WriteFlatProfile(std::ostream &os) const {
+  std::vector<uint64_t> inclusive = InclusiveCycles(SubtreeCycles());
+
+  // Only symbols that were called have an inclusive count
+  std::vector<bool> called(symbol_names_.size());
+  for (size_t i = 1; i < nodes_.size(); ++i) {
+    called[nodes_[i].symbol] = true;
+  }
+
+  std::vector<int> order;
+  for (size_t i = 0; i < stats_.size(); ++i) {
+    if (stats_[i].cycles || inclusive[i]) {
+      order.push_back(i);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+    return stats_[a].cycles > stats_[b].cycles;
+  });
+
+  os << "Flat profile (" << total_cycles_ << " cycles)\n\n"
+     << "    self  self%  cumul%   inclusive     insns    stalls  rnd wait"
+        "  loop ovh  symbol\n";
+  uint64_t cumulative = 0;
+  for (int i : order) {
+    const SymbolStats &stats = stats_[i];
+    cumulative += stats.cycles;
+    os << std::fixed << std::setprecision(2) << std::setw(8) << stats.cycles
+       << " " << std::setw(6) << percent(stats.cycles, total_cycles_) << " "
+       << std::setw(7) << percent(cumulative, total_cycles_) << " "
+       << std::setw(11);
+    if (called[i]) {
+      os << inclusive[i];
+    } else {
+      os << "-";
+    }
+    os << " " << std::setw(9) << stats.insns
+       << " " << std::setw(9) << stats.stall_cycles << " " << std::setw(9)
+       << stats.rnd_cycles << " " << std::setw(9) << stats.loop_cycles << "  "
+       << symbol_names_[i] << "\n";
+  }
+}
+
+void OtbnProfileListener::WriteCallGraph(std::ostream &os) const {
+  std::vector<uint64_t> subtree = SubtreeCycles();
+  std::vector<uint64_t> inclusive = InclusiveCycles(subtree);
+
+  // Collect the calls between pairs of symbols. A caller of -1 means the call
+  // came from the top level.
+  struct Edge {
+    uint64_t calls;
+    uint64_t cycles;
+  };
+  std::map<std::pair<int, int>, Edge> edges;
+  std::vector<uint64_t> self(symbol_names_.size());
+  std::vector<uint64_t> calls(symbol_names_.size());
+  std::set<int> functions;
+  for (size_t i = 1; i < nodes_.size(); ++i) {
+    const Node &node = nodes_[i];
+    Edge &edge = edges[std::make_pair(nodes_[node.parent].symbol, node.symbol)];
+    edge.calls += node.calls;
+    edge.cycles += subtree[i];
+    self[node.symbol] += node.self_cycles;
+    calls[node.symbol] += node.calls;
+    functions.insert(node.symbol);
+  }
+
+  std::vector<int> order(functions.begin(), functions.end());
+  std::stable_sort(order.begin(), order.end(), [&inclusive](int a, int b) {
+    return inclusive[a] > inclusive[b];
+  });
+
+  os << "Call graph (" << total_cycles_ << " cycles)\n\n"
+     << "For each function, the callers are listed above it and its callees "
+        "below it,\nwith the number of calls along that edge and the cycles "
+        "spent in them.\n\n"
+     << "  inclusive    self     calls  function\n";
+  for (int sym : order) {
+    os << "------------------------------------------------------------\n";
+    for (const auto &edge : edges) {
+      if (edge.first.second == sym) {
+        int caller = edge.first.first;
+        os << std::setw(11) << edge.second.cycles << "         "
+           << std::setw(9) << edge.second.calls << "      "
+           << (caller < 0 ? "<top level>" : symbol_names_[caller]) << "\n";
+      }
+    }
+    os << std::setw(11) << inclusive[sym] << " " << std::setw(7) << self[sym]
+       << " " << std::setw(9) << calls[sym] << "  " << symbol_names_[sym]
+       << " (" << std::fixed << std::setprecision(2)
+       << percent(inclusive[sym], total_cycles_) << "%)\n";
+    for (const auto &edge : edges) {
+      if (edge.first.first == sym) {
+        os << std::setw(11) << edge.second.cycles << "         "
+           << std::setw(9) << edge.second.calls << "      "
+           << symbol_names_[edge.first.second] << "\n";
+      }
+    }
+  }
+}
+
+void OtbnProfileListener::WriteFoldedStacks(std::ostream &os) const {
+  for (size_t i = 1; i < nodes_.size(); ++i) {
+    if (!nodes_[i].self_cycles) {
+      continue;
+    }
+
+    std::vector<int> stack;
+    for (int n = i; n > 0; n = nodes_[n].parent) {
+      stack.push_back(nodes_[n].symbol);
+    }
+    for (size_t j = stack.size(); j-- > 0;) {
+      os << symbol_names_[stack[j]] << (j ? ";" : " ");
+    }
+    os << nodes_[i].self_cycles << "\n";
+  }
+}
+
+bool OtbnProfileListener::WriteReports(const std::string &prefix) const {
+  struct Report {
+    const char *suffix;
+    void (OtbnProfileListener::*write)(std::ostream &) const;
+  };
+  const Report reports[] = {
+      {".flat", &OtbnProfileListener::WriteFlatProfile},
+      {".callgraph", &OtbnProfileListener::WriteCallGraph},
+      {".folded", &OtbnProfileListener::WriteFoldedStacks}};
+
+  bool ok = true;
+  for (const Report &report : reports) {
+    std::string filename = prefix + report.suffix;
+    std::ofstream file(filename);
+    if (file.is_open()) {
+      (this->*report.write)(file);
+      file.close();
+    }
+    if (!file) {
+      std::cerr << "ERROR: Could not write OTBN profile to " << filename
+                << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,149 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_PROFILE_LISTENER_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_PROFILE_LISTENER_H_
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "otbn_trace_listener.h"
+
+/**
+ * An OtbnTraceListener that builds a cycle-accurate profile of the code that
+ * OTBN runs, from the RTL trace.
+ *
+ * Every cycle with a trace record is attributed to the symbol that contains
+ * the instruction's PC (the nearest code symbol at or below it). The cycles
+ * for an instruction are split into:
+ *
+ * - Stall cycles, with the subset of those that were spent waiting for RND
+ *   (stalls of an instruction that goes on to read RND)
+ *
+ * - Loop cycles, spent on LOOP and LOOPI instructions. OTBN's hardware loops
+ *   have no other per-iteration cost, so these are the loop overhead.
+ *
+ * Cycles in secure wipes are attributed to a "[secure wipe]" entry.
+ *
+ * The listener also keeps a shadow call stack, following OTBN's calling
+ * convention: a JAL or JALR that writes x1 is a call, and a JALR through x1
+ * that writes x0 is a return. This gives a calling context tree, from which it
+ * builds a call graph and "folded" stacks, which can be passed to
+ * flamegraph.pl.
+ */
+class OtbnProfileListener : public OtbnTraceListener {
+ public:
+  typedef std::map<uint32_t, std::string> SymbolTable;
+
+  /**
+   * Constructor
+   *
+   * @param symbols The code symbols of the program (address to name), which
+   *                are read when the first record arrives, so they can be
+   *                loaded after the listener is set up. If this is null or
+   *                empty, everything is attributed to "[unknown]".
+   */
+  explicit OtbnProfileListener(const SymbolTable *symbols);
+
+  void AcceptTraceRecord(const OtbnTraceRecord &record,
+                         unsigned int cycle_count) override;
+
+  /**
+   * Write a flat profile, with a line for each symbol, sorted by the number of
+   * cycles attributed to it
+   */
+  void WriteFlatProfile(std::ostream &os) const;
+
+  /**
+   * Write a call graph profile, with an entry for each function (each symbol
+   * that was called), sorted by the number of cycles spent in it and its
+   * callees
+   */
+  void WriteCallGraph(std::ostream &os) const;
+
+  /**
+   * Write the folded stacks: one line per call stack that was seen, of the
+   * form "outer;inner;innermost CYCLES"
+   */
+  void WriteFoldedStacks(std::ostream &os) const;
+
+  /**
+   * Write all three reports to PREFIX.flat, PREFIX.callgraph and
+   * PREFIX.folded. On failure, prints a message to stderr and returns false.
+   */
+  bool WriteReports(const std::string &prefix) const;
+
+ private:
+  // Per-symbol counts for the flat profile
+  struct SymbolStats {
+    uint64_t cycles;
+    uint64_t insns;
+    uint64_t stall_cycles;
+    uint64_t rnd_cycles;
+    uint64_t loop_cycles;
+  };
+
+  // A node in the calling context tree. The root node has symbol -1.
+  struct Node {
+    int symbol;
+    int parent;
+    // Number of calls between the root and this node
+    unsigned depth;
+    // Number of times the node was entered
+    uint64_t calls;
+    // Cycles spent in the node itself, not counting its children
+    uint64_t self_cycles;
+    std::map<int, int> children;
+  };
+
+  enum PendingCall { kPendingNone, kPendingCall, kPendingReturn };
+
+  // Build the symbol table on the first record
+  void LoadSymbols();
+
+  // Get the symbol that contains pc
+  int SymbolAt(uint32_t pc);
+
+  // Get the child of a node for a symbol, creating it if necessary
+  int Child(int node, int symbol);
+
+  // The total cycles of each node and its descendents, indexed by node
+  std::vector<uint64_t> SubtreeCycles() const;
+
+  // The cycles spent in each symbol and its callees (not counting recursive
+  // calls twice), indexed by symbol
+  std::vector<uint64_t> InclusiveCycles(
+      const std::vector<uint64_t> &subtree) const;
+
+  const SymbolTable *symbol_table_;
+  bool symbols_loaded_;
+  std::vector<uint32_t> symbol_addrs_;
+  std::vector<std::string> symbol_names_;
+  int unknown_symbol_;
+  int wipe_symbol_;
+
+  // The range of PCs in the last lookup and its result
+  uint32_t last_lo_, last_hi_;
+  int last_symbol_;
+
+  std::vector<SymbolStats> stats_;
+  std::vector<Node> nodes_;
+
+  // The current node in the calling context tree
+  int cur_node_;
+  // A call or return that takes effect on the next instruction
+  PendingCall pending_;
+  // Stall cycles so far for the current instruction
+  uint64_t insn_stall_cycles_;
+
+  bool have_prev_cycle_;
+  unsigned prev_cycle_;
+
+  uint64_t total_cycles_;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_PROFILE_LISTENER_H_
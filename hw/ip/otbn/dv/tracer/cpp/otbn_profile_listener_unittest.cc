@@ -0,0 +1,171 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "hw/ip/otbn/dv/tracer/cpp/otbn_profile_listener.h"
+
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace otbn_profile_listener_unittest {
+namespace {
+
+// Instruction encodings that the profiler picks out, and one it doesn't
+const uint32_t kAddi = 0x00000013;  // addi x0, x0, 0
+const uint32_t kCall = 0x000000ef;  // jal x1, 0
+const uint32_t kRet = 0x00008067;   // jalr x0, 0(x1)
+const uint32_t kLoopi = 0x0000107b;
+
+// A row of the flat profile
+struct FlatRow {
+  uint64_t self;
+  std::string inclusive;
+  uint64_t insns, stalls, rnd_wait, loop_ovh;
+};
+
+// Parse the flat profile into rows, indexed by symbol name
+std::map<std::string, FlatRow> ParseFlatProfile(
+    const OtbnProfileListener &profile) {
+  std::ostringstream oss;
+  profile.WriteFlatProfile(oss);
+
+  std::map<std::string, FlatRow> rows;
+  std::istringstream iss(oss.str());
+  std::string line;
+  // Skip the title, blank line and column headings
+  for (int i = 0; i < 3; ++i) {
+    std::getline(iss, line);
+  }
+  while (std::getline(iss, line)) {
+    std::istringstream fields(line);
+    FlatRow row;
+    double self_pct, cumul_pct;
+    fields >> row.self >> self_pct >> cumul_pct >> row.inclusive >> row.insns >>
+        row.stalls >> row.rnd_wait >> row.loop_ovh;
+    std::string symbol;
+    std::getline(fields >> std::ws, symbol);
+    EXPECT_FALSE(symbol.empty()) << line;
+    rows[symbol] = row;
+  }
+  return rows;
+}
+
+class OtbnProfileListenerTest : public ::testing::Test {
+ protected:
+  OtbnProfileListenerTest()
+      : symbols_{{0x0, "main"}, {0x100, "func"}}, profile_(&symbols_) {}
+
+  // Pass an instruction record to the profiler
+  void Insn(unsigned cycle, char kind, uint32_t pc, uint32_t insn,
+            bool reads_rnd = false) {
+    OtbnTraceRecord record;
+    record.insn_kind = kind;
+    record.insn_flags = OtbnTraceRecord::kHasPc | OtbnTraceRecord::kInsnKnown;
+    record.pc = pc;
+    record.insn = insn;
+    if (reads_rnd) {
+      OtbnTraceLine rnd_line;
+      rnd_line.type = '<';
+      rnd_line.flags = 0;
+      rnd_line.loc = OtbnTraceLoc::Rnd;
+      rnd_line.addr = 0;
+      uint32_t words[8] = {0};
+      rnd_line.value.Set(8, words);
+      rnd_line.mask.Set(1, words);
+      record.lines.push_back(rnd_line);
+    }
+    profile_.AcceptTraceRecord(record, cycle);
+  }
+
+  // Pass a completed secure wipe to the profiler, ending the run
+  void EndOfRun(unsigned cycle) {
+    OtbnTraceRecord record;
+    record.wipe_kind = 'V';
+    profile_.AcceptTraceRecord(record, cycle);
+  }
+
+  // main calls func, which waits for RND, runs a loop and returns
+  void RunProgram() {
+    Insn(1, 'E', 0x0, kAddi);
+    Insn(2, 'E', 0x4, kCall);
+    Insn(3, 'S', 0x100, kAddi);
+    Insn(4, 'S', 0x100, kAddi);
+    Insn(5, 'E', 0x100, kAddi, true);
+    Insn(6, 'E', 0x104, kLoopi);
+    Insn(7, 'E', 0x108, kRet);
+    // A stall that doesn't end in a read of RND
+    Insn(8, 'S', 0x8, kAddi);
+    Insn(9, 'E', 0x8, kAddi);
+    // A record two cycles after the last one counts for both
+    Insn(11, 'E', 0xc, kAddi);
+    EndOfRun(12);
+  }
+
+  OtbnProfileListener::SymbolTable symbols_;
+  OtbnProfileListener profile_;
+};
+
+TEST_F(OtbnProfileListenerTest, FlatProfileAttributesCycles) {
+  RunProgram();
+  std::map<std::string, FlatRow> rows = ParseFlatProfile(profile_);
+  ASSERT_EQ(rows.size(), 3u);
+
+  const FlatRow &main = rows["main"];
+  EXPECT_EQ(main.self, 6u);
+  EXPECT_EQ(main.inclusive, "11");
+  EXPECT_EQ(main.insns, 4u);
+  EXPECT_EQ(main.stalls, 1u);
+  EXPECT_EQ(main.rnd_wait, 0u);
+  EXPECT_EQ(main.loop_ovh, 0u);
+
+  const FlatRow &func = rows["func"];
+  EXPECT_EQ(func.self, 5u);
+  EXPECT_EQ(func.inclusive, "5");
+  EXPECT_EQ(func.insns, 3u);
+  EXPECT_EQ(func.stalls, 2u);
+  EXPECT_EQ(func.rnd_wait, 2u);
+  EXPECT_EQ(func.loop_ovh, 1u);
+
+  const FlatRow &wipe = rows["[secure wipe]"];
+  EXPECT_EQ(wipe.self, 1u);
+  EXPECT_EQ(wipe.insns, 0u);
+}
+
+TEST_F(OtbnProfileListenerTest, FoldedStacksFollowCallsAndReturns) {
+  RunProgram();
+  std::ostringstream oss;
+  profile_.WriteFoldedStacks(oss);
+  EXPECT_EQ(oss.str(),
+            "main 6\n"
+            "main;func 5\n"
+            "[secure wipe] 1\n");
+}
+
+TEST_F(OtbnProfileListenerTest, EachRunStartsWithAnEmptyStack) {
+  RunProgram();
+  // The second run starts at a cycle count below the end of the first, and
+  // in the middle of func (e.g. after a jump rather than a call).
+  Insn(3, 'E', 0x104, kAddi);
+  Insn(4, 'E', 0x108, kRet);
+  Insn(5, 'E', 0x0, kAddi);
+  EndOfRun(6);
+
+  std::ostringstream oss;
+  profile_.WriteFoldedStacks(oss);
+  EXPECT_EQ(oss.str(),
+            "main 7\n"
+            "main;func 5\n"
+            "[secure wipe] 2\n"
+            "func 2\n");
+
+  std::map<std::string, FlatRow> rows = ParseFlatProfile(profile_);
+  EXPECT_EQ(rows["main"].self, 7u);
+  EXPECT_EQ(rows["func"].self, 7u);
+  EXPECT_EQ(rows["func"].inclusive, "7");
+}
+
+}  // namespace
+}  // namespace otbn_profile_listener_unittest
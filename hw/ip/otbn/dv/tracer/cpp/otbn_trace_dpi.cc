@@ -0,0 +1,125 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <cassert>
+#include <cstdint>
+#include <svdpi.h>
+
+#include "otbn_trace_source.h"
+
+// Read a value from a logic vector of num_words words that was passed over
+// DPI. X and Z bits are unknown.
+static void read_logic_value(const svLogicVecVal *src, unsigned num_words,
+                             OtbnTraceValue *dst) {
+  assert(src && num_words <= OtbnTraceValue::kMaxWords);
+  dst->num_words = num_words;
+  for (unsigned i = 0; i < num_words; ++i) {
+    dst->unknown[i] = src[i].bval;
+    // X is encoded as aval = bval = 1 and Z as aval = 0, bval = 1. Clear the
+    // unknown bits, so that they don't depend on which one we saw.
+    dst->words[i] = src[i].aval & ~src[i].bval;
+  }
+}
+
+// Append a body line to the current record and return it
+static OtbnTraceLine &add_line(unsigned char type, uint16_t loc,
+                               uint32_t addr) {
+  OtbnTraceLine line;
+  line.type = type;
+  line.flags = 0;
+  line.loc = loc;
+  line.addr = addr;
+  return OtbnTraceSource::get().CurrentRecord().lines.push_back(line);
+}
+
+// The DPI functions that are called by otbn_tracer.sv. The sizes of the
+// arguments must match the imports there.
+
+extern "C" void otbn_trace_insn(unsigned char kind, const svBitVecVal *pc,
+                                const svBitVecVal *insn,
+                                unsigned char insn_known) {
+  OtbnTraceRecord &record = OtbnTraceSource::get().CurrentRecord();
+  record.insn_kind = kind;
+  record.insn_flags = OtbnTraceRecord::kHasPc;
+  if (insn_known)
+    record.insn_flags |= OtbnTraceRecord::kInsnKnown;
+  record.pc = pc[0];
+  record.insn = insn_known ? insn[0] : 0;
+}
+
+extern "C" void otbn_trace_wipe(unsigned char kind) {
+  OtbnTraceSource::get().CurrentRecord().wipe_kind = kind;
+}
+
+extern "C" void otbn_trace_gpr(unsigned char type, unsigned char is_wide,
+                               unsigned idx, const svLogicVecVal *value) {
+  assert(idx < 32);
+  uint16_t loc = (is_wide ? OtbnTraceLoc::W0 : OtbnTraceLoc::X0) + idx;
+  read_logic_value(value, is_wide ? OtbnTraceValue::kMaxWords : 1,
+                   &add_line(type, loc, 0).value);
+}
+
+extern "C" void otbn_trace_ispr(unsigned char type, unsigned ispr,
+                                const svLogicVecVal *value) {
+  read_logic_value(value, OtbnTraceValue::kMaxWords,
+                   &add_line(type, OtbnTraceLoc::FromIspr(ispr), 0).value);
+}
+
+extern "C" void otbn_trace_flags(unsigned char type, unsigned group,
+                                 const svLogicVecVal *flags) {
+  assert(group < 2);
+  OtbnTraceValue &value = add_line(type, OtbnTraceLoc::Flags0 + group, 0).value;
+  read_logic_value(flags, 1, &value);
+  value.words[0] &= 0xf;
+  value.unknown[0] &= 0xf;
+}
+
+extern "C" void otbn_trace_dmem(unsigned char type, const svBitVecVal *addr,
+                                const svLogicVecVal *data,
+                                const svLogicVecVal *mask) {
+  OtbnTraceValue data_value;
+  read_logic_value(data, OtbnTraceValue::kMaxWords, &data_value);
+
+  // Reads and full-width writes show all of the data.
+  bool full_width = true;
+  if (type == 'W') {
+    OtbnTraceValue mask_value;
+    read_logic_value(mask, OtbnTraceValue::kMaxWords, &mask_value);
+    for (unsigned i = 0; i < OtbnTraceValue::kMaxWords; ++i) {
+      full_width &= mask_value.words[i] == UINT32_MAX;
+    }
+
+    if (!full_width) {
+      // A write to a single 32-bit chunk shows just that chunk, with the
+      // address of the chunk.
+      for (unsigned i = 0; i < OtbnTraceValue::kMaxWords; ++i) {
+        bool just_chunk = true;
+        for (unsigned j = 0; j < OtbnTraceValue::kMaxWords; ++j) {
+          uint32_t expected = i == j ? UINT32_MAX : 0;
+          just_chunk &= mask_value.words[j] == expected;
+        }
+        if (just_chunk) {
+          OtbnTraceLine &line =
+              add_line(type, OtbnTraceLoc::Mem, addr[0] + 4 * i);
+          line.value.Set(1, &data_value.words[i]);
+          line.value.unknown[0] = data_value.unknown[i];
+          return;
+        }
+      }
+
+      // Otherwise, the mask is bad. Show all of the data and the mask.
+      OtbnTraceLine &line = add_line(type, OtbnTraceLoc::Mem, addr[0]);
+      line.flags = OtbnTraceLine::kMaskErr;
+      line.value = data_value;
+      line.mask = mask_value;
+      return;
+    }
+  }
+
+  add_line(type, OtbnTraceLoc::Mem, addr[0]).value = data_value;
+}
+
+extern "C" void otbn_trace_end(unsigned cycle_count) {
+  OtbnTraceSource::get().Broadcast(cycle_count);
+}
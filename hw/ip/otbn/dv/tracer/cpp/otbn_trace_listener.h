@@ -9,10 +9,20 @@
 #include <string>
 #include <vector>
 
+#include "otbn_trace_record.h"
+
 /**
  * Base class for anything that wants to examine trace output from OTBN. The
- * simulation that hosts the tracer is responsible for setting up listeners and
- * routing the DPI `accept_otbn_trace_string` calls to them.
+ * simulation that hosts the tracer is responsible for setting up listeners
+ * with OtbnTraceSource, which passes them the records built up by the DPI
+ * calls from the tracer.
+ *
+ * A listener can take each record in its structured form (by overriding
+ * AcceptTraceRecord) or as text (by overriding AcceptTraceString).
+ *
+ * A listener that is added with OtbnTraceSource::AddBackgroundListener is
+ * called on a thread of its own rather than the simulation thread, so it
+ * shouldn't touch the simulation.
  */
 class OtbnTraceListener {
  public:
@@ -36,13 +46,29 @@ class OtbnTraceListener {
   }
 
   /**
-   * Called to process an OTBN trace output, called a maximum of once per cycle
+   * Called to process an OTBN trace record, called a maximum of once per
+   * cycle. The record is only valid until this returns.
+   *
+   * The default implementation formats the record as text and passes it to
+   * AcceptTraceString.
+   *
+   * @param record Trace record from OTBN
+   * @param cycle_count The cycle count associated with the trace record
+   */
+  virtual void AcceptTraceRecord(const OtbnTraceRecord &record,
+                                 unsigned int cycle_count) {
+    AcceptTraceString(record.ToString(), cycle_count);
+  }
+
+  /**
+   * Called to process an OTBN trace output in the text format, called a
+   * maximum of once per cycle
    *
    * @param trace Trace output from OTBN
    * @param cycle_count The cycle count associated with the trace output
    */
-  virtual void AcceptTraceString(const std::string &trace,
-                                 unsigned int cycle_count) = 0;
+  virtual void AcceptTraceString(const std::string & /* trace */,
+                                 unsigned int /* cycle_count */) {}
   virtual ~OtbnTraceListener() {}
 };
 
@@ -0,0 +1,465 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "otbn_trace_record.h"
+
+#include <deque>
+#include <map>
+#include <mutex>
+
+static const char kHexDigits[] = "0123456789abcdef";
+
+// The names of the locations with fixed IDs, from OtbnTraceLoc::Mod onwards
+static const char *const kFixedLocNames[] = {
+    "MOD", "RND", "ACC", "URND", "FLAGS0", "FLAGS1", "UNKNOWN_ISPR", "MEM"};
+
+// The table of interned location names. Records can be formatted by
+// listeners on their own threads (see OtbnTraceSource::AddBackgroundListener),
+// so the names that are added after construction are protected by a mutex.
+// The fixed names never change, so looking them up doesn't need the lock.
+struct TraceLocTable {
+  std::vector<std::string> fixed_names;
+  // A deque, so that references to names stay valid as more are added
+  std::deque<std::string> names;
+  std::map<std::string, uint16_t> ids;
+  std::mutex mutex;
+
+  TraceLocTable() {
+    for (int i = 0; i < 32; ++i) {
+      AddFixed(std::string("x") + kHexDigits[i / 10] + kHexDigits[i % 10]);
+    }
+    for (int i = 0; i < 32; ++i) {
+      AddFixed(std::string("w") + kHexDigits[i / 10] + kHexDigits[i % 10]);
+    }
+    for (const char *name : kFixedLocNames) {
+      AddFixed(name);
+    }
+    assert(fixed_names.size() == OtbnTraceLoc::NumFixed);
+  }
+
+  void AddFixed(const std::string &name) {
+    ids[name] = fixed_names.size();
+    fixed_names.push_back(name);
+  }
+};
+
+static TraceLocTable &loc_table() {
+  static TraceLocTable table;
+  return table;
+}
+
+uint16_t OtbnTraceLoc::Intern(const std::string &name) {
+  TraceLocTable &table = loc_table();
+  std::lock_guard<std::mutex> lock(table.mutex);
+  auto it = table.ids.find(name);
+  if (it != table.ids.end())
+    return it->second;
+
+  assert(NumFixed + table.names.size() < UINT16_MAX);
+  uint16_t id = NumFixed + table.names.size();
+  table.names.push_back(name);
+  table.ids[name] = id;
+  return id;
+}
+
+const std::string &OtbnTraceLoc::Name(uint16_t loc) {
+  TraceLocTable &table = loc_table();
+  if (loc < NumFixed)
+    return table.fixed_names[loc];
+
+  std::lock_guard<std::mutex> lock(table.mutex);
+  assert((size_t)(loc - NumFixed) < table.names.size());
+  return table.names[loc - NumFixed];
+}
+
+uint16_t OtbnTraceLoc::FromIspr(unsigned ispr) {
+  // This matches the order of otbn_pkg::ispr_e. IsprFlags (3) is traced
+  // separately, per flag group.
+  switch (ispr) {
+    case 0:
+      return Mod;
+    case 1:
+      return Rnd;
+    case 2:
+      return Acc;
+    case 4:
+      return Urnd;
+    default:
+      return UnknownIspr;
+  }
+}
+
+void OtbnTraceValue::Set(unsigned n, const uint32_t *src) {
+  assert(0 < n && n <= kMaxWords);
+  num_words = n;
+  for (unsigned i = 0; i < n; ++i) {
+    words[i] = src[i];
+    unknown[i] = 0;
+  }
+}
+
+bool OtbnTraceValue::Matches(const OtbnTraceValue &other) const {
+  if (num_words != other.num_words)
+    return false;
+
+  for (unsigned i = 0; i < num_words; ++i) {
+    uint32_t known = ~(unknown[i] | other.unknown[i]);
+    if ((words[i] ^ other.words[i]) & known)
+      return false;
+  }
+  return true;
+}
+
+bool OtbnTraceValue::operator==(const OtbnTraceValue &other) const {
+  if (num_words != other.num_words)
+    return false;
+
+  for (unsigned i = 0; i < num_words; ++i) {
+    if (words[i] != other.words[i] || unknown[i] != other.unknown[i])
+      return false;
+  }
+  return true;
+}
+
+// Format a 4-bit digit with its unknown bits the way that $sformatf does: 'x'
+// if all the bits are unknown and 'X' if only some of them are.
+static char digit_char(uint32_t digit, uint32_t unknown) {
+  if (unknown == 0)
+    return kHexDigits[digit];
+  return unknown == 0xf ? 'x' : 'X';
+}
+
+void OtbnTraceValue::AppendString(bool is_flags, std::string *dst) const {
+  assert(dst);
+
+  if (is_flags) {
+    static const char *const kFlagNames[] = {"C", "M", "L", "Z"};
+    dst->push_back('{');
+    for (int i = 0; i < 4; ++i) {
+      if (i)
+        dst->append(", ");
+      dst->append(kFlagNames[i]);
+      dst->append(": ");
+      bool is_unknown = (unknown[0] >> i) & 1;
+      dst->push_back(is_unknown ? 'x' : kHexDigits[(words[0] >> i) & 1]);
+    }
+    dst->push_back('}');
+    return;
+  }
+
+  dst->append("0x");
+  for (int i = num_words - 1; i >= 0; --i) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      dst->push_back(
+          digit_char((words[i] >> shift) & 0xf, (unknown[i] >> shift) & 0xf));
+    }
+    if (i)
+      dst->push_back('_');
+  }
+}
+
+bool OtbnTraceValue::Parse(const std::string &str, bool is_flags) {
+  if (is_flags) {
+    // Expect "{C: c, M: m, L: l, Z: z}", where each value is 0, 1 or x
+    static const char kTemplate[] = "{C: ?, M: ?, L: ?, Z: ?}";
+    if (str.size() != sizeof kTemplate - 1)
+      return false;
+
+    num_words = 1;
+    words[0] = 0;
+    unknown[0] = 0;
+    int flag = 0;
+    for (size_t i = 0; i < str.size(); ++i) {
+      if (kTemplate[i] != '?') {
+        if (str[i] != kTemplate[i])
+          return false;
+        continue;
+      }
+      if (str[i] == '1') {
+        words[0] |= 1u << flag;
+      } else if (str[i] == 'x') {
+        unknown[0] |= 1u << flag;
+      } else if (str[i] != '0') {
+        return false;
+      }
+      ++flag;
+    }
+    return true;
+  }
+
+  // Expect "0x" followed by 8-digit hex words, separated by underscores
+  if (str.size() < 2 || str[0] != '0' || str[1] != 'x')
+    return false;
+
+  size_t n = (str.size() - 1) / 9;
+  if (n == 0 || n > kMaxWords || str.size() != 2 + 9 * n - 1)
+    return false;
+
+  num_words = n;
+  for (size_t word = 0; word < n; ++word) {
+    size_t start = 2 + 9 * word;
+    if (word && str[start - 1] != '_')
+      return false;
+
+    uint32_t value = 0, value_unknown = 0;
+    for (size_t i = start; i < start + 8; ++i) {
+      char c = str[i];
+      uint32_t digit = 0, digit_unknown = 0;
+      if ('0' <= c && c <= '9') {
+        digit = c - '0';
+      } else if ('a' <= c && c <= 'f') {
+        digit = c - 'a' + 10;
+      } else if (c == 'x' || c == 'X') {
+        digit_unknown = 0xf;
+      } else {
+        return false;
+      }
+      value = (value << 4) | digit;
+      value_unknown = (value_unknown << 4) | digit_unknown;
+    }
+    words[n - 1 - word] = value;
+    unknown[n - 1 - word] = value_unknown;
+  }
+  return true;
+}
+
+static void append_hex32(uint32_t value, std::string *dst) {
+  OtbnTraceValue tmp;
+  tmp.Set(1, &value);
+  tmp.AppendString(false, dst);
+}
+
+void OtbnTraceLine::AppendString(std::string *dst) const {
+  assert(dst);
+
+  dst->push_back(type);
+  dst->push_back(' ');
+  if (loc == OtbnTraceLoc::Mem) {
+    dst->push_back('[');
+    append_hex32(addr, dst);
+    dst->push_back(']');
+  } else {
+    dst->append(OtbnTraceLoc::Name(loc));
+  }
+  dst->append(": ");
+
+  if (flags & kMaskErr) {
+    dst->append("Mask ERR Mask: ");
+    mask.AppendString(false, dst);
+    dst->append(" Data: ");
+  }
+  value.AppendString(OtbnTraceLoc::IsFlags(loc), dst);
+}
+
+void OtbnTraceRecord::Clear() {
+  insn_kind = 0;
+  wipe_kind = 0;
+  insn_flags = 0;
+  pc = 0;
+  insn = 0;
+  lines.clear();
+  str_valid_ = false;
+}
+
+OtbnTraceRecord &OtbnTraceRecord::operator=(const OtbnTraceRecord &other) {
+  insn_kind = other.insn_kind;
+  wipe_kind = other.wipe_kind;
+  insn_flags = other.insn_flags;
+  pc = other.pc;
+  insn = other.insn;
+  lines = other.lines;
+  str_valid_ = false;
+  return *this;
+}
+
+const std::string &OtbnTraceRecord::ToString() const {
+  if (str_valid_)
+    return str_;
+
+  str_.clear();
+  if (insn_kind) {
+    if (insn_kind == 'S' && !(insn_flags & kHasPc)) {
+      str_.append("STALL");
+    } else {
+      str_.push_back(insn_kind);
+      str_.append(" PC: ");
+      append_hex32(pc, &str_);
+      str_.append(", insn: ");
+      if (insn_flags & kInsnKnown) {
+        append_hex32(insn, &str_);
+      } else {
+        str_.append("??");
+      }
+    }
+    str_.push_back('\n');
+  }
+  if (wipe_kind) {
+    // The trailing space matches what the tracer has always printed
+    str_.push_back(wipe_kind);
+    str_.append(" \n");
+  }
+  for (const OtbnTraceLine &line : lines) {
+    line.AppendString(&str_);
+    str_.push_back('\n');
+  }
+
+  str_valid_ = true;
+  return str_;
+}
+
+// The packed format is as follows, with all multi-byte fields little-endian:
+//
+//   record:  u8 insn_kind, u8 wipe_kind, u8 insn_flags, u8 (zero),
+//            u32 pc, u32 insn, u32 num_lines, line * num_lines
+//
+//   line:    u8 type, u8 flags, u16 loc, u32 addr, value,
+//            value (the mask, only if flags has kMaskErr)
+//
+//   value:   u8 num_words, u8 has_unknown, u16 (zero), u32 words[num_words],
+//            u32 unknown[num_words] (only if has_unknown is nonzero)
+//
+// Words are stored least significant first.
+
+static void pack_u8(uint8_t value, std::string *dst) {
+  dst->push_back(static_cast<char>(value));
+}
+
+static void pack_u16(uint16_t value, std::string *dst) {
+  pack_u8(value, dst);
+  pack_u8(value >> 8, dst);
+}
+
+static void pack_u32(uint32_t value, std::string *dst) {
+  pack_u16(value, dst);
+  pack_u16(value >> 16, dst);
+}
+
+static void pack_value(const OtbnTraceValue &value, std::string *dst) {
+  bool has_unknown = false;
+  for (unsigned i = 0; i < value.num_words; ++i) {
+    has_unknown |= value.unknown[i] != 0;
+  }
+
+  pack_u8(value.num_words, dst);
+  pack_u8(has_unknown, dst);
+  pack_u16(0, dst);
+  for (unsigned i = 0; i < value.num_words; ++i) {
+    pack_u32(value.words[i], dst);
+  }
+  if (has_unknown) {
+    for (unsigned i = 0; i < value.num_words; ++i) {
+      pack_u32(value.unknown[i], dst);
+    }
+  }
+}
+
+void OtbnTraceRecord::Pack(std::string *dst) const {
+  assert(dst);
+
+  pack_u8(insn_kind, dst);
+  pack_u8(wipe_kind, dst);
+  pack_u8(insn_flags, dst);
+  pack_u8(0, dst);
+  pack_u32(pc, dst);
+  pack_u32(insn, dst);
+  pack_u32(lines.size(), dst);
+  for (const OtbnTraceLine &line : lines) {
+    pack_u8(line.type, dst);
+    pack_u8(line.flags, dst);
+    pack_u16(line.loc, dst);
+    pack_u32(line.addr, dst);
+    pack_value(line.value, dst);
+    if (line.flags & OtbnTraceLine::kMaskErr) {
+      pack_value(line.mask, dst);
+    }
+  }
+}
+
+// A cursor for unpacking little-endian fields from a buffer
+class RecordUnpacker {
+ public:
+  RecordUnpacker(const std::string &buf, size_t *pos) : buf_(buf), pos_(pos) {}
+
+  bool U8(uint8_t *dst) {
+    if (*pos_ + 1 > buf_.size())
+      return false;
+    *dst = static_cast<uint8_t>(buf_[(*pos_)++]);
+    return true;
+  }
+
+  bool U16(uint16_t *dst) {
+    uint8_t lo, hi;
+    if (!(U8(&lo) && U8(&hi)))
+      return false;
+    *dst = lo | (hi << 8);
+    return true;
+  }
+
+  bool U32(uint32_t *dst) {
+    uint16_t lo, hi;
+    if (!(U16(&lo) && U16(&hi)))
+      return false;
+    *dst = lo | ((uint32_t)hi << 16);
+    return true;
+  }
+
+  bool Value(OtbnTraceValue *dst) {
+    uint8_t has_unknown;
+    uint16_t zero;
+    if (!(U8(&dst->num_words) && U8(&has_unknown) && U16(&zero)))
+      return false;
+    if (dst->num_words == 0 || dst->num_words > OtbnTraceValue::kMaxWords)
+      return false;
+
+    for (unsigned i = 0; i < dst->num_words; ++i) {
+      dst->unknown[i] = 0;
+      if (!U32(&dst->words[i]))
+        return false;
+    }
+    if (has_unknown) {
+      for (unsigned i = 0; i < dst->num_words; ++i) {
+        if (!U32(&dst->unknown[i]))
+          return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  const std::string &buf_;
+  size_t *pos_;
+};
+
+bool OtbnTraceRecord::Unpack(const std::string &buf, size_t *pos) {
+  assert(pos);
+  Clear();
+
+  RecordUnpacker unpacker(buf, pos);
+  uint8_t insn_kind_u8, wipe_kind_u8, zero;
+  uint32_t num_lines;
+  if (!(unpacker.U8(&insn_kind_u8) && unpacker.U8(&wipe_kind_u8) &&
+        unpacker.U8(&insn_flags) && unpacker.U8(&zero) &&
+        unpacker.U32(&pc) && unpacker.U32(&insn) && unpacker.U32(&num_lines)))
+    return false;
+
+  insn_kind = insn_kind_u8;
+  wipe_kind = wipe_kind_u8;
+
+  for (uint32_t i = 0; i < num_lines; ++i) {
+    OtbnTraceLine line;
+    uint8_t type;
+    if (!(unpacker.U8(&type) && unpacker.U8(&line.flags) &&
+          unpacker.U16(&line.loc) && unpacker.U32(&line.addr) &&
+          unpacker.Value(&line.value)))
+      return false;
+    if (line.loc >= OtbnTraceLoc::NumFixed)
+      return false;
+    if ((line.flags & OtbnTraceLine::kMaskErr) && !unpacker.Value(&line.mask))
+      return false;
+
+    line.type = type;
+    lines.push_back(line);
+  }
+  return true;
+}
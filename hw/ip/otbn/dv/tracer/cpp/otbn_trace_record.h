@@ -0,0 +1,233 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_RECORD_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_RECORD_H_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A vector that stores up to N items inline, only allocating memory if it
+// grows beyond that. T must be trivially copyable.
+template <typename T, size_t N>
+class OtbnSmallVector {
+ public:
+  OtbnSmallVector() : size_(0) {}
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T *begin() { return data(); }
+  T *end() { return data() + size_; }
+  const T *begin() const { return data(); }
+  const T *end() const { return data() + size_; }
+
+  T &operator[](size_t idx) {
+    assert(idx < size_);
+    return data()[idx];
+  }
+  const T &operator[](size_t idx) const {
+    assert(idx < size_);
+    return data()[idx];
+  }
+
+  T &back() { return (*this)[size_ - 1]; }
+  const T &back() const { return (*this)[size_ - 1]; }
+
+  void clear() {
+    size_ = 0;
+    heap_.clear();
+  }
+
+  // Append an item, returning a reference to it
+  T &push_back(const T &item) {
+    if (size_ < N) {
+      inline_[size_] = item;
+    } else {
+      if (size_ == N)
+        heap_.assign(inline_, inline_ + N);
+      heap_.push_back(item);
+    }
+    ++size_;
+    return back();
+  }
+
+  // Insert the items in [first, last) before the item at index idx
+  void insert(size_t idx, const T *first, const T *last) {
+    assert(idx <= size_);
+    std::vector<T> tmp(begin(), end());
+    tmp.insert(tmp.begin() + idx, first, last);
+
+    clear();
+    for (const T &item : tmp)
+      push_back(item);
+  }
+
+ private:
+  T *data() { return size_ <= N ? inline_ : heap_.data(); }
+  const T *data() const { return size_ <= N ? inline_ : heap_.data(); }
+
+  size_t size_;
+  T inline_[N];
+  std::vector<T> heap_;
+};
+
+// Interned names for the locations in OTBN trace lines. The locations that
+// the tracer knows about have fixed IDs. Any other name (which might be seen
+// when parsing a trace) gets a new ID the first time it is interned.
+class OtbnTraceLoc {
+ public:
+  enum : uint16_t {
+    // x00 .. x31
+    X0 = 0,
+    // w00 .. w31
+    W0 = 32,
+    Mod = 64,
+    Rnd,
+    Acc,
+    Urnd,
+    Flags0,
+    Flags1,
+    // The sideload key ISPRs, which the RTL tracer doesn't name
+    UnknownIspr,
+    // A DMEM address (stored separately in the line)
+    Mem,
+    NumFixed
+  };
+
+  // Get the ID for a location name, interning it if necessary
+  static uint16_t Intern(const std::string &name);
+
+  // Get the name of a location (which must have been interned)
+  static const std::string &Name(uint16_t loc);
+
+  // Get the location for an ISPR, indexed by otbn_pkg::ispr_e (for anything
+  // but IsprFlags).
+  static uint16_t FromIspr(unsigned ispr);
+
+  static bool IsFlags(uint16_t loc) { return loc == Flags0 || loc == Flags1; }
+};
+
+// A value in a trace line. This is either a 32-bit value (for base registers,
+// flags and 32-bit memory accesses) or a 256-bit value. Any bits that are
+// unknown (X or Z in the RTL, or an invalid value in the ISS) are set in
+// unknown.
+//
+// For flags, the value is a 32-bit value with C, M, L, Z in bits 0 to 3.
+struct OtbnTraceValue {
+  enum { kMaxWords = 8 };
+
+  uint8_t num_words;
+  uint32_t words[kMaxWords];
+  uint32_t unknown[kMaxWords];
+
+  // Set the value to num_words words from src (least significant first),
+  // with all bits known.
+  void Set(unsigned num_words, const uint32_t *src);
+
+  // True if the two values match. Unknown bits in either value match
+  // anything.
+  bool Matches(const OtbnTraceValue &other) const;
+
+  bool operator==(const OtbnTraceValue &other) const;
+
+  // Format the value the way that the RTL tracer has always done: hex words
+  // (most significant first) separated by underscores with an 'x' for an
+  // unknown digit, or "{C: c, M: m, L: l, Z: z}" if is_flags is true.
+  void AppendString(bool is_flags, std::string *dst) const;
+
+  // Parse a value in the format of AppendString. Returns false if str isn't
+  // well-formed.
+  bool Parse(const std::string &str, bool is_flags);
+};
+
+// A body line in a trace record: a register read or write, or a memory load
+// or store.
+struct OtbnTraceLine {
+  enum Flags : uint8_t {
+    // A DMEM write with a mask that was neither a full word nor an aligned
+    // 32-bit chunk. The mask is in mask.
+    kMaskErr = 1 << 0,
+  };
+
+  // One of '<', '>', 'R' or 'W'
+  char type;
+  uint8_t flags;
+  // An ID from OtbnTraceLoc
+  uint16_t loc;
+  // The address (if loc is OtbnTraceLoc::Mem)
+  uint32_t addr;
+  OtbnTraceValue value;
+  OtbnTraceValue mask;
+
+  // Append the line in the text trace format (without a newline)
+  void AppendString(std::string *dst) const;
+};
+
+// A trace record: everything that the OTBN tracer saw on one cycle.
+//
+// The tracer fills in a record through the DPI functions in
+// otbn_trace_dpi.cc and then passes it to listeners by reference, which
+// avoids formatting and parsing text on every cycle. Listeners that want text
+// can use ToString(), which formats the record on the first call.
+//
+// A well-formed record has exactly one header (an instruction or a wipe),
+// but the tracer can produce other records if the design goes wrong.
+class OtbnTraceRecord {
+ public:
+  enum HeaderFlags : uint8_t {
+    // The instruction bits are known (there wasn't a fetch error)
+    kInsnKnown = 1 << 0,
+    // There is a PC for the instruction (always true for the RTL, but the ISS
+    // doesn't give one for a stall)
+    kHasPc = 1 << 1,
+  };
+
+  OtbnTraceRecord() { Clear(); }
+
+  // Copying a record copies its contents but not the cached string, so that
+  // copying records around doesn't allocate.
+  OtbnTraceRecord(const OtbnTraceRecord &other) { *this = other; }
+  OtbnTraceRecord &operator=(const OtbnTraceRecord &other);
+
+  // Empty the record, ready to be filled in for a new cycle
+  void Clear();
+
+  bool Empty() const {
+    return insn_kind == 0 && wipe_kind == 0 && lines.empty();
+  }
+
+  // Get the record in the text trace format (see hw/ip/otbn/dv/tracer/
+  // README.md), with a newline after each line. The string is formatted on
+  // the first call and cached until the record is cleared.
+  const std::string &ToString() const;
+
+  // Append the record to dst in the packed format that is used by the
+  // stepped ISS in its binary protocol (see otbnsim/stepped.py).
+  void Pack(std::string *dst) const;
+
+  // Unpack a record in the packed format from buf at *pos, advancing *pos.
+  // Returns false if buf is malformed.
+  bool Unpack(const std::string &buf, size_t *pos);
+
+  // 0 for no instruction, 'S' for an instruction that stalled or 'E' for one
+  // that completed
+  char insn_kind;
+  // 0 for no wipe, 'U' for a wipe in progress or 'V' for a completed one
+  char wipe_kind;
+  // HeaderFlags for the instruction
+  uint8_t insn_flags;
+  uint32_t pc;
+  uint32_t insn;
+
+  OtbnSmallVector<OtbnTraceLine, 8> lines;
+
+ private:
+  mutable bool str_valid_;
+  mutable std::string str_;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_RECORD_H_
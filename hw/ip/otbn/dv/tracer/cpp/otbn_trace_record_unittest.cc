@@ -0,0 +1,255 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "hw/ip/otbn/dv/tracer/cpp/otbn_trace_record.h"
+
+#include <cstdio>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace otbn_trace_record_unittest {
+namespace {
+
+OtbnTraceValue MakeValue(std::initializer_list<uint32_t> words,
+                         std::initializer_list<uint32_t> unknown = {}) {
+  OtbnTraceValue value;
+  value.num_words = 0;
+  for (uint32_t word : words) {
+    value.words[value.num_words] = word;
+    value.unknown[value.num_words] = 0;
+    ++value.num_words;
+  }
+  unsigned i = 0;
+  for (uint32_t bits : unknown) {
+    value.unknown[i++] = bits;
+  }
+  return value;
+}
+
+OtbnTraceLine MakeLine(char type, uint16_t loc, const OtbnTraceValue &value) {
+  OtbnTraceLine line;
+  line.type = type;
+  line.flags = 0;
+  line.loc = loc;
+  line.addr = 0;
+  line.value = value;
+  line.mask = MakeValue({0});
+  return line;
+}
+
+// Pack a record, unpack it again and check that nothing changed
+OtbnTraceRecord RoundTrip(const OtbnTraceRecord &record) {
+  std::string packed;
+  record.Pack(&packed);
+
+  OtbnTraceRecord unpacked;
+  size_t pos = 0;
+  EXPECT_TRUE(unpacked.Unpack(packed, &pos));
+  EXPECT_EQ(pos, packed.size());
+
+  EXPECT_EQ(unpacked.insn_kind, record.insn_kind);
+  EXPECT_EQ(unpacked.wipe_kind, record.wipe_kind);
+  EXPECT_EQ(unpacked.insn_flags, record.insn_flags);
+  EXPECT_EQ(unpacked.pc, record.pc);
+  EXPECT_EQ(unpacked.insn, record.insn);
+  EXPECT_EQ(unpacked.lines.size(), record.lines.size());
+  for (size_t i = 0; i < record.lines.size() && i < unpacked.lines.size();
+       ++i) {
+    const OtbnTraceLine &a = record.lines[i], &b = unpacked.lines[i];
+    EXPECT_EQ(a.type, b.type);
+    EXPECT_EQ(a.flags, b.flags);
+    EXPECT_EQ(a.loc, b.loc);
+    EXPECT_EQ(a.addr, b.addr);
+    EXPECT_TRUE(a.value == b.value);
+    if (a.flags & OtbnTraceLine::kMaskErr) {
+      EXPECT_TRUE(a.mask == b.mask);
+    }
+  }
+  EXPECT_EQ(unpacked.ToString(), record.ToString());
+  return unpacked;
+}
+
+TEST(OtbnTraceRecordTest, Instruction) {
+  OtbnTraceRecord record;
+  record.insn_kind = 'E';
+  record.insn_flags = OtbnTraceRecord::kInsnKnown | OtbnTraceRecord::kHasPc;
+  record.pc = 0x124;
+  record.insn = 0x00b50533;
+  record.lines.push_back(
+      MakeLine('<', OtbnTraceLoc::X0 + 10, MakeValue({0x12345678})));
+  record.lines.push_back(
+      MakeLine('>', OtbnTraceLoc::X0 + 10, MakeValue({0xdeadbeef})));
+
+  EXPECT_EQ(record.ToString(),
+            "E PC: 0x00000124, insn: 0x00b50533\n"
+            "< x10: 0x12345678\n"
+            "> x10: 0xdeadbeef\n");
+  RoundTrip(record);
+}
+
+TEST(OtbnTraceRecordTest, StallAndWipe) {
+  OtbnTraceRecord stall;
+  stall.insn_kind = 'S';
+  EXPECT_EQ(stall.ToString(), "STALL\n");
+  RoundTrip(stall);
+
+  OtbnTraceRecord fetch_err;
+  fetch_err.insn_kind = 'E';
+  fetch_err.insn_flags = OtbnTraceRecord::kHasPc;
+  fetch_err.pc = 0x10;
+  EXPECT_EQ(fetch_err.ToString(), "E PC: 0x00000010, insn: ??\n");
+  RoundTrip(fetch_err);
+
+  OtbnTraceRecord wipe;
+  wipe.wipe_kind = 'V';
+  EXPECT_EQ(wipe.ToString(), "V \n");
+  RoundTrip(wipe);
+}
+
+TEST(OtbnTraceRecordTest, UnknownBits) {
+  OtbnTraceRecord record;
+  record.insn_kind = 'S';
+  record.insn_flags = OtbnTraceRecord::kHasPc;
+  // A wide register with a fully unknown nibble, a partly unknown nibble and
+  // a fully unknown word
+  OtbnTraceValue wide = MakeValue({1, 2, 3, 4, 5, 6, 7, 8},
+                                  {0xf, 0x30, 0, 0, 0, 0, 0, 0xffffffff});
+  record.lines.push_back(MakeLine('>', OtbnTraceLoc::W0 + 3, wide));
+
+  EXPECT_EQ(record.ToString(),
+            "S PC: 0x00000000, insn: ??\n"
+            "> w03: 0xxxxxxxxx_00000007_00000006_00000005_00000004_"
+            "00000003_000000X2_0000000x\n");
+  RoundTrip(record);
+}
+
+TEST(OtbnTraceRecordTest, Flags) {
+  OtbnTraceRecord record;
+  record.insn_kind = 'E';
+  record.insn_flags = OtbnTraceRecord::kInsnKnown | OtbnTraceRecord::kHasPc;
+  // C and Z set, L unknown
+  record.lines.push_back(
+      MakeLine('>', OtbnTraceLoc::Flags1, MakeValue({0x9}, {0x4})));
+
+  EXPECT_EQ(record.ToString(),
+            "E PC: 0x00000000, insn: 0x00000000\n"
+            "> FLAGS1: {C: 1, M: 0, L: x, Z: 1}\n");
+  RoundTrip(record);
+}
+
+TEST(OtbnTraceRecordTest, MaskedDmemWrite) {
+  OtbnTraceRecord record;
+  record.insn_kind = 'E';
+  record.insn_flags = OtbnTraceRecord::kInsnKnown | OtbnTraceRecord::kHasPc;
+
+  OtbnTraceLine write = MakeLine('W', OtbnTraceLoc::Mem,
+                                 MakeValue({0, 0, 0, 0, 0, 0, 0, 0xaabbccdd}));
+  write.addr = 0x40;
+  write.flags = OtbnTraceLine::kMaskErr;
+  write.mask = MakeValue({0, 0, 0, 0, 0, 0, 0xffff0000, 0x0000ffff});
+  record.lines.push_back(write);
+
+  EXPECT_EQ(record.ToString(),
+            "E PC: 0x00000000, insn: 0x00000000\n"
+            "W [0x00000040]: Mask ERR Mask: "
+            "0x0000ffff_ffff0000_00000000_00000000_00000000_00000000_"
+            "00000000_00000000 Data: "
+            "0xaabbccdd_00000000_00000000_00000000_00000000_00000000_"
+            "00000000_00000000\n");
+  RoundTrip(record);
+}
+
+// More than 8 lines spill out of the inline storage of OtbnSmallVector
+TEST(OtbnTraceRecordTest, ManyLines) {
+  OtbnTraceRecord record;
+  record.insn_kind = 'E';
+  record.insn_flags = OtbnTraceRecord::kInsnKnown | OtbnTraceRecord::kHasPc;
+  std::string expected = "E PC: 0x00000000, insn: 0x00000000\n";
+  for (uint32_t i = 0; i < 20; ++i) {
+    record.lines.push_back(
+        MakeLine('<', OtbnTraceLoc::X0 + i, MakeValue({i * 0x11111111})));
+    char line[32];
+    snprintf(line, sizeof line, "< x%02u: 0x%08x\n", i, i * 0x11111111);
+    expected += line;
+  }
+  EXPECT_EQ(record.ToString(), expected);
+
+  OtbnTraceRecord unpacked = RoundTrip(record);
+  ASSERT_EQ(unpacked.lines.size(), 20u);
+  EXPECT_EQ(unpacked.lines[19].loc, OtbnTraceLoc::X0 + 19);
+
+  // Copying a record doesn't copy its cached string
+  OtbnTraceRecord copy(unpacked);
+  EXPECT_EQ(copy.ToString(), expected);
+}
+
+TEST(OtbnTraceRecordTest, UnpackRejectsTruncated) {
+  OtbnTraceRecord record;
+  record.insn_kind = 'E';
+  record.lines.push_back(
+      MakeLine('>', OtbnTraceLoc::W0, MakeValue({1, 2, 3, 4, 5, 6, 7, 8})));
+
+  std::string packed;
+  record.Pack(&packed);
+  for (size_t len = 0; len < packed.size(); ++len) {
+    OtbnTraceRecord unpacked;
+    size_t pos = 0;
+    EXPECT_FALSE(unpacked.Unpack(packed.substr(0, len), &pos)) << len;
+  }
+}
+
+TEST(OtbnTraceValueTest, ParseRoundTrip) {
+  const OtbnTraceValue values[] = {
+      MakeValue({0x01234567}),
+      MakeValue({0x89abcdef}, {0xf0000000}),
+      MakeValue({1, 2, 3, 4, 5, 6, 7, 8}, {0, 0, 0, 0, 0, 0, 0, 0xffffffff}),
+  };
+  for (const OtbnTraceValue &value : values) {
+    std::string str;
+    value.AppendString(false, &str);
+
+    OtbnTraceValue parsed;
+    ASSERT_TRUE(parsed.Parse(str, false)) << str;
+    // Unknown bits are stored as zero in the value, but don't count
+    EXPECT_TRUE(parsed.Matches(value)) << str;
+    EXPECT_EQ(parsed.num_words, value.num_words);
+    for (unsigned i = 0; i < value.num_words; ++i) {
+      EXPECT_EQ(parsed.unknown[i], value.unknown[i]) << str;
+    }
+  }
+
+  OtbnTraceValue flags = MakeValue({0x9}, {0x4}), parsed_flags;
+  std::string flags_str;
+  flags.AppendString(true, &flags_str);
+  ASSERT_TRUE(parsed_flags.Parse(flags_str, true));
+  EXPECT_TRUE(parsed_flags == flags);
+}
+
+// A partly unknown nibble is printed as 'X', which reads back as a wholly
+// unknown nibble: the text format can't say which bits were unknown.
+TEST(OtbnTraceValueTest, ParsePartlyUnknown) {
+  OtbnTraceValue value = MakeValue({0x00000012}, {0x00000030});
+  std::string str;
+  value.AppendString(false, &str);
+  EXPECT_EQ(str, "0x000000X2");
+
+  OtbnTraceValue parsed;
+  ASSERT_TRUE(parsed.Parse(str, false));
+  EXPECT_EQ(parsed.unknown[0], 0xf0u);
+  EXPECT_TRUE(parsed.Matches(value));
+}
+
+TEST(OtbnTraceValueTest, ParseRejectsMalformed) {
+  OtbnTraceValue value;
+  EXPECT_FALSE(value.Parse("", false));
+  EXPECT_FALSE(value.Parse("0x1234", false));
+  EXPECT_FALSE(value.Parse("0x00000000-00000000", false));
+  EXPECT_FALSE(value.Parse("0x0000000g", false));
+  EXPECT_FALSE(value.Parse("{C: 1, M: 0, L: 2, Z: 1}", true));
+  EXPECT_FALSE(value.Parse("{C: 1, M: 0, L: 0}", true));
+}
+
+}  // namespace
+}  // namespace otbn_trace_record_unittest
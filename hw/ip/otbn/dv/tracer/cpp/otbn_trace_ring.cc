@@ -0,0 +1,156 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "otbn_trace_ring.h"
+
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+// The state of a slot is the sequence number of its record in the top 32 bits,
+// the pending bits of the consumers in bits [15:0] and their reading bits in
+// bits [31:16].
+static uint64_t make_state(uint32_t seq, uint32_t bits) {
+  return ((uint64_t)seq << 32) | bits;
+}
+static uint32_t state_seq(uint64_t state) { return state >> 32; }
+static uint32_t state_bits(uint64_t state) { return (uint32_t)state; }
+static uint32_t pending_bit(int id) { return 1u << id; }
+static uint32_t reading_bit(int id) {
+  return 1u << (id + OtbnTraceRing::kMaxConsumers);
+}
+
+struct OtbnTraceRing::Slot {
+  std::atomic<uint64_t> state;
+  unsigned cycle_count;
+  OtbnTraceRecord record;
+};
+
+// Yield for the first few tries, so that a consumer that is keeping up sees a
+// record soon after it is published, and then sleep, so that idle threads don't
+// use a core.
+void OtbnTraceRing::Backoff(unsigned *tries) {
+  if (++*tries < 64) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+OtbnTraceRing::OtbnTraceRing(size_t capacity)
+    : head_(0), consumers_(0), drop_consumers_(0), stall_count_(0) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  slots_.reset(new Slot[size]);
+  mask_ = size - 1;
+
+  // Start each slot with the sequence number of the record from the lap
+  // "before" the first one, so that nothing looks published.
+  for (size_t i = 0; i < size; ++i) {
+    slots_[i].state.store(make_state(i - size, 0), std::memory_order_relaxed);
+    slots_[i].cycle_count = 0;
+  }
+  for (auto &dropped : dropped_) {
+    dropped.store(0, std::memory_order_relaxed);
+  }
+}
+
+OtbnTraceRing::~OtbnTraceRing() {}
+
+int OtbnTraceRing::AddConsumer(bool drop) {
+  for (int id = 0; id < kMaxConsumers; ++id) {
+    if (!(consumers_ & pending_bit(id))) {
+      consumers_ |= pending_bit(id);
+      if (drop) {
+        drop_consumers_ |= pending_bit(id);
+      }
+      dropped_[id].store(0, std::memory_order_relaxed);
+      return id;
+    }
+  }
+  return -1;
+}
+
+void OtbnTraceRing::RemoveConsumer(int id) {
+  assert(0 <= id && id < kMaxConsumers);
+  consumers_ &= ~pending_bit(id);
+  drop_consumers_ &= ~pending_bit(id);
+}
+
+void OtbnTraceRing::Publish(const OtbnTraceRecord &record,
+                            unsigned cycle_count) {
+  uint32_t seq = head_.load(std::memory_order_relaxed);
+  Slot &slot = slots_[seq & mask_];
+
+  uint64_t state = slot.state.load(std::memory_order_acquire);
+  bool stalled = false;
+  unsigned tries = 0;
+  while (state_bits(state) != 0) {
+    // Take the old record away from any dropping consumers that haven't
+    // claimed it yet.
+    uint32_t revoke = state_bits(state) & drop_consumers_;
+    if (revoke) {
+      uint64_t new_state = state & ~(uint64_t)revoke;
+      if (!slot.state.compare_exchange_weak(state, new_state,
+                                            std::memory_order_acq_rel)) {
+        continue;
+      }
+      for (int id = 0; id < kMaxConsumers; ++id) {
+        if (revoke & pending_bit(id)) {
+          dropped_[id].fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+      state = new_state;
+      continue;
+    }
+
+    // Otherwise, wait for a blocking consumer to read the record, or for a
+    // consumer that has claimed it to finish copying it.
+    if (!stalled) {
+      ++stall_count_;
+      stalled = true;
+    }
+    Backoff(&tries);
+    state = slot.state.load(std::memory_order_acquire);
+  }
+
+  // Nobody can claim the slot while its state has no pending bits, so it is
+  // safe to overwrite.
+  slot.record = record;
+  slot.cycle_count = cycle_count;
+  slot.state.store(make_state(seq, consumers_), std::memory_order_release);
+  head_.store(seq + 1, std::memory_order_release);
+}
+
+OtbnTraceRing::ReadResult OtbnTraceRing::TryRead(int id, uint32_t seq,
+                                                 OtbnTraceRecord *record,
+                                                 unsigned *cycle_count) {
+  Slot &slot = slots_[seq & mask_];
+
+  uint64_t state = slot.state.load(std::memory_order_acquire);
+  while (1) {
+    int32_t age = (int32_t)(state_seq(state) - seq);
+    if (age < 0) {
+      return kReadEmpty;
+    }
+    // If the slot has moved on to a later record (age > 0), the producer
+    // dropped ours.
+    if (age > 0 || !(state_bits(state) & pending_bit(id))) {
+      return kReadSkipped;
+    }
+
+    uint64_t claimed = (state & ~(uint64_t)pending_bit(id)) | reading_bit(id);
+    if (slot.state.compare_exchange_weak(state, claimed,
+                                         std::memory_order_acq_rel)) {
+      break;
+    }
+  }
+
+  *record = slot.record;
+  *cycle_count = slot.cycle_count;
+  slot.state.fetch_and(~(uint64_t)reading_bit(id), std::memory_order_release);
+  return kReadOk;
+}
@@ -0,0 +1,141 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_RING_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "otbn_trace_record.h"
+
+/**
+ * A single-producer, multi-consumer ring buffer of trace records.
+ *
+ * The producer (the simulation thread) copies each record into the next slot
+ * of the ring. Every consumer has its own read position, so each one sees
+ * every record (or is told that it missed some), in order.
+ *
+ * Each slot has an atomic state word, which holds the sequence number of the
+ * record in the slot, a "pending" bit for each consumer that hasn't read the
+ * record yet and a "reading" bit for each consumer that is copying it out. A
+ * consumer claims a record by swapping its pending bit for its reading bit and
+ * releases it once it has a copy. The producer only writes a slot once its
+ * state has no bits set, so neither side takes a lock.
+ *
+ * A consumer that is a full ring behind the producer is handled according to
+ * its policy:
+ *
+ * - Blocking consumers hold up the producer until they have read the slot
+ *   that is about to be reused.
+ *
+ * - Dropping consumers lose the record in that slot (the oldest one that they
+ *   haven't read). The producer clears their pending bit and counts the drop.
+ *   The producer only waits for a dropping consumer if it is in the middle of
+ *   copying a record out of that slot.
+ */
+class OtbnTraceRing {
+ public:
+  enum { kMaxConsumers = 16 };
+
+  enum ReadResult {
+    // The record was copied out
+    kReadOk,
+    // The record hasn't been published yet
+    kReadEmpty,
+    // The record isn't available to this consumer (it was dropped)
+    kReadSkipped,
+  };
+
+  /**
+   * Constructor
+   *
+   * @param capacity Number of records in the ring (rounded up to a power of
+   *                 two)
+   */
+  explicit OtbnTraceRing(size_t capacity);
+  ~OtbnTraceRing();
+
+  OtbnTraceRing(const OtbnTraceRing &) = delete;
+  void operator=(const OtbnTraceRing &) = delete;
+
+  /**
+   * Register a consumer. Must be called on the producer thread.
+   *
+   * The consumer will see the records that are published from now on, starting
+   * with the sequence number Head().
+   *
+   * @param drop True if the consumer drops records rather than blocking the
+   *             producer
+   * @return The ID of the consumer or -1 if there are already kMaxConsumers
+   */
+  int AddConsumer(bool drop);
+
+  /**
+   * Unregister a consumer. Must be called on the producer thread, once the
+   * consumer has read (or skipped) every record up to Head().
+   */
+  void RemoveConsumer(int id);
+
+  /**
+   * Copy a record into the ring for all registered consumers. Must only be
+   * called on the producer thread.
+   */
+  void Publish(const OtbnTraceRecord &record, unsigned cycle_count);
+
+  /**
+   * The sequence number that the next record to be published will have
+   */
+  uint32_t Head() const { return head_.load(std::memory_order_acquire); }
+
+  /**
+   * Try to copy out the record with sequence number seq for a consumer.
+   *
+   * @param id The ID of the consumer
+   * @param seq The sequence number to read
+   * @param record Filled in with the record if the result is kReadOk
+   * @param cycle_count Filled in with the record's cycle count if the result
+   *                    is kReadOk
+   */
+  ReadResult TryRead(int id, uint32_t seq, OtbnTraceRecord *record,
+                     unsigned *cycle_count);
+
+  /**
+   * Number of records that were dropped for a (dropping) consumer
+   */
+  uint64_t GetDroppedCount(int id) const {
+    return dropped_[id].load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Number of times the producer had to wait for a consumer
+   */
+  unsigned long GetStallCount() const { return stall_count_; }
+
+  /**
+   * Wait a little before polling the ring again
+   *
+   * @param tries The number of times the caller has waited so far, which is
+   *              incremented. Reset it to zero after making progress.
+   */
+  static void Backoff(unsigned *tries);
+
+ private:
+  struct Slot;
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_;
+  std::atomic<uint32_t> head_;
+
+  // The consumers that are registered and the subset of those that drop
+  // records. Only used by the producer.
+  uint32_t consumers_;
+  uint32_t drop_consumers_;
+
+  std::atomic<uint64_t> dropped_[kMaxConsumers];
+  unsigned long stall_count_;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_RING_H_
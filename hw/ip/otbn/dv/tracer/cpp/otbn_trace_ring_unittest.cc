@@ -0,0 +1,208 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "hw/ip/otbn/dv/tracer/cpp/otbn_trace_ring.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "hw/ip/otbn/dv/tracer/cpp/otbn_trace_listener.h"
+#include "hw/ip/otbn/dv/tracer/cpp/otbn_trace_source.h"
+
+// These tests run several threads against the ring, so are most useful when
+// built with ThreadSanitizer (bazel test --config=tsan).
+
+namespace otbn_trace_ring_unittest {
+namespace {
+
+// Publish num_records records, where record i has PC i and cycle count 2 * i
+void PublishRecords(OtbnTraceRing *ring, uint32_t num_records) {
+  OtbnTraceRecord record;
+  record.insn_kind = 'E';
+  record.insn_flags = OtbnTraceRecord::kHasPc;
+  for (uint32_t i = 0; i < num_records; ++i) {
+    record.pc = i;
+    ring->Publish(record, 2 * i);
+  }
+}
+
+// Read records for a consumer until seq reaches end, appending the PC of each
+// one that is read to *pcs and checking that its cycle count matches. Sleeps
+// every slow_every records, if that is nonzero.
+void ConsumeRecords(OtbnTraceRing *ring, int id, uint32_t end,
+                    unsigned slow_every, std::vector<uint32_t> *pcs) {
+  OtbnTraceRecord record;
+  unsigned cycle_count;
+  unsigned tries = 0;
+  uint32_t seq = 0;
+  while (seq != end) {
+    switch (ring->TryRead(id, seq, &record, &cycle_count)) {
+      case OtbnTraceRing::kReadOk:
+        EXPECT_EQ(cycle_count, 2 * record.pc);
+        pcs->push_back(record.pc);
+        if (slow_every && pcs->size() % slow_every == 0) {
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        // fall through
+      case OtbnTraceRing::kReadSkipped:
+        ++seq;
+        tries = 0;
+        break;
+      case OtbnTraceRing::kReadEmpty:
+        OtbnTraceRing::Backoff(&tries);
+        break;
+    }
+  }
+}
+
+TEST(OtbnTraceRingTest, BlockingConsumersSeeEveryRecordInOrder) {
+  const uint32_t kNumRecords = 20000;
+  OtbnTraceRing ring(8);
+
+  std::vector<int> ids;
+  for (int i = 0; i < 3; ++i) {
+    ids.push_back(ring.AddConsumer(false));
+    ASSERT_GE(ids.back(), 0);
+  }
+
+  std::vector<std::vector<uint32_t>> pcs(ids.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    // Make one consumer slow, so that the producer has to wait for it
+    threads.emplace_back(ConsumeRecords, &ring, ids[i], kNumRecords,
+                         i == 0 ? 64 : 0, &pcs[i]);
+  }
+  PublishRecords(&ring, kNumRecords);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(ring.GetDroppedCount(ids[i]), 0u);
+    ASSERT_EQ(pcs[i].size(), kNumRecords);
+    for (uint32_t j = 0; j < kNumRecords; ++j) {
+      ASSERT_EQ(pcs[i][j], j);
+    }
+  }
+}
+
+TEST(OtbnTraceRingTest, DroppingConsumerLosesOldestRecords) {
+  OtbnTraceRing ring(4);
+  int id = ring.AddConsumer(true);
+  ASSERT_GE(id, 0);
+
+  // Nobody reads anything, but the producer doesn't wait
+  PublishRecords(&ring, 10);
+  EXPECT_EQ(ring.GetDroppedCount(id), 6u);
+  EXPECT_EQ(ring.GetStallCount(), 0u);
+
+  OtbnTraceRecord record;
+  unsigned cycle_count;
+  for (uint32_t seq = 0; seq < 6; ++seq) {
+    EXPECT_EQ(ring.TryRead(id, seq, &record, &cycle_count),
+              OtbnTraceRing::kReadSkipped);
+  }
+  for (uint32_t seq = 6; seq < 10; ++seq) {
+    ASSERT_EQ(ring.TryRead(id, seq, &record, &cycle_count),
+              OtbnTraceRing::kReadOk);
+    EXPECT_EQ(record.pc, seq);
+  }
+  EXPECT_EQ(ring.TryRead(id, 10, &record, &cycle_count),
+            OtbnTraceRing::kReadEmpty);
+}
+
+TEST(OtbnTraceRingTest, DroppingConsumerDoesntDisturbBlockingOne) {
+  const uint32_t kNumRecords = 20000;
+  OtbnTraceRing ring(8);
+  int blocking_id = ring.AddConsumer(false);
+  int dropping_id = ring.AddConsumer(true);
+  ASSERT_GE(blocking_id, 0);
+  ASSERT_GE(dropping_id, 0);
+
+  std::vector<uint32_t> blocking_pcs, dropping_pcs;
+  std::thread blocking(ConsumeRecords, &ring, blocking_id, kNumRecords, 0,
+                       &blocking_pcs);
+  std::thread dropping(ConsumeRecords, &ring, dropping_id, kNumRecords, 16,
+                       &dropping_pcs);
+  PublishRecords(&ring, kNumRecords);
+  blocking.join();
+  dropping.join();
+
+  EXPECT_EQ(ring.GetDroppedCount(blocking_id), 0u);
+  ASSERT_EQ(blocking_pcs.size(), kNumRecords);
+  for (uint32_t j = 0; j < kNumRecords; ++j) {
+    ASSERT_EQ(blocking_pcs[j], j);
+  }
+
+  // The dropping consumer sees some of the records, in order, and every other
+  // record is counted as dropped.
+  EXPECT_EQ(dropping_pcs.size() + ring.GetDroppedCount(dropping_id),
+            kNumRecords);
+  for (size_t j = 1; j < dropping_pcs.size(); ++j) {
+    ASSERT_LT(dropping_pcs[j - 1], dropping_pcs[j]);
+  }
+}
+
+// A listener that records the PC of each record it sees, checking the cycle
+// count, and sleeps every slow_every records
+class RecordingListener : public OtbnTraceListener {
+ public:
+  explicit RecordingListener(unsigned slow_every) : slow_every_(slow_every) {}
+
+  void AcceptTraceRecord(const OtbnTraceRecord &record,
+                         unsigned int cycle_count) override {
+    EXPECT_EQ(cycle_count, 2 * record.pc);
+    pcs.push_back(record.pc);
+    if (slow_every_ && pcs.size() % slow_every_ == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  std::vector<uint32_t> pcs;
+
+ private:
+  unsigned slow_every_;
+};
+
+TEST(OtbnTraceSourceTest, BlockingBackgroundListenersLoseNothing) {
+  // More records than the ring in OtbnTraceSource holds, so that a slow
+  // listener makes the simulation wait.
+  const uint32_t kNumRecords = 5000;
+  OtbnTraceSource &source = OtbnTraceSource::get();
+
+  RecordingListener fast(0), slow(32), sync(0);
+  source.AddBackgroundListener(&fast, OtbnTraceSource::kOverflowBlock);
+  source.AddBackgroundListener(&slow, OtbnTraceSource::kOverflowBlock);
+  source.AddListener(&sync);
+
+  for (uint32_t i = 0; i < kNumRecords; ++i) {
+    OtbnTraceRecord &record = source.CurrentRecord();
+    record.insn_kind = 'E';
+    record.insn_flags = OtbnTraceRecord::kHasPc;
+    record.pc = i;
+    source.Broadcast(2 * i);
+
+    // An empty record isn't sent to anybody
+    source.Broadcast(2 * i + 1);
+  }
+  source.Flush();
+
+  EXPECT_EQ(source.GetDroppedCount(&fast), 0u);
+  EXPECT_EQ(source.GetDroppedCount(&slow), 0u);
+  source.RemoveListener(&fast);
+  source.RemoveListener(&slow);
+  source.RemoveListener(&sync);
+
+  for (const RecordingListener *listener : {&fast, &slow, &sync}) {
+    ASSERT_EQ(listener->pcs.size(), kNumRecords);
+    for (uint32_t j = 0; j < kNumRecords; ++j) {
+      ASSERT_EQ(listener->pcs[j], j);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace otbn_trace_ring_unittest
@@ -5,11 +5,38 @@
 #include "otbn_trace_source.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include "otbn_trace_ring.h"
+
+// The number of records in the ring that background listeners read from
+static const size_t kRingCapacity = 1024;
+
+struct OtbnTraceSource::BackgroundListener {
+  OtbnTraceListener *listener;
+  // The consumer ID in the ring
+  int id;
+  // Set to tell the thread to stop once it has caught up
+  std::atomic<bool> stop;
+  // The sequence number of the next record that the thread will look at. All
+  // records before it have been processed.
+  std::atomic<uint32_t> next_seq;
+  std::thread thread;
+};
 
 static std::unique_ptr<OtbnTraceSource> trace_source;
 
+OtbnTraceSource::~OtbnTraceSource() {
+  for (auto &bg : background_listeners_) {
+    StopBackgroundListener(bg.get());
+  }
+}
+
 OtbnTraceSource &OtbnTraceSource::get() {
   if (!trace_source) {
     trace_source.reset(new OtbnTraceSource());
@@ -21,21 +48,118 @@ void OtbnTraceSource::AddListener(OtbnTraceListener *listener) {
   listeners_.push_back(listener);
 }
 
+// The main function of the thread for a background listener
+static void background_listener_loop(OtbnTraceRing *ring,
+                                     OtbnTraceListener *listener, int id,
+                                     const std::atomic<bool> *stop,
+                                     std::atomic<uint32_t> *next_seq) {
+  OtbnTraceRecord record;
+  unsigned cycle_count;
+  uint32_t seq = next_seq->load(std::memory_order_relaxed);
+  unsigned tries = 0;
+  while (1) {
+    // Check for a stop request before looking at the ring: the request is
+    // made after the last record is published, so if we see it, we will also
+    // see that record.
+    bool stopping = stop->load(std::memory_order_acquire);
+
+    switch (ring->TryRead(id, seq, &record, &cycle_count)) {
+      case OtbnTraceRing::kReadOk:
+        listener->AcceptTraceRecord(record, cycle_count);
+        // fall through
+      case OtbnTraceRing::kReadSkipped:
+        next_seq->store(++seq, std::memory_order_release);
+        tries = 0;
+        break;
+      case OtbnTraceRing::kReadEmpty:
+        if (stopping) {
+          return;
+        }
+        OtbnTraceRing::Backoff(&tries);
+        break;
+    }
+  }
+}
+
+void OtbnTraceSource::AddBackgroundListener(OtbnTraceListener *listener,
+                                            OverflowPolicy policy) {
+  if (!ring_) {
+    ring_.reset(new OtbnTraceRing(kRingCapacity));
+  }
+
+  int id = ring_->AddConsumer(policy == kOverflowDrop);
+  if (id < 0) {
+    throw std::runtime_error("Too many background OTBN trace listeners.");
+  }
+
+  std::unique_ptr<BackgroundListener> bg(new BackgroundListener());
+  bg->listener = listener;
+  bg->id = id;
+  bg->stop.store(false);
+  bg->next_seq.store(ring_->Head());
+  bg->thread = std::thread(background_listener_loop, ring_.get(), listener,
+                           id, &bg->stop, &bg->next_seq);
+  background_listeners_.push_back(std::move(bg));
+}
+
+void OtbnTraceSource::StopBackgroundListener(BackgroundListener *bg) {
+  bg->stop.store(true, std::memory_order_release);
+  bg->thread.join();
+  ring_->RemoveConsumer(bg->id);
+
+  uint64_t dropped = ring_->GetDroppedCount(bg->id);
+  if (dropped) {
+    std::cerr << "WARNING: A background OTBN trace listener dropped "
+              << dropped << " trace records." << std::endl;
+  }
+}
+
 void OtbnTraceSource::RemoveListener(const OtbnTraceListener *listener) {
   auto it = std::find(listeners_.begin(), listeners_.end(), listener);
-  assert(it != listeners_.end());
-  listeners_.erase(it);
+  if (it != listeners_.end()) {
+    listeners_.erase(it);
+    return;
+  }
+
+  auto bg_it =
+      std::find_if(background_listeners_.begin(), background_listeners_.end(),
+                   [&](const std::unique_ptr<BackgroundListener> &bg) {
+                     return bg->listener == listener;
+                   });
+  assert(bg_it != background_listeners_.end());
+  StopBackgroundListener(bg_it->get());
+  background_listeners_.erase(bg_it);
+}
+
+void OtbnTraceSource::Flush() {
+  for (auto &bg : background_listeners_) {
+    unsigned tries = 0;
+    while (bg->next_seq.load(std::memory_order_acquire) != ring_->Head()) {
+      OtbnTraceRing::Backoff(&tries);
+    }
+  }
 }
 
-void OtbnTraceSource::Broadcast(const std::string &trace,
-                                unsigned cycle_count) {
-  for (OtbnTraceListener *listener : listeners_) {
-    listener->AcceptTraceString(trace, cycle_count);
+uint64_t OtbnTraceSource::GetDroppedCount(
+    const OtbnTraceListener *listener) const {
+  for (auto &bg : background_listeners_) {
+    if (bg->listener == listener) {
+      return ring_->GetDroppedCount(bg->id);
+    }
   }
+  return 0;
 }
 
-extern "C" void accept_otbn_trace_string(const char *trace,
-                                         unsigned int cycle_count) {
-  assert(trace != nullptr);
-  OtbnTraceSource::get().Broadcast(trace, cycle_count);
+void OtbnTraceSource::Broadcast(unsigned cycle_count) {
+  if (!record_.Empty()) {
+    // Publish to the background listeners first: the synchronous ones might
+    // format the record, and the copy in the ring doesn't need that.
+    if (!background_listeners_.empty()) {
+      ring_->Publish(record_, cycle_count);
+    }
+    for (OtbnTraceListener *listener : listeners_) {
+      listener->AcceptTraceRecord(record_, cycle_count);
+    }
+  }
+  record_.Clear();
 }
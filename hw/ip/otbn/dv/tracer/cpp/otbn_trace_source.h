@@ -4,35 +4,87 @@
 #ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_SOURCE_H_
 #define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_SOURCE_H_
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 #include "otbn_trace_listener.h"
 
+class OtbnTraceRing;
+
 // A source for simulation trace data.
 //
 // This is a singleton class, which will be constructed on the first call to
 // get() or the first trace data that comes back from the simulation.
 //
-// The object is in charge of taking trace data from the simulation (which is
-// sent by calling the accept_otbn_trace_string DPI function) and passing it
-// out to registered listeners.
+// The object is in charge of taking trace data from the simulation and passing
+// it out to registered listeners. The tracer builds up a record for each cycle
+// by calling the otbn_trace_* DPI functions (defined in otbn_trace_dpi.cc)
+// and then calls otbn_trace_end, which sends the record to the listeners.
+//
+// Listeners added with AddListener are called synchronously, on the
+// simulation thread. Listeners added with AddBackgroundListener run on a
+// thread of their own, which reads records from a ring buffer (see
+// OtbnTraceRing). This keeps slow listeners, like ones that write the trace to
+// a file, from holding up the simulation. Anything that must see a record
+// before the simulation moves on (like the trace checker) should be a
+// synchronous listener.
 
 class OtbnTraceSource {
  public:
+  // What a background listener does if it falls a full ring of records
+  // behind the simulation
+  enum OverflowPolicy {
+    // Make the simulation wait, so that no records are lost
+    kOverflowBlock,
+    // Drop the oldest records that the listener hasn't seen, counting them
+    kOverflowDrop,
+  };
+
+  ~OtbnTraceSource();
+
   // Get the (singleton) OtbnTraceSource object
   static OtbnTraceSource &get();
 
-  // Add a listener to the source
+  // Add a listener to the source, which will be called on the simulation
+  // thread
   void AddListener(OtbnTraceListener *listener);
 
-  // Remove a listener from the source
+  // Add a listener to the source, which will be called on a thread of its own.
+  // Throws std::runtime_error if there are too many background listeners.
+  void AddBackgroundListener(OtbnTraceListener *listener,
+                             OverflowPolicy policy);
+
+  // Remove a listener from the source. For a background listener, this waits
+  // for it to process every record that has been sent so far and then stops
+  // its thread, printing a warning if any records were dropped.
   void RemoveListener(const OtbnTraceListener *listener);
 
-  // Send a trace string to all listeners
-  void Broadcast(const std::string &trace, unsigned cycle_count);
+  // Wait until every background listener has processed every record that has
+  // been sent so far
+  void Flush();
+
+  // The number of records that a background listener has dropped
+  uint64_t GetDroppedCount(const OtbnTraceListener *listener) const;
+
+  // The record that is being built up for the current cycle
+  OtbnTraceRecord &CurrentRecord() { return record_; }
+
+  // Send the current record to all listeners (if it isn't empty) and then
+  // clear it.
+  void Broadcast(unsigned cycle_count);
 
  private:
+  struct BackgroundListener;
+
+  // Wait for a background listener to catch up and then stop its thread
+  void StopBackgroundListener(BackgroundListener *bg);
+
   std::vector<OtbnTraceListener *> listeners_;
+  std::vector<std::unique_ptr<BackgroundListener>> background_listeners_;
+  // The ring that background listeners read from (created with the first one)
+  std::unique_ptr<OtbnTraceRing> ring_;
+  OtbnTraceRecord record_;
 };
 
 #endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_SOURCE_H_
@@ -0,0 +1,273 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// A command line tool for reading OTBN traces in the binary trace format (see
+// otbn_binary_trace.h), as written by otbn_top_sim --otbn-trace-bin.
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "log_trace_listener.h"
+#include "otbn_binary_trace.h"
+
+static void print_usage(const char *argv0) {
+  std::cout
+      << "Usage: " << argv0 << " [OPTION]... TRACE\n\n"
+      << "Read an OTBN binary trace and print it in the text log format.\n\n"
+         "  --cycles=FIRST[:LAST]\n"
+         "      Only print records from cycles FIRST to LAST (inclusive).\n"
+         "      Either end may be omitted.\n"
+         "  --reg=NAME[,NAME...]\n"
+         "      Only print records that read or write one of the given\n"
+         "      locations, named as in the trace (like x5, w12, ACC,\n"
+         "      FLAGS0 or MEM). May be given more than once.\n"
+         "  --pc=ADDR[:ADDR]\n"
+         "      Only print records for instructions at ADDR (or in the\n"
+         "      range).\n"
+         "  --insn=VALUE[/MASK]\n"
+         "      Only print records for instructions whose bits match VALUE\n"
+         "      under MASK (default: all ones).\n"
+         "  --limit=N\n"
+         "      Stop after N records.\n"
+         "  --count\n"
+         "      Print the number of matching records instead of the records.\n"
+         "  --index\n"
+         "      Print the block index of the trace instead of the records.\n"
+         "  -o, --output=FILE\n"
+         "      Write to FILE instead of stdout.\n"
+         "  -h, --help\n"
+         "      Show this help.\n";
+}
+
+// Parse an unsigned number in any base that strtoul understands
+static bool parse_u32(const std::string &str, uint32_t *dst) {
+  if (str.empty())
+    return false;
+  errno = 0;
+  char *end;
+  unsigned long value = strtoul(str.c_str(), &end, 0);
+  if (errno || *end || value > UINT32_MAX)
+    return false;
+  *dst = value;
+  return true;
+}
+
+// Parse "FIRST:LAST", "FIRST", "FIRST:" or ":LAST". If there's no separator,
+// the range is a single value.
+static bool parse_range(const std::string &str, uint32_t *first,
+                        uint32_t *last) {
+  size_t colon = str.find(':');
+  if (colon == std::string::npos) {
+    return parse_u32(str, first) && parse_u32(str, last);
+  }
+
+  std::string lo = str.substr(0, colon), hi = str.substr(colon + 1);
+  *first = 0;
+  *last = UINT32_MAX;
+  return (lo.empty() || parse_u32(lo, first)) &&
+         (hi.empty() || parse_u32(hi, last)) && *first <= *last;
+}
+
+// Convert a location name as given on the command line to its ID. Register
+// numbers don't need a leading zero and names are case insensitive. Returns
+// false if the name isn't one that the tracer uses.
+static bool parse_loc(const std::string &name, uint16_t *loc) {
+  char prefix = name.empty() ? 0 : tolower(name[0]);
+  if ((prefix == 'x' || prefix == 'w') && name.size() >= 2 &&
+      isdigit(name[1])) {
+    uint32_t idx;
+    if (!parse_u32(name.substr(1), &idx) || idx >= 32)
+      return false;
+    *loc = (prefix == 'x' ? OtbnTraceLoc::X0 : OtbnTraceLoc::W0) + idx;
+    return true;
+  }
+
+  std::string upper;
+  for (char c : name) {
+    upper.push_back(toupper(c));
+  }
+  for (uint16_t i = OtbnTraceLoc::Mod; i < OtbnTraceLoc::NumFixed; ++i) {
+    if (OtbnTraceLoc::Name(i) == upper) {
+      *loc = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void print_index(const OtbnBinaryTraceReader &reader, std::ostream &os) {
+  uint64_t records = 0, compressed = 0, uncompressed = 0;
+  os << "block     offset   records  first cycle   last cycle   "
+        "min pc     max pc\n";
+  for (size_t i = 0; i < reader.Blocks().size(); ++i) {
+    const OtbnBinaryTraceBlock &block = reader.Blocks()[i];
+    os << std::setw(5) << i << " " << std::setw(10) << block.offset << " "
+       << std::setw(9) << block.num_records << " " << std::setw(12)
+       << block.first_cycle << " " << std::setw(12) << block.last_cycle;
+    if (block.pc_min <= block.pc_max) {
+      os << std::hex << std::setfill('0') << "   0x" << std::setw(8)
+         << block.pc_min << " 0x" << std::setw(8) << block.pc_max << std::dec
+         << std::setfill(' ');
+    }
+    os << "\n";
+
+    records += block.num_records;
+    compressed += block.compressed_size;
+    uncompressed += block.uncompressed_size;
+  }
+  os << reader.Blocks().size() << " blocks, " << records << " records, "
+     << compressed << " bytes compressed from " << uncompressed << "\n";
+  if (!reader.Monotonic()) {
+    os << "Blocks are not in cycle order (OTBN was reset during the trace)\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  const struct option long_options[] = {
+      {"cycles", required_argument, nullptr, 'c'},
+      {"reg", required_argument, nullptr, 'r'},
+      {"pc", required_argument, nullptr, 'p'},
+      {"insn", required_argument, nullptr, 'i'},
+      {"limit", required_argument, nullptr, 'l'},
+      {"count", no_argument, nullptr, 'n'},
+      {"index", no_argument, nullptr, 'x'},
+      {"output", required_argument, nullptr, 'o'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, no_argument, nullptr, 0}};
+
+  uint32_t first_cycle = 0, last_cycle = UINT32_MAX;
+  uint32_t limit = UINT32_MAX;
+  bool count_only = false, index_only = false;
+  std::string output;
+  OtbnTraceFilter filter;
+
+  while (1) {
+    int c = getopt_long(argc, argv, "o:h", long_options, nullptr);
+    if (c == -1) {
+      break;
+    }
+
+    std::string arg = optarg ? optarg : "";
+    bool ok = true;
+    switch (c) {
+      case 'c':
+        ok = parse_range(arg, &first_cycle, &last_cycle);
+        break;
+      case 'r': {
+        size_t start = 0;
+        while (ok && start <= arg.size()) {
+          size_t comma = arg.find(',', start);
+          if (comma == std::string::npos)
+            comma = arg.size();
+          uint16_t loc;
+          ok = parse_loc(arg.substr(start, comma - start), &loc);
+          if (ok)
+            filter.locs.push_back(loc);
+          start = comma + 1;
+        }
+        break;
+      }
+      case 'p':
+        filter.match_pc = true;
+        ok = parse_range(arg, &filter.pc_min, &filter.pc_max);
+        break;
+      case 'i': {
+        filter.match_insn = true;
+        size_t slash = arg.find('/');
+        filter.insn_mask = UINT32_MAX;
+        ok = parse_u32(arg.substr(0, slash), &filter.insn) &&
+             (slash == std::string::npos ||
+              parse_u32(arg.substr(slash + 1), &filter.insn_mask));
+        break;
+      }
+      case 'l':
+        ok = parse_u32(arg, &limit);
+        break;
+      case 'n':
+        count_only = true;
+        break;
+      case 'x':
+        index_only = true;
+        break;
+      case 'o':
+        output = arg;
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return 0;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!ok) {
+      for (const struct option &opt : long_options) {
+        if (opt.val == c) {
+          std::cerr << "ERROR: Bad argument for --" << opt.name << ": `"
+                    << arg << "'" << std::endl;
+        }
+      }
+      return 1;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::ofstream out_file;
+  if (!output.empty()) {
+    out_file.open(output);
+    if (!out_file.is_open()) {
+      std::cerr << "ERROR: Could not open output file: " << output
+                << std::endl;
+      return 1;
+    }
+  }
+  std::ostream &os = output.empty() ? std::cout : out_file;
+
+  try {
+    OtbnBinaryTraceReader reader(argv[optind]);
+    if (reader.Recovered()) {
+      std::cerr << "WARNING: Trace has no index (the simulation may not have "
+                   "finished cleanly). Rebuilt it from "
+                << reader.Blocks().size() << " blocks." << std::endl;
+    }
+
+    if (index_only) {
+      print_index(reader, os);
+      return 0;
+    }
+
+    uint32_t matches = 0;
+    reader.Read(first_cycle, last_cycle, filter,
+                [&](const OtbnTraceRecord &record, unsigned cycle_count) {
+                  if (matches == limit)
+                    return false;
+                  ++matches;
+                  if (!count_only) {
+                    LogTraceListener::WriteTrace(os, record.ToString(),
+                                                 cycle_count);
+                  }
+                  return true;
+                });
+
+    if (count_only) {
+      os << matches << "\n";
+    }
+  } catch (const std::runtime_error &err) {
+    std::cerr << "ERROR: " << err.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
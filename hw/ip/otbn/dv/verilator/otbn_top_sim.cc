@@ -11,9 +11,11 @@
 #include <svdpi.h>
 
 #include "Votbn_top_sim__Syms.h"
+#include "binary_trace_listener.h"
 #include "log_trace_listener.h"
 #include "otbn_memutil.h"
 #include "otbn_model.h"
+#include "otbn_profile_listener.h"
 #include "otbn_trace_checker.h"
 #include "otbn_trace_source.h"
 #include "sv_scoped.h"
@@ -31,18 +33,29 @@ extern int otbn_core_get_stop_pc();
 }
 
 /**
- * SimCtrlExtension that adds a '--otbn-trace-file' command line option. If set
- * it sets up a LogTraceListener that will dump out the trace to the given log
- * file
+ * SimCtrlExtension that adds '--otbn-trace-file' and '--otbn-trace-bin'
+ * command line options. These set up a LogTraceListener or a
+ * BinaryTraceListener that will dump out the trace to the given file. The
+ * listeners run on background threads, so writing the trace doesn't hold up
+ * the simulation.
+ *
+ * It also adds '--otbn-profile', which sets up an OtbnProfileListener that
+ * attributes cycles to the symbols in the ELF file loaded by memutil and
+ * writes its reports when the simulation ends.
  */
 class OtbnTraceUtil : public SimCtrlExtension {
  private:
+  const OtbnMemUtil &memutil_;
   std::unique_ptr<LogTraceListener> log_trace_listener_;
+  std::unique_ptr<BinaryTraceListener> binary_trace_listener_;
+  std::unique_ptr<OtbnProfileListener> profile_listener_;
+  std::string profile_prefix_;
 
   bool SetupTraceLog(const std::string &log_filename) {
     try {
       log_trace_listener_.reset(new LogTraceListener(log_filename));
-      OtbnTraceSource::get().AddListener(log_trace_listener_.get());
+      OtbnTraceSource::get().AddBackgroundListener(
+          log_trace_listener_.get(), OtbnTraceSource::kOverflowBlock);
       return true;
     } catch (const std::runtime_error &err) {
       std::cerr << "ERROR: Failed to set up trace log: " << err.what()
@@ -53,16 +66,53 @@ class OtbnTraceUtil : public SimCtrlExtension {
     return false;
   }
 
+  bool SetupBinaryTrace(const std::string &filename) {
+    try {
+      binary_trace_listener_.reset(new BinaryTraceListener(filename));
+      OtbnTraceSource::get().AddBackgroundListener(
+          binary_trace_listener_.get(), OtbnTraceSource::kOverflowBlock);
+      return true;
+    } catch (const std::runtime_error &err) {
+      std::cerr << "ERROR: Failed to set up binary trace: " << err.what()
+                << std::endl;
+      return false;
+    }
+  }
+
+  void SetupProfile(const std::string &prefix) {
+    // The profiler is cheap, so it runs on the simulation thread. That way it
+    // reads the symbol table after the ELF file has been loaded, and there's
+    // no race with memutil loading another one.
+    profile_prefix_ = prefix;
+    if (!profile_listener_) {
+      profile_listener_.reset(
+          new OtbnProfileListener(&memutil_.GetImemSymbols()));
+      OtbnTraceSource::get().AddListener(profile_listener_.get());
+    }
+  }
+
   void PrintHelp() {
     std::cout << "Trace log utilities:\n\n"
                  "--otbn-trace-file=FILE\n"
-                 "  Write OTBN trace log to FILE\n\n";
+                 "  Write OTBN trace log to FILE\n\n"
+                 "--otbn-trace-bin=FILE\n"
+                 "  Write OTBN trace to FILE in the binary trace format,\n"
+                 "  which can be read with otbn_trace_tool\n\n"
+                 "--otbn-profile=PREFIX\n"
+                 "  Profile the cycles spent in each symbol of the loaded ELF\n"
+                 "  file, writing a flat profile to PREFIX.flat, a call graph\n"
+                 "  to PREFIX.callgraph and folded stacks (for\n"
+                 "  flamegraph.pl) to PREFIX.folded\n\n";
   }
 
  public:
+  explicit OtbnTraceUtil(const OtbnMemUtil &memutil) : memutil_(memutil) {}
+
   virtual bool ParseCLIArguments(int argc, char **argv, bool &exit_app) {
     const struct option long_options[] = {
         {"otbn-trace-file", required_argument, nullptr, 'l'},
+        {"otbn-trace-bin", required_argument, nullptr, 'b'},
+        {"otbn-profile", required_argument, nullptr, 'p'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, no_argument, nullptr, 0}};
 
@@ -80,7 +130,16 @@ class OtbnTraceUtil : public SimCtrlExtension {
         case 1:
           break;
         case 'l':
-          return SetupTraceLog(optarg);
+          if (!SetupTraceLog(optarg))
+            return false;
+          break;
+        case 'b':
+          if (!SetupBinaryTrace(optarg))
+            return false;
+          break;
+        case 'p':
+          SetupProfile(optarg);
+          break;
         case 'h':
           PrintHelp();
           break;
@@ -93,6 +152,12 @@ class OtbnTraceUtil : public SimCtrlExtension {
   ~OtbnTraceUtil() {
     if (log_trace_listener_)
       OtbnTraceSource::get().RemoveListener(log_trace_listener_.get());
+    if (binary_trace_listener_)
+      OtbnTraceSource::get().RemoveListener(binary_trace_listener_.get());
+    if (profile_listener_) {
+      OtbnTraceSource::get().RemoveListener(profile_listener_.get());
+      profile_listener_->WriteReports(profile_prefix_);
+    }
   }
 };
 
@@ -101,7 +166,7 @@ static OtbnMemUtil otbn_memutil("TOP.otbn_top_sim");
 
 int main(int argc, char **argv) {
   VerilatorMemUtil memutil(&otbn_memutil);
-  OtbnTraceUtil traceutil;
+  OtbnTraceUtil traceutil(otbn_memutil);
 
   otbn_top_sim top;
   // Make the otbn_top_sim object visible to OtbnTopApplyLoopWarp.
@@ -6,8 +6,7 @@
 
 #include <algorithm>
 #include <cassert>
-#include <functional>
-#include <iostream>
+#include <cstring>
 #include <stdint.h>
 #include <vector>
 
@@ -23,299 +22,365 @@ static const uint32_t kNumAddrSubstPermRounds = 2;
 static const uint32_t kNumDataSubstPermRounds = 2;
 static const uint32_t kNumPrinceHalfRounds = 3;
 
-static std::vector<uint8_t> byte_reverse_vector(
-    const std::vector<uint8_t> &vec_in) {
-  std::vector<uint8_t> vec_out(vec_in.size());
-
-  std::reverse_copy(std::begin(vec_in), std::end(vec_in), std::begin(vec_out));
-
-  return vec_out;
+static uint64_t width_mask(uint32_t width) {
+  return width >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
 }
 
-static uint8_t read_vector_bit(const std::vector<uint8_t> &vec,
-                               uint32_t bit_pos) {
-  assert(bit_pos / 8 < vec.size());
-
-  return (vec[bit_pos / 8] >> (bit_pos % 8)) & 1;
-}
+// Read count bits from buf, starting at bit_pos, where count <= 64
+static uint64_t read_bits(const uint8_t *buf, uint32_t bit_pos,
+                          uint32_t count) {
+  assert(count <= 64);
 
-static void or_vector_bit(std::vector<uint8_t> &vec, uint32_t bit_pos,
-                          uint8_t bit) {
-  assert(bit_pos / 8 < vec.size());
+  uint64_t ret = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t pos = bit_pos + i;
+    ret |= (uint64_t)((buf[pos / 8] >> (pos % 8)) & 1) << i;
+  }
 
-  vec[bit_pos / 8] |= bit << (bit_pos % 8);
+  return ret;
 }
 
-static std::vector<uint8_t> xor_vectors(const std::vector<uint8_t> &vec_a,
-                                        const std::vector<uint8_t> &vec_b) {
-  assert(vec_a.size() == vec_b.size());
-
-  std::vector<uint8_t> vec_out(vec_a.size());
+// Write the bottom count bits of bits to buf, starting at bit_pos
+static void write_bits(uint8_t *buf, uint32_t bit_pos, uint64_t bits,
+                       uint32_t count) {
+  assert(count <= 64);
 
-  std::transform(vec_a.begin(), vec_a.end(), vec_b.begin(), vec_out.begin(),
-                 std::bit_xor<uint8_t>{});
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t pos = bit_pos + i;
+    uint8_t mask = 1 << (pos % 8);
+    uint8_t bit = ((bits >> i) & 1) << (pos % 8);
+    buf[pos / 8] = (buf[pos / 8] & ~mask) | bit;
+  }
+}
 
-  return vec_out;
+// Read a little endian 64-bit integer from bytes
+static uint64_t read_le64(const uint8_t *bytes) {
+  uint64_t ret = 0;
+  for (int i = 7; i >= 0; --i) {
+    ret = (ret << 8) | bytes[i];
+  }
+  return ret;
 }
 
-// Run each 4-bit chunk of bytes from `in` through the SBOX. Where `bit_width`
-// isn't a multiple of 4 the remaining bits are just copied straight through.
-// `invert` choose whether to use the inverted SBOX or not.
-static std::vector<uint8_t> scramble_sbox_layer(const std::vector<uint8_t> &in,
-                                                uint32_t bit_width,
-                                                uint8_t sbox[16]) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  std::vector<uint8_t> out(in.size(), 0);
+// Run each 4-bit chunk of `in` through the SBOX. Where `bit_width` isn't a
+// multiple of 4 the remaining bits are just copied straight through.
+static uint64_t scramble_sbox_layer(uint64_t in, uint32_t bit_width,
+                                    const uint8_t sbox[16]) {
+  assert(bit_width <= 64);
+
+  uint64_t out = 0;
 
   // Iterate through each 4 bit chunk of the data and apply the appropriate SBOX
   for (uint32_t i = 0; i < bit_width / 4; ++i) {
-    uint8_t sbox_in, sbox_out;
-
-    sbox_in = in[i / 2];
-
-    int shift = (i % 2) ? 4 : 0;
-    sbox_in = (sbox_in >> shift) & 0xf;
-
-    sbox_out = sbox[sbox_in];
-
-    out[i / 2] |= sbox_out << shift;
+    out |= (uint64_t)sbox[(in >> (4 * i)) & 0xf] << (4 * i);
   }
 
   // Where bit_width is not a multiple of 4 copy over the remaining bits
-  if (bit_width % 4) {
-    int shift = ((bit_width % 8) >= 4) ? 4 : 0;
-    uint8_t nibble = (in[bit_width / 8] >> shift) & 0xf;
-    out[bit_width / 8] |= nibble << shift;
-  }
+  out |= in & width_mask(bit_width) & ~width_mask(4 * (bit_width / 4));
 
   return out;
 }
 
-// Reverse bits from incoming byte vector
-static std::vector<uint8_t> scramble_flip_layer(const std::vector<uint8_t> &in,
-                                                uint32_t bit_width) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  std::vector<uint8_t> out(in.size(), 0);
+// Reverse the bottom bit_width bits of `in`
+static uint64_t scramble_flip_layer(uint64_t in, uint32_t bit_width) {
+  uint64_t out = 0;
 
   for (uint32_t i = 0; i < bit_width; ++i) {
-    or_vector_bit(out, bit_width - i - 1, read_vector_bit(in, i));
+    out |= ((in >> i) & 1) << (bit_width - i - 1);
   }
 
   return out;
 }
 
-// Apply butterfly to incoming byte vector. Even bits are placed in the lower
-// half of the output, odd bits are placed in the upper half of the output.
-static std::vector<uint8_t> scramble_perm_layer(const std::vector<uint8_t> &in,
-                                                uint32_t bit_width,
-                                                bool invert) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  std::vector<uint8_t> out(in.size(), 0);
+// Apply butterfly to `in`. Even bits are placed in the lower half of the
+// output, odd bits are placed in the upper half of the output.
+static uint64_t scramble_perm_layer(uint64_t in, uint32_t bit_width,
+                                    bool invert) {
+  uint64_t out = 0;
+  uint32_t half = bit_width / 2;
 
-  for (uint32_t i = 0; i < bit_width / 2; ++i) {
+  for (uint32_t i = 0; i < half; ++i) {
     if (invert) {
-      or_vector_bit(out, i * 2, read_vector_bit(in, i));
-      or_vector_bit(out, i * 2 + 1, read_vector_bit(in, i + (bit_width / 2)));
+      out |= ((in >> i) & 1) << (i * 2);
+      out |= ((in >> (i + half)) & 1) << (i * 2 + 1);
     } else {
-      or_vector_bit(out, i, read_vector_bit(in, i * 2));
-      or_vector_bit(out, i + (bit_width / 2), read_vector_bit(in, i * 2 + 1));
+      out |= ((in >> (i * 2)) & 1) << i;
+      out |= ((in >> (i * 2 + 1)) & 1) << (i + half);
     }
   }
 
   if (bit_width % 2) {
     // Where bit_width isn't even, the final bit is copied across to the same
     // position
-    or_vector_bit(out, bit_width - 1, read_vector_bit(in, bit_width - 1));
+    out |= in & ((uint64_t)1 << (bit_width - 1));
   }
 
   return out;
 }
 
 // Apply a full set of subsitution/permutation rounds for encrypt to the
-// incoming byte vector
-static std::vector<uint8_t> scramble_subst_perm_enc(
-    const std::vector<uint8_t> &in, const std::vector<uint8_t> &key,
-    uint32_t bit_width, uint32_t num_rounds) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  assert(key.size() == ((bit_width + 7) / 8));
-
-  std::vector<uint8_t> state(in);
+// bottom bit_width bits of `in`
+static uint64_t scramble_subst_perm_enc(uint64_t in, uint64_t key,
+                                        uint32_t bit_width,
+                                        uint32_t num_rounds) {
+  uint64_t state = in & width_mask(bit_width);
 
   for (uint32_t i = 0; i < num_rounds; ++i) {
-    state = xor_vectors(state, key);
+    state ^= key;
 
     state = scramble_sbox_layer(state, bit_width, PRESENT_SBOX4);
     state = scramble_flip_layer(state, bit_width);
     state = scramble_perm_layer(state, bit_width, false);
   }
 
-  state = xor_vectors(state, key);
-
-  return state;
+  return state ^ key;
 }
 
 // Apply a full set of substitution/permutation rounds for decrypt to the
-// incoming byte vector
-static std::vector<uint8_t> scramble_subst_perm_dec(
-    const std::vector<uint8_t> &in, const std::vector<uint8_t> &key,
-    uint32_t bit_width, uint32_t num_rounds) {
-  assert(in.size() == ((bit_width + 7) / 8));
-  assert(key.size() == ((bit_width + 7) / 8));
-
-  std::vector<uint8_t> state(in);
+// bottom bit_width bits of `in`
+static uint64_t scramble_subst_perm_dec(uint64_t in, uint64_t key,
+                                        uint32_t bit_width,
+                                        uint32_t num_rounds) {
+  uint64_t state = in & width_mask(bit_width);
 
   for (uint32_t i = 0; i < num_rounds; ++i) {
-    state = xor_vectors(state, key);
+    state ^= key;
 
     state = scramble_perm_layer(state, bit_width, true);
     state = scramble_flip_layer(state, bit_width);
     state = scramble_sbox_layer(state, bit_width, PRESENT_SBOX4_INV);
   }
 
-  state = xor_vectors(state, key);
-
-  return state;
+  return state ^ key;
 }
 
-// Generate a keystream for XORing with data using PRINCE.
-// If repeat_keystream is set to true, the output from one PRINCE instance is
-// repeated when the keystream is greater than a single PRINCE width (64bit).
-// Otherwise, multiple PRINCEs are instantiated to form the keystream.
-static std::vector<uint8_t> scramble_gen_keystream(
-    const std::vector<uint8_t> &addr, uint32_t addr_width,
-    const std::vector<uint8_t> &nonce, const std::vector<uint8_t> &key,
-    uint32_t keystream_width, uint32_t num_half_rounds, bool repeat_keystream) {
-  assert(key.size() == (kPrinceWidthByte * 2));
+// Generate the idx'th 64-bit block of keystream using PRINCE. The initial
+// vector for PRINCE is formed from the address and nonce: the bottom
+// addr_width bits are the address and the other bits are taken from the nonce.
+// Each PRINCE instance uses different nonce bits.
+static uint64_t scramble_keystream_block(uint32_t addr, uint32_t addr_width,
+                                         const uint8_t *nonce, uint64_t k0,
+                                         uint64_t k1, uint32_t idx) {
+  assert(addr_width < kPrinceWidth);
 
-  // Determine how many PRINCE replications are required
-  uint32_t num_princes, num_repetitions;
-  if (repeat_keystream) {
-    num_princes = 1;
-    num_repetitions = (keystream_width + kPrinceWidth - 1) / kPrinceWidth;
-  } else {
-    num_princes = (keystream_width + kPrinceWidth - 1) / kPrinceWidth;
-    num_repetitions = 1;
-  }
+  uint32_t nonce_bits = kPrinceWidth - addr_width;
+  uint64_t iv = (addr & width_mask(addr_width)) |
+                (read_bits(nonce, idx * nonce_bits, nonce_bits) << addr_width);
 
-  std::vector<uint8_t> keystream;
-
-  for (uint32_t i = 0; i < num_princes; ++i) {
-    // Initial vector is data for PRINCE to encrypt. Formed from nonce and data
-    // address
-    std::vector<uint8_t> iv(8, 0);
-
-    for (uint32_t j = 0; j < kPrinceWidth; ++j) {
-      if (j < addr_width) {
-        // Bottom addr_width bits of IV are address
-        or_vector_bit(iv, j, read_vector_bit(addr, j));
-      } else {
-        // Other bits are taken from nonce. Each PRINCE instantiation will use
-        // different nonce bits.
-        int nonce_bit = (j - addr_width) + i * (kPrinceWidth - addr_width);
-        or_vector_bit(iv, j, read_vector_bit(nonce, nonce_bit));
-      }
+  return prince_enc_dec_uint64(iv, k0, k1, 0, kNumPrinceHalfRounds, 0);
+}
+
+// XOR the first data_width bits of in with the keystream for addr, writing
+// the result to out. If repeat_keystream is set to true, the output from one
+// PRINCE instance is repeated when the keystream is greater than a single
+// PRINCE width (64bit). Otherwise, multiple PRINCEs are used to form the
+// keystream. Keystream bits above data_width are zero, so any bits of in above
+// data_width are copied unchanged.
+static inline void scramble_xor_keystream(const uint8_t *in, uint8_t *out,
+                                          uint32_t data_width, uint32_t addr,
+                                          uint32_t addr_width,
+                                          const uint8_t *nonce,
+                                          const uint8_t *key,
+                                          bool repeat_keystream) {
+  // The PRINCE C reference model takes K0 from the top half of the key and K1
+  // from the bottom half (reading each as big-endian after flipping the
+  // little-endian key).
+  uint64_t k0 = read_le64(key + kPrinceWidthByte);
+  uint64_t k1 = read_le64(key);
+
+  uint32_t num_bytes = (data_width + 7) / 8;
+  uint64_t block = 0;
+
+  for (uint32_t i = 0; i < num_bytes; ++i) {
+    uint32_t block_idx = i / kPrinceWidthByte;
+    if (i % kPrinceWidthByte == 0 && (block_idx == 0 || !repeat_keystream)) {
+      block = scramble_keystream_block(addr, addr_width, nonce, k0, k1,
+                                       block_idx);
     }
 
-    // PRINCE C reference model works on big-endian byte order
-    iv = byte_reverse_vector(iv);
-    auto key_be = byte_reverse_vector(key);
-
-    // Apply PRINCE to IV to produce keystream
-    std::vector<uint8_t> keystream_block(kPrinceWidthByte);
-    prince_enc_dec(&iv[0], &key_be[0], &keystream_block[0], 0, num_half_rounds,
-                   0);
-
-    // Flip keystream into little endian order and add to keystream vector
-    keystream_block = byte_reverse_vector(keystream_block);
-    // Repeat the output of a single PRINCE instance if needed
-    for (uint32_t k = 0; k < num_repetitions; ++k) {
-      keystream.insert(keystream.end(), keystream_block.begin(),
-                       keystream_block.end());
+    uint8_t keystream = block >> (8 * (i % kPrinceWidthByte));
+    if (i == num_bytes - 1 && data_width % 8) {
+      keystream &= (1 << (data_width % 8)) - 1;
     }
+
+    out[i] = in[i] ^ keystream;
   }
+}
+
+// Split the first bit_width bits of buf into subst_perm_width chunks and
+// individually apply the substitution/permutation layer to each in place. Bits
+// above bit_width in the final byte are cleared.
+static void scramble_subst_perm_full_width(uint8_t *buf, uint32_t bit_width,
+                                           uint32_t subst_perm_width,
+                                           bool enc) {
+  assert(0 < subst_perm_width && subst_perm_width <= kPrinceWidth);
 
-  // Total keystream bits generated are some multiple of kPrinceWidth. This can
-  // result in unused keystream bits. Remove the unused bytes from the keystream
-  // vector and zero out top unused bits in the final byte if required.
-  uint32_t keystream_bytes = (keystream_width + 7) / 8;
-  uint32_t keystream_bytes_to_erase = keystream.size() - keystream_bytes;
-  if (keystream_bytes_to_erase) {
-    keystream.erase(keystream.end() - keystream_bytes_to_erase,
-                    keystream.end());
+  for (uint32_t lo = 0; lo < bit_width; lo += subst_perm_width) {
+    // Where bit_width does not evenly divide into subst_perm_width the
+    // final block is smaller.
+    uint32_t block_width = std::min(subst_perm_width, bit_width - lo);
+
+    uint64_t block = read_bits(buf, lo, block_width);
+    block = enc ? scramble_subst_perm_enc(block, 0, block_width,
+                                          kNumDataSubstPermRounds)
+                : scramble_subst_perm_dec(block, 0, block_width,
+                                          kNumDataSubstPermRounds);
+    write_bits(buf, lo, block, block_width);
   }
 
-  if (keystream_width % 8) {
-    keystream[keystream.size() - 1] &= (1 << (keystream_width % 8)) - 1;
+  if (bit_width % 8) {
+    buf[bit_width / 8] &= (1 << (bit_width % 8)) - 1;
   }
+}
+
+static inline void scramble_encrypt_impl(
+    const uint8_t *data_in, uint8_t *data_out, uint32_t data_width,
+    uint32_t subst_perm_width, uint32_t addr, uint32_t addr_width,
+    const uint8_t *nonce, const uint8_t *key, bool repeat_keystream,
+    bool use_sp_layer) {
+  // Data is encrypted by XORing with keystream then applying
+  // substitution/permutation layer
+  scramble_xor_keystream(data_in, data_out, data_width, addr, addr_width,
+                         nonce, key, repeat_keystream);
 
-  return keystream;
+  if (use_sp_layer) {
+    scramble_subst_perm_full_width(data_out, data_width, subst_perm_width,
+                                   true);
+  }
 }
 
-// Split incoming data into subst_perm_width chunks and individually apply the
-// substitution/permutation layer to each
-static std::vector<uint8_t> scramble_subst_perm_full_width(
-    const std::vector<uint8_t> &in, uint32_t bit_width,
-    uint32_t subst_perm_width, bool enc) {
-  assert(in.size() == ((bit_width + 7) / 8));
+static inline void scramble_decrypt_impl(
+    const uint8_t *data_in, uint8_t *data_out, uint32_t data_width,
+    uint32_t subst_perm_width, uint32_t addr, uint32_t addr_width,
+    const uint8_t *nonce, const uint8_t *key, bool repeat_keystream,
+    bool use_sp_layer) {
+  if (use_sp_layer) {
+    // Data is decrypted by reversing substitution/permutation layer then XORing
+    // with keystream
+    if (data_out != data_in) {
+      memcpy(data_out, data_in, (data_width + 7) / 8);
+    }
+    scramble_subst_perm_full_width(data_out, data_width, subst_perm_width,
+                                   false);
+    data_in = data_out;
+  }
 
-  // Determine how many bytes each subst_perm_width chunk is and how many
-  // chunks are needed to cover the full bit_width.
-  uint32_t subst_perm_bytes = (subst_perm_width + 7) / 8;
-  uint32_t subst_perm_blocks =
-      (bit_width + subst_perm_width - 1) / subst_perm_width;
+  scramble_xor_keystream(data_in, data_out, data_width, addr, addr_width,
+                         nonce, key, repeat_keystream);
+}
 
-  std::vector<uint8_t> out(in.size(), 0);
-  std::vector<uint8_t> zero_key(subst_perm_bytes, 0);
+uint32_t scramble_addr_int(uint32_t addr_in, uint32_t addr_width,
+                           const uint8_t *nonce, uint32_t nonce_width) {
+  assert(addr_width <= 32);
+  assert(addr_width <= nonce_width);
 
-  auto sp_scrambler = enc ? scramble_subst_perm_enc : scramble_subst_perm_dec;
+  // Address is scrambled by using substitution/permutation layer with the nonce
+  // used as a key. The key is made from the top addr_width bits of the nonce.
+  uint64_t addr_enc_nonce =
+      read_bits(nonce, nonce_width - addr_width, addr_width);
 
-  for (uint32_t i = 0; i < subst_perm_blocks; ++i) {
-    // Where bit_width does not evenly divide into subst_perm_width the
-    // final block is smaller.
-    uint32_t bits_so_far = subst_perm_width * i;
-    uint32_t block_width = std::min(subst_perm_width, bit_width - bits_so_far);
+  return scramble_subst_perm_enc(addr_in, addr_enc_nonce, addr_width,
+                                 kNumAddrSubstPermRounds);
+}
 
-    std::vector<uint8_t> subst_perm_data(subst_perm_bytes, 0);
+void scramble_encrypt_buf(const uint8_t *data_in, uint8_t *data_out,
+                          uint32_t data_width, uint32_t subst_perm_width,
+                          uint32_t addr, uint32_t addr_width,
+                          const uint8_t *nonce, const uint8_t *key,
+                          bool repeat_keystream, bool use_sp_layer) {
+  scramble_encrypt_impl(data_in, data_out, data_width, subst_perm_width, addr,
+                        addr_width, nonce, key, repeat_keystream,
+                        use_sp_layer);
+}
 
-    // Extract bits from in for this chunk
-    for (uint32_t j = 0; j < block_width; ++j) {
-      or_vector_bit(subst_perm_data, j,
-                    read_vector_bit(in, j + i * subst_perm_width));
-    }
+void scramble_decrypt_buf(const uint8_t *data_in, uint8_t *data_out,
+                          uint32_t data_width, uint32_t subst_perm_width,
+                          uint32_t addr, uint32_t addr_width,
+                          const uint8_t *nonce, const uint8_t *key,
+                          bool repeat_keystream, bool use_sp_layer) {
+  scramble_decrypt_impl(data_in, data_out, data_width, subst_perm_width, addr,
+                        addr_width, nonce, key, repeat_keystream,
+                        use_sp_layer);
+}
 
-    // Apply the substitution/permutation layer to the chunk
-    auto subst_perm_out = sp_scrambler(subst_perm_data, zero_key, block_width,
-                                       kNumDataSubstPermRounds);
+template <uint32_t DataWidth>
+ScrambleWord<DataWidth> scramble_encrypt_word(
+    const ScrambleWord<DataWidth> &data_in, uint32_t subst_perm_width,
+    uint32_t addr, uint32_t addr_width, const uint8_t *nonce,
+    const uint8_t *key, bool repeat_keystream, bool use_sp_layer) {
+  ScrambleWord<DataWidth> data_out;
+  scramble_encrypt_impl(data_in.data(), data_out.data(), DataWidth,
+                        subst_perm_width, addr, addr_width, nonce, key,
+                        repeat_keystream, use_sp_layer);
+  return data_out;
+}
 
-    // Write the result to the `out` vector
-    for (uint32_t j = 0; j < block_width; ++j) {
-      or_vector_bit(out, j + i * subst_perm_width,
-                    read_vector_bit(subst_perm_out, j));
-    }
-  }
+template <uint32_t DataWidth>
+ScrambleWord<DataWidth> scramble_decrypt_word(
+    const ScrambleWord<DataWidth> &data_in, uint32_t subst_perm_width,
+    uint32_t addr, uint32_t addr_width, const uint8_t *nonce,
+    const uint8_t *key, bool repeat_keystream, bool use_sp_layer) {
+  ScrambleWord<DataWidth> data_out;
+  scramble_decrypt_impl(data_in.data(), data_out.data(), DataWidth,
+                        subst_perm_width, addr, addr_width, nonce, key,
+                        repeat_keystream, use_sp_layer);
+  return data_out;
+}
 
-  return out;
+template ScrambleWord<39> scramble_encrypt_word<39>(
+    const ScrambleWord<39> &, uint32_t, uint32_t, uint32_t, const uint8_t *,
+    const uint8_t *, bool, bool);
+template ScrambleWord<39> scramble_decrypt_word<39>(
+    const ScrambleWord<39> &, uint32_t, uint32_t, uint32_t, const uint8_t *,
+    const uint8_t *, bool, bool);
+template ScrambleWord<312> scramble_encrypt_word<312>(
+    const ScrambleWord<312> &, uint32_t, uint32_t, uint32_t, const uint8_t *,
+    const uint8_t *, bool, bool);
+template ScrambleWord<312> scramble_decrypt_word<312>(
+    const ScrambleWord<312> &, uint32_t, uint32_t, uint32_t, const uint8_t *,
+    const uint8_t *, bool, bool);
+
+// The vector API below is a thin wrapper around the functions above. These
+// helpers check that the arguments have the sizes that the functions expect.
+static uint32_t addr_from_vector(const std::vector<uint8_t> &addr,
+                                 uint32_t addr_width) {
+  assert(addr.size() == ((addr_width + 7) / 8));
+  assert(addr_width <= 32);
+
+  return read_bits(&addr[0], 0, addr_width);
+}
+
+static void check_data_args(const std::vector<uint8_t> &data_in,
+                            uint32_t data_width, uint32_t addr_width,
+                            const std::vector<uint8_t> &nonce,
+                            const std::vector<uint8_t> &key,
+                            bool repeat_keystream) {
+  assert(data_in.size() == ((data_width + 7) / 8));
+  assert(key.size() == (kPrinceWidthByte * 2));
+
+  // Check that the nonce has all the bits that the PRINCE instances will use
+  uint32_t num_princes =
+      repeat_keystream ? 1 : (data_width + kPrinceWidth - 1) / kPrinceWidth;
+  assert(nonce.size() * 8 >= num_princes * (kPrinceWidth - addr_width));
+  (void)num_princes;
 }
 
 std::vector<uint8_t> scramble_addr(const std::vector<uint8_t> &addr_in,
                                    uint32_t addr_width,
                                    const std::vector<uint8_t> &nonce,
                                    uint32_t nonce_width) {
-  assert(addr_in.size() == ((addr_width + 7) / 8));
+  assert(nonce.size() * 8 >= nonce_width);
 
-  std::vector<uint8_t> addr_enc_nonce(addr_in.size(), 0);
+  uint32_t addr_out = scramble_addr_int(addr_from_vector(addr_in, addr_width),
+                                        addr_width, &nonce[0], nonce_width);
 
-  // Address is scrambled by using substitution/permutation layer with the nonce
-  // used as a key.
-  // Extract relevant nonce bits for key
-  for (uint32_t i = 0; i < addr_width; ++i) {
-    or_vector_bit(addr_enc_nonce, i,
-                  read_vector_bit(nonce, nonce_width - addr_width + i));
+  std::vector<uint8_t> ret(addr_in.size());
+  for (uint8_t &byte : ret) {
+    byte = addr_out & 0xff;
+    addr_out >>= 8;
   }
 
-  // Apply substitution/permutation layer
-  return scramble_subst_perm_enc(addr_in, addr_enc_nonce, addr_width,
-                                 kNumAddrSubstPermRounds);
+  return ret;
 }
 
 std::vector<uint8_t> scramble_encrypt_data(
@@ -323,24 +388,14 @@ std::vector<uint8_t> scramble_encrypt_data(
     uint32_t subst_perm_width, const std::vector<uint8_t> &addr,
     uint32_t addr_width, const std::vector<uint8_t> &nonce,
     const std::vector<uint8_t> &key, bool repeat_keystream, bool use_sp_layer) {
-  assert(data_in.size() == ((data_width + 7) / 8));
-  assert(addr.size() == ((addr_width + 7) / 8));
-
-  // Data is encrypted by XORing with keystream then applying
-  // substitution/permutation layer
-
-  auto keystream =
-      scramble_gen_keystream(addr, addr_width, nonce, key, data_width,
-                             kNumPrinceHalfRounds, repeat_keystream);
-
-  auto data_enc = xor_vectors(data_in, keystream);
-
-  if (use_sp_layer) {
-    return scramble_subst_perm_full_width(data_enc, data_width,
-                                          subst_perm_width, true);
-  } else {
-    return data_enc;
-  }
+  check_data_args(data_in, data_width, addr_width, nonce, key,
+                  repeat_keystream);
+
+  std::vector<uint8_t> data_out(data_in.size());
+  scramble_encrypt_buf(&data_in[0], &data_out[0], data_width, subst_perm_width,
+                       addr_from_vector(addr, addr_width), addr_width,
+                       &nonce[0], &key[0], repeat_keystream, use_sp_layer);
+  return data_out;
 }
 
 std::vector<uint8_t> scramble_decrypt_data(
@@ -348,19 +403,12 @@ std::vector<uint8_t> scramble_decrypt_data(
     uint32_t subst_perm_width, const std::vector<uint8_t> &addr,
     uint32_t addr_width, const std::vector<uint8_t> &nonce,
     const std::vector<uint8_t> &key, bool repeat_keystream, bool use_sp_layer) {
-  assert(data_in.size() == ((data_width + 7) / 8));
-  assert(addr.size() == ((addr_width + 7) / 8));
-
-  auto keystream =
-      scramble_gen_keystream(addr, addr_width, nonce, key, data_width,
-                             kNumPrinceHalfRounds, repeat_keystream);
-  if (use_sp_layer) {
-    // Data is decrypted by reversing substitution/permutation layer then XORing
-    // with keystream
-    auto data_sp_out = scramble_subst_perm_full_width(data_in, data_width,
-                                                      subst_perm_width, false);
-    return xor_vectors(data_sp_out, keystream);
-  } else {
-    return xor_vectors(data_in, keystream);
-  }
+  check_data_args(data_in, data_width, addr_width, nonce, key,
+                  repeat_keystream);
+
+  std::vector<uint8_t> data_out(data_in.size());
+  scramble_decrypt_buf(&data_in[0], &data_out[0], data_width, subst_perm_width,
+                       addr_from_vector(addr, addr_width), addr_width,
+                       &nonce[0], &key[0], repeat_keystream, use_sp_layer);
+  return data_out;
 }
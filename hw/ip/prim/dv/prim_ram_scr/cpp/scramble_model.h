@@ -5,6 +5,7 @@
 #ifndef OPENTITAN_HW_IP_PRIM_DV_PRIM_RAM_SCR_CPP_SCRAMBLE_MODEL_H_
 #define OPENTITAN_HW_IP_PRIM_DV_PRIM_RAM_SCR_CPP_SCRAMBLE_MODEL_H_
 
+#include <array>
 #include <stdint.h>
 #include <vector>
 
@@ -76,4 +77,77 @@ std::vector<uint8_t> scramble_encrypt_data(
     uint32_t addr_width, const std::vector<uint8_t> &nonce,
     const std::vector<uint8_t> &key, bool repeat_keystream, bool use_sp_layer);
 
+// Allocation-free variants of the functions above.
+//
+// These work on caller-provided buffers or on integers. Byte buffers use the
+// same little endian byte order as the vector API. The key is
+// 2 * kPrinceWidthByte bytes long. The nonce must contain every bit that the
+// vector API would read: that's nonce_width bits for scramble_addr_int and
+// (for data) kPrinceWidth - addr_width bits per PRINCE instance. The
+// substitution/permutation width and the address width are limited to
+// kPrinceWidth bits.
+
+/** Scramble an address held in an integer. See scramble_addr for the
+ * meaning of the other arguments.
+ */
+uint32_t scramble_addr_int(uint32_t addr_in, uint32_t addr_width,
+                           const uint8_t *nonce, uint32_t nonce_width);
+
+/** Encrypt (data_width + 7) / 8 bytes from data_in into data_out. The two may
+ * point at the same buffer. Bits of data_out above data_width are zero. See
+ * scramble_encrypt_data for the meaning of the other arguments.
+ */
+void scramble_encrypt_buf(const uint8_t *data_in, uint8_t *data_out,
+                          uint32_t data_width, uint32_t subst_perm_width,
+                          uint32_t addr, uint32_t addr_width,
+                          const uint8_t *nonce, const uint8_t *key,
+                          bool repeat_keystream, bool use_sp_layer);
+
+/** Decrypt (data_width + 7) / 8 bytes from data_in into data_out. See
+ * scramble_encrypt_buf.
+ */
+void scramble_decrypt_buf(const uint8_t *data_in, uint8_t *data_out,
+                          uint32_t data_width, uint32_t subst_perm_width,
+                          uint32_t addr, uint32_t addr_width,
+                          const uint8_t *nonce, const uint8_t *key,
+                          bool repeat_keystream, bool use_sp_layer);
+
+/** A scrambled memory word of DataWidth bits */
+template <uint32_t DataWidth>
+using ScrambleWord = std::array<uint8_t, (DataWidth + 7) / 8>;
+
+/** Encrypt a word with a data width that is known at compile time.
+ *
+ * This is equivalent to scramble_encrypt_buf, but is specialised for
+ * DataWidth. It is instantiated for the physical widths of the 32-bit and
+ * 256-bit ECC32 memories in the design (39 and 312 bits).
+ */
+template <uint32_t DataWidth>
+ScrambleWord<DataWidth> scramble_encrypt_word(
+    const ScrambleWord<DataWidth> &data_in, uint32_t subst_perm_width,
+    uint32_t addr, uint32_t addr_width, const uint8_t *nonce,
+    const uint8_t *key, bool repeat_keystream, bool use_sp_layer);
+
+/** Decrypt a word with a data width that is known at compile time. See
+ * scramble_encrypt_word.
+ */
+template <uint32_t DataWidth>
+ScrambleWord<DataWidth> scramble_decrypt_word(
+    const ScrambleWord<DataWidth> &data_in, uint32_t subst_perm_width,
+    uint32_t addr, uint32_t addr_width, const uint8_t *nonce,
+    const uint8_t *key, bool repeat_keystream, bool use_sp_layer);
+
+extern template ScrambleWord<39> scramble_encrypt_word<39>(
+    const ScrambleWord<39> &, uint32_t, uint32_t, uint32_t, const uint8_t *,
+    const uint8_t *, bool, bool);
+extern template ScrambleWord<39> scramble_decrypt_word<39>(
+    const ScrambleWord<39> &, uint32_t, uint32_t, uint32_t, const uint8_t *,
+    const uint8_t *, bool, bool);
+extern template ScrambleWord<312> scramble_encrypt_word<312>(
+    const ScrambleWord<312> &, uint32_t, uint32_t, uint32_t, const uint8_t *,
+    const uint8_t *, bool, bool);
+extern template ScrambleWord<312> scramble_decrypt_word<312>(
+    const ScrambleWord<312> &, uint32_t, uint32_t, uint32_t, const uint8_t *,
+    const uint8_t *, bool, bool);
+
 #endif  // OPENTITAN_HW_IP_PRIM_DV_PRIM_RAM_SCR_CPP_SCRAMBLE_MODEL_H_
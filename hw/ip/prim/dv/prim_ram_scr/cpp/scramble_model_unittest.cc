@@ -0,0 +1,192 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "hw/ip/prim/dv/prim_ram_scr/cpp/scramble_model.h"
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace scramble_model_unittest {
+namespace {
+
+struct KnownAnswer {
+  uint32_t data_width;
+  uint32_t addr_width;
+  uint32_t addr;
+  bool repeat_keystream;
+  bool use_sp_layer;
+  std::vector<uint8_t> key;
+  std::vector<uint8_t> nonce;
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> scrambled_data;
+  uint32_t scrambled_addr;
+};
+
+// Generated with the original, vector-based implementation of the model. All
+// of these use a substitution/permutation width of 39 bits.
+const KnownAnswer kKnownAnswers[] = {
+    {39, 14, 0x198e, true, false,
+     {0x25, 0xeb, 0x8c, 0x48, 0xff, 0x89, 0xcb, 0x85, 0x4f, 0xc0, 0x90, 0x81, 0xcc, 0x47, 0xed, 0xfc},
+     {0x86, 0x19, 0xb2, 0x14, 0xfe, 0x65, 0x92, 0xd4},
+     {0x8b, 0xfc, 0xea, 0x9c, 0x1d},
+     {0x52, 0x76, 0x17, 0xb0, 0x60},
+     0x760},
+    {39, 10, 0x1c8, true, true,
+     {0x32, 0x44, 0xd7, 0xd7, 0xe9, 0xf1, 0xf7, 0xde, 0x60, 0x56, 0x8d, 0xe9, 0x89, 0x07, 0x3f, 0x3d},
+     {0x16, 0x39, 0x01, 0x80, 0x3c, 0xd1, 0x08, 0xd8},
+     {0x8d, 0x73, 0xaf, 0xea, 0x79},
+     {0x03, 0xc9, 0xbe, 0x04, 0x18},
+     0x4a},
+    {312, 9, 0x1fc, false, false,
+     {0x1e, 0x47, 0x83, 0xc6, 0x95, 0x31, 0x39, 0x03, 0xc4, 0x18, 0xf1, 0x2b, 0x4c, 0x1a, 0x34, 0x50},
+     {0x6d, 0x73, 0x29, 0xd2, 0x0f, 0x40, 0xc4, 0x19, 0x6f, 0xe2, 0xd7, 0x87, 0x1a, 0x99, 0x68, 0x16, 0x09, 0xc3, 0xe7, 0x7e, 0x17, 0x7d, 0x64, 0x9b, 0xa5, 0x39, 0x53, 0xa6, 0x88, 0x20, 0xa2, 0x0a, 0x17, 0x8f, 0xef, 0x57, 0x19, 0xc7, 0xf3, 0x5c},
+     {0x4a, 0xbe, 0x2e, 0xa0, 0xd8, 0x97, 0xb7, 0x41, 0x71, 0x4d, 0x03, 0x80, 0xf8, 0xfd, 0xcd, 0x06, 0x34, 0xd5, 0xc6, 0x02, 0x4c, 0xdb, 0x95, 0xcb, 0x07, 0x4d, 0xc8, 0x4b, 0x4c, 0x2b, 0x14, 0x1e, 0x24, 0x67, 0x07, 0x2d, 0xc4, 0x39, 0xf0},
+     {0x38, 0x54, 0x85, 0x79, 0x0f, 0xc6, 0xbd, 0xaa, 0xa4, 0xcf, 0x9f, 0x89, 0x0e, 0x38, 0xbf, 0x4c, 0x9f, 0xec, 0xd4, 0xb4, 0xe4, 0xa3, 0x62, 0x1c, 0x1f, 0x84, 0x3f, 0x10, 0xe3, 0x13, 0x9b, 0xdc, 0xcb, 0x03, 0xdf, 0x2a, 0x1e, 0x62, 0xee},
+     0x87},
+    {312, 12, 0xc60, true, false,
+     {0xd2, 0x60, 0x0d, 0x0a, 0x17, 0x7c, 0x51, 0x87, 0x79, 0x98, 0xca, 0xdc, 0x94, 0xa0, 0x8c, 0xc1},
+     {0x5e, 0x3c, 0xe9, 0x98, 0x52, 0x73, 0x61, 0x82},
+     {0xec, 0xdc, 0x67, 0x62, 0x0a, 0xb6, 0x60, 0xe9, 0x52, 0xd6, 0xc6, 0xc2, 0x47, 0xe7, 0xb0, 0x36, 0x0f, 0x85, 0x91, 0xaa, 0x14, 0x76, 0xb0, 0x16, 0xe5, 0x8d, 0xf1, 0x72, 0x61, 0xb5, 0x54, 0x0a, 0x60, 0xb7, 0x3d, 0x38, 0xd9, 0x95, 0xe7},
+     {0xd8, 0xb5, 0xca, 0xe1, 0xaf, 0x06, 0x37, 0x8f, 0x66, 0xbf, 0x6b, 0x41, 0xe2, 0x57, 0xe7, 0x50, 0x3b, 0xec, 0x3c, 0x29, 0xb1, 0xc6, 0xe7, 0x70, 0xd1, 0xe4, 0x5c, 0xf1, 0xc4, 0x05, 0x03, 0x6c, 0x54, 0xde, 0x90, 0xbb, 0x7c, 0x25, 0xb0},
+     0x1d9},
+    {312, 9, 0x187, false, true,
+     {0xf9, 0xd3, 0x19, 0xf1, 0x8e, 0x8d, 0xd4, 0x74, 0x2b, 0x86, 0xcd, 0xb8, 0xbb, 0x8f, 0x18, 0xfb},
+     {0x89, 0xc2, 0xc7, 0x35, 0x45, 0xa4, 0x65, 0xf8, 0x15, 0x28, 0x4d, 0xdb, 0xb1, 0x71, 0x2f, 0xcd, 0xa8, 0xce, 0x2d, 0x57, 0x90, 0x9c, 0xea, 0x2d, 0xc3, 0x74, 0x42, 0xce, 0x2e, 0x80, 0x9d, 0x3f, 0x4b, 0x23, 0xb5, 0xdd, 0x21, 0x82, 0xd4, 0x53},
+     {0x30, 0x36, 0x20, 0xfd, 0x9c, 0x37, 0xd2, 0x1f, 0x1c, 0xde, 0x4a, 0x88, 0x6d, 0x63, 0x20, 0x08, 0x54, 0xcd, 0x32, 0x4f, 0xa9, 0x40, 0x6c, 0xd3, 0x18, 0x71, 0xea, 0x14, 0x2c, 0x0f, 0x9e, 0xdb, 0x8e, 0xf3, 0x13, 0xfb, 0x9a, 0xeb, 0x56},
+     {0xf2, 0x39, 0x15, 0xe7, 0x36, 0xa8, 0xcb, 0x4a, 0x3d, 0x52, 0x40, 0xc1, 0x8b, 0x27, 0xde, 0xc5, 0x73, 0xe0, 0x71, 0x74, 0x8c, 0xb6, 0x35, 0xe6, 0xa7, 0xa7, 0xf5, 0xa1, 0x0e, 0x6f, 0x22, 0x30, 0xa3, 0x2a, 0x77, 0xb2, 0x96, 0xa5, 0x8b},
+     0xad},
+    {78, 11, 0x696, false, false,
+     {0xe3, 0x35, 0xaf, 0x6e, 0xbc, 0xf3, 0x22, 0x64, 0xe4, 0x20, 0x93, 0xc3, 0x18, 0xd3, 0xe5, 0x5e},
+     {0xa6, 0xaf, 0xe7, 0x85, 0x4f, 0x3f, 0x71, 0x57, 0xa0, 0x2a, 0xca, 0xc2, 0xd8, 0xe2, 0x9e, 0x91},
+     {0x44, 0x40, 0xbc, 0xf4, 0xce, 0x91, 0xa7, 0xa3, 0xd1, 0x1c},
+     {0x62, 0x8e, 0x6c, 0x51, 0x10, 0x97, 0xe7, 0x60, 0x8f, 0x0f},
+     0x5fe}
+};
+
+std::vector<uint8_t> AddrToBytes(uint32_t addr, uint32_t addr_width) {
+  std::vector<uint8_t> ret((addr_width + 7) / 8);
+  for (uint8_t &byte : ret) {
+    byte = addr & 0xff;
+    addr >>= 8;
+  }
+  return ret;
+}
+
+uint32_t NonceWidth(const KnownAnswer &ka) { return ka.nonce.size() * 8; }
+
+TEST(ScrambleModelTest, VectorApiKnownAnswers) {
+  for (const KnownAnswer &ka : kKnownAnswers) {
+    std::vector<uint8_t> addr = AddrToBytes(ka.addr, ka.addr_width);
+
+    EXPECT_EQ(scramble_encrypt_data(ka.data, ka.data_width, 39, addr,
+                                    ka.addr_width, ka.nonce, ka.key,
+                                    ka.repeat_keystream, ka.use_sp_layer),
+              ka.scrambled_data);
+    EXPECT_EQ(scramble_decrypt_data(ka.scrambled_data, ka.data_width, 39, addr,
+                                    ka.addr_width, ka.nonce, ka.key,
+                                    ka.repeat_keystream, ka.use_sp_layer),
+              ka.data);
+    EXPECT_EQ(scramble_addr(addr, ka.addr_width, ka.nonce, NonceWidth(ka)),
+              AddrToBytes(ka.scrambled_addr, ka.addr_width));
+  }
+}
+
+TEST(ScrambleModelTest, BufferApiKnownAnswers) {
+  for (const KnownAnswer &ka : kKnownAnswers) {
+    std::vector<uint8_t> buf(ka.data);
+
+    // Encrypt and decrypt in place
+    scramble_encrypt_buf(&buf[0], &buf[0], ka.data_width, 39, ka.addr,
+                         ka.addr_width, &ka.nonce[0], &ka.key[0],
+                         ka.repeat_keystream, ka.use_sp_layer);
+    EXPECT_EQ(buf, ka.scrambled_data);
+
+    scramble_decrypt_buf(&buf[0], &buf[0], ka.data_width, 39, ka.addr,
+                         ka.addr_width, &ka.nonce[0], &ka.key[0],
+                         ka.repeat_keystream, ka.use_sp_layer);
+    EXPECT_EQ(buf, ka.data);
+
+    EXPECT_EQ(scramble_addr_int(ka.addr, ka.addr_width, &ka.nonce[0],
+                                NonceWidth(ka)),
+              ka.scrambled_addr);
+  }
+}
+
+template <uint32_t DataWidth>
+void CheckWordApi(const KnownAnswer &ka) {
+  ScrambleWord<DataWidth> data, scrambled_data;
+  ASSERT_EQ(ka.data.size(), data.size());
+  std::copy(ka.data.begin(), ka.data.end(), data.begin());
+  std::copy(ka.scrambled_data.begin(), ka.scrambled_data.end(),
+            scrambled_data.begin());
+
+  EXPECT_EQ(scramble_encrypt_word<DataWidth>(
+                data, 39, ka.addr, ka.addr_width, &ka.nonce[0], &ka.key[0],
+                ka.repeat_keystream, ka.use_sp_layer),
+            scrambled_data);
+  EXPECT_EQ(scramble_decrypt_word<DataWidth>(
+                scrambled_data, 39, ka.addr, ka.addr_width, &ka.nonce[0],
+                &ka.key[0], ka.repeat_keystream, ka.use_sp_layer),
+            data);
+}
+
+TEST(ScrambleModelTest, WordApiKnownAnswers) {
+  for (const KnownAnswer &ka : kKnownAnswers) {
+    if (ka.data_width == 39) {
+      CheckWordApi<39>(ka);
+    } else if (ka.data_width == 312) {
+      CheckWordApi<312>(ka);
+    }
+  }
+}
+
+// Cross-check the vector and buffer APIs on random data, covering more widths
+// than the known answers above.
+TEST(ScrambleModelTest, VectorAndBufferApisAgree) {
+  std::mt19937 rng(0);
+
+  for (uint32_t data_width : {8u, 39u, 64u, 78u, 156u, 312u}) {
+    for (bool repeat_keystream : {false, true}) {
+      for (bool use_sp_layer : {false, true}) {
+        uint32_t addr_width = 1 + rng() % 16;
+        uint32_t addr = rng() & ((1u << addr_width) - 1);
+
+        std::vector<uint8_t> key(kPrinceWidthByte * 2);
+        std::vector<uint8_t> nonce(kPrinceWidthByte *
+                                   ((data_width + kPrinceWidth - 1) /
+                                    kPrinceWidth));
+        std::vector<uint8_t> data((data_width + 7) / 8);
+        for (uint8_t &byte : key)
+          byte = rng();
+        for (uint8_t &byte : nonce)
+          byte = rng();
+        for (uint8_t &byte : data)
+          byte = rng();
+        if (data_width % 8)
+          data.back() &= (1 << (data_width % 8)) - 1;
+
+        std::vector<uint8_t> addr_bytes = AddrToBytes(addr, addr_width);
+        std::vector<uint8_t> enc = scramble_encrypt_data(
+            data, data_width, 39, addr_bytes, addr_width, nonce, key,
+            repeat_keystream, use_sp_layer);
+
+        std::vector<uint8_t> buf(data.size());
+        scramble_encrypt_buf(&data[0], &buf[0], data_width, 39, addr,
+                             addr_width, &nonce[0], &key[0], repeat_keystream,
+                             use_sp_layer);
+        EXPECT_EQ(buf, enc);
+
+        scramble_decrypt_buf(&enc[0], &buf[0], data_width, 39, addr,
+                             addr_width, &nonce[0], &key[0], repeat_keystream,
+                             use_sp_layer);
+        EXPECT_EQ(buf, data);
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace scramble_model_unittest
@@ -0,0 +1,101 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "chip_sim_fast_forward.h"
+
+#include <algorithm>
+#include <getopt.h>
+#include <iostream>
+#include <svdpi.h>
+
+#include "sv_scoped.h"
+#include "verilator_sim_ctrl.h"
+
+// DPI exports from chip_sim_tb.sv
+extern "C" {
+long long chip_sim_tb_idle_cycles();
+void chip_sim_tb_skip_timer_cycles(long long cycles);
+}
+
+// Number of cycles between checks whether the CPU sleeps
+static const unsigned long kCheckPeriod = 16;
+
+// Number of cycles to simulate before the next timer event, so that the
+// timer and the wakeup logic see the event happen normally
+static const unsigned long kMarginCycles = 64;
+
+// Skipping fewer cycles than this isn't worth it
+static const unsigned long kMinSkipCycles = 256;
+
+// The timers run on clocks divided by this from the main clock (see
+// chip_sim_tb.sv)
+static const unsigned long kTimerClkDiv = 4;
+
+ChipSimFastForward::ChipSimFastForward(const std::string &scope)
+    : scope_(scope), enabled_(false) {}
+
+bool ChipSimFastForward::ParseCLIArguments(int argc, char **argv,
+                                           bool &exit_app) {
+  const struct option long_options[] = {
+      {"fast-forward", no_argument, nullptr, 'w'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, no_argument, nullptr, 0}};
+
+  // Reset the command parsing index in-case other utils have already parsed
+  // some arguments
+  optind = 1;
+  while (1) {
+    int c = getopt_long(argc, argv, "-:h", long_options, nullptr);
+    if (c == -1) {
+      break;
+    }
+
+    // Disable error reporting by getopt
+    opterr = 0;
+
+    switch (c) {
+      case 'w':
+        enabled_ = true;
+        break;
+      case 'h':
+        std::cout << "--fast-forward\n"
+                     "  Skip idle cycles while the CPU sleeps until the next "
+                     "timer event\n\n";
+        return true;
+      default:;
+        // Ignore other options since they might be consumed by other utils
+    }
+  }
+  return true;
+}
+
+unsigned long ChipSimFastForward::GetClockPeriod() const {
+  return enabled_ ? kCheckPeriod : 0;
+}
+
+void ChipSimFastForward::OnClock(unsigned long sim_time) {
+  VerilatorSimCtrl &simctrl = VerilatorSimCtrl::GetInstance();
+
+  long long idle_cycles;
+  {
+    SVScoped scoped(scope_);
+    idle_cycles = chip_sim_tb_idle_cycles();
+  }
+  if (idle_cycles <= static_cast<long long>(kMarginCycles + kMinSkipCycles)) {
+    return;
+  }
+
+  unsigned long skip_cycles = std::min<unsigned long>(
+      idle_cycles - kMarginCycles, simctrl.GetMaxSkipCycles());
+  skip_cycles -= skip_cycles % kTimerClkDiv;
+  if (skip_cycles < kMinSkipCycles) {
+    return;
+  }
+
+  {
+    SVScoped scoped(scope_);
+    chip_sim_tb_skip_timer_cycles(skip_cycles);
+  }
+  simctrl.SkipCycles(skip_cycles);
+}
@@ -0,0 +1,42 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_TOP_EARLGREY_DV_VERILATOR_CHIP_SIM_FAST_FORWARD_H_
+#define OPENTITAN_HW_TOP_EARLGREY_DV_VERILATOR_CHIP_SIM_FAST_FORWARD_H_
+
+#include <string>
+
+#include "sim_ctrl_extension.h"
+
+/**
+ * Simulation extension which skips idle cycles while the CPU sleeps
+ *
+ * When enabled with --fast-forward, this checks every few cycles whether Ibex
+ * is sleeping (e.g. in WFI). If it is, the simulation skips ahead to just
+ * before the next event of rv_timer or aon_timer: the timers are advanced as if
+ * the cycles had passed, and the other logic of the chip is left as it is.
+ *
+ * This is an approximation: other activity while the CPU sleeps (such as an
+ * ongoing UART transfer, or input from a DPI model) doesn't stop the skipping.
+ * It suits tests which sleep until a timer wakes them up.
+ */
+class ChipSimFastForward : public SimCtrlExtension {
+ public:
+  /**
+   * Constructor
+   *
+   * @param scope SV scope of the chip_sim_tb module
+   */
+  explicit ChipSimFastForward(const std::string &scope);
+
+  bool ParseCLIArguments(int argc, char **argv, bool &exit_app) override;
+  void OnClock(unsigned long sim_time) override;
+  unsigned long GetClockPeriod() const override;
+
+ private:
+  std::string scope_;
+  bool enabled_;
+};
+
+#endif  // OPENTITAN_HW_TOP_EARLGREY_DV_VERILATOR_CHIP_SIM_FAST_FORWARD_H_
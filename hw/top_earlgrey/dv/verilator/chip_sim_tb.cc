@@ -7,16 +7,20 @@
 #include <string>
 #include <vector>
 
+#include "chip_sim_fast_forward.h"
 #include "verilated_toplevel.h"
 #include "verilator_memutil.h"
 #include "verilator_sim_ctrl.h"
 
 int main(int argc, char **argv) {
-  chip_sim_tb top;
-  VerilatorMemUtil memutil;
   VerilatorSimCtrl &simctrl = VerilatorSimCtrl::GetInstance();
-  simctrl.SetTop(&top, &top.clk_i, &top.rst_ni,
-                 VerilatorSimCtrlFlags::ResetPolarityNegative);
+  // The number of threads must be known before the model is constructed.
+  bool exit_app = false;
+  if (!simctrl.ParseThreadArgs(argc, argv, exit_app)) {
+    return 1;
+  }
+
+  VerilatorMemUtil memutil;
 
   std::string top_scope("TOP.chip_sim_tb.u_dut.top_earlgrey");
   std::string ram1p_adv_scope(
@@ -41,12 +45,6 @@ int main(int argc, char **argv) {
           "gen_prim_flash_banks[1].u_prim_flash_bank.u_mem."
           "gen_generic.u_impl_generic",
       0x80000 / 8, 8);
-  // Start with the flash region erased. Future loads can overwrite.
-  std::vector<uint8_t> all_ones(flash0.GetSizeBytes());
-  std::fill(all_ones.begin(), all_ones.end(), 0xffu);
-  flash0.Write(/*word_offset=*/0, all_ones);
-  flash1.Write(/*word_offset=*/0, all_ones);
-
   MemArea otp(top_scope + ".u_otp_ctrl.u_otp.gen_generic.u_impl_generic." +
                   ram1p_adv_scope,
               0x4000 / 4, 4);
@@ -58,6 +56,26 @@ int main(int argc, char **argv) {
   memutil.RegisterMemoryArea("otp", 0x40000000u /* (bogus LMA) */, &otp);
   simctrl.RegisterExtension(&memutil);
 
+  ChipSimFastForward fast_forward("TOP.chip_sim_tb");
+  simctrl.RegisterExtension(&fast_forward);
+
+  // In batch mode, this only returns in the processes that run the jobs. The
+  // model must be constructed afterwards.
+  bool good_batch = simctrl.RunBatch(argc, argv, exit_app);
+  if (exit_app) {
+    return good_batch ? 0 : 1;
+  }
+
+  chip_sim_tb top;
+  simctrl.SetTop(&top, &top.clk_i, &top.rst_ni,
+                 VerilatorSimCtrlFlags::ResetPolarityNegative);
+
+  // Start with the flash region erased. Future loads can overwrite.
+  std::vector<uint8_t> all_ones(flash0.GetSizeBytes());
+  std::fill(all_ones.begin(), all_ones.end(), 0xffu);
+  flash0.Write(/*word_offset=*/0, all_ones);
+  flash1.Write(/*word_offset=*/0, all_ones);
+
   // The initial reset delay must be long enough such that pwr/rst/clkmgr will
   // release clocks to the entire design.  This allows for synchronous resets
   // to appropriately propagate.
@@ -136,7 +136,11 @@ module chip_sim_tb (
     .spi_device_csb_o     (cio_spi_device_csb_p2d),
     .spi_device_sdi_o     (cio_spi_device_sdi_p2d),
     .spi_device_sdo_i     (cio_spi_device_sdo_d2p),
-    .spi_device_sdo_en_i  (cio_spi_device_sdo_en_d2p)
+    .spi_device_sdo_en_i  (cio_spi_device_sdo_en_d2p),
+    // Only single-lane transfers are wired up
+    .spi_device_sd_o      (),
+    .spi_device_sd_en_o   (),
+    .spi_device_sd_i      ('0)
   );
 
   // USB DPI
@@ -207,6 +211,108 @@ module chip_sim_tb (
     end
   end
 
+  ///////////////////////////////////////
+  // Fast-forwarding through idle time //
+  ///////////////////////////////////////
+
+  // While the CPU sleeps, the simulation can skip ahead to just before the next timer event (see
+  // chip_sim_fast_forward.cc). The functions below find the next event of rv_timer and aon_timer,
+  // and advance the timers as if cycles of clk_i had passed. Both timers run on clocks divided by
+  // four from clk_i (io_div4 and aon, see chip_earlgrey_verilator.sv), so the number of cycles must
+  // be a multiple of four to keep the clocks in phase.
+  `define RV_TIMER  u_dut.top_earlgrey.u_rv_timer
+  `define AON_TIMER u_dut.top_earlgrey.u_aon_timer_aon
+
+  localparam longint TimerClkDiv = 4;
+
+  // Number of cycles until a counter at count, which wraps (and ticks) when it reaches prescaler,
+  // has ticked n times.
+  function automatic longint cycles_to_ticks(longint count, longint prescaler, longint n);
+    return (prescaler - count) + (n - 1) * (prescaler + 1);
+  endfunction
+
+  // Return the number of clk_i cycles until the next timer event, or 0 if the CPU isn't sleeping
+  // or no timer is running.
+  export "DPI-C" function chip_sim_tb_idle_cycles;
+  function automatic longint chip_sim_tb_idle_cycles();
+    longint idle = 0;
+    longint cycles;
+
+    if (!`RV_CORE_IBEX.core_sleep_q) begin
+      return 0;
+    end
+
+    if (`RV_TIMER.active[0] && `RV_TIMER.step[0] != 0) begin
+      logic [63:0] mtime = `RV_TIMER.mtime[0];
+      logic [63:0] mtimecmp = `RV_TIMER.mtimecmp[0][0];
+      longint step = longint'(`RV_TIMER.step[0]);
+      longint prescaler = longint'(`RV_TIMER.prescaler[0]);
+      longint count = longint'(`RV_TIMER.gen_harts[0].u_core.tick_count);
+      if (mtime >= mtimecmp || count > prescaler) begin
+        return 0;
+      end
+      cycles = cycles_to_ticks(count, prescaler, longint'((mtimecmp - mtime + step - 1) / step));
+      idle = (idle == 0 || cycles < idle) ? cycles : idle;
+    end
+
+    if (`AON_TIMER.reg2hw.wkup_ctrl.enable.q) begin
+      logic [63:0] wkup_count = `AON_TIMER.u_core.wkup_count;
+      logic [63:0] wkup_thold = `AON_TIMER.u_core.wkup_thold;
+      longint prescaler = longint'(`AON_TIMER.reg2hw.wkup_ctrl.prescaler.q);
+      longint count = longint'(`AON_TIMER.u_core.prescale_count_q);
+      if (wkup_count >= wkup_thold || count > prescaler) begin
+        return 0;
+      end
+      cycles = cycles_to_ticks(count, prescaler, longint'(wkup_thold - wkup_count + 1));
+      idle = (idle == 0 || cycles < idle) ? cycles : idle;
+    end
+
+    if (`AON_TIMER.u_core.wdog_incr) begin
+      longint wdog_count = longint'(`AON_TIMER.reg2hw.wdog_count.q);
+      longint bark_thold = longint'(`AON_TIMER.reg2hw.wdog_bark_thold.q);
+      longint bite_thold = longint'(`AON_TIMER.reg2hw.wdog_bite_thold.q);
+      if (wdog_count >= bark_thold || wdog_count >= bite_thold) begin
+        return 0;
+      end
+      cycles = (bark_thold < bite_thold ? bark_thold : bite_thold) - wdog_count;
+      idle = (idle == 0 || cycles < idle) ? cycles : idle;
+    end
+
+    return idle * TimerClkDiv;
+  endfunction
+
+  // Advance the timers by the given number of clk_i cycles, which must be a multiple of
+  // TimerClkDiv.
+  export "DPI-C" function chip_sim_tb_skip_timer_cycles;
+  function automatic void chip_sim_tb_skip_timer_cycles(longint cycles);
+    longint n = cycles / TimerClkDiv;
+
+    if (`RV_TIMER.active[0]) begin
+      longint period = longint'(`RV_TIMER.prescaler[0]) + 1;
+      longint total = longint'(`RV_TIMER.gen_harts[0].u_core.tick_count) + n;
+      logic [63:0] mtime = `RV_TIMER.mtime[0] + 64'((total / period) * `RV_TIMER.step[0]);
+      `RV_TIMER.gen_harts[0].u_core.tick_count = 12'(total % period);
+      `RV_TIMER.u_reg.u_timer_v_lower0.q = mtime[31:0];
+      `RV_TIMER.u_reg.u_timer_v_upper0.q = mtime[63:32];
+    end
+
+    if (`AON_TIMER.reg2hw.wkup_ctrl.enable.q) begin
+      longint period = longint'(`AON_TIMER.reg2hw.wkup_ctrl.prescaler.q) + 1;
+      longint total = longint'(`AON_TIMER.u_core.prescale_count_q) + n;
+      logic [63:0] wkup_count = `AON_TIMER.u_core.wkup_count + 64'(total / period);
+      `AON_TIMER.u_core.prescale_count_q = 12'(total % period);
+      `AON_TIMER.u_reg.u_wkup_count_lo.q = wkup_count[31:0];
+      `AON_TIMER.u_reg.u_wkup_count_hi.q = wkup_count[63:32];
+    end
+
+    if (`AON_TIMER.u_core.wdog_incr) begin
+      `AON_TIMER.u_reg.u_wdog_count.q = `AON_TIMER.reg2hw.wdog_count.q + 32'(n);
+    end
+  endfunction
+
+  `undef RV_TIMER
+  `undef AON_TIMER
+
   `undef RV_CORE_IBEX
   `undef SIM_SRAM_IF
 
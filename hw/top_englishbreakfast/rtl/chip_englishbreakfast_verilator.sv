@@ -291,7 +291,11 @@ module chip_englishbreakfast_verilator (
     .spi_device_csb_o     (cio_spi_device_csb_p2d),
     .spi_device_sdi_o     (cio_spi_device_sdi_p2d),
     .spi_device_sdo_i     (cio_spi_device_sdo_d2p),
-    .spi_device_sdo_en_i  (cio_spi_device_sdo_en_d2p)
+    .spi_device_sdo_en_i  (cio_spi_device_sdo_en_d2p),
+    // Only single-lane transfers are wired up
+    .spi_device_sd_o      (),
+    .spi_device_sd_en_o   (),
+    .spi_device_sd_i      ('0)
   );
 
   // USB DPI
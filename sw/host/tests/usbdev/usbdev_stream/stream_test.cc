@@ -25,7 +25,7 @@
 // overridden using command line parameters.
 //
 // Usage:
-//   stream [-v<bool>][-c<bool>][-r<bool>][-s<bool>]
+//   stream [-v<bool>][-c<bool>][-r<bool>][-s<bool>][-q<depth>][-l[<types>]]
 //          [[-d<bus>:<address>] | [--device <bus>:<address>]]
 //          [<input port>[ <output port>]]
 //
@@ -34,6 +34,11 @@
 //
 //   -c   check any retrieved data against expectations
 //   -d   specify a particular USB device by bus number and device address
+//   -l   use an in-process loopback device instead of a physical device,
+//        with one stream per character of <types>; 'b' (Bulk),
+//        'i' (Interrupt) or 's' (iSochronous). The default is 'bb'
+//   -q   number of transfers kept in flight on each endpoint (1-64,
+//        default 8)
 //   -r   retrieve data from device
 //   -s   send data to device
 //   -t   use serial ports (ttyUSBx) in preference to libusb Bulk Transfer
@@ -59,12 +64,14 @@
 #include <cstring>
 #include <ctime>
 #include <iostream>
+#include <string>
 #include <sys/time.h>
 
 #include "usb_device.h"
 #if STREAMTEST_LIBUSB
 #include "usbdev_int.h"
 #include "usbdev_iso.h"
+#include "usbdev_loopback.h"
 #endif
 #include "usbdev_serial.h"
 #include "usbdev_utils.h"
@@ -79,6 +86,12 @@
 //       override the specified transfer amount.
 constexpr uint32_t kTransferBytes = (0x10U << 20);
 
+// Number of bytes transferred by each stream of the loopback device.
+constexpr uint32_t kLoopbackBytes = (1U << 20);
+
+// Maximum number of transfers in flight on each endpoint.
+constexpr unsigned kMaxDepth = 64U;
+
 // Has any data yet been received from the device?
 bool received = false;
 
@@ -154,6 +167,7 @@ void ReportSyntax(void) {
   fputs(
       "Usage:\n"
       "  stream [-n<streams>][-v<bool>][-c<bool>][-r<bool>][-s<bool>][-t][-z]\n"
+      "         [-q<depth>][-l[<types>]]\n"
       "         [[-d<bus>:<address>] | [--device <bus>:<address>]]\n"
       "         [<input port>[ <output port>]]"
       "\n\n"
@@ -163,6 +177,11 @@ void ReportSyntax(void) {
       "  -c   check any retrieved data against expectations\n"
       "  -d   specify a particular USB device by bus number"
       " and device address\n"
+      "  -l   use an in-process loopback device with one stream per character\n"
+      "       of <types>; 'b' (Bulk), 'i' (Interrupt) or 's' (iSochronous),\n"
+      "       default 'bb'\n"
+      "  -q   number of transfers kept in flight on each endpoint (1-64,\n"
+      "       default 8)\n"
       "  -r   retrieve data from device\n"
       "  -s   send data to device\n"
       "  -t   use serial ports (ttyUSBx) in preference to libusb Bulk\n"
@@ -290,7 +309,7 @@ static int RunTest(USBDevice *dev, const char *in_port, const char *out_port) {
       case USBDevStream::StreamType_Isochronous: {
         USBDevIso *iso;
         iso = new USBDevIso(dev, idx, transfer_bytes, cfg.retrieve, cfg.check,
-                            cfg.send, cfg.verbose);
+                            cfg.send, cfg.verbose, cfg.depth);
         if (iso) {
           opened = iso->Open(idx);
           if (opened) {
@@ -306,7 +325,7 @@ static int RunTest(USBDevice *dev, const char *in_port, const char *out_port) {
       case USBDevStream::StreamType_Bulk: {
         USBDevInt *interrupt;
         interrupt = new USBDevInt(dev, bulk, idx, transfer_bytes, cfg.retrieve,
-                                  cfg.check, cfg.send, cfg.verbose);
+                                  cfg.check, cfg.send, cfg.verbose, cfg.depth);
         if (interrupt) {
           opened = interrupt->Open(idx);
           if (opened) {
@@ -332,6 +351,13 @@ static int RunTest(USBDevice *dev, const char *in_port, const char *out_port) {
     }
   }
 
+#if STREAMTEST_LIBUSB
+  // Transfer completions are handled, and the libusb streams refilled, by a
+  // dedicated thread.
+  USBDevLoopback *loopback = dev->Loopback();
+  dev->StartEvents();
+#endif
+
   std::cout << "Streaming..." << std::endl;
 
   // Times are in microseconds.
@@ -371,6 +397,14 @@ static int RunTest(USBDevice *dev, const char *in_port, const char *out_port) {
             done = false;
           }
         }
+#if STREAMTEST_LIBUSB
+        // The loopback device decides success or failure of the test, as the
+        // device-side software would.
+        if (loopback && !failed) {
+          failed = loopback->Failed();
+          done = loopback->Completed();
+        }
+#endif
 
         // Initiate transition to Suspended.
         if (cfg.suspending && elapsed_time(start_time) >= kRunInterval) {
@@ -448,6 +482,9 @@ static int RunTest(USBDevice *dev, const char *in_port, const char *out_port) {
       for (unsigned idx = 0U; idx < nstreams; idx++) {
         (void)streams[idx]->Stop();
       }
+#if STREAMTEST_LIBUSB
+      dev->StopEvents();
+#endif
       return 3;
     }
 
@@ -471,14 +508,19 @@ static int RunTest(USBDevice *dev, const char *in_port, const char *out_port) {
   for (unsigned idx = 0U; idx < nstreams; idx++) {
     streams[idx]->Stop();
   }
+#if STREAMTEST_LIBUSB
+  dev->StopEvents();
+#endif
 
-  // TODO: introduce a crude estimate of the performance being achieved,
-  // for profiling the performance of IN and OUT traffic; totals and individual
-  // endpoints?
   double elapsed_secs = elapsed_time / 1e6;
   printf("Test completed in %.2lf seconds (%" PRIu64 "us)\n", elapsed_secs,
          elapsed_time);
 
+  // Report the throughput and latency of each stream.
+  for (unsigned idx = 0U; idx < nstreams; idx++) {
+    std::cout << streams[idx]->Report(true, cfg.verbose);
+  }
+
   return 0;
 }
 
@@ -489,6 +531,9 @@ int main(int argc, char *argv[]) {
   const char *in_port = nullptr;
   uint8_t devAddress = 0u;
   uint8_t busNumber = 0u;
+#if STREAMTEST_LIBUSB
+  std::string loopback_types("bb");
+#endif
 
   cfg.override_flags = false;
 
@@ -500,6 +545,30 @@ int main(int argc, char *argv[]) {
           cfg.check = GetBool(&argv[i][2]);
           cfg.override_flags = true;
           break;
+#if STREAMTEST_LIBUSB
+        case 'l':
+          cfg.loopback = true;
+          if (argv[i][2] != '\0') {
+            loopback_types = &argv[i][2];
+          }
+          if (loopback_types.size() > STREAMS_MAX ||
+              loopback_types.find_first_not_of("bis") != std::string::npos) {
+            std::cerr << "ERROR: Invalid loopback streams '" << argv[i] << "'"
+                      << std::endl;
+            ReportSyntax();
+            return 7;
+          }
+          break;
+#endif
+        case 'q':
+          cfg.depth = (unsigned)atoi(&argv[i][2]);
+          if (cfg.depth < 1U || cfg.depth > kMaxDepth) {
+            std::cerr << "ERROR: Invalid transfer depth '" << argv[i] << "'"
+                      << std::endl;
+            ReportSyntax();
+            return 7;
+          }
+          break;
         case 'd':
           if (!GetDevice(&argv[i][2], busNumber, devAddress)) {
             std::cerr << "ERROR: Unrecognised option '" << argv[i] << "'"
@@ -569,6 +638,14 @@ int main(int argc, char *argv[]) {
   // specific device address and bus number to handle the presence of multiple
   // similar devices.
   USBDevice dev(cfg.verbose);
+#if STREAMTEST_LIBUSB
+  USBDevLoopback loopback(loopback_types, kLoopbackBytes, cfg.verbose);
+  if (cfg.loopback) {
+    // The loopback device has no serial ports.
+    cfg.serial = false;
+    dev.SetLoopback(&loopback);
+  }
+#endif
   if (!dev.Init(kVendorID, kProductID, devAddress, busNumber)) {
     return 2;
   }
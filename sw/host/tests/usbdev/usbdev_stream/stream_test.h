@@ -30,7 +30,9 @@ struct TestConfig {
 #else
         serial(true),
 #endif
-        suspending(false) {
+        suspending(false),
+        depth(8U),
+        loopback(false) {
   }
   /**
    * Verbose logging/diagnostic reporting.
@@ -60,6 +62,14 @@ struct TestConfig {
    * Are we performing suspend-resume testing whilst streaming?
    */
   bool suspending;
+  /**
+   * Number of transfers kept in flight on each endpoint of libusb streams.
+   */
+  unsigned depth;
+  /**
+   * Use an in-process loopback device instead of a physical USB device?
+   */
+  bool loopback;
 };
 
 // Has any data yet been received from the device?
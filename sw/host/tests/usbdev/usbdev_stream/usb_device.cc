@@ -10,12 +10,19 @@
 #include <linux/usbdevice_fs.h>
 #include <unistd.h>
 
+#if STREAMTEST_LIBUSB
+#include "usbdev_loopback.h"
+#endif
 #include "usbdev_utils.h"
 
 // Initialize USB access, with intent to use a device with the given properties.
 bool USBDevice::Init(uint16_t vendorID, uint16_t productID, uint8_t devAddress,
                      uint8_t busNumber) {
 #if STREAMTEST_LIBUSB
+  if (loopback_) {
+    return true;
+  }
+
   // Initialize libusb
   int rc = libusb_init(&ctx_);
   if (rc < 0) {
@@ -38,7 +45,11 @@ bool USBDevice::Init(uint16_t vendorID, uint16_t productID, uint8_t devAddress,
 bool USBDevice::Fin() {
   (void)Close();
 #if STREAMTEST_LIBUSB
-  libusb_exit(ctx_);
+  StopEvents();
+  if (ctx_) {
+    libusb_exit(ctx_);
+    ctx_ = nullptr;
+  }
 #endif
   return true;
 }
@@ -51,6 +62,11 @@ bool USBDevice::Open() {
   }
 
 #if STREAMTEST_LIBUSB
+  if (loopback_) {
+    std::cout << "Using loopback device" << std::endl;
+    return true;
+  }
+
   // Locate our USB device.
   std::cout << "Locating USB device" << std::endl;
   unsigned numTries = 30u;
@@ -205,15 +221,89 @@ bool USBDevice::Close() {
 
 bool USBDevice::Service() {
 #if STREAMTEST_LIBUSB
-  struct timeval tv = {0};
-  int rc = libusb_handle_events_timeout(ctx_, &tv);
-  if (rc < 0) {
-    return ErrorUSB("ERROR: Handling events", rc);
+  if (eventsRunning_) {
+    // Transfers are being handled by the event thread; just avoid spinning.
+    usleep(1000);
+  } else if (loopback_) {
+    loopback_->HandleEvents(0U);
+  } else {
+    struct timeval tv = {0};
+    int rc = libusb_handle_events_timeout(ctx_, &tv);
+    if (rc < 0) {
+      return ErrorUSB("ERROR: Handling events", rc);
+    }
   }
 #endif
   return true;
 }
 
+#if STREAMTEST_LIBUSB
+bool USBDevice::StartEvents() {
+  if (eventsRunning_) {
+    return true;
+  }
+  eventsStop_ = false;
+  events_ = std::thread([this] {
+    while (!eventsStop_) {
+      if (loopback_) {
+        loopback_->HandleEvents(kEventTimeout);
+      } else {
+        struct timeval tv = {0, kEventTimeout * 1000};
+        int rc = libusb_handle_events_timeout_completed(ctx_, &tv, nullptr);
+        if (rc < 0 && rc != LIBUSB_ERROR_INTERRUPTED) {
+          ErrorUSB("ERROR: Handling events", rc);
+          break;
+        }
+      }
+    }
+  });
+  eventsRunning_ = true;
+  return true;
+}
+
+void USBDevice::StopEvents() {
+  if (!eventsRunning_) {
+    return;
+  }
+  eventsStop_ = true;
+  if (loopback_) {
+    loopback_->Interrupt();
+  } else {
+    libusb_interrupt_event_handler(ctx_);
+  }
+  events_.join();
+  eventsRunning_ = false;
+}
+
+int USBDevice::ClaimInterface(unsigned interface) const {
+  if (loopback_) {
+    return LIBUSB_SUCCESS;
+  }
+  return libusb_claim_interface(devh_, (int)interface);
+}
+
+int USBDevice::ReleaseInterface(unsigned interface) const {
+  if (loopback_) {
+    return LIBUSB_SUCCESS;
+  }
+  return libusb_release_interface(devh_, (int)interface);
+}
+
+int USBDevice::SubmitTransfer(struct libusb_transfer *xfr) const {
+  if (loopback_) {
+    return loopback_->Submit(xfr);
+  }
+  return libusb_submit_transfer(xfr);
+}
+
+int USBDevice::CancelTransfer(struct libusb_transfer *xfr) const {
+  if (loopback_) {
+    return loopback_->Cancel(xfr);
+  }
+  return libusb_cancel_transfer(xfr);
+}
+#endif
+
 bool USBDevice::ReadTestDesc() {
   std::cout << "Reading Test Descriptor" << std::endl;
 
@@ -221,6 +311,15 @@ bool USBDevice::ReadTestDesc() {
     return false;
   }
 #if STREAMTEST_LIBUSB
+  if (loopback_) {
+    // The loopback device describes the streams that it implements.
+    testNumber_ = (usb_testutils_test_number_t)loopback_->TestNumber();
+    for (unsigned arg = 0U; arg < 4U; arg++) {
+      testArg_[arg] = loopback_->TestArg(arg);
+    }
+    return true;
+  }
+
   uint8_t bmRequestType = LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR |
                           LIBUSB_RECIPIENT_ENDPOINT;
   std::cout << "req type " << (int)bmRequestType << std::endl;
@@ -283,6 +382,12 @@ bool USBDevice::ReadTestDesc() {
 
 bool USBDevice::Suspend() {
   std::cout << "Suspending Device " << devPath_ << std::endl;
+#if STREAMTEST_LIBUSB
+  if (loopback_) {
+    SetState(StateSuspending);
+    return true;
+  }
+#endif
 
   // We need to relinquish our access to the device otherwise the kernel
   // will refuse to autosuspend the device!
@@ -329,6 +434,12 @@ bool USBDevice::Suspend() {
 
 bool USBDevice::Resume() {
   std::cout << "Resuming Device" << std::endl;
+#if STREAMTEST_LIBUSB
+  if (loopback_) {
+    SetState(StateResuming);
+    return true;
+  }
+#endif
 
   std::string powerPath = "/sys/bus/usb/devices/" + devPath_ + "/power/";
   std::string filename = powerPath + "control";
@@ -3,13 +3,17 @@
 // SPDX-License-Identifier: Apache-2.0
 #ifndef OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USB_DEVICE_H_
 #define OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USB_DEVICE_H_
+#include <atomic>
 #include <iostream>
+#include <thread>
 
 // The 'usbdev_serial' class may be used on platforms where libusb support is
 // not available; libusb is required to exercise Isochronous streams, Interrupt
 // streams and Control Transfers.
 #if STREAMTEST_LIBUSB
 #include <libusb-1.0/libusb.h>
+
+class USBDevLoopback;
 #endif
 
 class USBDevice {
@@ -19,7 +23,10 @@ class USBDevice {
       : verbose_(verbose),
         state_(StateStreaming),
         ctx_(nullptr),
-        devh_(nullptr) {}
+        devh_(nullptr),
+        loopback_(nullptr),
+        eventsRunning_(false),
+        eventsStop_(false) {}
 #else
   USBDevice(bool verbose = false)
       : verbose_(verbose), state_(StateStreaming), devh_(false) {}
@@ -124,24 +131,44 @@ class USBDevice {
   bool Service();
 
 #if STREAMTEST_LIBUSB
+  /**
+   * Use an in-process loopback device in place of a physical USB device; must
+   * be called before Init().
+   *
+   * @param  loopback  Loopback device.
+   */
+  void SetLoopback(USBDevLoopback *loopback) { loopback_ = loopback; }
+  /**
+   * Return the loopback device in use, if any.
+   *
+   * @return The loopback device, or nullptr if using a physical device.
+   */
+  USBDevLoopback *Loopback() const { return loopback_; }
+  /**
+   * Start a thread that handles libusb events, invoking the completion
+   * callbacks of transfers as soon as they complete.
+   *
+   * @return true iff the thread was started.
+   */
+  bool StartEvents();
+  /**
+   * Stop the event-handling thread, if running.
+   */
+  void StopEvents();
   /**
    * Claim an interface on the device.
    *
    * @param interface The interface number of the interface to be claimed.
    * @return The result of the operation.
    */
-  int ClaimInterface(unsigned interface) const {
-    return libusb_claim_interface(devh_, (int)interface);
-  }
+  int ClaimInterface(unsigned interface) const;
   /**
    * Release an interface on the device.
    *
    * @param interface The interface number of the interface to be claimed.
    * @return The result of the operation.
    */
-  int ReleaseInterface(unsigned interface) const {
-    return libusb_release_interface(devh_, (int)interface);
-  }
+  int ReleaseInterface(unsigned interface) const;
   /**
    * Emit a textual report of an error returned by libusb.
    *
@@ -231,17 +258,13 @@ class USBDevice {
    *
    * @param  xfr     The transfer to be submitted.
    */
-  int SubmitTransfer(struct libusb_transfer *xfr) const {
-    return libusb_submit_transfer(xfr);
-  }
+  int SubmitTransfer(struct libusb_transfer *xfr) const;
   /**
    * Cancel a pending transfer.
    *
    * @param  xfr     The transfer to be cancelled.
    */
-  int CancelTransfer(struct libusb_transfer *xfr) const {
-    return libusb_cancel_transfer(xfr);
-  }
+  int CancelTransfer(struct libusb_transfer *xfr) const;
 #endif
 
   /**
@@ -332,6 +355,17 @@ class USBDevice {
 
   // Device descriptor.
   libusb_device_descriptor devDesc_;
+
+  // In-process loopback device, if used in place of a physical device.
+  USBDevLoopback *loopback_;
+
+  // Event-handling thread.
+  std::thread events_;
+  bool eventsRunning_;
+  std::atomic<bool> eventsStop_;
+
+  // Maximum time for which the event thread blocks (milliseconds).
+  static constexpr unsigned kEventTimeout = 100U;
 #else
   // Device handle; just retain whether open/closed.
   bool devh_;
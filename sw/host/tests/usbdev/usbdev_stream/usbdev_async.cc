@@ -0,0 +1,275 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#include "usbdev_async.h"
+
+#include <cstdio>
+
+#include "usbdev_utils.h"
+
+// Stub callback function supplied to libusb.
+void LIBUSB_CALL USBDevAsync::CbStubIN(struct libusb_transfer *xfr) {
+  Xfr *x = reinterpret_cast<Xfr *>(xfr->user_data);
+  x->stream->CallbackIN(x);
+}
+
+void LIBUSB_CALL USBDevAsync::CbStubOUT(struct libusb_transfer *xfr) {
+  Xfr *x = reinterpret_cast<Xfr *>(xfr->user_data);
+  x->stream->CallbackOUT(x);
+}
+
+USBDevAsync::~USBDevAsync() {
+  for (Xfr &x : pool_) {
+    if (x.xfr) {
+      dev_->FreeTransfer(x.xfr);
+    }
+    delete[] x.buf;
+  }
+}
+
+bool USBDevAsync::Open(unsigned interface) {
+  int rc = dev_->ClaimInterface(interface);
+  if (rc < 0) {
+    return dev_->ErrorUSB("ERROR: Claiming interface", rc);
+  }
+
+  // Retain the interface number.
+  interface_ = interface;
+
+  // Remember the (assumed) endpoints which we're using.
+  epOut_ = interface + 1U;
+  epIn_ = 0x80U | epOut_;
+
+  // Allocate the pool of transfers; enough for `depth_` transfers to be in
+  // flight on each endpoint simultaneously.
+  const unsigned nxfrs = 2U * depth_;
+  pool_.resize(nxfrs);
+  for (Xfr &x : pool_) {
+    x.stream = this;
+    x.xfr = dev_->AllocTransfer(IsoPackets());
+    x.buf = new uint8_t[BufferSize()];
+    x.offset = 0U;
+    x.len = 0U;
+    x.submitted = 0U;
+    x.active = false;
+    if (!x.xfr) {
+      std::cerr << PrefixID() << "Failed to allocate transfers" << std::endl;
+      return false;
+    }
+    free_.push_back(&x);
+  }
+
+  return true;
+}
+
+void USBDevAsync::Stop() {
+  // Transfers requesting data that the device has no need to send would
+  // otherwise remain in flight indefinitely.
+  Cancel(true);
+  WaitIdle();
+
+  int rc = dev_->ReleaseInterface(interface_);
+  if (rc < 0) {
+    std::cerr << "" << std::endl;
+  }
+}
+
+void USBDevAsync::Pause() {
+  if (verbose_) {
+    std::cout << PrefixID() << "waiting to close" << std::endl;
+  }
+  // Any data already received by a cancelled IN transfer is still processed
+  // and queued for transmission upon resumption; OUT transfers are allowed
+  // to complete.
+  Cancel(false);
+  WaitIdle();
+  if (verbose_) {
+    std::cout << PrefixID() << " closed" << std::endl;
+  }
+
+  int rc = dev_->ReleaseInterface(interface_);
+  if (rc < 0) {
+    std::cerr << "" << std::endl;
+  }
+}
+
+bool USBDevAsync::Resume() {
+  {
+    std::lock_guard<std::mutex> lk(lock_);
+    SetClosing(false);
+  }
+
+  int rc = dev_->ClaimInterface(interface_);
+  if (rc < 0) {
+    return dev_->ErrorUSB("ERROR: Claiming interface", rc);
+  }
+  return true;
+}
+
+// Return a summary report of the stream settings of status.
+std::string USBDevAsync::Report(bool status, bool verbose) const {
+  if (!status) {
+    return "";
+  }
+  std::lock_guard<std::mutex> lk(lock_);
+  return statsIn_.Report(PrefixID() + "IN  ") +
+         statsOut_.Report(PrefixID() + "OUT ");
+}
+
+void USBDevAsync::DumpTransfer(struct libusb_transfer *xfr) const {
+  const void *buf = reinterpret_cast<void *>(xfr->buffer);
+  std::cout << "Buffer " << buf << " length " << xfr->length
+            << " => actual length " << xfr->actual_length << std::endl;
+  buffer_dump(stdout, xfr->buffer, xfr->actual_length);
+}
+
+bool USBDevAsync::Service() {
+  std::lock_guard<std::mutex> lk(lock_);
+  // Prime the stream, or restart it after resuming; thereafter the completion
+  // callbacks keep the transfers flowing.
+  Refill();
+  return !failed_;
+}
+
+bool USBDevAsync::Submit(Xfr *x, const char *dir) {
+  x->submitted = time_us();
+  int rc = dev_->SubmitTransfer(x->xfr);
+  if (rc < 0) {
+    std::string prefix = PrefixID() + "ERROR: Submitting " + dir + " transfer";
+    dev_->ErrorUSB(prefix.c_str(), rc);
+    failed_ = true;
+    return false;
+  }
+  x->active = true;
+  return true;
+}
+
+void USBDevAsync::Refill() {
+  if (failed_ || !CanSchedule()) {
+    return;
+  }
+
+  // Return received data to the device in the order in which it arrived.
+  while (!pendingOut_.empty() && inFlightOut_ < depth_) {
+    Xfr *x = pendingOut_.front();
+    FillOUT(x);
+    if (!Submit(x, "OUT")) {
+      return;
+    }
+    pendingOut_.pop_front();
+    inFlightOut_++;
+  }
+
+  // Keep the IN endpoint busy whilst there are buffers available.
+  while (!free_.empty() && inFlightIn_ < depth_) {
+    Xfr *x = free_.back();
+    if (!FillIN(x)) {
+      break;
+    }
+    if (!Submit(x, "IN")) {
+      return;
+    }
+    free_.pop_back();
+    inFlightIn_++;
+  }
+}
+
+void USBDevAsync::Cancel(bool all) {
+  std::lock_guard<std::mutex> lk(lock_);
+  // No further transfers may be submitted by the completion callbacks.
+  SetClosing(true);
+  for (Xfr &x : pool_) {
+    if (x.active && (all || (x.xfr->endpoint & LIBUSB_ENDPOINT_IN))) {
+      // Failure just means that the transfer has already completed.
+      (void)dev_->CancelTransfer(x.xfr);
+    }
+  }
+}
+
+unsigned USBDevAsync::InFlight() const {
+  std::lock_guard<std::mutex> lk(lock_);
+  return inFlightIn_ + inFlightOut_;
+}
+
+void USBDevAsync::WaitIdle() {
+  while (InFlight()) {
+    dev_->Service();
+  }
+}
+
+// Callback function supplied to libusb for IN transfers.
+void USBDevAsync::CallbackIN(Xfr *x) {
+  struct libusb_transfer *xfr = x->xfr;
+  std::lock_guard<std::mutex> lk(lock_);
+  x->active = false;
+  inFlightIn_--;
+
+  // A cancelled transfer may still have received some data.
+  if (xfr->status == LIBUSB_TRANSFER_COMPLETED ||
+      (xfr->status == LIBUSB_TRANSFER_CANCELLED && xfr->actual_length > 0)) {
+    if (verbose_) {
+      std::cout << PrefixID() << "CallbackIN xfr " << xfr << std::endl;
+      DumpTransfer(xfr);
+    }
+
+    // Check the received data and combine it with our LFSR output in place;
+    // the same buffer then carries the data back to the device.
+    x->offset = 0U;
+    x->len = 0U;
+    int nrecvd = CompletedIN(x);
+    if (nrecvd < 0) {
+      failed_ = true;
+      Release(x);
+      return;
+    }
+    statsIn_.Record(time_us(), x->submitted, (uint32_t)nrecvd);
+    if (x->len) {
+      pendingOut_.push_back(x);
+    } else {
+      Release(x);
+    }
+  } else {
+    Release(x);
+    if (xfr->status != LIBUSB_TRANSFER_CANCELLED) {
+      std::cerr << PrefixID() << " Invalid/unexpected IN transfer status "
+                << xfr->status << std::endl;
+      std::cerr << "length " << xfr->length << " actual " << xfr->actual_length
+                << std::endl;
+      statsIn_.RecordError();
+      failed_ = true;
+      return;
+    }
+  }
+
+  Refill();
+}
+
+// Callback function supplied to libusb for OUT transfers.
+void USBDevAsync::CallbackOUT(Xfr *x) {
+  struct libusb_transfer *xfr = x->xfr;
+  std::lock_guard<std::mutex> lk(lock_);
+  x->active = false;
+  inFlightOut_--;
+  Release(x);
+
+  if (xfr->status == LIBUSB_TRANSFER_COMPLETED) {
+    if (verbose_) {
+      std::cout << PrefixID() << "CallbackOUT xfr " << xfr << std::endl;
+      DumpTransfer(xfr);
+    }
+
+    uint32_t nsent = CompletedOUT(x);
+    statsOut_.Record(time_us(), x->submitted, nsent);
+    bytes_sent_ += nsent;
+  } else if (xfr->status != LIBUSB_TRANSFER_CANCELLED) {
+    std::cerr << PrefixID() << " Invalid/unexpected OUT transfer status "
+              << xfr->status << std::endl;
+    std::cerr << "length " << xfr->length << " actual " << xfr->actual_length
+              << std::endl;
+    statsOut_.RecordError();
+    failed_ = true;
+    return;
+  }
+
+  Refill();
+}
@@ -0,0 +1,246 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_ASYNC_H_
+#define OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_ASYNC_H_
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "usb_device.h"
+#include "usbdev_stats.h"
+#include "usbdev_stream.h"
+
+// Asynchronous libusb-based stream; the common engine of the Bulk, Interrupt
+// and Isochronous streams.
+//
+// Each stream owns a pool of transfers, each with its own data buffer, that
+// are allocated when the stream is opened. A transfer cycles from the pool to
+// the IN endpoint, where the received data is checked and combined with the
+// host-side LFSR in place, then to the OUT endpoint carrying that same data
+// back to the device, and then back to the pool. At most `depth` transfers are
+// in flight on each endpoint.
+//
+// Transfers are refilled from the completion callbacks, which are invoked by
+// the libusb event thread of the USBDevice, so the main thread need not poll
+// the stream to keep data flowing.
+class USBDevAsync : public USBDevStream {
+ public:
+  USBDevAsync(USBDevice *dev, unsigned id, uint32_t transfer_bytes,
+              bool retrieve, bool check, bool send, bool verbose,
+              unsigned depth)
+      : USBDevStream(id, transfer_bytes, retrieve, check, send, verbose),
+        dev_(dev),
+        depth_(depth),
+        failed_(false),
+        inFlightIn_(0U),
+        inFlightOut_(0U) {}
+  virtual ~USBDevAsync();
+  /**
+   * Open a connection to specified device interface, and allocate the pool of
+   * transfers.
+   *
+   * @param  interface  Interface number.
+   * @return The success of the operation.
+   */
+  bool Open(unsigned interface);
+  /**
+   * Finalize the stream, prior to shutting down.
+   */
+  virtual void Stop();
+  /**
+   * Pause the stream, prior to suspending the device.
+   */
+  virtual void Pause();
+  /**
+   * Resume streaming.
+   */
+  virtual bool Resume();
+  /**
+   * Return a summary report of the stream settings or status.
+   *
+   * @param  status    Indicates whether settings or status requested.
+   * @param  verbose   true iff a more verbose report is required.
+   * @return Status report.
+   */
+  virtual std::string Report(bool status = false, bool verbose = false) const;
+  /**
+   * Service this stream; transfers are (re)started if necessary.
+   *
+   * @return true iff the stream is still operational.
+   */
+  virtual bool Service();
+
+ protected:
+  /**
+   * Transfer descriptor from the pool, and its data buffer.
+   */
+  struct Xfr {
+    /**
+     * Stream that owns this transfer.
+     */
+    USBDevAsync *stream;
+    /**
+     * libusb transfer descriptor.
+     */
+    struct libusb_transfer *xfr;
+    /**
+     * Data buffer.
+     */
+    uint8_t *buf;
+    /**
+     * Data to be sent OUT to the device, within the data buffer.
+     */
+    uint32_t offset;
+    uint32_t len;
+    /**
+     * Time at which the transfer was submitted (microseconds).
+     */
+    uint64_t submitted;
+    /**
+     * Has the transfer been submitted and not yet completed?
+     */
+    bool active;
+  };
+  /**
+   * Return the number of Isochronous packets per transfer, for allocation.
+   */
+  virtual unsigned IsoPackets() const { return 0U; }
+  /**
+   * Return the size of the data buffer required for each transfer.
+   */
+  virtual uint32_t BufferSize() const { return maxPacketSize_; }
+  /**
+   * Complete the transfer descriptor for an IN transfer, supplying CbStubIN
+   * as the callback function and `x` as the user data.
+   *
+   * @param  x       Transfer to be completed.
+   * @return Number of bytes requested, or zero if no transfer is required.
+   */
+  virtual uint32_t FillIN(Xfr *x) = 0;
+  /**
+   * Complete the transfer descriptor for an OUT transfer of `x->len` bytes at
+   * `x->offset` within the buffer, supplying CbStubOUT as the callback
+   * function and `x` as the user data.
+   *
+   * @param  x       Transfer to be completed.
+   */
+  virtual void FillOUT(Xfr *x) = 0;
+  /**
+   * Process the data received by a completed IN transfer, checking it in place
+   * and leaving the data to be sent OUT in the buffer.
+   *
+   * @param  x       Transfer that has completed successfully.
+   * @return Number of bytes received, or -1 if the stream has failed.
+   */
+  virtual int CompletedIN(Xfr *x) = 0;
+  /**
+   * Return the number of bytes sent by a completed OUT transfer.
+   *
+   * @param  x       Transfer that has completed successfully.
+   * @return Number of bytes sent.
+   */
+  virtual uint32_t CompletedOUT(Xfr *x) = 0;
+  /**
+   * Record a packet that failed to complete successfully.
+   *
+   * @param  in      IN packet, rather than OUT packet.
+   */
+  void PacketError(bool in) { (in ? statsIn_ : statsOut_).RecordError(); }
+  /**
+   * Diagnostic utility function to display the content of a transfer.
+   *
+   * @param  xfr     The transfer to be displayed.
+   */
+  virtual void DumpTransfer(struct libusb_transfer *xfr) const;
+  /**
+   * Stub callback functions supplied to libusb.
+   *
+   * @param  xfr     The transfer that has completed.
+   */
+  static void LIBUSB_CALL CbStubIN(struct libusb_transfer *xfr);
+  static void LIBUSB_CALL CbStubOUT(struct libusb_transfer *xfr);
+
+  // USB device.
+  USBDevice *dev_;
+
+  // The number of the interface being used by this stream.
+  unsigned interface_;
+
+  // Maximum packet size for this stream.
+  uint8_t maxPacketSize_;
+
+  // Endpoint numbers used by this stream.
+  uint8_t epIn_;
+  uint8_t epOut_;
+
+  // No timeout at present; the device-side code is responsible for signaling
+  // test completion/failure. This may need to change for CI tests.
+  static constexpr unsigned kDataTimeout = 0U;
+
+ private:
+  /**
+   * Submit IN and OUT transfers until each endpoint has `depth_` transfers in
+   * flight, or we run out of transfers or data. The stream lock must be held.
+   */
+  void Refill();
+  /**
+   * Submit a transfer. The stream lock must be held.
+   *
+   * @return true iff the transfer was submitted successfully.
+   */
+  bool Submit(Xfr *x, const char *dir);
+  /**
+   * Mark the stream as closing, and cancel all transfers in flight on the IN
+   * endpoint, or on both endpoints.
+   *
+   * @param  all     Cancel OUT transfers too.
+   */
+  void Cancel(bool all);
+  /**
+   * Return the number of transfers in flight.
+   */
+  unsigned InFlight() const;
+  /**
+   * Return a transfer to the pool.
+   */
+  void Release(Xfr *x) { free_.push_back(x); }
+  /**
+   * Wait for all transfers in flight to complete.
+   */
+  void WaitIdle();
+  /**
+   * Callback functions for IN and OUT transfers.
+   *
+   * @param  x       The transfer that has completed.
+   */
+  void CallbackIN(Xfr *x);
+  void CallbackOUT(Xfr *x);
+
+  // Maximum number of transfers in flight on each endpoint.
+  unsigned depth_;
+
+  // Serializes the completion callbacks (libusb event thread) with the
+  // servicing of the stream (main thread).
+  mutable std::mutex lock_;
+
+  // Has this stream experienced a failure?
+  std::atomic<bool> failed_;
+
+  // Pool of transfers, those that are free, and those holding data that is
+  // waiting to be sent OUT, in order.
+  std::vector<Xfr> pool_;
+  std::vector<Xfr *> free_;
+  std::deque<Xfr *> pendingOut_;
+
+  // Number of transfers in flight on each endpoint.
+  unsigned inFlightIn_;
+  unsigned inFlightOut_;
+
+  // Throughput and latency statistics.
+  USBDevStats statsIn_;
+  USBDevStats statsOut_;
+};
+
+#endif  // OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_ASYNC_H_
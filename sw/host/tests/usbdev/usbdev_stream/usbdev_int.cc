@@ -8,268 +8,90 @@
 
 #include "usbdev_utils.h"
 
-// Stub callback function supplied to libusb.
-void LIBUSB_CALL USBDevInt::CbStubIN(struct libusb_transfer *xfr) {
-  USBDevInt *self = reinterpret_cast<USBDevInt *>(xfr->user_data);
-  self->CallbackIN(xfr);
-}
-
-void LIBUSB_CALL USBDevInt::CbStubOUT(struct libusb_transfer *xfr) {
-  USBDevInt *self = reinterpret_cast<USBDevInt *>(xfr->user_data);
-  self->CallbackOUT(xfr);
-}
-
-bool USBDevInt::Open(unsigned interface) {
-  int rc = dev_->ClaimInterface(interface);
-  if (rc < 0) {
-    return dev_->ErrorUSB("ERROR: Claiming interface", rc);
-  }
-
-  // Retain the interface number.
-  interface_ = interface;
-
-  // Remember the (assumed) endpoints which we're using.
-  epOut_ = interface + 1U;
-  epIn_ = 0x80U | epOut_;
-
-  // No transfers in progress.
-  xfrIn_ = nullptr;
-
-  xfrOut_ = nullptr;
-
-  maxPacketSize_ = USBDevice::kDevDataMaxPacketSize;
-
-  return true;
-}
-
-void USBDevInt::Stop() {
-  SetClosing(true);
-
-  int rc = dev_->ReleaseInterface(interface_);
-  if (rc < 0) {
-    std::cerr << "" << std::endl;
-  }
-}
-
-void USBDevInt::Pause() {
-  SetClosing(true);
-
-  if (verbose_) {
-    std::cout << PrefixID() << "waiting to close" << std::endl;
-  }
-  while (inActive_ || outActive_) {
-    dev_->Service();
-  }
-  if (verbose_) {
-    std::cout << PrefixID() << " closed" << std::endl;
-  }
-
-  int rc = dev_->ReleaseInterface(interface_);
-  if (rc < 0) {
-    std::cerr << "" << std::endl;
-  }
-}
-
-bool USBDevInt::Resume() {
-  SetClosing(false);
-
-  int rc = dev_->ClaimInterface(interface_);
-  if (rc < 0) {
-    return dev_->ErrorUSB("ERROR: Claiming interface", rc);
-  }
-  return true;
-}
-
-// Return a summary report of the stream settings of status.
-std::string USBDevInt::Report(bool status, bool verbose) const { return ""; }
-
-void USBDevInt::DumpIntTransfer(struct libusb_transfer *xfr) const {
-  const void *buf = reinterpret_cast<void *>(xfr->buffer);
-  std::cout << "Buffer " << buf << " length " << xfr->length
-            << " => actual length " << xfr->actual_length << std::endl;
-  buffer_dump(stdout, xfr->buffer, xfr->actual_length);
-}
-
-// Retrieving of IN traffic from device.
-bool USBDevInt::ServiceIN() {
-  // Ensure that we have enough space available for a full packet; the device
-  // software decides upon the length of each packet.
-  uint8_t *space;
-  bool ok = ProvisionSpace(&space, maxPacketSize_);
-  if (ok) {
-    uint32_t to_fetch = maxPacketSize_;
-    if (to_fetch > transfer_bytes_ - bytes_recvd_) {
-      to_fetch = transfer_bytes_ - bytes_recvd_;
-    }
-
-    if (!xfrIn_) {
-      xfrIn_ = dev_->AllocTransfer(0U);
-      if (!xfrIn_) {
-        return false;
-      }
-    }
-
-    if (bulk_) {
-      dev_->FillBulkTransfer(xfrIn_, epIn_, space, to_fetch, CbStubIN, this,
-                             kDataTimeout);
-    } else {
-      dev_->FillIntTransfer(xfrIn_, epIn_, space, to_fetch, CbStubIN, this,
-                            kDataTimeout);
-    }
-
-    int rc = dev_->SubmitTransfer(xfrIn_);
-    if (rc < 0) {
-      return dev_->ErrorUSB("ERROR: Submitting IN transfer", rc);
-    }
-    inActive_ = true;
+// Complete an IN transfer descriptor.
+uint32_t USBDevInt::FillIN(Xfr *x) {
+  // Request a full packet; the device software decides upon the length of
+  // each packet.
+  //
+  // Note: the device never sends more than the number of bytes that remain
+  // to be transferred, so this cannot be exceeded by any of the transfers
+  // in flight, each of which completes with a single packet.
+  uint32_t recvd = bytes_recvd_;
+  uint32_t total = transfer_bytes_;
+  if (recvd >= total) {
+    return 0U;
+  }
+  uint32_t to_fetch = maxPacketSize_;
+  if (to_fetch > total - recvd) {
+    to_fetch = total - recvd;
+  }
+
+  if (bulk_) {
+    dev_->FillBulkTransfer(x->xfr, epIn_, x->buf, to_fetch, CbStubIN, x,
+                           kDataTimeout);
   } else {
-    inActive_ = false;
+    dev_->FillIntTransfer(x->xfr, epIn_, x->buf, to_fetch, CbStubIN, x,
+                          kDataTimeout);
   }
-
-  return true;
+  return to_fetch;
 }
 
-// Sending of OUT traffic to device.
-bool USBDevInt::ServiceOUT() {
-  // Do we have any data ready to send?
-  uint8_t *data;
-  uint32_t num_bytes = DataAvailable(&data);
-  if (num_bytes > 0U) {
-    // Supply details of the single OUT packet.
-    if (!xfrOut_) {
-      xfrOut_ = dev_->AllocTransfer(0U);
-      if (!xfrOut_) {
-        // Stream is not operational.
-        return false;
-      }
-    }
-
-    if (bulk_) {
-      dev_->FillBulkTransfer(xfrOut_, epOut_, data, num_bytes, CbStubOUT, this,
-                             kDataTimeout);
-    } else {
-      dev_->FillIntTransfer(xfrOut_, epOut_, data, num_bytes, CbStubOUT, this,
-                            kDataTimeout);
-    }
-
-    int rc = dev_->SubmitTransfer(xfrOut_);
-    if (rc < 0) {
-      return dev_->ErrorUSB("ERROR: Submitting OUT transfer", rc);
-    }
-    outActive_ = true;
+// Complete an OUT transfer descriptor.
+void USBDevInt::FillOUT(Xfr *x) {
+  uint8_t *data = &x->buf[x->offset];
+  if (bulk_) {
+    dev_->FillBulkTransfer(x->xfr, epOut_, data, x->len, CbStubOUT, x,
+                           kDataTimeout);
   } else {
-    // Nothing to propagate at this time.
-    outActive_ = false;
+    dev_->FillIntTransfer(x->xfr, epOut_, data, x->len, CbStubOUT, x,
+                          kDataTimeout);
   }
-  // Stream remains operational, even if it presently has no work on the OUT
-  // side.
-  return true;
 }
 
-bool USBDevInt::Service() {
-  if (failed_) {
-    return false;
-  }
-  // (Re)start IN traffic if not already in progress.
-  if (!inActive_ && !ServiceIN()) {
-    return false;
-  }
-  // (Re)start OUT traffic if not already in progress and there is
-  // data available to be transmitted.
-  if (!outActive_ && !ServiceOUT()) {
-    return false;
-  }
-  return true;
-}
-
-// Callback function supplied to libusb for IN transfers.
-void USBDevInt::CallbackIN(struct libusb_transfer *xfr) {
-  if (xfr->status != LIBUSB_TRANSFER_COMPLETED) {
-    std::cerr << PrefixID() << " Invalid/unexpected IN transfer status "
-              << xfr->status << std::endl;
-    std::cerr << "length " << xfr->length << " actual " << xfr->actual_length
-              << std::endl;
-    failed_ = true;
-    return;
-  }
-
-  if (verbose_) {
-    std::cout << PrefixID() << "CallbackIN xfr " << xfr << std::endl;
-    DumpIntTransfer(xfr);
-  }
+// Process the data received by a completed IN transfer.
+int USBDevInt::CompletedIN(Xfr *x) {
+  struct libusb_transfer *xfr = x->xfr;
 
   // Collect and parse signature bytes at the start of the IN stream.
   uint8_t *dp = xfr->buffer;
-  int nrecvd = xfr->actual_length;
-
-  // Update the circular buffer with the amount of data that we've received
-  CommitData(nrecvd);
-
-  if (!SigReceived()) {
-    if (nrecvd > 0 && !SigReceived()) {
-      uint32_t dropped = SigDetect(&sig_, dp, (uint32_t)nrecvd);
+  uint32_t nrecvd = (uint32_t)xfr->actual_length;
 
-      // Consume stream signature, rather than propagating it to the output
-      // side.
-      if (SigReceived()) {
-        SigProcess(sig_);
-        dropped += sizeof(usbdev_stream_sig_t);
-      }
+  if (!SigReceived() && nrecvd > 0U) {
+    uint32_t dropped = SigDetect(&sig_, dp, nrecvd);
 
-      // Skip past any dropped bytes, including the signature, so that if there
-      // are additional bytes we may process them.
-      nrecvd = ((uint32_t)nrecvd > dropped) ? ((uint32_t)nrecvd - dropped) : 0;
-      dp += dropped;
-
-      if (dropped) {
-        DiscardData(dropped);
-      }
+    // Consume stream signature, rather than propagating it to the output
+    // side.
+    if (SigReceived()) {
+      SigProcess(sig_);
+      dropped += sizeof(usbdev_stream_sig_t);
+    } else {
+      // Nothing but (partial) signature bytes in this packet.
+      dropped = nrecvd;
     }
+
+    // Skip past any dropped bytes, including the signature, so that if there
+    // are additional bytes we may process them.
+    nrecvd = (nrecvd > dropped) ? (nrecvd - dropped) : 0U;
+    dp += dropped;
   }
 
-  bool ok = true;
-  if (nrecvd > 0) {
+  if (nrecvd > 0U) {
     // Check the received LFSR-generated byte(s) and combine them with the
     // output of our host-side LFSR.
-    ok = ProcessData(dp, nrecvd);
-  }
-
-  if (ok) {
-    if (CanSchedule()) {
-      // Attempt to set up another IN transfer.
-      failed_ = !ServiceIN();
-    } else {
-      inActive_ = false;
+    if (!ProcessData(dp, nrecvd)) {
+      return -1;
     }
-  } else {
-    failed_ = true;
+    x->offset = (uint32_t)(dp - x->buf);
+    x->len = nrecvd;
   }
-}
 
-// Callback function supplied to libusb for OUT transfers.
-void USBDevInt::CallbackOUT(struct libusb_transfer *xfr) {
-  if (xfr->status != LIBUSB_TRANSFER_COMPLETED) {
-    std::cerr << PrefixID() << " Invalid/unexpected OUT transfer status "
-              << xfr->status << std::endl;
-    std::cerr << "length " << xfr->length << " actual " << xfr->actual_length
-              << std::endl;
-    failed_ = true;
-    return;
-  }
-
-  if (verbose_) {
-    std::cout << PrefixID() << "CallbackOUT xfr " << xfr << std::endl;
-    DumpIntTransfer(xfr);
-  }
+  return xfr->actual_length;
+}
 
+// Return the number of bytes sent by a completed OUT transfer.
+uint32_t USBDevInt::CompletedOUT(Xfr *x) {
+  struct libusb_transfer *xfr = x->xfr;
   // Note: we're not expecting any truncation on OUT transfers.
   assert(xfr->actual_length == xfr->length);
-  ConsumeData(xfr->actual_length);
-
-  if (CanSchedule()) {
-    // Attempt to set up another OUT transfer.
-    failed_ = !ServiceOUT();
-  } else {
-    outActive_ = false;
-  }
+  return xfr->actual_length;
 }
@@ -8,75 +8,6 @@
 
 #include "usbdev_utils.h"
 
-// Stub callback function supplied to libusb.
-void LIBUSB_CALL USBDevIso::CbStubIN(struct libusb_transfer *xfr) {
-  USBDevIso *self = reinterpret_cast<USBDevIso *>(xfr->user_data);
-  self->CallbackIN(xfr);
-}
-
-void LIBUSB_CALL USBDevIso::CbStubOUT(struct libusb_transfer *xfr) {
-  USBDevIso *self = reinterpret_cast<USBDevIso *>(xfr->user_data);
-  self->CallbackOUT(xfr);
-}
-
-bool USBDevIso::Open(unsigned interface) {
-  int rc = dev_->ClaimInterface(interface);
-  if (rc < 0) {
-    return dev_->ErrorUSB("ERROR: Claiming interface", rc);
-  }
-
-  // Retain the interface number.
-  interface_ = interface;
-
-  // Remember the (assumed) endpoints which we're using.
-  epOut_ = interface + 1U;
-  epIn_ = 0x80U | epOut_;
-
-  // No transfers in progress.
-  xfrIn_ = nullptr;
-  xfrOut_ = nullptr;
-
-  // Expected sequence number of first packet.
-  tst_seq_ = 0U;
-
-  // Maximum size of a packet in bytes.
-  maxPacketSize_ = USBDevice::kDevIsoMaxPacketSize;
-
-  return true;
-}
-
-void USBDevIso::Stop() {
-  SetClosing(true);
-
-  int rc = dev_->ReleaseInterface(interface_);
-  if (rc < 0) {
-    std::cerr << "" << std::endl;
-  }
-}
-
-void USBDevIso::Pause() {
-  SetClosing(true);
-
-  while (inActive_ || outActive_) {
-    dev_->Service();
-  }
-
-  int rc = dev_->ReleaseInterface(interface_);
-  if (rc < 0) {
-    std::cerr << "" << std::endl;
-  }
-}
-
-bool USBDevIso::Resume() {
-  SetClosing(false);
-
-  int rc = dev_->ClaimInterface(interface_);
-  if (rc < 0) {
-    return dev_->ErrorUSB("ERROR: Claiming interface", rc);
-  }
-  return true;
-}
-
 // Return an indication of whether this stream has completed its transfer.
 bool USBDevIso::Completed() const {
   // Note: an Isochronous stream presently cannot know whether it has
@@ -88,12 +19,9 @@ bool USBDevIso::Completed() const {
   return false;
 }
 
-// Return a summary report of the stream settings of status.
-std::string USBDevIso::Report(bool status, bool verbose) const { return ""; }
-
-void USBDevIso::DumpIsoTransfer(struct libusb_transfer *xfr) const {
+void USBDevIso::DumpTransfer(struct libusb_transfer *xfr) const {
   for (int idx = 0U; idx < xfr->num_iso_packets; idx++) {
-    struct libusb_iso_packet_descriptor *pack = &xfrIn_->iso_packet_desc[idx];
+    struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[idx];
     std::cout << "Requested " << pack->length << " actual "
               << pack->actual_length << std::endl;
     // Buffer dumping works only because we have just a single Iso packet per
@@ -102,114 +30,41 @@ void USBDevIso::DumpIsoTransfer(struct libusb_transfer *xfr) const {
   }
 }
 
-// Retrieving of IN traffic from device.
-bool USBDevIso::ServiceIN() {
-  // Ensure that we have enough space available for a full packet; the device
-  // software decides upon the length of each packet.
-  uint8_t *space;
-  bool ok = ProvisionSpace(&space, maxPacketSize_);
-  if (ok) {
-    if (!xfrIn_) {
-      xfrIn_ = dev_->AllocTransfer(kNumIsoPackets);
-      if (!xfrIn_) {
-        return false;
-      }
-    }
-
-    dev_->FillIsoTransfer(xfrIn_, epIn_, space, maxPacketSize_, kNumIsoPackets,
-                          CbStubIN, this, kIsoTimeout);
-    dev_->SetIsoPacketLengths(xfrIn_, maxPacketSize_);
-
-    int rc = dev_->SubmitTransfer(xfrIn_);
-    if (rc < 0) {
-      return dev_->ErrorUSB("ERROR: Submitting IN transfer", rc);
-    }
-    inActive_ = true;
-  } else {
-    inActive_ = false;
-  }
-  return true;
+// Complete an IN transfer descriptor.
+uint32_t USBDevIso::FillIN(Xfr *x) {
+  // The device software decides upon the length of each packet.
+  dev_->FillIsoTransfer(x->xfr, epIn_, x->buf, BufferSize(), kNumIsoPackets,
+                        CbStubIN, x, kIsoTimeout);
+  dev_->SetIsoPacketLengths(x->xfr, maxPacketSize_);
+  return BufferSize();
 }
 
-// Sending of OUT traffic to device.
-bool USBDevIso::ServiceOUT() {
-  // Do we have one or more packets ready for sending?
-  if (pktLen_.empty()) {
-    // Nothing to propagate at this time.
-    outActive_ = false;
-  } else {
-    uint32_t len = pktLen_.front();
-    pktLen_.pop();
-    // We should have propagated only valid packets to the OUT side ready for
-    // transmission.
-    assert(len >= sizeof(usbdev_stream_sig_t));
-
-    uint8_t *data;
-    size_t num_bytes = DataAvailable(&data);
-    assert(num_bytes >= len);
-
-    // Supply details of the single OUT packet.
-    if (!xfrOut_) {
-      xfrOut_ = dev_->AllocTransfer(kNumIsoPackets);
-      if (!xfrOut_) {
-        // Stream is not operational.
-        return false;
-      }
-    }
-    dev_->FillIsoTransfer(xfrOut_, epOut_, data, len, kNumIsoPackets, CbStubOUT,
-                          this, kIsoTimeout);
-    dev_->SetIsoPacketLengths(xfrOut_, len);
-
-    int rc = dev_->SubmitTransfer(xfrOut_);
-    if (rc < 0) {
-      return dev_->ErrorUSB("ERROR: Submitting OUT transfer", rc);
-    }
-    outActive_ = true;
-  }
-  // Stream remains operational, even if it presently has no work on the OUT
-  // side.
-  return true;
+// Complete an OUT transfer descriptor.
+void USBDevIso::FillOUT(Xfr *x) {
+  // Supply details of the single OUT packet.
+  dev_->FillIsoTransfer(x->xfr, epOut_, &x->buf[x->offset], x->len,
+                        kNumIsoPackets, CbStubOUT, x, kIsoTimeout);
+  dev_->SetIsoPacketLengths(x->xfr, x->len);
 }
 
-bool USBDevIso::Service() {
-  if (failed_) {
-    return false;
-  }
-  // (Re)start Isochronous IN traffic if not already in progress.
-  if (!inActive_ && !ServiceIN()) {
-    return false;
-  }
-  // (Re)start Isochronous OUT traffic if not already in progress and there is
-  // data available to be transmitted.
-  if (!outActive_ && !ServiceOUT()) {
-    return false;
-  }
-  return true;
-}
-
-// Callback function supplied to libusb for IN transfers.
-void USBDevIso::CallbackIN(struct libusb_transfer *xfr) {
-  if (xfr->status != LIBUSB_TRANSFER_COMPLETED) {
-    std::cerr << PrefixID() << " Invalid/unexpected IN transfer status "
-              << xfr->status << std::endl;
-    failed_ = true;
-    return;
-  }
-
-  if (verbose_) {
-    std::cout << PrefixID() << "CallbackIN xfr " << xfr << " num_iso_packets "
-              << xfr->num_iso_packets << std::endl;
-    DumpIsoTransfer(xfr);
-  }
+// Process the packet(s) received by a completed IN transfer.
+int USBDevIso::CompletedIN(Xfr *x) {
+  struct libusb_transfer *xfr = x->xfr;
+  uint32_t nrecvd = 0U;
 
+  // Note: packet handling works only because we have just a single Iso packet
+  // per transfer; the data to be returned to the device is described by a
+  // single offset and length.
   for (int idx = 0U; idx < xfr->num_iso_packets; idx++) {
     struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[idx];
     if (pack->status != LIBUSB_TRANSFER_COMPLETED) {
+      // Isochronous packets are not retried; just drop this one.
       std::cerr << "ERROR: pack " << idx << " status " << pack->status
                 << std::endl;
-      inActive_ = false;
-      return;
+      PacketError(true);
+      continue;
     }
+    nrecvd += pack->actual_length;
 
     if (pack->actual_length) {
       // Reset signature detection, because a new signature is included at the
@@ -226,11 +81,6 @@ void USBDevIso::CallbackIN(struct libusb_transfer *xfr) {
         // Pick up information from this packet signature.
         SigProcess(sig);
 
-        // Valid packet received; payload includes the signature which we
-        // retain and propagate to the caller to permit synchronization.
-        uint32_t payload = pack->actual_length - dropped;
-        pktLen_.push(payload);
-
         // Since packets may have been dropped we must use the supplied values
         // of the device-side LFSR
         uint16_t seq = (uint16_t)((sig.seq_hi << 8) | sig.seq_lo);
@@ -239,15 +89,15 @@ void USBDevIso::CallbackIN(struct libusb_transfer *xfr) {
             std::cerr << "ERROR: Unexpected device-side LFSR value (expected 0x"
                       << std::hex << tst_lfsr_ << " received 0x"
                       << sig.init_lfsr << ")" << std::dec << std::endl;
-            inActive_ = false;
-            return;
+            PacketError(true);
+            continue;
           }
         } else if (seq < tst_seq_) {
           std::cerr << "ERROR: Iso stream packets out of order (expected seq 0x"
                     << std::hex << tst_seq_ << " received 0x" << seq << ")"
                     << std::dec << std::endl;
-          inActive_ = false;
-          return;
+          PacketError(true);
+          continue;
         } else {
           // One or more packets has disappeared; use the supplied LFSR to
           // resynchronize.
@@ -257,6 +107,10 @@ void USBDevIso::CallbackIN(struct libusb_transfer *xfr) {
         // Remember the sequence number that we expect to see next.
         tst_seq_ = seq + 1U;
 
+        // Valid packet received; payload includes the signature which we
+        // retain and propagate to the device to permit synchronization.
+        uint32_t payload = pack->actual_length - dropped;
+
         // Supply the host-side LFSR value so that the device may check the
         // content of received OUT packets.
         const size_t sig_size = sizeof(usbdev_stream_sig_t);
@@ -264,57 +118,32 @@ void USBDevIso::CallbackIN(struct libusb_transfer *xfr) {
         dp[offsetof(usbdev_stream_sig_t, init_lfsr)] = dpi_lfsr_;
         ProcessData(dp + sig_size, payload - sig_size);
 
-        CommitData(payload);
+        x->offset = dropped;
+        x->len = payload;
       } else {
         std::cerr << PrefixID() << " received invalid Iso packet of "
                   << pack->actual_length << " bytes" << std::endl;
+        PacketError(true);
       }
     }
   }
 
-  if (CanSchedule()) {
-    // Attempt to set up another IN transfer.
-    failed_ = !ServiceIN();
-  } else {
-    inActive_ = false;
-  }
+  return (int)nrecvd;
 }
 
-// Callback function supplied to libusb for OUT transfers.
-void USBDevIso::CallbackOUT(struct libusb_transfer *xfr) {
-  if (xfr->status != LIBUSB_TRANSFER_COMPLETED) {
-    std::cerr << PrefixID() << " Invalid/unexpected OUT transfer status "
-              << xfr->status << std::endl;
-    failed_ = true;
-    return;
-  }
-
-  if (verbose_) {
-    const void *buf = reinterpret_cast<void *>(xfr->buffer);
-    std::cout << PrefixID() << "CallbackOUT xfr " << xfr << " buffer " << buf
-              << " num_iso_packets " << xfr->num_iso_packets << std::endl;
-    DumpIsoTransfer(xfr);
-  }
-
+// Return the number of bytes sent by a completed OUT transfer.
+uint32_t USBDevIso::CompletedOUT(Xfr *x) {
+  struct libusb_transfer *xfr = x->xfr;
+  uint32_t nsent = 0U;
   for (int idx = 0U; idx < xfr->num_iso_packets; idx++) {
     struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[idx];
     if (pack->status != LIBUSB_TRANSFER_COMPLETED) {
-      std::cout << "ERROR: pack " << idx << " status " << pack->status
+      std::cerr << "ERROR: pack " << idx << " status " << pack->status
                 << std::endl;
-      outActive_ = false;
-      exit(0);
-      return;
-    }
-
-    if (pack->actual_length) {
-      ConsumeData(pack->actual_length);
+      PacketError(false);
+    } else {
+      nsent += pack->actual_length;
     }
   }
-
-  if (CanSchedule()) {
-    // Attempt to set up another OUT transfer.
-    failed_ = !ServiceOUT();
-  } else {
-    outActive_ = false;
-  }
+  return nsent;
 }
@@ -3,143 +3,74 @@
 // SPDX-License-Identifier: Apache-2.0
 #ifndef OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_ISO_H_
 #define OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_ISO_H_
-#include <queue>
-
 #include "usb_device.h"
+#include "usbdev_async.h"
 #include "usbdev_stream.h"
 
-class USBDevIso : public USBDevStream {
+class USBDevIso : public USBDevAsync {
  public:
   USBDevIso(USBDevice *dev, unsigned id, uint32_t transfer_bytes, bool retrieve,
-            bool check, bool send, bool verbose)
-      : USBDevStream(id, transfer_bytes, retrieve, check, send, verbose),
-        dev_(dev),
-        failed_(false),
-        inActive_(false),
-        outActive_(false),
-        xfrIn_(nullptr),
-        xfrOut_(nullptr) {}
-  /**
-   * Open an Isochronous connection to specified device interface.
-   *
-   * @param  interface  Interface number.
-   * @return The success of the operation.
-   */
-  bool Open(unsigned interface);
-  /**
-   * Finalize the stream, prior to shutting down.
-   */
-  virtual void Stop();
-  /**
-   * Pause the stream, prior to suspending the device.
-   */
-  virtual void Pause();
-  /**
-   * Resume stremaing.
-   */
-  virtual bool Resume();
-  /**
-   * Return a summary report of the stream settings or status.
-   *
-   * @param  status    Indicates whether settings or status requested.
-   * @param  verbose   true iff a more verbose report is required.
-   * @return Status report.
-   */
-  virtual std::string Report(bool status = false, bool verbose = false) const;
+            bool check, bool send, bool verbose, unsigned depth = 1U)
+      : USBDevAsync(dev, id, transfer_bytes, retrieve, check, send, verbose,
+                    depth),
+        tst_seq_(0U) {
+    maxPacketSize_ = USBDevice::kDevIsoMaxPacketSize;
+  }
   /**
    * Indicates whether this stream has completed its transfer.
    *
    * @return         true iff this stream has nothing more to do.
    */
   virtual bool Completed() const;
-  /**
-   * Service this Isochronous stream.
-   *
-   * @return true iff the stream is still operational.
-   */
-  virtual bool Service();
 
  private:
   /**
-   * Diagnostic utility function to display the content of libusb Iso transfer.
-   *
-   * @param  xfr     The Isochronous transfer to be displayed.
+   * Return the number of Isochronous packets per transfer.
    */
-  void DumpIsoTransfer(struct libusb_transfer *xfr) const;
+  virtual unsigned IsoPackets() const { return kNumIsoPackets; }
   /**
-   * Retrieving of IN traffic from device.
-   *
-   * @return true iff the stream is still operational.
+   * Return the size of the data buffer required for each transfer.
    */
-  bool ServiceIN();
+  virtual uint32_t BufferSize() const {
+    return kNumIsoPackets * maxPacketSize_;
+  }
   /**
-   * Sending of OUT traffic to device.
+   * Complete the transfer descriptor for an IN transfer.
    *
-   * @return true iff the stream is still operational.
+   * @param  x       Transfer to be completed.
+   * @return Number of bytes requested, or zero if no transfer is required.
    */
-  bool ServiceOUT();
+  virtual uint32_t FillIN(Xfr *x);
   /**
-   * Callback function supplied to libusb for IN transfers; transfer has
-   * completed and requires attention.
+   * Complete the transfer descriptor for an OUT transfer.
    *
-   * @param  xfr     The transfer that has completed.
+   * @param  x       Transfer to be completed.
    */
-  void CallbackIN(struct libusb_transfer *xfr);
+  virtual void FillOUT(Xfr *x);
   /**
-   * Callback function supplied to libusb for OUT transfers; transfer has
-   * completed and requires attention.
+   * Process the packet(s) received by a completed IN transfer.
    *
-   * @param  xfr     The transfer that has completed.
+   * @param  x       Transfer that has completed successfully.
+   * @return Number of bytes received, or -1 if the stream has failed.
    */
-  void CallbackOUT(struct libusb_transfer *xfr);
+  virtual int CompletedIN(Xfr *x);
   /**
-   * Stub callback function supplied to libusb for IN transfers.
+   * Return the number of bytes sent by a completed OUT transfer.
    *
-   * @param  xfr     The transfer that has completed.
+   * @param  x       Transfer that has completed successfully.
+   * @return Number of bytes sent.
    */
-  static void LIBUSB_CALL CbStubIN(struct libusb_transfer *xfr);
+  virtual uint32_t CompletedOUT(Xfr *x);
   /**
-   * Stub callback function supplied to libusb for OUT transfers.
+   * Diagnostic utility function to display the content of libusb Iso transfer.
    *
-   * @param  xfr     The transfer that has completed.
+   * @param  xfr     The Isochronous transfer to be displayed.
    */
-  static void LIBUSB_CALL CbStubOUT(struct libusb_transfer *xfr);
-
-  // USB device.
-  USBDevice *dev_;
-
-  // The number of the interface being used by this stream.
-  unsigned interface_;
-
-  // Has this stream experienced a failure?
-  bool failed_;
-
-  // Is an IN transfer in progress?
-  bool inActive_;
-
-  // Is an OUT transfer in progress?
-  bool outActive_;
-
-  // Do we currently have an IN transfer?
-  struct libusb_transfer *xfrIn_;
-
-  // Do we currently have an OUT transfer?
-  struct libusb_transfer *xfrOut_;
-
-  // Maximum packet size for this stream.
-  uint8_t maxPacketSize_;
-
-  // Endpoint numbers used by this stream.
-  uint8_t epIn_;
-  uint8_t epOut_;
+  virtual void DumpTransfer(struct libusb_transfer *xfr) const;
 
   // Expected device-side sequence number of next IN packet.
   uint16_t tst_seq_;
 
-  // Lengths of packets (in bytes) of the Isochronous Data packets held in the
-  // circular buffer.
-  std::queue<uint32_t> pktLen_;
-
   // No timeout at present; the device-side code is responsible for signaling
   // test completion/failure. This may need to change for CI tests.
   static constexpr unsigned kIsoTimeout = 0U;
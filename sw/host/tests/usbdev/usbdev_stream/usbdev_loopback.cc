@@ -0,0 +1,322 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#include "usbdev_loopback.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// Maximum number of payload bytes following the signature in each
+// Isochronous packet.
+static constexpr uint32_t kIsoMaxPayload =
+    USBDevice::kDevIsoMaxPacketSize - sizeof(usbdev_stream_sig_t);
+
+USBDevLoopback::USBDevLoopback(const std::string &types,
+                               uint32_t transfer_bytes, bool verbose)
+    : verbose_(verbose), rand_(1U), interrupted_(false) {
+  // Describe the streams in the same manner as the device-side software.
+  bool bulk_only = true;
+  uint32_t mixed_types = 0U;
+  streams_.resize(types.size());
+  for (unsigned id = 0U; id < types.size(); id++) {
+    Stream &s = streams_[id];
+    s.type = types[id];
+    s.id = id;
+    s.tx_left = transfer_bytes;
+    s.rx_left = transfer_bytes;
+    s.tx_lfsr = USBTST_LFSR_SEED(id);
+    s.rx_tst_lfsr = USBTST_LFSR_SEED(id);
+    s.rx_dpi_lfsr = USBDPI_LFSR_SEED(id);
+    s.tx_seq = 0U;
+    s.failed = false;
+
+    // Two bits per stream specify the transfer type.
+    uint32_t code = 2U;
+    if (s.type == 's') {
+      code = 1U;
+      bulk_only = false;
+    } else if (s.type == 'i') {
+      code = 3U;
+      bulk_only = false;
+    }
+    mixed_types |= code << (id * 2U);
+  }
+
+  testNumber_ = bulk_only ? USBDevice::kUsbTestNumberStreams
+                          : USBDevice::kUsbTestNumberMixed;
+  testArg_[0] = (uint8_t)types.size();
+  testArg_[1] = bulk_only ? 0U : (uint8_t)mixed_types;
+  testArg_[2] = bulk_only ? 0U : (uint8_t)(mixed_types >> 8);
+  testArg_[3] = bulk_only ? 0U : (uint8_t)(mixed_types >> 16);
+}
+
+int USBDevLoopback::Submit(struct libusb_transfer *xfr) {
+  unsigned idx = (xfr->endpoint & 0x7fU) - 1U;
+  std::lock_guard<std::mutex> lk(lock_);
+  if (idx >= streams_.size()) {
+    return LIBUSB_ERROR_NOT_FOUND;
+  }
+  Stream &s = streams_[idx];
+  if (xfr->endpoint & LIBUSB_ENDPOINT_IN) {
+    s.in.push_back(xfr);
+  } else {
+    s.out.push_back(xfr);
+  }
+  work_.notify_one();
+  return LIBUSB_SUCCESS;
+}
+
+int USBDevLoopback::Cancel(struct libusb_transfer *xfr) {
+  std::lock_guard<std::mutex> lk(lock_);
+  for (Stream &s : streams_) {
+    for (auto *q : {&s.in, &s.out}) {
+      for (auto it = q->begin(); it != q->end(); it++) {
+        if (*it == xfr) {
+          q->erase(it);
+          xfr->status = LIBUSB_TRANSFER_CANCELLED;
+          xfr->actual_length = 0;
+          done_.push_back(xfr);
+          work_.notify_one();
+          return LIBUSB_SUCCESS;
+        }
+      }
+    }
+  }
+  return LIBUSB_ERROR_NOT_FOUND;
+}
+
+void USBDevLoopback::Interrupt() {
+  std::lock_guard<std::mutex> lk(lock_);
+  interrupted_ = true;
+  work_.notify_all();
+}
+
+void USBDevLoopback::HandleEvents(unsigned timeout_ms) {
+  std::vector<struct libusb_transfer *> done;
+  {
+    std::unique_lock<std::mutex> lk(lock_);
+    auto ready = [this] {
+      if (interrupted_ || !done_.empty()) {
+        return true;
+      }
+      for (const Stream &s : streams_) {
+        // A non-Isochronous stream has nothing more to send once its data has
+        // been exhausted; its IN transfers remain pending until cancelled.
+        if (!s.out.empty() || (!s.in.empty() && (s.type == 's' || !s.tx_seq ||
+                                                 s.tx_left))) {
+          return true;
+        }
+      }
+      return false;
+    };
+    if (!ready() && timeout_ms) {
+      work_.wait_for(lk, std::chrono::milliseconds(timeout_ms), ready);
+    }
+    interrupted_ = false;
+
+    // Each endpoint transfers at most one packet per call.
+    for (Stream &s : streams_) {
+      if (!s.in.empty() && PacketIN(s, s.in.front())) {
+        done_.push_back(s.in.front());
+        s.in.pop_front();
+      }
+      if (!s.out.empty()) {
+        PacketOUT(s, s.out.front());
+        done_.push_back(s.out.front());
+        s.out.pop_front();
+      }
+    }
+    done.swap(done_);
+  }
+
+  // Callbacks are invoked without the lock held, since they submit further
+  // transfers.
+  for (struct libusb_transfer *xfr : done) {
+    xfr->callback(xfr);
+  }
+}
+
+bool USBDevLoopback::PacketIN(Stream &s, struct libusb_transfer *xfr) {
+  if (s.type != 's') {
+    uint32_t len;
+    if (!s.tx_seq) {
+      // The stream signature is sent alone as the first packet.
+      len = sizeof(usbdev_stream_sig_t);
+    } else if (s.tx_left) {
+      // Packets are of random length, including Zero Length Packets.
+      uint32_t max_len = USBDevice::kDevDataMaxPacketSize;
+      if (max_len > s.tx_left) {
+        max_len = s.tx_left;
+      }
+      len = rand_() % (max_len + 1U);
+    } else {
+      return false;
+    }
+
+    xfr->actual_length = 0;
+    if (len > (uint32_t)xfr->length) {
+      xfr->status = LIBUSB_TRANSFER_OVERFLOW;
+      Fail(s, "IN transfer overflow");
+      return true;
+    }
+
+    if (!s.tx_seq) {
+      usbdev_stream_sig_t sig;
+      sig.head_sig = STREAM_SIGNATURE_HEAD;
+      sig.init_lfsr = s.tx_lfsr;
+      sig.stream = (uint8_t)(s.id | USBDevice::kUsbdevStreamFlagRetrieve |
+                             USBDevice::kUsbdevStreamFlagCheck |
+                             USBDevice::kUsbdevStreamFlagSend);
+      sig.seq_lo = 0U;
+      sig.seq_hi = 0U;
+      sig.num_bytes = s.tx_left;
+      sig.tail_sig = STREAM_SIGNATURE_TAIL;
+      memcpy(xfr->buffer, &sig, sizeof(sig));
+      s.tx_seq++;
+    } else {
+      for (uint32_t idx = 0U; idx < len; idx++) {
+        xfr->buffer[idx] = s.tx_lfsr;
+        s.tx_lfsr = LFSR_ADVANCE(s.tx_lfsr);
+      }
+      s.tx_left -= len;
+    }
+    xfr->status = LIBUSB_TRANSFER_COMPLETED;
+    xfr->actual_length = (int)len;
+    return true;
+  }
+
+  // Every Isochronous packet carries its own signature, followed by a random
+  // number of data bytes; the stream continues until the test completes.
+  uint8_t *dp = xfr->buffer;
+  for (int idx = 0; idx < xfr->num_iso_packets; idx++) {
+    struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[idx];
+    uint32_t payload = rand_() % (kIsoMaxPayload + 1U);
+    uint32_t len = sizeof(usbdev_stream_sig_t) + payload;
+    pack->actual_length = 0U;
+    if (len > pack->length) {
+      pack->status = LIBUSB_TRANSFER_OVERFLOW;
+      Fail(s, "Isochronous IN packet overflow");
+    } else {
+      usbdev_stream_sig_t sig;
+      sig.head_sig = STREAM_SIGNATURE_HEAD;
+      sig.init_lfsr = s.tx_lfsr;
+      sig.stream = (uint8_t)(s.id | USBDevice::kUsbdevStreamFlagRetrieve |
+                             USBDevice::kUsbdevStreamFlagCheck |
+                             USBDevice::kUsbdevStreamFlagSend);
+      sig.seq_lo = (uint8_t)s.tx_seq;
+      sig.seq_hi = (uint8_t)(s.tx_seq >> 8);
+      // Down counter of the bytes remaining; the signature is rejected if
+      // this is zero.
+      sig.num_bytes = s.tx_left ? s.tx_left : 1U;
+      sig.tail_sig = STREAM_SIGNATURE_TAIL;
+      memcpy(dp, &sig, sizeof(sig));
+
+      s.tx_hist[s.tx_seq & 0xffU] = s.tx_lfsr;
+      for (uint32_t i = 0U; i < payload; i++) {
+        dp[sizeof(sig) + i] = s.tx_lfsr;
+        s.tx_lfsr = LFSR_ADVANCE(s.tx_lfsr);
+      }
+      s.tx_left -= (payload < s.tx_left) ? payload : s.tx_left;
+      s.tx_seq++;
+
+      pack->status = LIBUSB_TRANSFER_COMPLETED;
+      pack->actual_length = len;
+    }
+    dp += pack->length;
+  }
+  xfr->status = LIBUSB_TRANSFER_COMPLETED;
+  xfr->actual_length = 0;
+  return true;
+}
+
+void USBDevLoopback::PacketOUT(Stream &s, struct libusb_transfer *xfr) {
+  if (s.type != 's') {
+    uint32_t len = (uint32_t)xfr->length;
+    if (len > s.rx_left) {
+      Fail(s, "Unexpected OUT data");
+      len = s.rx_left;
+    }
+    for (uint32_t idx = 0U; idx < len; idx++) {
+      uint8_t expected = s.rx_tst_lfsr ^ s.rx_dpi_lfsr;
+      if (xfr->buffer[idx] != expected) {
+        Fail(s, "Mismatched OUT data");
+      }
+      s.rx_tst_lfsr = LFSR_ADVANCE(s.rx_tst_lfsr);
+      s.rx_dpi_lfsr = LFSR_ADVANCE(s.rx_dpi_lfsr);
+    }
+    s.rx_left -= len;
+    xfr->status = LIBUSB_TRANSFER_COMPLETED;
+    xfr->actual_length = xfr->length;
+    return;
+  }
+
+  const uint8_t *dp = xfr->buffer;
+  for (int idx = 0; idx < xfr->num_iso_packets; idx++) {
+    struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[idx];
+    CheckIso(s, dp, pack->length);
+    pack->status = LIBUSB_TRANSFER_COMPLETED;
+    pack->actual_length = pack->length;
+    dp += pack->length;
+  }
+  xfr->status = LIBUSB_TRANSFER_COMPLETED;
+  xfr->actual_length = 0;
+}
+
+void USBDevLoopback::CheckIso(Stream &s, const uint8_t *dp, uint32_t len) {
+  usbdev_stream_sig_t sig;
+  if (len < sizeof(sig)) {
+    Fail(s, "Isochronous OUT packet too short");
+    return;
+  }
+  memcpy(&sig, dp, sizeof(sig));
+  uint16_t seq = (uint16_t)((sig.seq_hi << 8) | sig.seq_lo);
+  if (sig.head_sig != STREAM_SIGNATURE_HEAD ||
+      sig.tail_sig != STREAM_SIGNATURE_TAIL ||
+      seq >= s.tx_seq || (unsigned)(s.tx_seq - seq) > 0x100U) {
+    Fail(s, "Invalid Isochronous OUT signature");
+    return;
+  }
+
+  // The returned data is the device-side data for that packet combined with
+  // the host-side LFSR sequence commencing at the value in the signature.
+  uint8_t tst_lfsr = s.tx_hist[seq & 0xffU];
+  uint8_t dpi_lfsr = sig.init_lfsr;
+  uint32_t payload = len - sizeof(sig);
+  for (uint32_t idx = 0U; idx < payload; idx++) {
+    if (dp[sizeof(sig) + idx] != (uint8_t)(tst_lfsr ^ dpi_lfsr)) {
+      Fail(s, "Mismatched Isochronous OUT data");
+      return;
+    }
+    tst_lfsr = LFSR_ADVANCE(tst_lfsr);
+    dpi_lfsr = LFSR_ADVANCE(dpi_lfsr);
+  }
+  s.rx_left -= (payload < s.rx_left) ? payload : s.rx_left;
+}
+
+void USBDevLoopback::Fail(Stream &s, const char *rsn) {
+  if (!s.failed || verbose_) {
+    std::cerr << "Loopback S" << s.id << ": " << rsn << std::endl;
+  }
+  s.failed = true;
+}
+
+bool USBDevLoopback::Completed() const {
+  std::lock_guard<std::mutex> lk(lock_);
+  for (const Stream &s : streams_) {
+    if (s.failed || !StreamCompleted(s)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool USBDevLoopback::Failed() const {
+  std::lock_guard<std::mutex> lk(lock_);
+  for (const Stream &s : streams_) {
+    if (s.failed) {
+      return true;
+    }
+  }
+  return false;
+}
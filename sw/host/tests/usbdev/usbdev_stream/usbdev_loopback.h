@@ -0,0 +1,157 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_LOOPBACK_H_
+#define OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_LOOPBACK_H_
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "usb_device.h"
+#include "usbdev_stream.h"
+
+// In-process stand-in for the USB device, running the device side of the
+// streaming tests (usb_testutils_streams) so that the host-side streaming
+// engine may be exercised and profiled without any hardware.
+//
+// Transfers submitted to the loopback device are completed by HandleEvents(),
+// which invokes their callbacks in the same manner as libusb_handle_events().
+class USBDevLoopback {
+ public:
+  /**
+   * Create a loopback device.
+   *
+   * @param  types     Transfer type of each stream; 'b' (Bulk),
+   *                   'i' (Interrupt) or 's' (iSochronous).
+   * @param  transfer_bytes  Number of bytes to be transferred by each stream.
+   * @param  verbose   Verbose reporting.
+   */
+  USBDevLoopback(const std::string &types, uint32_t transfer_bytes,
+                 bool verbose = false);
+  /**
+   * Return the test number that the device-side software would report.
+   */
+  uint8_t TestNumber() const { return testNumber_; }
+  /**
+   * Return the specified test argument from the test descriptor.
+   *
+   * @param  arg     Argument number.
+   * @return test argument
+   */
+  uint8_t TestArg(unsigned arg) const {
+    return (arg < 4U) ? testArg_[arg] : 0U;
+  }
+  /**
+   * Submit a transfer to the device.
+   *
+   * @param  xfr     The transfer to be submitted.
+   * @return The result of the operation (LIBUSB_SUCCESS or LIBUSB_ERROR_*).
+   */
+  int Submit(struct libusb_transfer *xfr);
+  /**
+   * Cancel a pending transfer.
+   *
+   * @param  xfr     The transfer to be cancelled.
+   * @return The result of the operation (LIBUSB_SUCCESS or LIBUSB_ERROR_*).
+   */
+  int Cancel(struct libusb_transfer *xfr);
+  /**
+   * Perform the bus traffic for all pending transfers and invoke the
+   * callbacks of those that complete, waiting for work if there is none.
+   *
+   * @param  timeout_ms  Maximum time to wait for work (milliseconds).
+   */
+  void HandleEvents(unsigned timeout_ms);
+  /**
+   * Wake a thread blocked in HandleEvents().
+   */
+  void Interrupt();
+  /**
+   * Has the device-side test completed successfully?
+   */
+  bool Completed() const;
+  /**
+   * Has the device-side test detected a failure?
+   */
+  bool Failed() const;
+
+ private:
+  /**
+   * Device-side state of a stream.
+   */
+  struct Stream {
+    // Stream type and number.
+    char type;
+    unsigned id;
+    // Pending IN and OUT transfers.
+    std::deque<struct libusb_transfer *> in;
+    std::deque<struct libusb_transfer *> out;
+    // Number of bytes still to be sent and received.
+    uint32_t tx_left;
+    uint32_t rx_left;
+    // LFSR generating the IN data.
+    uint8_t tx_lfsr;
+    // LFSRs predicting the OUT data.
+    uint8_t rx_tst_lfsr;
+    uint8_t rx_dpi_lfsr;
+    // Sequence number of the next IN packet; the stream signature is sent as
+    // the first packet of non-Isochronous streams.
+    uint16_t tx_seq;
+    // Device-side LFSR at the start of each recent Isochronous packet, indexed
+    // by the low bits of its sequence number.
+    uint8_t tx_hist[0x100U];
+    // Has the stream failed?
+    bool failed;
+  };
+  /**
+   * Supply the next IN packet of a stream, if any.
+   *
+   * @return true iff the transfer has completed.
+   */
+  bool PacketIN(Stream &s, struct libusb_transfer *xfr);
+  /**
+   * Accept and check an OUT transfer.
+   */
+  void PacketOUT(Stream &s, struct libusb_transfer *xfr);
+  /**
+   * Check the content of an Isochronous OUT packet.
+   */
+  void CheckIso(Stream &s, const uint8_t *dp, uint32_t len);
+  /**
+   * Record a device-side failure of a stream.
+   */
+  void Fail(Stream &s, const char *rsn);
+  /**
+   * Is the device-side transfer of a stream complete? Isochronous streams
+   * continue sending until all of their data has been returned.
+   */
+  static bool StreamCompleted(const Stream &s) {
+    return !s.rx_left && (s.type == 's' || !s.tx_left);
+  }
+
+  // Verbose reporting.
+  bool verbose_;
+
+  // Test descriptor.
+  uint8_t testNumber_;
+  uint8_t testArg_[4];
+
+  // Device-side stream states.
+  std::vector<Stream> streams_;
+
+  // Completed transfers awaiting their callbacks.
+  std::vector<struct libusb_transfer *> done_;
+
+  // Packet length generation.
+  std::minstd_rand rand_;
+
+  // Serialize access by the main and event threads.
+  mutable std::mutex lock_;
+  std::condition_variable work_;
+  bool interrupted_;
+};
+
+#endif  // OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_LOOPBACK_H_
@@ -0,0 +1,113 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#include "usbdev_stats.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+void USBDevStats::Reset() {
+  xfrs_ = 0U;
+  errors_ = 0U;
+  bytes_ = 0U;
+  first_ = 0U;
+  last_ = 0U;
+  latMax_ = 0U;
+  latSum_ = 0U;
+  memset(latHist_, 0, sizeof(latHist_));
+  sampleStart_ = 0U;
+  sampleBytes_ = 0U;
+  samples_ = 0U;
+  memset(tputHist_, 0, sizeof(tputHist_));
+}
+
+unsigned USBDevStats::Bucket(uint64_t val) {
+  unsigned b = 0U;
+  while (val && b < kBuckets - 1U) {
+    val >>= 1;
+    b++;
+  }
+  return b;
+}
+
+void USBDevStats::Record(uint64_t now, uint64_t submitted, uint32_t bytes) {
+  if (!xfrs_) {
+    first_ = submitted;
+    sampleStart_ = submitted;
+  }
+  xfrs_++;
+  bytes_ += bytes;
+  last_ = now;
+
+  uint64_t lat = now - submitted;
+  if (lat > latMax_) {
+    latMax_ = lat;
+  }
+  latSum_ += lat;
+  latHist_[Bucket(lat)]++;
+
+  // Close the current throughput sample once its interval has elapsed.
+  sampleBytes_ += bytes;
+  uint64_t elapsed = now - sampleStart_;
+  if (elapsed >= kSampleInterval) {
+    // Bytes per millisecond is kB/s.
+    tputHist_[Bucket(sampleBytes_ * 1000U / elapsed)]++;
+    samples_++;
+    sampleStart_ = now;
+    sampleBytes_ = 0U;
+  }
+}
+
+uint64_t USBDevStats::Percentile(const uint64_t *hist, uint64_t total,
+                                 unsigned pct) {
+  uint64_t target = (total * pct + 99U) / 100U;
+  uint64_t count = 0U;
+  for (unsigned b = 0U; b < kBuckets; b++) {
+    count += hist[b];
+    if (count >= target) {
+      // Report the upper limit of the bucket.
+      return b ? ((uint64_t)1U << b) - 1U : 0U;
+    }
+  }
+  return 0U;
+}
+
+std::string USBDevStats::FormatHist(const uint64_t *hist, const char *units) {
+  std::string s;
+  for (unsigned b = 0U; b < kBuckets; b++) {
+    if (hist[b]) {
+      char buf[48];
+      snprintf(buf, sizeof(buf), " <%" PRIu64 "%s:%" PRIu64,
+               (uint64_t)1U << b, units, hist[b]);
+      s += buf;
+    }
+  }
+  return s;
+}
+
+std::string USBDevStats::Report(const std::string &prefix) const {
+  char buf[160];
+  uint64_t elapsed = last_ - first_;
+  double kbps = elapsed ? (double)bytes_ * 1e3 / elapsed : 0.0;
+  snprintf(buf, sizeof(buf),
+           "%" PRIu64 " xfrs %" PRIu64 " bytes %.1f kB/s errors %" PRIu64,
+           xfrs_, bytes_, kbps, errors_);
+  std::string s = prefix + buf + "\n";
+  if (!xfrs_) {
+    return s;
+  }
+
+  snprintf(buf, sizeof(buf),
+           " latency us avg %.1f p50 <%" PRIu64 " p99 <%" PRIu64
+           " max %" PRIu64,
+           (double)latSum_ / xfrs_, Percentile(latHist_, xfrs_, 50U) + 1U,
+           Percentile(latHist_, xfrs_, 99U) + 1U, latMax_);
+  s += prefix + buf + "\n";
+  s += prefix + " latency:" + FormatHist(latHist_, "us") + "\n";
+  if (samples_) {
+    s += prefix + " kB/s per " + std::to_string(kSampleInterval / 1000U) +
+         "ms:" + FormatHist(tputHist_, "") + "\n";
+  }
+  return s;
+}
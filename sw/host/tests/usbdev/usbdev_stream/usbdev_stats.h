@@ -0,0 +1,91 @@
+// Copyright lowRISC contributors (OpenTitan project).
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_STATS_H_
+#define OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_STATS_H_
+#include <cstdint>
+#include <string>
+
+/**
+ * Throughput and latency statistics for one direction of a stream.
+ *
+ * Both histograms use power-of-two buckets; bucket `n` counts values in the
+ * range [2^(n-1), 2^n), with bucket 0 counting zero values.
+ */
+class USBDevStats {
+ public:
+  USBDevStats() { Reset(); }
+  /**
+   * Discard all collected statistics.
+   */
+  void Reset();
+  /**
+   * Record the completion of a transfer.
+   *
+   * @param  now       Time of completion (microseconds).
+   * @param  submitted Time at which the transfer was submitted (microseconds).
+   * @param  bytes     Number of bytes transferred.
+   */
+  void Record(uint64_t now, uint64_t submitted, uint32_t bytes);
+  /**
+   * Record a transfer or packet that failed to complete successfully.
+   */
+  void RecordError() { errors_++; }
+  /**
+   * Return the number of transfers completed.
+   */
+  uint64_t Transfers() const { return xfrs_; }
+  /**
+   * Return a report of the statistics collected, including the histograms.
+   *
+   * @param  prefix    Prefix for each line of the report.
+   * @return Report text.
+   */
+  std::string Report(const std::string &prefix) const;
+
+ private:
+  /**
+   * Return the histogram bucket for the given value.
+   */
+  static unsigned Bucket(uint64_t val);
+  /**
+   * Return the value below which the given proportion of samples lie.
+   */
+  static uint64_t Percentile(const uint64_t *hist, uint64_t total,
+                             unsigned pct);
+  /**
+   * Format a histogram for reporting.
+   */
+  static std::string FormatHist(const uint64_t *hist, const char *units);
+
+  // Number of histogram buckets.
+  static constexpr unsigned kBuckets = 32U;
+
+  // Interval over which the throughput is sampled (microseconds).
+  static constexpr uint64_t kSampleInterval = 100000U;
+
+  // Number of transfers completed, and the number that failed.
+  uint64_t xfrs_;
+  uint64_t errors_;
+
+  // Total number of bytes transferred.
+  uint64_t bytes_;
+
+  // Time of the first and last completions (microseconds).
+  uint64_t first_;
+  uint64_t last_;
+
+  // Transfer latency from submission to completion (microseconds).
+  uint64_t latMax_;
+  uint64_t latSum_;
+  uint64_t latHist_[kBuckets];
+
+  // Throughput within each sample interval (kB/s), and the state of the
+  // current interval.
+  uint64_t sampleStart_;
+  uint64_t sampleBytes_;
+  uint64_t samples_;
+  uint64_t tputHist_[kBuckets];
+};
+
+#endif  // OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_STATS_H_
@@ -12,20 +12,6 @@
 #include "usb_device.h"
 #include "usbdev_utils.h"
 
-// Stream signature words.
-#define STREAM_SIGNATURE_HEAD 0x579EA01AU
-#define STREAM_SIGNATURE_TAIL 0x160AE975U
-
-// Seed numbers for the LFSR generators in each transfer direction for
-// the given stream number.
-#define USBTST_LFSR_SEED(s) (uint8_t)(0x10U + (s)*7U)
-#define USBDPI_LFSR_SEED(s) (uint8_t)(0x9BU - (s)*7U)
-
-// Simple LFSR for 8-bit sequences.
-#define LFSR_ADVANCE(lfsr) \
-  (((lfsr) << 1) ^         \
-   ((((lfsr) >> 1) ^ ((lfsr) >> 2) ^ ((lfsr) >> 3) ^ ((lfsr) >> 7)) & 1u))
-
 USBDevStream::USBDevStream(unsigned id, uint32_t transfer_bytes, bool retrieve,
                            bool check, bool send, bool verbose) {
   // Remember Stream IDentifier and flags.
@@ -292,32 +278,35 @@ bool USBDevStream::ProcessData(uint8_t *dp, uint32_t len) {
                 << " byte(s)" << std::endl;
     }
 
-    // We can just check and overwrite the input data in-situ.
-    const uint8_t *sp = dp;
+    // We can just check and overwrite the input data in-situ; the LFSR
+    // states are kept in locals because the data buffer may alias them.
+    const bool check = retrieve_ && check_;
+    uint8_t tst_lfsr = tst_lfsr_;
+    uint8_t dpi_lfsr = dpi_lfsr_;
     for (uint32_t idx = 0U; idx < len; idx++) {
-      uint8_t expected = tst_lfsr_;
-      uint8_t recvd = sp[idx];
+      uint8_t expected = tst_lfsr;
+      uint8_t recvd = dp[idx];
 
       // Check whether the received byte is as expected.
-      if (retrieve_ && check_) {
-        if (recvd != expected) {
-          printf("S%u: Mismatched data from device 0x%02x, expected 0x%02x\n",
-                 id_, recvd, expected);
-          ok = false;
-        }
+      if (check && recvd != expected) {
+        printf("S%u: Mismatched data from device 0x%02x, expected 0x%02x\n",
+               id_, recvd, expected);
+        ok = false;
       }
 
       // Simply XOR the two LFSR-generated streams together.
-      dp[idx] = recvd ^ dpi_lfsr_;
+      dp[idx] = recvd ^ dpi_lfsr;
       if (verbose_) {
         printf("S%u: 0x%02x <- 0x%02x ^ 0x%02x\n", id_, dp[idx], recvd,
-               dpi_lfsr_);
+               dpi_lfsr);
       }
 
       // Advance our LFSRs.
-      tst_lfsr_ = LFSR_ADVANCE(tst_lfsr_);
-      dpi_lfsr_ = LFSR_ADVANCE(dpi_lfsr_);
+      tst_lfsr = LFSR_ADVANCE(tst_lfsr);
+      dpi_lfsr = LFSR_ADVANCE(dpi_lfsr);
     }
+    tst_lfsr_ = tst_lfsr;
+    dpi_lfsr_ = dpi_lfsr;
 
     // Update the buffer writing state.
     bytes_recvd_ += len;
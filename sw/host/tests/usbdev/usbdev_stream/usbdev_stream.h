@@ -3,11 +3,26 @@
 // SPDX-License-Identifier: Apache-2.0
 #ifndef OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_STREAM_H_
 #define OPENTITAN_SW_HOST_TESTS_USBDEV_USBDEV_STREAM_USBDEV_STREAM_H_
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <string>
 #include <sys/types.h>
 
+// Stream signature words.
+#define STREAM_SIGNATURE_HEAD 0x579EA01AU
+#define STREAM_SIGNATURE_TAIL 0x160AE975U
+
+// Seed numbers for the LFSR generators in each transfer direction for
+// the given stream number.
+#define USBTST_LFSR_SEED(s) (uint8_t)(0x10U + (s)*7U)
+#define USBDPI_LFSR_SEED(s) (uint8_t)(0x9BU - (s)*7U)
+
+// Simple LFSR for 8-bit sequences.
+#define LFSR_ADVANCE(lfsr) \
+  (((lfsr) << 1) ^         \
+   ((((lfsr) >> 1) ^ ((lfsr) >> 2) ^ ((lfsr) >> 3) ^ ((lfsr) >> 7)) & 1u))
+
 /**
  * Stream signature.
  * Note: this needs to be transferred over a byte stream.
@@ -99,7 +114,7 @@ class USBDevStream {
   /**
    * Return a Stream IDentifier prefix suitable for logging/reporting.
    */
-  std::string PrefixID() {
+  std::string PrefixID() const {
     std::string s("S");
     s += std::to_string(id_);
     s += ": ";
@@ -380,12 +395,14 @@ class USBDevStream {
   bool verbose_;
   /**
    * Total number of bytes received.
+   * Note: the byte counts may be updated by the libusb event thread whilst
+   *       being read by the main thread.
    */
-  uint32_t bytes_recvd_;
+  std::atomic<uint32_t> bytes_recvd_;
   /**
    * Total number of bytes sent.
    */
-  uint32_t bytes_sent_;
+  std::atomic<uint32_t> bytes_sent_;
   /**
    * Device-side LFSR; byte stream expected from usbdev_stream_test.
    */
@@ -397,7 +414,7 @@ class USBDevStream {
   /**
    * Number of bytes to be transferred.
    */
-  uint32_t transfer_bytes_;
+  std::atomic<uint32_t> transfer_bytes_;
   /**
    * Circular buffer of streamed data.
    */
@@ -121,11 +121,11 @@ ssize_t send_bytes(int out, const uint8_t *data, size_t len) {
 
 // Current monotonic wall clock time in microseconds.
 uint64_t time_us(void) {
-  struct timeval ts;
-  int ret = gettimeofday(&ts, NULL);
+  struct timespec ts;
+  int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
   if (ret < 0)
     return (uint64_t)0u;
-  return ((uint64_t)ts.tv_sec * 1000000u) + ts.tv_usec;
+  return ((uint64_t)ts.tv_sec * 1000000u) + ts.tv_nsec / 1000u;
 }
 
 // Dump a sequence of bytes as hexadecimal and ASCII for diagnostic purposes.